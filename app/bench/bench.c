@@ -0,0 +1,795 @@
+// Headless benchmark: runs the import pipeline and renders frames into an offscreen framebuffer
+// on a surfaceless EGL context, so it also works on llvmpipe without a display. Results are
+// written as JSON, logs go to stderr.
+
+#include "glad/glad.h"
+#include "log.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core/analyze.h"
+#include "core/edges.h"
+#include "core/meshlet.h"
+#include "core/model.h"
+#include "core/normals.h"
+#include "core/optimize.h"
+#include "core/preview.h"
+#include "core/scene.h"
+#include "core/simplify.h"
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#define STR_IMPL
+#include "engine/string.h"
+
+#define BENCH_MAX_MESHES 64
+
+typedef struct {
+    int             frames;
+    int             width;
+    int             height;
+    int             grid;      // quads per side of the synthetic height field, 0 to skip
+    int             sphere;    // segments of the synthetic uv sphere, 0 to skip
+    int             instances; // placements of each mesh, drawn in one indirect call
+    vertex_format_t format;
+    view_mode_t     view;
+    bool            optimize;
+    bool            preview; // parse on a thread like the loader and upload the preview it publishes
+    bool            paged;   // stream every file mesh from a page file instead of importing it
+    size_t          budget;  // slot memory of a paged mesh
+    const char*     out_path;
+} bench_options_t;
+
+typedef struct {
+    char* name;
+    char* path;
+    bool  generated;
+} bench_mesh_t;
+
+typedef struct {
+    bool   ok;
+    size_t file_bytes;
+    int    vertex_count;
+    int    triangle_count;
+    int    lod_count;
+    double parse_ms;
+    double normals_ms;
+    double meshlets_ms;
+    double optimize_ms;
+    double lods_ms;
+    double edges_ms;
+    double pack_ms;
+    double analyze_ms;
+    double upload_ms;
+    double frame_mean_ms;
+    double frame_p50_ms;
+    double frame_p99_ms;
+    double drawn_triangles; // mean submitted per frame after culling
+    double peak_rss_mb;
+    int    page_count; // the rest only for paged meshes
+    int    slot_count;
+    int    resident_count;
+    double streamed_mb;
+    double settle_ms; // until the pages the first view wants are resident
+    double preview_ms; // from the start of the parse to the first preview upload
+    int    preview_triangles;
+} bench_result_t;
+
+typedef struct {
+    EGLDisplay   display;
+    EGLContext   context;
+    unsigned int fbo;
+    unsigned int color;
+    unsigned int depth;
+} bench_context_t;
+
+static double _peak_rss_mb(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    return usage.ru_maxrss / 1024.0; // kilobytes on linux
+}
+
+static bool _context_create(bench_context_t* ctx, int width, int height)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    ctx->display = EGL_NO_DISPLAY;
+    if (get_platform_display) {
+        ctx->display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (ctx->display == EGL_NO_DISPLAY) ctx->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (ctx->display == EGL_NO_DISPLAY || !eglInitialize(ctx->display, &major, &minor)) {
+        log_error("Failed to initialize an EGL display (0x%x)", eglGetError());
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        log_error("EGL display has no desktop OpenGL support");
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE,
+    };
+
+    EGLConfig config;
+    EGLint    config_count = 0;
+    if (!eglChooseConfig(ctx->display, config_attribs, &config, 1, &config_count) || config_count == 0) {
+        log_error("No EGL config with OpenGL support");
+        return false;
+    }
+
+    // 4.5 is what llvmpipe offers, the shaders do not need more
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION,       4,
+        EGL_CONTEXT_MINOR_VERSION,       5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+
+    ctx->context = eglCreateContext(ctx->display, config, EGL_NO_CONTEXT, context_attribs);
+    if (ctx->context == EGL_NO_CONTEXT
+        || !eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx->context))
+    {
+        log_error("Failed to create a surfaceless OpenGL 4.5 context (0x%x)", eglGetError());
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        log_error("Failed to load OpenGL functions");
+        return false;
+    }
+
+    glGenRenderbuffers(1, &ctx->color);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx->color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &ctx->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+    glGenFramebuffers(1, &ctx->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx->color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, ctx->depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        log_error("Offscreen framebuffer is incomplete");
+        return false;
+    }
+
+    log_info("Renderer: %s, OpenGL %s", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+}
+
+static void _context_destroy(bench_context_t* ctx)
+{
+    if (ctx->context != EGL_NO_CONTEXT) {
+        glDeleteFramebuffers(1, &ctx->fbo);
+        glDeleteRenderbuffers(1, &ctx->color);
+        glDeleteRenderbuffers(1, &ctx->depth);
+        eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(ctx->display, ctx->context);
+    }
+    if (ctx->display != EGL_NO_DISPLAY) eglTerminate(ctx->display);
+}
+
+static FILE* _open_temp_obj(char* path, size_t size, const char* name)
+{
+    const char* dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/fov_bench_%s_XXXXXX", dir ? dir : "/tmp", name);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        log_error("Failed to create a temporary file for %s", name);
+        return NULL;
+    }
+    return fdopen(fd, "w");
+}
+
+// Rolling height field, n x n quads
+static bool _generate_grid(int n, char* path, size_t size)
+{
+    FILE* f = _open_temp_obj(path, size, "grid");
+    if (!f) return false;
+
+    for (int z = 0; z <= n; z++) {
+        for (int x = 0; x <= n; x++) {
+            double u = (double)x / n, v = (double)z / n;
+            fprintf(f, "v %.6f %.6f %.6f\n", u * 2.0 - 1.0, 0.1 * sin(u * 12.0) * cos(v * 9.0), v * 2.0 - 1.0);
+        }
+    }
+
+    for (int z = 0; z < n; z++) {
+        for (int x = 0; x < n; x++) {
+            int a = z * (n + 1) + x + 1;
+            fprintf(f, "f %d %d %d %d\n", a, a + n + 1, a + n + 2, a + 1);
+        }
+    }
+
+    return fclose(f) == 0;
+}
+
+// Uv sphere with n segments and n / 2 rings, triangles at the poles
+static bool _generate_sphere(int n, char* path, size_t size)
+{
+    FILE* f = _open_temp_obj(path, size, "sphere");
+    if (!f) return false;
+
+    int rings = n / 2 > 2 ? n / 2 : 2;
+
+    fprintf(f, "v 0 1 0\n");
+    for (int r = 1; r < rings; r++) {
+        double theta = M_PI * r / rings;
+        for (int s = 0; s < n; s++) {
+            double phi = 2.0 * M_PI * s / n;
+            fprintf(f, "v %.6f %.6f %.6f\n", sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+        }
+    }
+    fprintf(f, "v 0 -1 0\n");
+
+    int bottom = 2 + (rings - 1) * n;
+    for (int s = 0; s < n; s++) {
+        int next = (s + 1) % n;
+        fprintf(f, "f 1 %d %d\n", 2 + next, 2 + s);
+
+        for (int r = 0; r < rings - 2; r++) {
+            int a = 2 + r * n;
+            int b = a + n;
+            fprintf(f, "f %d %d %d %d\n", a + s, a + next, b + next, b + s);
+        }
+
+        int last = 2 + (rings - 2) * n;
+        fprintf(f, "f %d %d %d\n", bottom, last + s, last + next);
+    }
+
+    return fclose(f) == 0;
+}
+
+static bool _add_mesh(bench_mesh_t* meshes, int* count, const char* name, const char* path, bool generated)
+{
+    if (*count >= BENCH_MAX_MESHES) {
+        log_warn("Skipping %s, at most %d meshes are benchmarked", path, BENCH_MAX_MESHES);
+        return false;
+    }
+
+    meshes[*count] = (bench_mesh_t) { .name = e_strdup(name), .path = e_strdup(path), .generated = generated };
+    (*count)++;
+    return true;
+}
+
+static void _add_path(bench_mesh_t* meshes, int* count, const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        log_warn("Skipping %s, no such file or directory", path);
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        _add_mesh(meshes, count, path, path, false);
+        return;
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        const char* ext = strrchr(entry->d_name, '.');
+        if (!ext || (strcmp(ext, ".obj") != 0 && strcmp(ext, ".stl") != 0 && strcmp(ext, ".gltf") != 0
+                     && strcmp(ext, ".glb") != 0))
+        {
+            continue;
+        }
+
+        char full[4096];
+        snprintf(full, sizeof(full), "%s/%s", path, entry->d_name);
+        _add_mesh(meshes, count, full, full, false);
+    }
+    closedir(dir);
+}
+
+static int _compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double _percentile(const double* sorted, int count, double p)
+{
+    if (count == 0) return 0.0;
+    return sorted[(int)(p * (count - 1) + 0.5)];
+}
+
+typedef struct {
+    const model_reader_t* reader;
+    model_t*              model;
+    const char*           path;
+    load_progress_t*      progress;
+    atomic_bool           done;
+    bool                  ok;
+} bench_parse_t;
+
+static void _parse_main(void* userdata, int index)
+{
+    (void)index;
+    bench_parse_t* job = userdata;
+    job->ok            = job->reader->parse(job->model, job->path, job->progress);
+    atomic_store(&job->done, true);
+}
+
+// Parses on a thread of its own and uploads the preview as it comes in, like the loader and scene
+static bool _parse_previewed(const model_reader_t* reader, model_t* model, const char* path, bench_result_t* r)
+{
+    load_preview_t  source;
+    load_progress_t progress;
+    preview_t       preview;
+    atomic_init(&source.batches, NULL);
+    progress_reset(&progress, 0);
+    progress.preview = &source;
+    preview_init(&preview);
+
+    bench_parse_t job = { .reader = reader, .model = model, .path = path, .progress = &progress };
+    atomic_init(&job.done, false);
+
+    double   start  = timer_now();
+    thread_t thread = thread_spawn(_parse_main, &job);
+    if (!thread) return false;
+
+    for (;;) {
+        bool done = atomic_load(&job.done);
+        if (preview_update(&preview, &source) && r->preview_ms == 0.0) {
+            glFinish();
+            r->preview_ms = (timer_now() - start) * 1000.0;
+        }
+        if (done) break;
+        usleep(1000);
+    }
+    thread_join(thread);
+
+    r->preview_triangles = preview.triangle_count;
+    preview_clear(&preview);
+    return job.ok;
+}
+
+static void _bench_mesh(const bench_mesh_t* mesh, const bench_options_t* opt, scene_t* scene, bench_result_t* r)
+{
+    double  start;
+    model_t model;
+    model_init(&model);
+
+    packed_model_t packed = { 0 };
+
+    struct stat st;
+    r->file_bytes = stat(mesh->path, &st) == 0 ? (size_t)st.st_size : 0;
+
+    const model_reader_t* reader = scene_sniff_reader(mesh->path);
+
+    // Imports hand over gpu ready buffers, parse_ms covers all of it and the other stages stay 0
+    start       = timer_now();
+    bool parsed = reader->import ? reader->import(&packed, mesh->path, NULL)
+                : opt->preview   ? _parse_previewed(reader, &model, mesh->path, r)
+                                 : reader->parse(&model, mesh->path, NULL);
+    r->parse_ms = (timer_now() - start) * 1000.0;
+    if (!parsed) goto cleanup;
+
+    if (reader->import) {
+        r->vertex_count = packed.vertex_count / 3;
+        for (int i = 0; i < packed.draw_count; i++) {
+            if (packed.draws[i].mode == GL_TRIANGLES) r->triangle_count += packed.draws[i].count / 3;
+        }
+    } else {
+        if (model.indice_count == 0) goto cleanup;
+
+        start = timer_now();
+        if (model.normal_count == 0 && !model_compute_normals(&model, NORMALS_DEFAULT_CREASE)) goto cleanup;
+        r->normals_ms = (timer_now() - start) * 1000.0;
+
+        start = timer_now();
+        if (!model_build_meshlets(&model)) goto cleanup;
+        r->meshlets_ms = (timer_now() - start) * 1000.0;
+
+        start = timer_now();
+        if (opt->optimize && !model_optimize(&model)) goto cleanup;
+        r->optimize_ms = (timer_now() - start) * 1000.0;
+
+        start = timer_now();
+        if (!model_build_lods(&model)) goto cleanup;
+        r->lods_ms = (timer_now() - start) * 1000.0;
+
+        start = timer_now();
+        if (!model_build_edges(&model, EDGES_DEFAULT_CREASE)) goto cleanup;
+        r->edges_ms = (timer_now() - start) * 1000.0;
+
+        start = timer_now();
+        if (!model_pack(&model, opt->format, &packed)) goto cleanup;
+        r->pack_ms = (timer_now() - start) * 1000.0;
+
+        start = timer_now();
+        if (!model_analyze(&model, &packed.stats)) goto cleanup;
+        r->analyze_ms = (timer_now() - start) * 1000.0;
+
+        r->vertex_count   = model.vertex_count / 3;
+        r->triangle_count = (int)model.lods[0].index_count / 3;
+        r->lod_count      = model.lod_count;
+    }
+
+    // glFinish makes the driver side of the upload part of the measurement
+    start             = timer_now();
+    gpu_model_t gpu   = gpu_model_create(&packed);
+    glFinish();
+    r->upload_ms = (timer_now() - start) * 1000.0;
+
+    if (gpu.draw_count == 0) {
+        gpu_model_unload(&gpu);
+        goto cleanup;
+    }
+
+    // Each mesh is measured on its own, repeated placements share its buffers
+    scene_clear(scene);
+    scene_set_model(scene, gpu, mesh->path);
+    for (int i = 1; i < opt->instances; i++) scene_load_model(scene, mesh->path);
+
+    double* frames = malloc((size_t)opt->frames * sizeof(double));
+    if (!frames) goto cleanup;
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // One untimed frame so shader compilation in the driver does not land in the percentiles
+    scene_render(scene);
+    glFinish();
+
+    double total = 0.0, drawn = 0.0;
+    for (int i = 0; i < opt->frames; i++) {
+        start = timer_now();
+
+        glClearColor(0.08f, 0.08f, 0.08f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        scene_render(scene);
+        glFinish();
+
+        frames[i]  = (timer_now() - start) * 1000.0;
+        total     += frames[i];
+        drawn     += scene->batch.drawn_indices / 3;
+
+        // Orbit a little every frame so the view is not the same each time
+        scene_handle_mouse_move(scene, 2.0f, 0.0f);
+    }
+
+    qsort(frames, opt->frames, sizeof(double), _compare_double);
+    r->frame_mean_ms   = opt->frames > 0 ? total / opt->frames : 0.0;
+    r->frame_p50_ms    = _percentile(frames, opt->frames, 0.50);
+    r->frame_p99_ms    = _percentile(frames, opt->frames, 0.99);
+    r->drawn_triangles = opt->frames > 0 ? drawn / opt->frames : 0.0;
+    free(frames);
+
+    r->ok = true;
+
+cleanup:
+    if (!r->ok) log_error("Benchmark of %s failed", mesh->name);
+    packed_model_free(&packed);
+    model_free(&model);
+    r->peak_rss_mb = _peak_rss_mb();
+}
+
+// Builds a page file of the mesh and streams it, parse_ms covers the build and upload_ms opening it
+static void _bench_paged(const bench_mesh_t* mesh, const bench_options_t* opt, scene_t* scene, bench_result_t* r)
+{
+    char        paged_path[4096];
+    const char* dir = getenv("TMPDIR");
+    snprintf(paged_path, sizeof(paged_path), "%s/fov_bench_%d.fovp", dir ? dir : "/tmp", (int)getpid());
+
+    struct stat st;
+    r->file_bytes = stat(mesh->path, &st) == 0 ? (size_t)st.st_size : 0;
+
+    double start = timer_now();
+    bool   built = paged_build(mesh->path, paged_path, NULL);
+    r->parse_ms  = (timer_now() - start) * 1000.0;
+    if (!built) goto cleanup;
+
+    scene_clear(scene);
+    scene->paged.gpu_budget = opt->budget;
+
+    // The page file is current, so the builder only maps it
+    start = timer_now();
+    if (!paged_open(&scene->paged, mesh->path, paged_path, GLM_VEC3_ZERO)) goto cleanup;
+    while (scene->paged.builder) {
+        scene_update(scene);
+        usleep(1000);
+    }
+    glFinish();
+    r->upload_ms = (timer_now() - start) * 1000.0;
+    if (!paged_is_loaded(&scene->paged)) goto cleanup;
+
+    r->triangle_count = scene->paged.triangle_count < INT_MAX ? (int)scene->paged.triangle_count : INT_MAX;
+    r->page_count     = scene->paged.page_count;
+    r->slot_count     = scene->paged.slot_count;
+
+    // Close enough that base cells cover pixels and pages stream in
+    scene_handle_mouse_scroll(scene, -6);
+
+    start = timer_now();
+    do {
+        scene_update(scene);
+        usleep(1000);
+    } while (paged_is_busy(&scene->paged));
+    glFinish();
+    r->settle_ms = (timer_now() - start) * 1000.0;
+
+    double* frames = malloc((size_t)opt->frames * sizeof(double));
+    if (!frames) goto cleanup;
+
+    glEnable(GL_DEPTH_TEST);
+    scene_render(scene);
+    glFinish();
+
+    // Streaming is part of the frame, every orbit step can evict and request pages
+    double total = 0.0, drawn = 0.0;
+    for (int i = 0; i < opt->frames; i++) {
+        start = timer_now();
+
+        glClearColor(0.08f, 0.08f, 0.08f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        scene_update(scene);
+        scene_render(scene);
+        glFinish();
+
+        frames[i]  = (timer_now() - start) * 1000.0;
+        total     += frames[i];
+        drawn     += (double)scene->paged.drawn_triangles;
+
+        scene_handle_mouse_move(scene, 20.0f, 0.0f);
+    }
+
+    qsort(frames, opt->frames, sizeof(double), _compare_double);
+    r->frame_mean_ms   = opt->frames > 0 ? total / opt->frames : 0.0;
+    r->frame_p50_ms    = _percentile(frames, opt->frames, 0.50);
+    r->frame_p99_ms    = _percentile(frames, opt->frames, 0.99);
+    r->drawn_triangles = opt->frames > 0 ? drawn / opt->frames : 0.0;
+    r->resident_count  = scene->paged.resident_count;
+    r->streamed_mb     = scene->paged.streamed_bytes / (1024.0 * 1024.0);
+    free(frames);
+
+    r->ok = true;
+
+cleanup:
+    if (!r->ok) log_error("Paged benchmark of %s failed", mesh->name);
+    scene_clear(scene);
+    remove(paged_path);
+    r->peak_rss_mb = _peak_rss_mb();
+}
+
+static void _json_string(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", *s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void _write_json(FILE* f, const bench_options_t* opt, const bench_mesh_t* meshes, const bench_result_t* results,
+                        int count)
+{
+    fprintf(f, "{\n  \"renderer\": ");
+    _json_string(f, (const char*)glGetString(GL_RENDERER));
+    fprintf(f, ",\n  \"gl_version\": ");
+    _json_string(f, (const char*)glGetString(GL_VERSION));
+    fprintf(f, ",\n  \"threads\": %d,\n  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n", thread_count(),
+            opt->width, opt->height, opt->frames);
+    fprintf(f, "  \"format\": \"%s\",\n  \"view\": \"%s\",\n  \"optimize\": %s,\n  \"instances\": %d,\n",
+            vertex_format_name(opt->format), view_mode_name(opt->view), opt->optimize ? "true" : "false",
+            opt->instances);
+    fprintf(f, "  \"meshes\": [");
+
+    for (int i = 0; i < count; i++) {
+        const bench_result_t* r = &results[i];
+
+        double file_mb = r->file_bytes / (1024.0 * 1024.0);
+        fprintf(f, "%s\n    {\n      \"name\": ", i ? "," : "");
+        _json_string(f, meshes[i].name);
+        fprintf(f, ",\n      \"ok\": %s,\n", r->ok ? "true" : "false");
+        fprintf(f, "      \"file_mb\": %.3f,\n", file_mb);
+        fprintf(f, "      \"vertices\": %d,\n      \"triangles\": %d,\n", r->vertex_count, r->triangle_count);
+        fprintf(f, "      \"parse_ms\": %.3f,\n", r->parse_ms);
+        fprintf(f, "      \"parse_mb_s\": %.1f,\n", r->parse_ms > 0.0 ? file_mb / (r->parse_ms / 1000.0) : 0.0);
+        fprintf(f, "      \"normals_ms\": %.3f,\n", r->normals_ms);
+        fprintf(f, "      \"meshlets_ms\": %.3f,\n", r->meshlets_ms);
+        fprintf(f, "      \"optimize_ms\": %.3f,\n", r->optimize_ms);
+        fprintf(f, "      \"lods\": %d,\n      \"lods_ms\": %.3f,\n", r->lod_count, r->lods_ms);
+        fprintf(f, "      \"edges_ms\": %.3f,\n", r->edges_ms);
+        fprintf(f, "      \"pack_ms\": %.3f,\n", r->pack_ms);
+        fprintf(f, "      \"analyze_ms\": %.3f,\n", r->analyze_ms);
+        fprintf(f, "      \"upload_ms\": %.3f,\n", r->upload_ms);
+        fprintf(f, "      \"frame_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f },\n", r->frame_mean_ms,
+                r->frame_p50_ms, r->frame_p99_ms);
+        fprintf(f, "      \"drawn_triangles\": %.0f,\n", r->drawn_triangles);
+        if (opt->preview) {
+            fprintf(f, "      \"preview_ms\": %.3f,\n      \"preview_triangles\": %d,\n", r->preview_ms,
+                    r->preview_triangles);
+        }
+        if (r->page_count > 0) {
+            fprintf(f, "      \"pages\": %d,\n      \"slots\": %d,\n      \"resident\": %d,\n", r->page_count,
+                    r->slot_count, r->resident_count);
+            fprintf(f, "      \"streamed_mb\": %.1f,\n      \"settle_ms\": %.3f,\n", r->streamed_mb, r->settle_ms);
+        }
+        fprintf(f, "      \"peak_rss_mb\": %.1f\n    }", r->peak_rss_mb);
+    }
+
+    // The import stages all run on this thread, so its scratch arena peaked at the largest mesh
+    arena_stats_t arenas;
+    arena_stats(&arenas);
+    fprintf(f, "\n  ],\n  \"scratch_peak_mb\": %.1f,\n", arenas.peak / (1024.0 * 1024.0));
+    fprintf(f, "  \"peak_rss_mb\": %.1f\n}\n", _peak_rss_mb());
+}
+
+static void _usage(const char* exe)
+{
+    fprintf(stderr,
+            "usage: %s [options] [model | directory]...\n"
+            "  --frames N        frames rendered per mesh (default 200)\n"
+            "  --size WxH        framebuffer size (default 1280x720)\n"
+            "  --grid N          synthetic height field of N x N quads, 0 to skip (default 512)\n"
+            "  --sphere N        synthetic uv sphere with N segments, 0 to skip (default 512)\n"
+            "  --instances N     placements of every mesh (default 1)\n"
+            "  --format FORMAT   f64, f32 or unorm16 (default f32)\n"
+            "  --view MODE       shaded, wireframe, edges or points (default shaded)\n"
+            "  --no-optimize     skip the vertex cache optimization\n"
+            "  --preview         parse like the loader and time the first upload of the partial model\n"
+            "  --paged           stream binary STL and OBJ files from a page file instead of importing them\n"
+            "  --budget MB       gpu slot memory of a paged mesh (default 512)\n"
+            "  --out FILE        write the json to FILE instead of stdout\n"
+            "Without paths test/models is benchmarked.\n",
+            exe);
+}
+
+int main(int argc, char** argv)
+{
+    bench_options_t opt = {
+        .frames    = 200,
+        .width     = 1280,
+        .height    = 720,
+        .grid      = 512,
+        .sphere    = 512,
+        .instances = 1,
+        .format    = VERTEX_FORMAT_F32,
+        .view      = VIEW_SHADED,
+        .optimize  = true,
+        .preview   = false,
+        .paged     = false,
+        .budget    = PAGED_GPU_BUDGET,
+        .out_path  = NULL,
+    };
+
+    static bench_mesh_t   meshes[BENCH_MAX_MESHES];
+    static bench_result_t results[BENCH_MAX_MESHES];
+    int                   mesh_count = 0;
+    int                   status     = EXIT_FAILURE;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg  = argv[i];
+        const char* next = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--frames") == 0 && next) {
+            opt.frames = atoi(argv[++i]);
+        } else if (strcmp(arg, "--size") == 0 && next) {
+            if (sscanf(argv[++i], "%dx%d", &opt.width, &opt.height) != 2) opt.width = 0;
+        } else if (strcmp(arg, "--grid") == 0 && next) {
+            opt.grid = atoi(argv[++i]);
+        } else if (strcmp(arg, "--sphere") == 0 && next) {
+            opt.sphere = atoi(argv[++i]);
+        } else if (strcmp(arg, "--instances") == 0 && next) {
+            opt.instances = atoi(argv[++i]);
+        } else if (strcmp(arg, "--format") == 0 && next) {
+            opt.format = VERTEX_FORMAT_COUNT;
+            for (int f = 0; f < VERTEX_FORMAT_COUNT; f++) {
+                if (strcmp(next, vertex_format_name(f)) == 0) opt.format = f;
+            }
+            i++;
+        } else if (strcmp(arg, "--view") == 0 && next) {
+            opt.view = VIEW_MODE_COUNT;
+            for (int v = 0; v < VIEW_MODE_COUNT; v++) {
+                if (strcmp(next, view_mode_name(v)) == 0) opt.view = v;
+            }
+            i++;
+        } else if (strcmp(arg, "--no-optimize") == 0) {
+            opt.optimize = false;
+        } else if (strcmp(arg, "--preview") == 0) {
+            opt.preview = true;
+        } else if (strcmp(arg, "--paged") == 0) {
+            opt.paged = true;
+        } else if (strcmp(arg, "--budget") == 0 && next) {
+            opt.budget = (size_t)atoi(argv[++i]) << 20;
+        } else if (strcmp(arg, "--out") == 0 && next) {
+            opt.out_path = argv[++i];
+        } else if (arg[0] == '-') {
+            _usage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            _add_path(meshes, &mesh_count, arg);
+        }
+    }
+
+    if (opt.frames < 0 || opt.width <= 0 || opt.height <= 0 || opt.instances < 1 || opt.budget == 0
+        || opt.format == VERTEX_FORMAT_COUNT || opt.view == VIEW_MODE_COUNT)
+    {
+        _usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (mesh_count == 0) _add_path(meshes, &mesh_count, "test/models");
+
+    char path[4096], name[64];
+    if (opt.grid > 0 && _generate_grid(opt.grid, path, sizeof(path))) {
+        snprintf(name, sizeof(name), "grid_%d", opt.grid);
+        if (!_add_mesh(meshes, &mesh_count, name, path, true)) remove(path);
+    }
+    if (opt.sphere > 0 && _generate_sphere(opt.sphere, path, sizeof(path))) {
+        snprintf(name, sizeof(name), "sphere_%d", opt.sphere);
+        if (!_add_mesh(meshes, &mesh_count, name, path, true)) remove(path);
+    }
+
+    bench_context_t ctx = { .display = EGL_NO_DISPLAY, .context = EGL_NO_CONTEXT };
+    if (!_context_create(&ctx, opt.width, opt.height)) goto cleanup;
+
+    scene_t scene;
+    scene_init(&scene, opt.width, opt.height);
+    scene.batch.view_mode = opt.view;
+
+    for (int i = 0; i < mesh_count; i++) {
+        log_info("Benchmarking %s", meshes[i].name);
+        if (opt.paged && !meshes[i].generated) {
+            _bench_paged(&meshes[i], &opt, &scene, &results[i]);
+        } else {
+            _bench_mesh(&meshes[i], &opt, &scene, &results[i]);
+        }
+    }
+
+    FILE* out = opt.out_path ? fopen(opt.out_path, "w") : stdout;
+    if (!out) {
+        log_error("Failed to open %s for writing", opt.out_path);
+    } else {
+        _write_json(out, &opt, meshes, results, mesh_count);
+        if (out != stdout) fclose(out);
+        status = EXIT_SUCCESS;
+    }
+
+    scene_unload(&scene);
+
+cleanup:
+    _context_destroy(&ctx);
+
+    for (int i = 0; i < mesh_count; i++) {
+        if (meshes[i].generated) remove(meshes[i].path);
+        free(meshes[i].name);
+        free(meshes[i].path);
+    }
+
+    return status;
+}
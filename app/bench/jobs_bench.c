@@ -0,0 +1,173 @@
+// Job pool micro benchmark: what queueing and waiting cost per job and per parallel_for, next to
+// spawning threads for every call the way thread_parallel used to, and how a compute bound loop
+// scales with the task count. Results are written as JSON, logs go to stderr.
+//
+// The churn pass runs many short nested loops whose counters live on the stack. Build it with
+// -fsanitize=address and run with ASAN_OPTIONS=detect_stack_use_after_return=1 to catch a job
+// touching a counter after its wait returned.
+
+#include "log.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine/jobs.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#define JOBS_BENCH_EMPTY_JOBS (1 << 20) // queued one by one on a single counter
+#define JOBS_BENCH_FAN_OUT (1 << 14)    // queued from inside a job, per job
+#define JOBS_BENCH_CALLS 2000           // parallel_for calls with empty tasks
+#define JOBS_BENCH_ELEMENTS (1 << 24)   // work of the scaling loop
+#define JOBS_BENCH_CHURN 20000          // short nested parallel_for calls checked for lost tasks
+
+typedef struct {
+    double* values;
+    int     count;
+    int     task_count;
+    double  sums[JOBS_MAX_WORKERS + 1];
+} _scale_job_t;
+
+typedef struct {
+    job_fn fn;
+    void*  userdata;
+    int    index;
+} _spawn_arg_t;
+
+static void _empty(void* userdata, int index)
+{
+    (void)userdata;
+    (void)index;
+}
+
+static void* _spawn_entry(void* arg)
+{
+    _spawn_arg_t* a = arg;
+    a->fn(a->userdata, a->index);
+    return NULL;
+}
+
+// One thread per task and a join, the way parallel loops ran before the pool
+static void _spawn_parallel(int count, job_fn fn, void* userdata)
+{
+    pthread_t    threads[JOBS_MAX_WORKERS + 1];
+    _spawn_arg_t args[JOBS_MAX_WORKERS + 1];
+
+    for (int i = 1; i < count; i++) {
+        args[i] = (_spawn_arg_t) { fn, userdata, i };
+        pthread_create(&threads[i], NULL, _spawn_entry, &args[i]);
+    }
+    fn(userdata, 0);
+    for (int i = 1; i < count; i++) pthread_join(threads[i], NULL);
+}
+
+static void _fan_out(void* userdata, int index)
+{
+    (void)index;
+    job_counter_t* counter = userdata;
+    for (int i = 0; i < JOBS_BENCH_FAN_OUT; i++) jobs_run(_empty, NULL, i, counter);
+}
+
+static void _count_task(void* userdata, int index)
+{
+    (void)index;
+    atomic_fetch_add((atomic_int*)userdata, 1);
+}
+
+// Every task waits on a counter of its own, so frames come and go while other jobs finish
+static void _churn_task(void* userdata, int index)
+{
+    (void)index;
+    atomic_int ran = 0;
+    jobs_parallel_for(4, _count_task, &ran);
+    atomic_fetch_add((atomic_int*)userdata, atomic_load(&ran));
+}
+
+static void _scale_task(void* userdata, int index)
+{
+    _scale_job_t* job   = userdata;
+    int           first = (int)((long long)job->count * index / job->task_count);
+    int           last  = (int)((long long)job->count * (index + 1) / job->task_count);
+
+    double sum = 0.0;
+    for (int i = first; i < last; i++) sum += sqrt(job->values[i]) * sin(job->values[i]);
+    job->sums[index] = sum;
+}
+
+int main(void)
+{
+    int threads = thread_count();
+    if (threads > JOBS_MAX_WORKERS + 1) threads = JOBS_MAX_WORKERS + 1;
+    jobs_init(threads - 1);
+
+    job_counter_t counter;
+    double        start;
+
+    // Queued from outside the pool, everything goes through the shared deque
+    jobs_counter_init(&counter);
+    start = timer_now();
+    for (int i = 0; i < JOBS_BENCH_EMPTY_JOBS; i++) jobs_run(_empty, NULL, i, &counter);
+    jobs_wait(&counter);
+    double queue_ns = (timer_now() - start) * 1e9 / JOBS_BENCH_EMPTY_JOBS;
+
+    // Queued by a worker onto its own deque, the others steal
+    jobs_counter_init(&counter);
+    start = timer_now();
+    for (int i = 0; i < threads; i++) jobs_run(_fan_out, &counter, i, &counter);
+    jobs_wait(&counter);
+    double fan_out_ns = (timer_now() - start) * 1e9 / ((double)threads * JOBS_BENCH_FAN_OUT);
+
+    start = timer_now();
+    for (int i = 0; i < JOBS_BENCH_CALLS; i++) jobs_parallel_for(threads, _empty, NULL);
+    double pool_us = (timer_now() - start) * 1e6 / JOBS_BENCH_CALLS;
+
+    start = timer_now();
+    for (int i = 0; i < JOBS_BENCH_CALLS; i++) _spawn_parallel(threads, _empty, NULL);
+    double spawn_us = (timer_now() - start) * 1e6 / JOBS_BENCH_CALLS;
+
+    start = timer_now();
+    for (int i = 0; i < JOBS_BENCH_CHURN; i++) {
+        atomic_int ran = 0;
+        jobs_parallel_for(threads, _churn_task, &ran);
+        if (atomic_load(&ran) != threads * 4) {
+            log_error("Churn call %d ran %d of %d tasks", i, atomic_load(&ran), threads * 4);
+            return EXIT_FAILURE;
+        }
+    }
+    double churn_us = (timer_now() - start) * 1e6 / JOBS_BENCH_CHURN;
+
+    _scale_job_t job = { .count = JOBS_BENCH_ELEMENTS };
+    job.values       = malloc((size_t)job.count * sizeof(double));
+    if (!job.values) {
+        log_error("Failed to allocate %d values", job.count);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < job.count; i++) job.values[i] = (double)i / job.count;
+
+    printf("{\n  \"threads\": %d,\n  \"workers\": %d,\n", threads, jobs_worker_count());
+    printf("  \"queue_ns\": %.1f,\n  \"fan_out_ns\": %.1f,\n", queue_ns, fan_out_ns);
+    printf("  \"parallel_for_us\": %.2f,\n  \"spawn_us\": %.2f,\n", pool_us, spawn_us);
+    printf("  \"churn_us\": %.2f,\n", churn_us);
+    printf("  \"scaling\": [");
+
+    double base_ms = 0.0;
+    for (int tasks = 1;; tasks = tasks * 2 < threads ? tasks * 2 : threads) {
+        job.task_count = tasks;
+        start          = timer_now();
+        jobs_parallel_for(tasks, _scale_task, &job);
+        double ms = (timer_now() - start) * 1000.0;
+        if (tasks == 1) base_ms = ms;
+
+        printf("%s\n    { \"tasks\": %d, \"ms\": %.3f, \"speedup\": %.2f }", tasks > 1 ? "," : "", tasks, ms,
+               ms > 0.0 ? base_ms / ms : 0.0);
+        if (tasks == threads) break;
+    }
+    printf("\n  ]\n}\n");
+
+    free(job.values);
+    jobs_shutdown();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,12 @@
+#ifndef __ANALYZE_H__
+#define __ANALYZE_H__
+
+#include "core/model.h"
+
+#include <stdbool.h>
+
+// Measures the full level of a model for model_stats_t. Edges are counted between positions, so
+// normal and uv seams don't show up as boundaries. Fast enough to run on every load.
+bool model_analyze(const model_t* model, model_stats_t* stats);
+
+#endif // __ANALYZE_H__
@@ -0,0 +1,133 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "cglm/cglm.h"
+#include "core/meshlet.h"
+#include "core/model.h"
+#include "engine/shader.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BATCH_INSTANCE_BINDING 0  // shader storage binding of the per instance transforms
+#define BATCH_DRAW_BINDING 1      // shader storage binding of the draw records
+#define BATCH_POSITION_BINDING 2  // pool buffers the outline modes read the triangles back from
+#define BATCH_INDEX_BINDING 3
+#define BATCH_EDGE_BINDING 4
+#define BATCH_INSTANCE_LOCATION 3 // instanced attribute holding the index into the draw records
+#define BATCH_POINT_SIZE 2.0f
+
+typedef enum {
+    VIEW_SHADED,
+    VIEW_WIREFRAME, // every triangle edge drawn over the shading in the same pass
+    VIEW_EDGES,     // only the feature edges, see edges.h
+    VIEW_POINTS,    // the vertices without the index buffer
+    VIEW_MODE_COUNT
+} view_mode_t;
+
+// Vertices and indices of every single draw model of one vertex format share these buffers,
+// so the whole pool is one multi draw indirect however many models it holds
+typedef struct {
+    unsigned int vao;
+    unsigned int positions;
+    unsigned int normals;
+    unsigned int indices;
+    unsigned int edges;        // feature bits per triangle, zero for models without
+    int          vertex_count; // vertices, not floats
+    int          vertex_capacity;
+    int          index_count;
+    int          index_capacity;
+} batch_pool_t;
+
+// A loaded file and every placement of it
+typedef struct {
+    char*       path;
+    gpu_model_t gpu;         // buffers are released once the model moved into a pool
+    int         pool;        // vertex format of the pool holding it, -1 when drawn from gpu.draws
+    int         base_vertex; // range in the pool
+    int         first_index;
+    int         first_entry; // of its instances in the transform buffer
+    mat4*       instances;
+    int         instance_count;
+    int         instance_capacity;
+} batch_model_t;
+
+// What an instance of a command reads through its base instance. The outline modes find the
+// triangle of a fragment from the range of the command and gl_PrimitiveID.
+typedef struct {
+    unsigned int instance; // transform
+    unsigned int first_index;
+    int          base_vertex;
+    unsigned int pad;
+} batch_draw_t;
+
+// One multi draw over a vao, built from the models and instances when they change
+typedef struct {
+    unsigned int    vao;
+    view_mode_t     view; // program variant, imports are always shaded
+    vertex_format_t format;
+    unsigned int    mode;
+    unsigned int    index_type; // 0 for non indexed draws
+    size_t          offset;     // of the first command in the indirect buffer
+    int             count;
+} batch_call_t;
+
+typedef struct {
+    batch_model_t*   models;
+    int              model_count;
+    int              model_capacity;
+    batch_pool_t     pools[VERTEX_FORMAT_COUNT];
+    shader_t         shaders[VIEW_MODE_COUNT][VERTEX_FORMAT_COUNT]; // created on first use
+    unsigned int     instance_buffer;                               // shader storage, see _instance_t
+    unsigned int     indirect_buffer;
+    unsigned int     draw_buffer;
+    unsigned int     id_buffer; // 0, 1, 2, ... read with divisor 1 so base instance picks the draw record
+    int              id_capacity;
+    size_t           entry_count; // transforms laid out, 0 until the models are
+    batch_call_t*    calls;
+    int              call_count;
+    int              call_capacity;
+    unsigned char*   commands; // cpu side of the indirect buffer, the imports first
+    size_t           command_bytes;
+    size_t           command_capacity;
+    int              static_calls; // calls and commands of the imports, the pools follow per render
+    size_t           static_bytes;
+    long long        static_indices;
+    batch_draw_t*    draws; // cpu side of the draw records, the imports first
+    size_t           draw_count;
+    size_t           draw_capacity;
+    size_t           static_draws;
+    meshlet_range_t* ranges; // culling output of one instance
+    int              range_capacity;
+    bool             backface_culling; // drop meshlets facing away and cull back faces in the pools
+    view_mode_t      view_mode;        // of the pools, imports are always shaded
+    long long        drawn_indices;    // submitted by the last render, vertices in the points mode
+    bool             dirty; // models or instances changed, the layout is rebuilt on the next render
+} batch_t;
+
+void batch_init(batch_t* batch);
+void batch_free(batch_t* batch);
+
+// Removes every model but keeps the pools and programs for the next ones
+void batch_clear(batch_t* batch);
+
+// Index of the model loaded from path, -1 if there is none
+int batch_find(const batch_t* batch, const char* path);
+
+// Takes ownership of an uploaded model. A model loaded from the same path before is replaced and
+// keeps its instances, a new one starts without any. Returns the index or -1 on failure.
+int  batch_add_model(batch_t* batch, gpu_model_t model, const char* path);
+bool batch_add_instance(batch_t* batch, int model, mat4 transform);
+
+// One instanced indirect draw per imported draw and one multi draw indirect per pool. Pooled models
+// with meshlets are culled against the camera first, only their visible runs are drawn. The
+// shaders still read the camera from the shared block.
+// The pools are drawn in view_mode, the outlines come out of the same pass as the shading.
+void batch_render(batch_t* batch, mat4 view, mat4 projection);
+
+// Totals over all models, instances count every placement once
+void batch_stats(const batch_t* batch, int* vertex_count, int* instance_count, float* size_mb);
+
+const char* view_mode_name(view_mode_t mode);
+
+#endif // __BATCH_H__
@@ -0,0 +1,46 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "core/model.h"
+#include "engine/file.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CACHE_DEFAULT_MAX_BYTES (4ull << 30)
+
+// Identifies one processed variant of a source file
+typedef struct {
+    char*           source_path; // canonical
+    size_t          source_size;
+    long long       source_mtime;
+    uint64_t        source_hash;
+    uint64_t        path_hash;
+    vertex_format_t format;
+    bool            optimized; // triangles and vertices went through model_optimize
+} cache_key_t;
+
+// A cache hit, packed points straight into the mapped cache file
+typedef struct {
+    packed_model_t packed;
+    file_map_t     map;
+    double         import_ms;
+} cache_entry_t;
+
+void cache_init(const char* directory, size_t max_bytes);
+void cache_set_enabled(bool enabled);
+bool cache_is_enabled(void);
+
+bool cache_key(const char* source_path, vertex_format_t format, bool optimized, cache_key_t* key);
+void cache_key_free(cache_key_t* key);
+
+bool cache_load(const cache_key_t* key, cache_entry_t* entry);
+void cache_release(cache_entry_t* entry);
+bool cache_store(const cache_key_t* key, const packed_model_t* packed, double import_ms);
+void cache_evict(void);
+
+// Path in the cache directory for a file derived from source_path that the size limit leaves
+// alone, such as a page file. False without a cache directory.
+bool cache_sidecar_path(const char* source_path, const char* extension, char* out, size_t size);
+
+#endif // __CACHE_H__
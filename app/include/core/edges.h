@@ -0,0 +1,18 @@
+#ifndef __EDGES_H__
+#define __EDGES_H__
+
+#include "core/model.h"
+
+#include <stdbool.h>
+
+#define EDGES_DEFAULT_CREASE 30.0f // degrees
+#define EDGES_AB 0x1               // feature bits of a triangle, one per edge in corner order
+#define EDGES_BC 0x2
+#define EDGES_CA 0x4
+
+// Marks the feature edges of every level in model_t.edges: open and non manifold edges and those
+// whose faces meet at more than crease_degrees. Triangles are matched by position, so vertices
+// split by their normals still join. Runs after model_build_lods.
+bool model_build_edges(model_t* model, float crease_degrees);
+
+#endif // __EDGES_H__
@@ -2,12 +2,13 @@
 #define __GRID_H__
 
 #include "cglm/cglm.h"
+#include "engine/shader.h"
 
 typedef struct {
     unsigned int vao;
     unsigned int vbo;
     unsigned int cbo;
-    unsigned int program;
+    shader_t     shader;
     int          line_width;
     int          line_count;
     int          size;
@@ -16,6 +17,6 @@ typedef struct {
 grid_t grid_create();
 void   grid_build(grid_t* grid, vec3 center, int size, int line_width, float spacing);
 void   grid_destroy(grid_t* grid);
-void   grid_render(const grid_t* grid, mat4 projection, mat4 view);
+void   grid_render(const grid_t* grid);
 
 #endif // __GRID_H__
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include "core/cache.h"
+#include "core/model.h"
+#include "core/preview.h"
+#include "core/progress.h"
+#include "engine/thread.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define LOADER_UPLOAD_BUDGET (32 << 20) // gpu upload bytes per frame
+
+// Parses a model file on the loader thread, see parse_obj and parse_stl
+typedef bool (*model_parse_fn)(model_t* model, const char* filepath, load_progress_t* progress);
+
+// Imports a file whose buffers are already gpu ready straight into a packed model, see parse_gltf.
+// Imports skip the cache, normal generation and optimization, the file is used as stored.
+typedef bool (*model_import_fn)(packed_model_t* packed, const char* filepath, load_progress_t* progress);
+
+// A file format, exactly one of parse and import is set
+typedef struct {
+    const char*     name;
+    model_parse_fn  parse;
+    model_import_fn import;
+} model_reader_t;
+
+typedef enum {
+    LOADER_IDLE,
+    LOADER_READING,   // parsing or reading the cache on the loader thread
+    LOADER_UPLOADING, // streaming buffers to the gpu on the render thread
+} loader_stage_t;
+
+// Loads one model off the render thread, only the gpu upload runs on the caller's thread
+typedef struct {
+    char*           path;
+    const model_reader_t* reader;
+    vertex_format_t format;
+    bool            optimize;
+    bool            use_cache;
+    thread_t        thread;
+    load_progress_t progress;
+    load_preview_t  preview;  // what the parser read so far, readers that can't publish it leave it empty
+    atomic_int      result;   // set by the loader thread
+    atomic_bool     finished; // loader thread returned and can be joined
+    model_t         model;
+    packed_model_t  packed;
+    cache_entry_t   entry;
+    bool            cached;
+    gpu_upload_t    upload;
+    bool            uploading;
+    bool            delivered;
+} loader_t;
+
+void loader_init(loader_t* loader);
+bool loader_start(loader_t* loader, const char* path, const model_reader_t* reader, vertex_format_t format,
+                  bool optimize);
+void loader_cancel(loader_t* loader);
+bool loader_poll(loader_t* loader, size_t upload_budget, gpu_model_t* out);
+
+loader_stage_t loader_status(loader_t* loader, size_t* done, size_t* total);
+
+#endif // __LOADER_H__
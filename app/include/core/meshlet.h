@@ -0,0 +1,37 @@
+#ifndef __MESHLET_H__
+#define __MESHLET_H__
+
+#include "cglm/cglm.h"
+#include "core/model.h"
+
+#include <stdbool.h>
+
+#define MESHLET_TRIANGLES 128 // triangles per meshlet, the last one of a model may have fewer
+#define MESHLET_LEAF_SIZE 4   // meshlets per bvh leaf
+
+// A visible run of indices, neighbouring meshlets are merged into one
+typedef struct {
+    unsigned int first_index;
+    unsigned int index_count;
+} meshlet_range_t;
+
+// Sorts the triangles along a Morton curve over their centroids and cuts the order into
+// meshlets, so each one covers a compact patch of the surface. Only the index ranges are set,
+// model_optimize keeps them intact.
+bool model_build_meshlets(model_t* model);
+
+// Fills in the bounding spheres and normal cones of the meshlets and builds the bvh over them,
+// nodes needs room for 2 * count. Positions are taken relative to center.
+bool meshlets_build_bounds(const model_t* model, const double center[3], meshlet_t* meshlets, int count,
+                           meshlet_node_t* nodes, int* node_count);
+
+// Frustum planes of a clip from model matrix, normalized with the normal pointing inside
+void meshlets_frustum(mat4 clip, vec4 planes[6]);
+
+// Walks the bvh and writes the index ranges of the meshlets inside the frustum to ranges, which
+// needs room for one per meshlet. With an eye position meshlets facing away from it are culled
+// as well. Returns the range count.
+int meshlets_cull(const meshlet_t* meshlets, const meshlet_node_t* nodes, int node_count, vec4 planes[6],
+                  const float* eye, meshlet_range_t* ranges);
+
+#endif // __MESHLET_H__
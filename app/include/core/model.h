@@ -2,47 +2,248 @@
 #define __MODEL_H__
 
 #include "cglm/cglm.h"
+#include "engine/file.h"
+
+#include <stdbool.h>
 
-#define MAX_VERTICES 1000000
-#define MAX_INDICES 1000000
 #define FORCE_SIMPLE_SHADER 1
+#define MODEL_MAX_LODS 5 // levels of detail, the full one included
+
+// GPU layout of the position attribute
+typedef enum {
+    VERTEX_FORMAT_F64,     // raw doubles, needs fp64 vertex fetch
+    VERTEX_FORMAT_F32,     // floats re-centred on the bbox center
+    VERTEX_FORMAT_UNORM16, // 16 bit normalized, decoded with the bbox
+    VERTEX_FORMAT_COUNT
+} vertex_format_t;
+
+// A cluster of spatially close triangles, bounds are in bbox centered model space
+typedef struct {
+    float        center[3]; // bounding sphere
+    float        radius;
+    float        cone_axis[3]; // average facing of the triangles
+    float        cone_cutoff;  // 1 when they face too many ways to ever be culled
+    unsigned int first_index;
+    unsigned int index_count;
+} meshlet_t;
+
+// Bvh over the meshlets in preorder, a subtree covers consecutive meshlets
+typedef struct {
+    float min[3];
+    float max[3];
+    int   first; // meshlets of the subtree
+    int   count;
+    int   skip;  // next node once the subtree is done with
+} meshlet_node_t;
+
+// A level of detail, a range of the index buffer over the same vertices as the full level
+typedef struct {
+    unsigned int first_index;
+    unsigned int index_count;
+    float        error; // deviation from the full surface in model units, 0 for the full level
+} model_lod_t;
+
+// Measured on the full level of a parsed model, see model_analyze
+typedef struct {
+    bool   valid; // imports are never parsed into a model and go without
+    double min[3];
+    double max[3];
+    double area;
+    double volume;      // signed, positive when a closed surface faces outwards
+    double centroid[3]; // of the enclosed volume when the surface is closed, of the surface otherwise
+    int    triangle_count;
+    int    degenerate_count;   // zero area or repeated positions, they take no part in the edge counts
+    int    boundary_edges;     // used by one triangle
+    int    non_manifold_edges; // used by three or more
+    int    boundary_loops;     // connected runs of boundary edges, the holes of a scan
+} model_stats_t;
 
 typedef struct {
-    unsigned int* indices;
-    double*       vertices;
-    float*        normals;
-    float*        texcrds;
-    int           indice_count;
-    int           vertex_count;
-    int           normal_count;
-    int           texcrd_count;
+    unsigned int*  indices;
+    double*        vertices;
+    float*         normals;
+    float*         texcrds;
+    int            indice_count;
+    int            vertex_count;
+    int            normal_count;
+    int            texcrd_count;
+    int            indice_capacity;
+    int            vertex_capacity;
+    int            normal_capacity;
+    int            texcrd_capacity;
+    meshlet_t*     meshlets;             // index ranges only, the bounds are computed when packing
+    int            meshlet_count;
+    model_lod_t    lods[MODEL_MAX_LODS]; // the coarser levels follow the full one in indices
+    int            lod_count;            // 0 until built, indice_count then covers every level
+    unsigned char* edges;                // feature edge bits per triangle of every level, see edges.h
 } model_t;
 
+// Bytes that become one gpu buffer
+typedef struct {
+    unsigned int target; // GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+    const void*  data;
+    size_t       bytes;
+} packed_view_t;
+
+// A vertex attribute as it sits in a packed view
+typedef struct {
+    int          view; // -1 when absent
+    size_t       offset;
+    int          stride; // 0 when tightly packed
+    unsigned int type;   // GL component type
+    int          size;   // components
+    bool         normalized;
+} packed_attrib_t;
+
+// One draw call reading straight from the packed views
+typedef struct {
+    packed_attrib_t position;
+    packed_attrib_t normal;
+    packed_attrib_t texcrd;
+    int             index_view; // -1 draws the vertices in order
+    size_t          index_offset;
+    unsigned int    index_type;
+    unsigned int    mode; // GL primitive
+    int             count; // indices, or vertices when not indexed
+    int             vertex_count;
+    mat4            transform; // placement in the model, dequantization included
+} packed_draw_t;
+
+// GPU ready buffers, either packed from a model_t, borrowed from a cache mapping or imported
+// from a file whose layout is already gpu ready. Imports fill views and draws, everything
+// else describes a single draw with the fields up to texcrd_count, plus meshlets for culling and
+// the levels of detail.
+typedef struct {
+    vertex_format_t       format;
+    const void*           vertices;
+    const unsigned int*   indices;
+    const float*          normals;
+    const float*          texcrds;
+    const unsigned char*  edges; // per triangle of every level, NULL without
+    size_t                vertex_bytes;
+    int                   vertex_count;
+    int                   indice_count;
+    int                   normal_count;
+    int                   texcrd_count;
+    vec3                  min_vertex;
+    vec3                  max_vertex;
+    vec3                  decode_scale;
+    vec3                  decode_offset;
+    void*                 storage; // owned by the packed model, NULL when borrowed
+    packed_view_t*        views;
+    packed_draw_t*        draws;
+    int                   view_count;
+    int                   draw_count;
+    file_map_t*           maps; // owned mappings the views point into
+    int                   map_count;
+    const meshlet_t*      meshlets;
+    const meshlet_node_t* nodes;
+    int                   meshlet_count;
+    int                   node_count;
+    void*                 cull_storage; // owned meshlets and nodes, NULL when borrowed
+    model_lod_t           lods[MODEL_MAX_LODS];
+    int                   lod_count;
+    model_stats_t         stats;
+} packed_model_t;
+
 typedef struct {
     unsigned int vao;
-    unsigned int vbo;
-    unsigned int nbo;
-    unsigned int tbo;
-    unsigned int ebo;
-    unsigned int program;
-    int          vertex_count;
-    int          indice_count;
-    int          normal_count;
-    int          texcrd_count;
-    vec3         min_vertex;
-    vec3         max_vertex;
-    mat4         model;
+    unsigned int mode;
+    unsigned int index_type; // 0 for non indexed draws
+    size_t       index_offset;
+    int          count;
+    bool         has_normals;
+    mat4         transform;
+    mat3         normal_matrix;
+} gpu_draw_t;
+
+typedef struct {
+    unsigned int*   buffers;
+    gpu_draw_t*     draws;
+    int             buffer_count;
+    int             draw_count;
+    int             position_buffer; // buffers of a single draw model, -1 for imports and once released
+    int             normal_buffer;   // -1 without normals
+    int             index_buffer;
+    int             edge_buffer; // -1 without feature edges
+    vertex_format_t format;
+    size_t          buffer_bytes;
+    int             vertex_count;
+    int             indice_count;
+    int             normal_count;
+    int             texcrd_count;
+    vec3            min_vertex;
+    vec3            max_vertex;
+    vec3            decode_scale;
+    vec3            decode_offset;
+    mat4            model;
+    meshlet_t*      meshlets; // cpu copy for culling, kept when the buffers are released
+    meshlet_node_t* nodes;
+    int             meshlet_count;
+    int             node_count;
+    model_lod_t     lods[MODEL_MAX_LODS]; // indice_count only counts the full level
+    int             lod_count;
+    model_stats_t   stats;
 } gpu_model_t;
 
+typedef struct {
+    unsigned int target;
+    unsigned int buffer;
+    const void*  data;
+    size_t       bytes;
+} gpu_upload_part_t;
+
+#define GPU_UPLOAD_SLOT_SIZE (8 << 20) // bytes per staging ring slot
+#define GPU_UPLOAD_SLOTS 4             // slots the gpu may still be copying from
+
+// Streams a packed model into gpu buffers over several calls so no single frame stalls.
+// Chunks go through a persistent mapped staging ring guarded by fences, so the driver never
+// holds more than the ring on top of the buffers. A packed buffer can be freed once
+// gpu_upload_staged says so, the rest must stay alive until the upload is done.
+typedef struct {
+    gpu_model_t        model;
+    gpu_upload_part_t* parts;
+    int                part_count;
+    int                part;
+    size_t             part_offset;
+    size_t             done_bytes;
+    size_t             total_bytes;
+    unsigned int       staging; // 0 without buffer storage, chunks then go through glBufferSubData
+    char*              staging_data;
+    size_t             slot_size;
+    int                slot;
+    struct __GLsync*   fences[GPU_UPLOAD_SLOTS]; // NULL for slots the gpu is done with
+} gpu_upload_t;
+
 void        model_init(model_t* model);
 void        model_free(model_t* model);
+bool        model_reserve(model_t* model, int vertex_count, int indice_count, int normal_count, int texcrd_count);
 float       model_get_size_mb(const model_t* model);
-gpu_model_t model_upload(model_t* model);
+void        model_get_bounds(const model_t* model, double min[3], double max[3]);
+void        model_pack_vertices(const model_t* model, vertex_format_t format, const double min[3], const double max[3],
+                                void* dst, vec3 decode_scale, vec3 decode_offset);
+// Leaves nothing to free on failure
+bool        model_pack(const model_t* model, vertex_format_t format, packed_model_t* packed);
+gpu_model_t model_upload(model_t* model, vertex_format_t format);
 // void        model_get_bbox(model_t* model, vec4 bbox);
 
-void  gpu_model_init(gpu_model_t* model);
-void  gpu_model_render(const gpu_model_t* model, mat4 proj, mat4 view);
-float gpu_model_get_size_mb(const gpu_model_t* model);
-void  gpu_model_unload(gpu_model_t* model);
+void packed_model_free(packed_model_t* packed);
+
+gpu_model_t gpu_model_create(const packed_model_t* packed);
+bool        gpu_upload_begin(gpu_upload_t* upload, const packed_model_t* packed);
+bool        gpu_upload_step(gpu_upload_t* upload, size_t budget);
+bool        gpu_upload_done(const gpu_upload_t* upload);
+bool        gpu_upload_staged(const gpu_upload_t* upload, const void* data);
+void        gpu_upload_abort(gpu_upload_t* upload);
+void        gpu_model_init(gpu_model_t* model);
+float       gpu_model_get_size_mb(const gpu_model_t* model);
+// Indices in the buffer of a single draw model, the coarser levels of detail included
+int         gpu_model_index_count(const gpu_model_t* model);
+// Frees the gpu storage but keeps the description, for models whose buffers were copied elsewhere
+void        gpu_model_release_buffers(gpu_model_t* model);
+void        gpu_model_unload(gpu_model_t* model);
+
+const char* vertex_format_name(vertex_format_t format);
+int         vertex_format_stride(vertex_format_t format);
 
 #endif // __MODEL_H__
\ No newline at end of file
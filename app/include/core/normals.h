@@ -0,0 +1,15 @@
+#ifndef __NORMALS_H__
+#define __NORMALS_H__
+
+#include "core/model.h"
+
+#include <stdbool.h>
+
+#define NORMALS_DEFAULT_CREASE 60.0f // degrees
+
+// Smooth per vertex normals from area weighted face normals. Faces around a vertex are smoothed
+// together when they are joined by edges meeting within crease_degrees, separate groups split
+// the vertex.
+bool model_compute_normals(model_t* model, float crease_degrees);
+
+#endif // __NORMALS_H__
@@ -0,0 +1,23 @@
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include "core/model.h"
+
+#include <stdbool.h>
+
+#define OPTIMIZE_CACHE_SIZE 32 // LRU size the triangle order is tuned for
+#define OPTIMIZE_FIFO_SIZE 16  // FIFO size the statistics are measured with
+
+typedef struct {
+    float acmr; // transformed vertices per triangle
+    float atvr; // transformed vertices per vertex
+} vcache_stats_t;
+
+void optimize_vcache_stats(const unsigned int* indices, int indice_count, int vertex_count, vcache_stats_t* stats);
+
+// Reorders triangles for the post-transform cache and overdraw, then vertices by first use.
+// The model keeps its contents, only the order changes. With meshlets the triangles are only
+// reordered within each of them, so their ranges stay valid.
+bool model_optimize(model_t* model);
+
+#endif // __OPTIMIZE_H__
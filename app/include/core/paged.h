@@ -0,0 +1,135 @@
+#ifndef __PAGED_H__
+#define __PAGED_H__
+
+#include "cglm/cglm.h"
+#include "core/progress.h"
+#include "engine/file.h"
+#include "engine/shader.h"
+#include "engine/thread.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAGED_PAGE_TRIANGLES 32768           // most a page holds, the size of one gpu slot
+#define PAGED_GPU_BUDGET ((size_t)512 << 20) // slot memory of a paged model
+#define PAGED_MAX_INFLIGHT 8                 // pages the io thread reads ahead of the uploads
+#define PAGED_BASE_GRID 512                  // cells per side of the always resident coarse mesh
+#define PAGED_DETAIL_PIXELS 1.0f             // a page is wanted once a base cell covers this much
+
+// A page is a node of an octree over the triangle centroids, cut where its triangles fit a slot.
+// Its full triangles are streamed in on demand, the base triangles clustered from them stand in
+// for it otherwise.
+typedef struct {
+    float    center[3];
+    float    radius;
+    uint64_t first_triangle;
+    uint32_t triangle_count;
+    uint32_t base_count;
+    uint64_t first_base;
+} paged_page_t;
+
+typedef enum {
+    PAGED_IDLE,
+    PAGED_BUILDING, // writing the page file on the builder thread
+    PAGED_READY,
+    PAGED_FAILED,
+} paged_state_t;
+
+typedef enum {
+    PAGED_REQUEST_FREE,
+    PAGED_REQUEST_QUEUED,
+    PAGED_REQUEST_READING,
+    PAGED_REQUEST_DONE,
+} paged_request_state_t;
+
+// A page on its way from the file into a slot, read by the io thread into its own staging
+typedef struct {
+    int       state;
+    int       page;
+    int       slot;
+    long long sequence; // the io thread reads the oldest first
+    float*    staging;
+} paged_request_t;
+
+// A visible page and how far its base is off on screen
+typedef struct {
+    int   page;
+    float pixels;
+} paged_rank_t;
+
+// A model too large for host memory. Its triangles live in a page file built once per source
+// file, a fixed gpu budget holds the pages closest to the camera and least recently wanted ones
+// make room for new ones.
+typedef struct {
+    char*                 source_path;
+    char*                 paged_path;
+    atomic_int            state;
+    thread_t              builder;
+    load_progress_t       progress;
+    file_map_t            map;
+    const paged_page_t*   pages;
+    const float*          triangles; // nine floats each, in page order
+    const float*          base;
+    int                   page_count;
+    long long             triangle_count;
+    long long             base_count;
+    float                 min_vertex[3]; // in the space of the stored positions
+    float                 max_vertex[3];
+    float                 base_cell; // edge of a base cell, what a base triangle may be off by
+    float                 position[3];
+    mat4                  model; // placement * unit size, stored positions to world
+    int*                  page_slot; // -1 while a page only has its base
+    bool*                 page_loading;
+    long long*            page_used; // frame the page was last wanted, the lru order
+    int*                  slot_page; // -1 for free slots
+    int                   slot_count;
+    size_t                gpu_budget;
+    long long             frame;
+    thread_t              io;
+    pthread_mutex_t       lock;
+    pthread_cond_t        wake;
+    bool                  stopping; // under lock
+    paged_request_t       requests[PAGED_MAX_INFLIGHT];
+    long long             next_sequence;
+    shader_t              shader;
+    unsigned int          slot_vao;
+    unsigned int          slot_buffer;
+    unsigned int          base_vao;
+    unsigned int          base_buffer;
+    int*                  firsts; // multi draw lists of one render
+    int*                  counts;
+    paged_rank_t*         ranking;
+    mat4                  view; // of the last residency pass
+    mat4                  projection;
+    bool                  pending; // wanted pages are still waiting for a slot or a request
+    int                   resident_count;
+    size_t                streamed_bytes;
+    long long             drawn_triangles; // submitted by the last render
+} paged_model_t;
+
+// True for a binary STL or OBJ file larger than a quarter of physical memory, those are opened
+// paged instead of through the loader
+bool paged_wanted(const char* source_path);
+
+// Writes the page file of a binary STL or OBJ file, temporary files go next to it
+bool paged_build(const char* source_path, const char* paged_path, load_progress_t* progress);
+
+void paged_init(paged_model_t* paged);
+// Opens the page file of source_path, building it on a thread of its own first unless the one at
+// paged_path is current. position is the placement of the unit sized model.
+bool paged_open(paged_model_t* paged, const char* source_path, const char* paged_path, vec3 position);
+void paged_close(paged_model_t* paged);
+
+// Finishes the build, uploads the pages the io thread read and picks the pages to stream next.
+// Returns true when the frame should be drawn again.
+bool paged_update(paged_model_t* paged, mat4 view, mat4 projection, int viewport_height);
+void paged_render(paged_model_t* paged, mat4 view, mat4 projection);
+
+bool paged_is_loaded(const paged_model_t* paged);
+// The build or pages still need polling
+bool paged_is_busy(paged_model_t* paged);
+
+#endif // __PAGED_H__
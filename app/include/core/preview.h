@@ -0,0 +1,60 @@
+#ifndef __PREVIEW_H__
+#define __PREVIEW_H__
+
+#include "cglm/cglm.h"
+#include "core/progress.h"
+#include "engine/shader.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define PREVIEW_MIN_FILE_SIZE ((size_t)32 << 20) // smaller files parse before a preview would show
+#define PREVIEW_TRIANGLES (1 << 21)              // most triangles a preview holds, larger files are sampled
+#define PREVIEW_POINTS (1 << 20)                 // most vertices drawn while no face has been read
+
+// Part of the file the parser got through, positions relative to the first vertex of the file
+typedef struct preview_batch_s {
+    float*                  triangles; // nine floats each
+    float*                  points;
+    int                     triangle_count;
+    int                     point_count;
+    float                   min[3]; // of every vertex of the part, not only the sampled ones
+    float                   max[3];
+    struct preview_batch_s* next;
+} preview_batch_t;
+
+// Batches the loader thread published and the render thread did not take yet
+struct load_preview_s {
+    _Atomic(preview_batch_t*) batches; // newest first
+};
+
+// The partial model on the render thread. Its buffers grow with every batch and it is drawn
+// at unit size from the bounds read so far, so it settles as the parse goes on.
+typedef struct {
+    shader_t     shader;
+    unsigned int triangle_vao;
+    unsigned int triangle_buffer;
+    unsigned int point_vao;
+    unsigned int point_buffer;
+    int          triangle_count;
+    int          triangle_capacity;
+    int          point_count;
+    int          point_capacity;
+    float        min[3];
+    float        max[3];
+} preview_t;
+
+void             preview_publish(load_preview_t* source, preview_batch_t* batch);
+preview_batch_t* preview_take(load_preview_t* source);
+void             preview_batch_free(preview_batch_t* batch);
+// Frees what was published and not taken
+void             preview_discard(load_preview_t* source);
+
+void preview_init(preview_t* preview);
+// Uploads every batch published since the last call, true when there was one
+bool preview_update(preview_t* preview, load_preview_t* source);
+void preview_render(preview_t* preview, vec3 position);
+void preview_clear(preview_t* preview);
+bool preview_is_loaded(const preview_t* preview);
+
+#endif // __PREVIEW_H__
@@ -0,0 +1,35 @@
+#ifndef __PROGRESS_H__
+#define __PROGRESS_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct load_preview_s load_preview_t; // see core/preview.h
+
+// Shared between a loader thread and the render thread
+typedef struct {
+    atomic_size_t   bytes_done;
+    atomic_size_t   bytes_total;
+    atomic_bool     cancel;
+    load_preview_t* preview; // set when the reader should publish what it parsed so far
+} load_progress_t;
+
+static inline void progress_reset(load_progress_t* p, size_t total)
+{
+    atomic_store(&p->bytes_done, 0);
+    atomic_store(&p->bytes_total, total);
+    atomic_store(&p->cancel, false);
+}
+
+static inline void progress_add(load_progress_t* p, size_t bytes)
+{
+    if (p) atomic_fetch_add(&p->bytes_done, bytes);
+}
+
+static inline bool progress_cancelled(load_progress_t* p)
+{
+    return p && atomic_load(&p->cancel);
+}
+
+#endif // __PROGRESS_H__
@@ -1,30 +1,71 @@
 #ifndef __SCENE_H__
 #define __SCENE_H__
 
+#include "core/batch.h"
 #include "core/grid.h"
+#include "core/loader.h"
 #include "core/model.h"
+#include "core/paged.h"
+#include "core/preview.h"
 #include "engine/orbit.h"
 
 #include <stdbool.h>
 
+#define SCENE_SAMPLES 4              // msaa of the cached frame, the window itself has none
+#define SCENE_PLACEMENT_SPACING 2.5f // distance between placements, models are normalized to unit size
+
 typedef struct {
-    char*       modelpath;
-    orbit_cam_t camera;
-    grid_t      grid;
-    gpu_model_t gpu_model;
-    int         window_height;
-    int         window_width;
-    float       model_size;
-    mat4        projection;
-    bool        dirty;
+    orbit_cam_t     camera;
+    grid_t          grid;
+    batch_t         batch;
+    paged_model_t   paged;   // at most one model too large for memory, streamed in pages
+    preview_t       preview; // the model the loader is parsing, drawn until it is delivered
+    loader_t        loader;
+    char**          queue; // paths waiting for the loader, it loads one at a time
+    int             queue_count;
+    int             queue_capacity;
+    char**          drops; // one per extra placement of a file dropped again while it was still loading
+    int             drop_count;
+    int             drop_capacity;
+    int             placement_count; // slots taken on the placement spiral
+    vertex_format_t vertex_format;
+    bool            optimize_meshes;
+    int             window_height;
+    int             window_width;
+    mat4            projection;
+    mat4            screen;       // pixel space projection for 2d drawing, origin top left
+    bool            dirty;        // the cached frame is stale, set by anything that moves the view
+    unsigned int    frame_fbo;    // last rendered model frame, overlay only frames just resolve it
+    unsigned int    frame_color;
+    unsigned int    frame_depth;
+    int             frame_width;
+    int             frame_height;
 } scene_t;
 
 struct nk_context;
 
 void scene_init(scene_t* scene, int width, int height);
 void scene_unload(scene_t* scene);
+
+// Queues a file for loading, a file that is already in the scene gets another instance instead.
+// A file still queued or loading gets its extra instance once it is in. Files larger than memory
+// are paged instead, see paged_wanted.
 void scene_load_model(scene_t* scene, const char* modelpath);
 
+// Removes every model and stops loading
+void scene_clear(scene_t* scene);
+
+// Picks the reader from the first bytes of the file, the extension only breaks ties
+const model_reader_t* scene_sniff_reader(const char* modelpath);
+// Loads every model again with the current format and settings, instances stay where they are
+void scene_reload_model(scene_t* scene);
+void scene_update(scene_t* scene);
+
+// Takes ownership of an uploaded model. It replaces the model loaded from the same path, a new
+// path gets its first instance on the next free placement.
+void scene_set_model(scene_t* scene, gpu_model_t model, const char* modelpath);
+
+// Redraws the model only when dirty, then resolves the cached frame into the bound framebuffer
 void scene_render(scene_t* scene);
 
 void scene_resize(scene_t* scene, int width, int height);
@@ -32,5 +73,9 @@ void scene_handle_mouse_scroll(scene_t* scene, int yoff);
 void scene_handle_mouse_move(scene_t* scene, float dx, float dy);
 
 bool scene_is_loaded(scene_t* scene);
+bool scene_is_loading(scene_t* scene);
+
+// The loader still needs polling, this includes writing the cache after the model is shown
+bool scene_is_busy(scene_t* scene);
 
 #endif // __SCENE_H__
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include "core/model.h"
+
+#include <stdbool.h>
+
+#define SIMPLIFY_LOD_RATIO 4        // triangles of a level per triangle of the next coarser one
+#define SIMPLIFY_MIN_TRIANGLES 1024 // no level gets smaller than this
+
+// Builds up to MODEL_MAX_LODS - 1 coarser levels by quadric error edge collapse and appends their
+// indices behind the full level, see model_t.lods. A collapse moves a vertex onto a neighbour, so
+// every level shares the vertices of the full one. Models too small for a coarser level just get
+// the full one. Runs after model_build_meshlets and model_optimize, which only touch the full level.
+bool model_build_lods(model_t* model);
+
+#endif // __SIMPLIFY_H__
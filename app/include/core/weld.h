@@ -0,0 +1,39 @@
+#ifndef __WELD_H__
+#define __WELD_H__
+
+#include "core/model.h"
+
+#include <stdbool.h>
+
+#define WELD_NONE 0xffffffffu
+
+// Face corners indexing separate position, texcoord and normal pools the way OBJ does.
+// Positions are either doubles or float xyz read in place from fixed size records (STL),
+// position i then lives at records + i / record_positions * record_stride + i % record_positions * 12.
+typedef struct {
+    const double*       positions; // xyz per position, NULL to read from records
+    const char*         records;
+    size_t              record_stride;
+    int                 record_positions;
+    const float*        texcrds; // uv per texcoord, may be NULL
+    const float*        normals; // xyz per normal, may be NULL
+    const unsigned int* indices; // position per corner, NULL when corner i uses position i
+    const unsigned int* attribs; // texcoord and normal per corner or WELD_NONE, may be NULL
+    int                 position_count;
+    int                 texcrd_count;
+    int                 normal_count;
+    int                 corner_count;
+} weld_input_t;
+
+// Builds one vertex per distinct position/normal/uv tuple. With epsilon > 0 positions
+// closer than epsilon are merged through a spatial hash grid, otherwise they must match exactly.
+// When some corners have no normal the supplied ones are dropped, the model comes out without
+// normals so they get generated for every face.
+bool weld_model(model_t* out, const weld_input_t* in, double epsilon);
+
+// Numbers the distinct positions of a model's vertices, vertices that only differ in their normals
+// or uvs share one. canon gets the position of every vertex and rep one vertex per position, both
+// need room for a slot per vertex. Returns the position count, -1 when out of memory.
+int weld_positions(const model_t* model, unsigned int* canon, unsigned int* rep);
+
+#endif // __WELD_H__
@@ -0,0 +1,44 @@
+#ifndef __ENGINE_ARENA_H__
+#define __ENGINE_ARENA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARENA_RESERVE (64ull << 30) // address space per arena, pages are only backed once touched
+#define ARENA_ALIGN 64              // every allocation starts on a cache line
+
+// A linear allocator over one reserved mapping. Allocations are released together by rolling
+// back to a mark, so a stage takes a mark, allocates its scratch and releases it on the way out.
+// Not thread safe, each thread has its own scratch arena.
+typedef struct {
+    char*  base;
+    size_t reserved;
+    size_t used;
+    size_t committed; // backed so far, a release past ARENA_KEEP hands the rest back
+    size_t clean;     // bytes from here on were never handed out and are still zero
+    size_t peak;      // most it had committed at once
+} arena_t;
+
+typedef size_t arena_mark_t;
+
+// Every live arena together
+typedef struct {
+    int    arena_count;
+    size_t committed;
+    size_t peak; // most any single arena had committed, the loader's scratch sets it on big imports
+} arena_stats_t;
+
+bool  arena_init(arena_t* arena, size_t reserve);
+void  arena_free(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t bytes);
+void* arena_calloc(arena_t* arena, size_t count, size_t size);
+
+arena_mark_t arena_mark(const arena_t* arena);
+void         arena_release(arena_t* arena, arena_mark_t mark);
+
+// The calling thread's scratch arena, mapped on first use and unmapped when the thread exits.
+// The loader runs every import on a thread of its own, so its scratch lives for one load.
+arena_t* arena_scratch(void);
+void     arena_stats(arena_stats_t* stats);
+
+#endif // __ENGINE_ARENA_H__
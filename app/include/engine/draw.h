@@ -3,7 +3,7 @@
 
 #include "cglm/cglm.h"
 
-void draw_init(int screen_width, int screen_height);
+void draw_init();
 void draw_flush();
 void draw_cleanup();
 
@@ -1,7 +1,29 @@
-
 #ifndef __ENGINE_FILE_H__
 #define __ENGINE_FILE_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    const char* data;
+    size_t      size;
+#ifdef _WIN32
+    void* file_handle;
+    void* mapping_handle;
+#endif
+} file_map_t;
+
+typedef void (*file_visit_fn)(const char* filepath, size_t size, long long mtime, void* userdata);
+
 char* file_read_bytes(const char* filepath, long* bytes_read);
 
-#endif // __ENGINE_FILE_H__
\ No newline at end of file
+bool  file_stat(const char* filepath, size_t* size, long long* mtime);
+bool  file_touch(const char* filepath);
+bool  file_create_directories(const char* path);
+void  file_list_directory(const char* path, file_visit_fn visit, void* userdata);
+char* file_canonical_path(const char* filepath);
+
+bool file_map(const char* filepath, file_map_t* map);
+void file_unmap(file_map_t* map);
+
+#endif // __ENGINE_FILE_H__
@@ -0,0 +1,50 @@
+#ifndef __ENGINE_JOBS_H__
+#define __ENGINE_JOBS_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define JOBS_MAX_WORKERS 63 // pool threads, the thread waiting on a job is the other one
+
+typedef void (*job_fn)(void* userdata, int index);
+
+struct job_node_s;
+
+// Jobs still to finish. Jobs queued with jobs_run_after start once it reaches zero. A counter
+// is good for one batch, initialize it again before reusing it.
+typedef struct {
+    atomic_int                  pending;
+    atomic_int                  finishing; // jobs still releasing the counter, it has to outlive them
+    _Atomic(struct job_node_s*) waiting;
+} job_counter_t;
+
+// Starts the shared pool with worker_count threads, 0 picks one per core besides the caller.
+// The first job starts it with the default, so calling this is only needed for another count.
+void jobs_init(int worker_count);
+// Finishes the queued jobs and stops the workers, jobs queued afterwards run on the caller
+void jobs_shutdown(void);
+int  jobs_worker_count(void);
+
+void jobs_counter_init(job_counter_t* counter);
+
+// Queues fn(userdata, index) on the pool. A worker pushes onto its own deque and the others
+// steal from it, any other thread queues onto the shared one. counter may be NULL.
+void jobs_run(job_fn fn, void* userdata, int index, job_counter_t* counter);
+
+// Queues the job once after reached zero, its jobs must be queued already. counter counts it
+// from now on, so waiting on it covers the dependency too.
+void jobs_run_after(job_counter_t* after, job_fn fn, void* userdata, int index, job_counter_t* counter);
+
+// Runs queued jobs until the counter reaches zero and sleeps when there are none, so it is safe
+// to wait from inside a job. Once it returns no job touches the counter anymore, it may go.
+void jobs_wait(job_counter_t* counter);
+
+// Calls fn for every index below count and returns once all are done, the caller takes index 0
+void jobs_parallel_for(int count, job_fn fn, void* userdata);
+
+// Queues fn for the thread owning the gl context, which picks it up in jobs_run_main
+void jobs_post_main(job_fn fn, void* userdata, int index);
+// Runs the jobs posted for the main thread so far, returns how many ran
+int jobs_run_main(void);
+
+#endif // __ENGINE_JOBS_H__
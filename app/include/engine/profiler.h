@@ -0,0 +1,53 @@
+#ifndef __ENGINE_PROFILER_H__
+#define __ENGINE_PROFILER_H__
+
+#include <stdbool.h>
+
+#define PROFILER_MAX_EVENTS (1 << 16) // zones kept for the trace, the oldest ones are overwritten
+#define PROFILER_HISTORY 240          // frames the rolling stats cover
+#define PROFILER_GPU_FRAMES 4         // frames a gpu query gets to finish before its slot is reused
+#define PROFILER_GPU_ZONES 8          // gpu zones per frame, more are not timed
+
+// A cpu zone in flight, it is recorded when it ends
+typedef struct {
+    const char* name;
+    double      start;
+} profiler_zone_t;
+
+typedef struct {
+    int         frame_count; // frames in the history
+    double      frame_p50;   // cpu milliseconds from frame begin to end
+    double      frame_p95;
+    double      frame_p99;
+    int         gpu_count;
+    const char* gpu_names[PROFILER_GPU_ZONES];
+    double      gpu_ms[PROFILER_GPU_ZONES]; // of the last frame whose queries finished
+} profiler_stats_t;
+
+// Starts recording, gpu zones need the calling thread's gl context. Until then every call is a no-op.
+void profiler_init(void);
+void profiler_shutdown(void);
+
+// Names the calling thread's track in the trace
+void profiler_name_thread(const char* name);
+
+// Brackets a frame on the render thread, the end also collects the gpu queries that finished
+void profiler_frame_begin(void);
+void profiler_frame_end(void);
+
+// Scoped cpu zone, usable from any thread. The name has to outlive the profiler.
+profiler_zone_t profiler_begin(const char* name);
+void            profiler_end(const profiler_zone_t* zone);
+
+// Times the gl commands in between with a GL_TIME_ELAPSED query, read back frames later so it
+// never stalls. These queries can't nest, a begin inside another gpu zone is ignored.
+void profiler_gpu_begin(const char* name);
+void profiler_gpu_end(void);
+
+void profiler_stats(profiler_stats_t* stats);
+
+// Writes the recorded zones as Chrome trace json, chrome://tracing and Perfetto open it. Gpu zones
+// get their own track and start where the cpu issued them.
+bool profiler_write_trace(const char* path);
+
+#endif // __ENGINE_PROFILER_H__
@@ -1,8 +1,38 @@
 #ifndef __ENGINE_SHADER_H__
 #define __ENGINE_SHADER_H__
 
+#include "cglm/cglm.h"
 #include "glad/glad.h"
 
+#include <stdbool.h>
+
+#define SHADER_MAX_UNIFORMS 16
+#define SHADER_CAMERA_BINDING 0 // uniform buffer binding of the camera block
+
+// Declares the shared camera block, any program that includes it reads the matrices of
+// shader_camera_update without per program uploads
+#define SHADER_CAMERA_BLOCK                                                                                           \
+    "layout (std140) uniform Camera {\n"                                                                              \
+    "    mat4 uProj;\n"                                                                                               \
+    "    mat4 uView;\n"                                                                                               \
+    "    mat4 uScreen;\n"                                                                                             \
+    "};\n"
+
+// A linked program with the locations of the uniforms its user asked for, resolved once at
+// link time so drawing never looks a uniform up by name
+typedef struct {
+    GLuint program;
+    GLint  locations[SHADER_MAX_UNIFORMS]; // in the order of the names, -1 for unused uniforms
+} shader_t;
+
 GLuint load_shader_program(const char* vs_source, const char* fs_source);
 
-#endif // __ENGINE_SHADER_H__
\ No newline at end of file
+bool shader_create(shader_t* shader, const char* vs_source, const char* fs_source, const char* const* uniforms,
+                   int uniform_count);
+void shader_destroy(shader_t* shader);
+
+// Uploads the camera block once per change, screen is the pixel space projection for 2d drawing
+void shader_camera_update(mat4 proj, mat4 view, mat4 screen);
+void shader_camera_destroy(void);
+
+#endif // __ENGINE_SHADER_H__
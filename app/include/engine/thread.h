@@ -0,0 +1,17 @@
+#ifndef __ENGINE_THREAD_H__
+#define __ENGINE_THREAD_H__
+
+typedef void (*thread_task_fn)(void* userdata, int index);
+
+// A single long running thread, the task is called with index 0
+typedef struct thread_s* thread_t;
+
+int thread_count(void);
+// Runs task for every index below count on the shared job pool and waits for all of them,
+// see jobs_parallel_for. Tasks may call it again, the waiting thread runs queued jobs meanwhile.
+void thread_parallel(int count, thread_task_fn task, void* userdata);
+
+thread_t thread_spawn(thread_task_fn task, void* userdata);
+void     thread_join(thread_t thread);
+
+#endif // __ENGINE_THREAD_H__
@@ -0,0 +1,7 @@
+#ifndef __ENGINE_TIMER_H__
+#define __ENGINE_TIMER_H__
+
+// Monotonic time in seconds, usable from any thread
+double timer_now(void);
+
+#endif // __ENGINE_TIMER_H__
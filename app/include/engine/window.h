@@ -25,7 +25,8 @@ static GLFWwindow* create_window(const char* title, int width, int height)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    // The scene renders multisampled into its own frame buffer and resolves it into the window
+    glfwWindowHint(GLFW_SAMPLES, 0);
     glfwWindowHint(GLFW_RESIZABLE, 1);
     window = glfwCreateWindow(width, height, title, NULL, NULL);
 
@@ -36,6 +37,9 @@ static GLFWwindow* create_window(const char* title, int width, int height)
 
     glfwMakeContextCurrent(window);
 
+    // Frames that do get drawn are paced by the display instead of spinning
+    glfwSwapInterval(1);
+
 #ifdef _WIN32
     HWND hwnd  = glfwGetWin32Window(window);
     BOOL value = TRUE;
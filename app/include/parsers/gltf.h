@@ -0,0 +1,16 @@
+#ifndef __PARSER_GLTF_H__
+#define __PARSER_GLTF_H__
+
+#include "core/model.h"
+#include "core/progress.h"
+
+#include <stddef.h>
+
+// Binary glTF by its magic, text glTF by a leading object with an asset member
+bool gltf_detect(const char* head, size_t head_size);
+
+// Imports every mesh of the default scene. Accessors are handed to the gpu as they sit in the
+// file, the packed model keeps the buffers mapped until it is freed.
+bool parse_gltf(packed_model_t* packed, const char* filepath, load_progress_t* progress);
+
+#endif // __PARSER_GLTF_H__
@@ -0,0 +1,50 @@
+#ifndef __PARSER_JSON_H__
+#define __PARSER_JSON_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    JSON_NULL,
+    JSON_FALSE,
+    JSON_TRUE,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} json_type_t;
+
+// Values in document order, an object member is its key token followed by the value
+typedef struct {
+    json_type_t type;
+    size_t      start; // byte range in the text, strings without their quotes
+    size_t      end;
+    int         children; // array elements or object members
+    int         next;     // token after the whole value
+} json_token_t;
+
+// Tokens point into text, which has to outlive the document
+typedef struct {
+    const char*   text;
+    json_token_t* tokens;
+    int           count;
+    int           capacity;
+} json_t;
+
+bool json_parse(json_t* json, const char* text, size_t size);
+void json_free(json_t* json);
+
+// Lookups take and return token indices, -1 for missing values, so calls can be chained.
+// Arrays are walked with json_first and json_next, bounded by json_count.
+int  json_find(const json_t* json, int object, const char* key);
+int  json_count(const json_t* json, int token);
+int  json_first(const json_t* json, int array);
+int  json_next(const json_t* json, int element);
+bool json_is(const json_t* json, int token, const char* string);
+
+double json_number(const json_t* json, int token, double fallback);
+int    json_int(const json_t* json, int token, int fallback);
+bool   json_bool(const json_t* json, int token, bool fallback);
+bool   json_string(const json_t* json, int token, char* out, size_t size);
+
+#endif // __PARSER_JSON_H__
@@ -2,7 +2,25 @@
 #define __PARSER_OBJ_H__
 
 #include "core/model.h"
+#include "core/progress.h"
 
-void parse_obj(model_t* model, const char* filepath);
+#include <stddef.h>
+#include <stdio.h>
+
+// What obj_stream wrote
+typedef struct {
+    double origin[3]; // the first vertex, positions are relative to it
+    double min[3];
+    double max[3];
+    size_t vertex_count;
+    size_t triangle_count;
+} obj_stream_t;
+
+bool parse_obj(model_t* model, const char* filepath, load_progress_t* progress);
+
+// Streams a file too large to parse whole. Positions go to positions as float triples relative
+// to the origin, faces are fanned into uint32 index triples in triangles. Texture coordinates,
+// normals and faces referencing vertices defined later are dropped.
+bool obj_stream(const char* filepath, FILE* positions, FILE* triangles, obj_stream_t* out, load_progress_t* progress);
 
 #endif // __PARSER_OBJ_H__
\ No newline at end of file
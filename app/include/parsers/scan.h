@@ -0,0 +1,135 @@
+#ifndef __PARSERS_SCAN_H__
+#define __PARSERS_SCAN_H__
+
+// Number scanning shared by the text parsers, all functions work on bounded, non terminated ranges
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static const double _scan_pow10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static inline int scan_is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline int scan_is_digit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+static inline const char* scan_skip_blank(const char* p, const char* end)
+{
+    while (p < end && scan_is_blank(*p)) p++;
+    return p;
+}
+
+// strtod on a bounded copy, used for everything the fast path can't represent exactly
+static inline const char* _scan_double_slow(const char* p, const char* end, double* out)
+{
+    char   buf[64];
+    size_t len = 0;
+    while (p + len < end && len < sizeof(buf) - 1 && !scan_is_blank(p[len])) {
+        buf[len] = p[len];
+        len++;
+    }
+    buf[len] = '\0';
+
+    char*  stop;
+    double value = strtod(buf, &stop);
+    if (stop == buf) return NULL;
+
+    *out = value;
+    return p + (stop - buf);
+}
+
+// Scans a double the way "%lf" does. Decimal input whose digits fit in a mantissa of at most
+// 2^53 with a decimal exponent within +-22 is converted with a single correctly rounded
+// operation, which yields the same bits as strtod. Everything else goes through strtod.
+static inline const char* scan_double(const char* p, const char* end, double* out)
+{
+    p = scan_skip_blank(p, end);
+    if (p >= end) return NULL;
+
+    const char* start = p;
+    int         neg   = 0;
+
+    if (*p == '-' || *p == '+') {
+        neg = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int      digits   = 0; // significant digits
+    int      seen     = 0; // any digits at all
+    int      exponent = 0;
+
+    while (p < end && scan_is_digit(*p)) {
+        if (mantissa || *p != '0') {
+            if (digits >= 19) return _scan_double_slow(start, end, out);
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            digits++;
+        }
+        seen = 1;
+        p++;
+    }
+
+    // Hex floats, inf and nan
+    if (p < end && (*p == 'x' || *p == 'X' || *p == 'i' || *p == 'I' || *p == 'n' || *p == 'N')) {
+        return _scan_double_slow(start, end, out);
+    }
+
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && scan_is_digit(*p)) {
+            if (mantissa || *p != '0') {
+                if (digits >= 19) return _scan_double_slow(start, end, out);
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits++;
+            }
+            exponent--;
+            seen = 1;
+            p++;
+        }
+    }
+
+    if (!seen) return _scan_double_slow(start, end, out);
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* e       = p + 1;
+        int         eneg    = 0;
+        int         evalue  = 0;
+        int         edigits = 0;
+
+        if (e < end && (*e == '-' || *e == '+')) {
+            eneg = *e == '-';
+            e++;
+        }
+        while (e < end && scan_is_digit(*e)) {
+            if (evalue < 10000) evalue = evalue * 10 + (*e - '0');
+            edigits++;
+            e++;
+        }
+
+        if (edigits) {
+            exponent += eneg ? -evalue : evalue;
+            p = e;
+        }
+    }
+
+    double value;
+    if (mantissa == 0) {
+        value = 0.0;
+    } else if (mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        value = (double)mantissa;
+        value = exponent < 0 ? value / _scan_pow10[-exponent] : value * _scan_pow10[exponent];
+    } else {
+        return _scan_double_slow(start, end, out);
+    }
+
+    *out = neg ? -value : value;
+    return p;
+}
+
+#endif // __PARSERS_SCAN_H__
@@ -0,0 +1,24 @@
+#ifndef __PARSER_STL_H__
+#define __PARSER_STL_H__
+
+#include "core/model.h"
+#include "core/progress.h"
+
+#include <stddef.h>
+
+#define STL_HEADER_SIZE 84 // 80 byte comment and the triangle count
+#define STL_RECORD_SIZE 50 // facet normal, three vertices and the attribute word
+
+typedef enum {
+    STL_NONE,
+    STL_BINARY,
+    STL_ASCII,
+} stl_kind_t;
+
+// Tells the STL flavour from the first bytes and the file size. Binary files may start with
+// "solid" as well, so a record count that matches the size wins over the keyword.
+stl_kind_t stl_detect(const char* head, size_t head_size, size_t file_size);
+
+bool parse_stl(model_t* model, const char* filepath, load_progress_t* progress);
+
+#endif // __PARSER_STL_H__
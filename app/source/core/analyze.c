@@ -0,0 +1,261 @@
+#include "core/analyze.h"
+
+#include "core/weld.h"
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <math.h>
+#include <string.h>
+
+#define ANALYZE_MIN_PARALLEL (1 << 16) // triangles below this are measured on the calling thread
+#define ANALYZE_DEGENERATE 0x80        // triangle flag next to the open edge bits 0 to 2
+
+// Per task sums, merged once every task is done
+typedef struct {
+    double area;
+    double volume;
+    double area_moment[3];   // area weighted triangle centroids
+    double volume_moment[3]; // volume weighted centroids of the tetrahedra to the center
+    int    degenerate_count;
+    int    boundary_edges;
+    int    non_manifold_edges;
+} _analyze_sums_t;
+
+typedef struct {
+    const model_t*      model;
+    double              center[3]; // positions are taken relative to it for precision
+    const unsigned int* canon;
+    int                 tri_count;
+    int*                adj_start; // position -> triangles around it, degenerate ones left out
+    unsigned int*       adj;
+    unsigned char*      flags; // per triangle
+    _analyze_sums_t*    sums;
+    int                 task_count;
+} _analyze_job_t;
+
+static inline void _task_range(const _analyze_job_t* job, int index, int* first, int* last)
+{
+    *first = (int)((long long)job->tri_count * index / job->task_count);
+    *last  = (int)((long long)job->tri_count * (index + 1) / job->task_count);
+}
+
+static void _measure_task(void* userdata, int index)
+{
+    _analyze_job_t*  job = userdata;
+    _analyze_sums_t* sum = &job->sums[index];
+    const model_t*   m   = job->model;
+
+    int first, last;
+    _task_range(job, index, &first, &last);
+
+    for (int t = first; t < last; t++) {
+        const unsigned int* tri = &m->indices[(size_t)t * 3];
+
+        double p[3][3];
+        for (int k = 0; k < 3; k++) {
+            for (int c = 0; c < 3; c++) p[k][c] = m->vertices[(size_t)tri[k] * 3 + c] - job->center[c];
+        }
+
+        double e1[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+        double e2[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+        double n[3]  = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+
+        unsigned int a = job->canon[tri[0]], b = job->canon[tri[1]], c = job->canon[tri[2]];
+        double       area = 0.5 * sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        if (area <= 0.0 || a == b || b == c || a == c) {
+            job->flags[t] = ANALYZE_DEGENERATE;
+            sum->degenerate_count++;
+            continue;
+        }
+        job->flags[t] = 0;
+
+        // Signed volume of the tetrahedron to the center, a closed surface sums to what it encloses
+        double volume = (p[0][0] * (p[1][1] * p[2][2] - p[1][2] * p[2][1])
+                         + p[0][1] * (p[1][2] * p[2][0] - p[1][0] * p[2][2])
+                         + p[0][2] * (p[1][0] * p[2][1] - p[1][1] * p[2][0]))
+                      / 6.0;
+
+        sum->area   += area;
+        sum->volume += volume;
+        for (int k = 0; k < 3; k++) {
+            double s               = p[0][k] + p[1][k] + p[2][k];
+            sum->area_moment[k]   += area * s / 3.0;
+            sum->volume_moment[k] += volume * s / 4.0;
+        }
+    }
+}
+
+static void _edge_task(void* userdata, int index)
+{
+    _analyze_job_t*  job = userdata;
+    _analyze_sums_t* sum = &job->sums[index];
+
+    int first, last;
+    _task_range(job, index, &first, &last);
+
+    for (int t = first; t < last; t++) {
+        if (job->flags[t] & ANALYZE_DEGENERATE) continue;
+        const unsigned int* tri = &job->model->indices[(size_t)t * 3];
+
+        for (int k = 0; k < 3; k++) {
+            unsigned int a = job->canon[tri[k]], b = job->canon[tri[(k + 1) % 3]];
+
+            // Every triangle on the edge sees it, the lowest one counts it
+            int  users  = 0;
+            bool lowest = true;
+            for (int i = job->adj_start[a]; i < job->adj_start[a + 1]; i++) {
+                const unsigned int* other = &job->model->indices[(size_t)job->adj[i] * 3];
+                if (job->canon[other[0]] != b && job->canon[other[1]] != b && job->canon[other[2]] != b) continue;
+                users++;
+                lowest = lowest && job->adj[i] >= (unsigned int)t;
+            }
+
+            if (users == 1) {
+                job->flags[t] |= 1 << k;
+                sum->boundary_edges++;
+            } else if (users > 2 && lowest) {
+                sum->non_manifold_edges++;
+            }
+        }
+    }
+}
+
+static unsigned int _find(unsigned int* parent, unsigned int p)
+{
+    while (parent[p] != p) {
+        parent[p] = parent[parent[p]];
+        p         = parent[p];
+    }
+    return p;
+}
+
+// Open edges joined at their ends, each connected run is a loop around a hole
+static int _count_loops(const _analyze_job_t* job, int position_count, unsigned int* parent)
+{
+    const unsigned int none = 0xffffffffu;
+    for (int p = 0; p < position_count; p++) parent[p] = none;
+
+    int nodes = 0, unions = 0;
+    for (int t = 0; t < job->tri_count; t++) {
+        if (!(job->flags[t] & 0x7) || (job->flags[t] & ANALYZE_DEGENERATE)) continue;
+        const unsigned int* tri = &job->model->indices[(size_t)t * 3];
+
+        for (int k = 0; k < 3; k++) {
+            if (!(job->flags[t] & (1 << k))) continue;
+
+            unsigned int ends[2] = { job->canon[tri[k]], job->canon[tri[(k + 1) % 3]] };
+            for (int e = 0; e < 2; e++) {
+                if (parent[ends[e]] != none) continue;
+                parent[ends[e]] = ends[e];
+                nodes++;
+            }
+
+            unsigned int ra = _find(parent, ends[0]), rb = _find(parent, ends[1]);
+            if (ra == rb) continue;
+            parent[ra] = rb;
+            unions++;
+        }
+    }
+    return nodes - unions;
+}
+
+bool model_analyze(const model_t* m, model_stats_t* stats)
+{
+    double start = timer_now();
+    memset(stats, 0, sizeof(*stats));
+
+    int vertex_count = m->vertex_count / 3;
+    int tri_count    = (m->lod_count > 0 ? (int)m->lods[0].index_count : m->indice_count) / 3;
+
+    _analyze_job_t job = {
+        .model      = m,
+        .tri_count  = tri_count,
+        .task_count = tri_count > ANALYZE_MIN_PARALLEL ? thread_count() : 1,
+    };
+
+    arena_t*      arena = arena_scratch();
+    arena_mark_t  mark  = arena_mark(arena);
+    unsigned int* canon = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    unsigned int* rep   = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    job.canon           = canon;
+    job.adj             = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(unsigned int));
+    job.flags           = arena_alloc(arena, (size_t)tri_count);
+    job.sums            = arena_calloc(arena, job.task_count, sizeof(_analyze_sums_t));
+
+    bool ok             = false;
+    int  position_count = canon && rep ? weld_positions(m, canon, rep) : -1;
+    if (position_count < 0 || !job.adj || !job.flags || !job.sums) goto cleanup;
+
+    job.adj_start = arena_calloc(arena, (size_t)position_count + 1, sizeof(int));
+    if (!job.adj_start) goto cleanup;
+
+    model_get_bounds(m, stats->min, stats->max);
+    for (int c = 0; c < 3; c++) job.center[c] = vertex_count > 0 ? (stats->min[c] + stats->max[c]) * 0.5 : 0.0;
+
+    thread_parallel(job.task_count, _measure_task, &job);
+
+    // Triangles per position as a CSR list, the fill advances every start to the next one's
+    for (int t = 0; t < tri_count; t++) {
+        if (job.flags[t] & ANALYZE_DEGENERATE) continue;
+        for (int k = 0; k < 3; k++) job.adj_start[canon[m->indices[(size_t)t * 3 + k]] + 1]++;
+    }
+    for (int p = 0; p < position_count; p++) job.adj_start[p + 1] += job.adj_start[p];
+    for (int t = 0; t < tri_count; t++) {
+        if (job.flags[t] & ANALYZE_DEGENERATE) continue;
+        for (int k = 0; k < 3; k++) job.adj[job.adj_start[canon[m->indices[(size_t)t * 3 + k]]]++] = (unsigned int)t;
+    }
+    for (int p = position_count; p > 0; p--) job.adj_start[p] = job.adj_start[p - 1];
+    job.adj_start[0] = 0;
+
+    thread_parallel(job.task_count, _edge_task, &job);
+
+    _analyze_sums_t total = { 0 };
+    for (int i = 0; i < job.task_count; i++) {
+        const _analyze_sums_t* s = &job.sums[i];
+        total.area               += s->area;
+        total.volume             += s->volume;
+        total.degenerate_count   += s->degenerate_count;
+        total.boundary_edges     += s->boundary_edges;
+        total.non_manifold_edges += s->non_manifold_edges;
+        for (int c = 0; c < 3; c++) {
+            total.area_moment[c]   += s->area_moment[c];
+            total.volume_moment[c] += s->volume_moment[c];
+        }
+    }
+
+    stats->valid              = true;
+    stats->area               = total.area;
+    stats->volume             = total.volume;
+    stats->triangle_count     = tri_count;
+    stats->degenerate_count   = total.degenerate_count;
+    stats->boundary_edges     = total.boundary_edges;
+    stats->non_manifold_edges = total.non_manifold_edges;
+    stats->boundary_loops     = _count_loops(&job, position_count, rep); // rep is free again, it holds the sets
+
+    // Only a closed surface encloses a volume, an open one is balanced by its area instead
+    bool closed = total.boundary_edges == 0 && total.non_manifold_edges == 0 && total.volume != 0.0;
+    for (int c = 0; c < 3; c++) {
+        double offset = 0.0;
+        if (closed) {
+            offset = total.volume_moment[c] / total.volume;
+        } else if (total.area > 0.0) {
+            offset = total.area_moment[c] / total.area;
+        }
+        stats->centroid[c] = job.center[c] + offset;
+    }
+
+    log_info("Analyzed %d triangles [area: %.4g, volume: %.4g, degenerate: %d, boundary loops: %d, non-manifold "
+             "edges: %d] in %.1fms",
+             tri_count, stats->area, stats->volume, stats->degenerate_count, stats->boundary_loops,
+             stats->non_manifold_edges, (timer_now() - start) * 1000.0);
+    ok = true;
+
+cleanup:
+    if (!ok) log_error("Failed to allocate analysis buffers for %d triangles", tri_count);
+    arena_release(arena, mark);
+    return ok;
+}
@@ -0,0 +1,962 @@
+#include "core/batch.h"
+
+#include "core/meshlet.h"
+#include "engine/string.h"
+
+#include "glad/glad.h"
+#include "log.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_MIN_IDS 1024
+#define BATCH_LOD_PIXELS 1.0f // screen space error a level of detail may have
+
+// Every instance carries its full placement, dequantization and unit size normalization are
+// folded in on the cpu, so one program draws any model of its vertex format. The position
+// declaration is prepended per vertex format (see _position_decls).
+static const char* vs_source = "layout (location = 1) in vec3 aNormal;\n"
+                               "layout (location = 3) in uint aInstance;\n"
+                               "out vec3 FragPos;\n"
+                               "out vec3 LocalPos;\n"
+                               "out vec3 Normal;\n"
+                               "flat out int HasNormals;\n"
+                               "flat out uint FirstIndex;\n"
+                               "flat out int BaseVertex;\n"
+                               SHADER_CAMERA_BLOCK
+                               "struct Instance {\n"
+                               "    mat4 world;\n"
+                               "    mat3 normal;\n"
+                               "    vec4 params;\n"
+                               "};\n"
+                               "struct Draw {\n"
+                               "    uint instance;\n"
+                               "    uint firstIndex;\n"
+                               "    int baseVertex;\n"
+                               "    uint pad;\n"
+                               "};\n"
+                               "layout (std430, binding = 0) readonly buffer Instances {\n"
+                               "    Instance instances[];\n"
+                               "};\n"
+                               "layout (std430, binding = 1) readonly buffer Draws {\n"
+                               "    Draw draws[];\n"
+                               "};\n"
+                               "void main() {\n"
+                               "    Draw draw = draws[aInstance];\n"
+                               "    Instance instance = instances[draw.instance];\n"
+                               "    vec4 world = instance.world * vec4(vec3(aPos), 1.0);\n"
+                               "    gl_Position = uProj * uView * world;\n"
+                               "    FragPos = world.xyz;\n"
+                               "    LocalPos = vec3(aPos);\n"
+                               "    Normal = instance.normal * aNormal;\n"
+                               "    HasNormals = int(instance.params.x);\n"
+                               "    FirstIndex = draw.firstIndex;\n"
+                               "    BaseVertex = draw.baseVertex;\n"
+                               "}\n";
+
+// The outline modes read the corners of their triangle back from the pool and take the
+// barycentrics of the interpolated position, so no vertex is duplicated and no extra pass is
+// drawn. The switches are prepended per view mode and vertex format (see _shader_for).
+static const char* fs_source = "in vec3 FragPos;\n"
+                               "in vec3 LocalPos;\n"
+                               "in vec3 Normal;\n"
+                               "flat in int HasNormals;\n"
+                               "flat in uint FirstIndex;\n"
+                               "flat in int BaseVertex;\n"
+                               "out vec4 FragColor;\n"
+                               "#if OUTLINE\n"
+                               "layout (std430, binding = 2) readonly buffer Positions {\n"
+                               "    POSITION positions[];\n"
+                               "};\n"
+                               "layout (std430, binding = 3) readonly buffer Indices {\n"
+                               "    uint indices[];\n"
+                               "};\n"
+                               "layout (std430, binding = 4) readonly buffer Edges {\n"
+                               "    uint edges[];\n"
+                               "};\n"
+                               "vec3 corner(uint k) {\n"
+                               "    uint i = FirstIndex + 3u * uint(gl_PrimitiveID) + k;\n"
+                               "    uint v = uint(int(indices[i]) + BaseVertex);\n"
+                               "#if PACKED\n"
+                               "    // Four shorts per vertex, the last one is padding\n"
+                               "    uint xy = positions[2u * v];\n"
+                               "    return vec3(xy & 0xffffu, xy >> 16, positions[2u * v + 1u] & 0xffffu) / 65535.0;\n"
+                               "#else\n"
+                               "    return vec3(positions[3u * v], positions[3u * v + 1u], positions[3u * v + 2u]);\n"
+                               "#endif\n"
+                               "}\n"
+                               "// Coverage of the edges, each one is where the weight of the opposite corner is zero\n"
+                               "float outline() {\n"
+                               "    vec3 a = corner(0u), b = corner(1u), c = corner(2u);\n"
+                               "    vec3 e0 = b - a, e1 = c - a, d = LocalPos - a;\n"
+                               "    float d00 = dot(e0, e0), d01 = dot(e0, e1), d11 = dot(e1, e1);\n"
+                               "    float d20 = dot(d, e0), d21 = dot(d, e1);\n"
+                               "    float den = d00 * d11 - d01 * d01;\n"
+                               "    float inv = den > 0.0 ? 1.0 / den : 0.0;\n"
+                               "    float v = (d11 * d20 - d01 * d21) * inv;\n"
+                               "    float w = (d00 * d21 - d01 * d20) * inv;\n"
+                               "    vec3 bary = vec3(1.0 - v - w, v, w);\n"
+                               "    vec3 line = 1.0 - smoothstep(vec3(0.0), 1.5 * fwidth(bary), bary);\n"
+                               "#if FEATURES\n"
+                               "    // Bit 0 is ab, across from c, bit 1 bc and bit 2 ca\n"
+                               "    uint t = FirstIndex / 3u + uint(gl_PrimitiveID);\n"
+                               "    uint bits = edges[t >> 2] >> ((t & 3u) * 8u);\n"
+                               "    line *= vec3((bits >> 1) & 1u, (bits >> 2) & 1u, bits & 1u);\n"
+                               "#endif\n"
+                               "    return den > 0.0 ? max(line.x, max(line.y, line.z)) : 0.0;\n"
+                               "}\n"
+                               "#endif\n"
+                               "void main() {\n"
+                               "    // Face normal from derivatives only for draws without vertex normals\n"
+                               "    vec3 normal;\n"
+                               "    if (HasNormals != 0) {\n"
+                               "        normal = normalize(Normal);\n"
+                               "    } else {\n"
+                               "        normal = normalize(cross(dFdx(FragPos), dFdy(FragPos)));\n"
+                               "    }\n"
+                               "    vec3 lightDir = normalize(vec3(1.0, 10.0, -1.0));\n"
+                               "    float diff = max(dot(normal, lightDir), 0.0);\n"
+                               "    vec3 baseColor = vec3(0.8, 0.8, 0.8);\n"
+                               "    vec3 ambient = 0.2 * baseColor;\n"
+                               "    vec3 diffuse = diff * baseColor;\n"
+                               "    vec3 color = ambient + diffuse;\n"
+                               "#if OUTLINE\n"
+                               "    color = mix(color, vec3(1.0, 0.6, 0.1), outline());\n"
+                               "#endif\n"
+                               "    FragColor = vec4(color, 1.0);\n"
+                               "}\n";
+
+static const char* _position_decls[VERTEX_FORMAT_COUNT] = {
+    [VERTEX_FORMAT_F64]     = "#version 450 core\nlayout (location = 0) in dvec3 aPos;\n",
+    [VERTEX_FORMAT_F32]     = "#version 450 core\nlayout (location = 0) in vec3 aPos;\n",
+    [VERTEX_FORMAT_UNORM16] = "#version 450 core\nlayout (location = 0) in vec3 aPos;\n",
+};
+
+// Element type of the position pool as the outline modes read it
+static const char* _position_types[VERTEX_FORMAT_COUNT] = {
+    [VERTEX_FORMAT_F64]     = "double",
+    [VERTEX_FORMAT_F32]     = "float",
+    [VERTEX_FORMAT_UNORM16] = "uint",
+};
+
+static const char* _view_mode_names[VIEW_MODE_COUNT] = {
+    [VIEW_SHADED]    = "shaded",
+    [VIEW_WIREFRAME] = "wireframe",
+    [VIEW_EDGES]     = "edges",
+    [VIEW_POINTS]    = "points",
+};
+
+// std430 layout of Instance
+typedef struct {
+    float world[16];
+    float normal[12]; // mat3 columns padded to vec4
+    float params[4];  // x: the draw has vertex normals
+} _instance_t;
+
+typedef struct {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint  base_vertex;
+    GLuint base_instance;
+} _elements_command_t;
+
+typedef struct {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first;
+    GLuint base_instance;
+} _arrays_command_t;
+
+void batch_init(batch_t* b)
+{
+    memset(b, 0, sizeof(*b));
+    b->dirty = true;
+
+    // Open scans and single sided sheets would show holes, closed models opt in
+    b->backface_culling = false;
+}
+
+static void _bind_ids(const batch_t* b, unsigned int vao)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, b->id_buffer);
+    glVertexAttribIPointer(BATCH_INSTANCE_LOCATION, 1, GL_UNSIGNED_INT, 0, NULL);
+    glVertexAttribDivisor(BATCH_INSTANCE_LOCATION, 1);
+    glEnableVertexAttribArray(BATCH_INSTANCE_LOCATION);
+}
+
+// Grows the id buffer to cover count instances
+static bool _ensure_ids(batch_t* b, size_t count)
+{
+    if (count <= (size_t)b->id_capacity) return true;
+    if (count > INT_MAX) return false;
+
+    size_t capacity = (size_t)b->id_capacity * 2;
+    if (capacity < count) capacity = count;
+    if (capacity < BATCH_MIN_IDS) capacity = BATCH_MIN_IDS;
+    if (capacity > INT_MAX) capacity = INT_MAX;
+
+    unsigned int* ids = malloc(capacity * sizeof(unsigned int));
+    if (!ids) {
+        log_error("Failed to allocate %zu instance ids", capacity);
+        return false;
+    }
+    for (size_t i = 0; i < capacity; i++) ids[i] = (unsigned int)i;
+
+    bool created = !b->id_buffer;
+    if (created) glGenBuffers(1, &b->id_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, b->id_buffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(unsigned int), ids, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    free(ids);
+    b->id_capacity = (int)capacity;
+
+    // New storage keeps the buffer name, only vaos made before the buffer existed lack it
+    if (!created) return true;
+
+    for (int f = 0; f < VERTEX_FORMAT_COUNT; f++) {
+        if (b->pools[f].vao) _bind_ids(b, b->pools[f].vao);
+    }
+    for (int i = 0; i < b->model_count; i++) {
+        const gpu_model_t* g = &b->models[i].gpu;
+        for (int d = 0; d < g->draw_count; d++) _bind_ids(b, g->draws[d].vao);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+static unsigned int _buffer_create(size_t bytes)
+{
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes ? bytes : 1, NULL, GL_STATIC_DRAW);
+    return buffer;
+}
+
+static void _buffer_copy(unsigned int src, unsigned int dst, size_t src_offset, size_t dst_offset, size_t bytes)
+{
+    if (bytes == 0) return;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, src);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset, dst_offset, bytes);
+}
+
+static void _pool_bind(const batch_t* b, const batch_pool_t* pool, vertex_format_t format)
+{
+    glBindVertexArray(pool->vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, pool->positions);
+    if (format == VERTEX_FORMAT_F64) {
+        glVertexAttribLPointer(0, 3, GL_DOUBLE, vertex_format_stride(format), NULL);
+    } else if (format == VERTEX_FORMAT_UNORM16) {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, vertex_format_stride(format), NULL);
+    } else {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_format_stride(format), NULL);
+    }
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, pool->normals);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->indices);
+    if (b->id_buffer) _bind_ids(b, pool->vao);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Moves the pool into buffers of the given capacity. Ranges keep their order, everything behind
+// the removed model slides down over it, the caller fixes up the ranges of the models it moved.
+static bool _pool_rebuild(batch_t* b, vertex_format_t format, int vertex_capacity, int index_capacity,
+                          const batch_model_t* removed)
+{
+    batch_pool_t* pool   = &b->pools[format];
+    size_t        stride = vertex_format_stride(format);
+    size_t        normal = 3 * sizeof(float);
+    size_t        index  = sizeof(unsigned int);
+
+    // The edges hold a byte per triangle, padded to the words the edge mode reads them as
+    unsigned int positions = _buffer_create((size_t)vertex_capacity * stride);
+    unsigned int normals   = _buffer_create((size_t)vertex_capacity * normal);
+    unsigned int indices   = _buffer_create((size_t)index_capacity * index);
+    unsigned int edges     = _buffer_create(((size_t)index_capacity / 3 + 3) & ~(size_t)3);
+
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        log_error("OpenGL error 0x%x while growing the %s pool to %d vertices", err, vertex_format_name(format),
+                  vertex_capacity);
+        glDeleteBuffers(1, &positions);
+        glDeleteBuffers(1, &normals);
+        glDeleteBuffers(1, &indices);
+        glDeleteBuffers(1, &edges);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return false;
+    }
+
+    size_t vertex_start = pool->vertex_count, vertex_end = pool->vertex_count;
+    size_t index_start = pool->index_count, index_end = pool->index_count;
+    if (removed) {
+        vertex_start = removed->base_vertex;
+        vertex_end   = vertex_start + removed->gpu.vertex_count / 3;
+        index_start  = removed->first_index;
+        index_end    = index_start + gpu_model_index_count(&removed->gpu);
+    }
+
+    if (pool->vao) {
+        size_t vertex_tail = pool->vertex_count - vertex_end;
+        size_t index_tail  = pool->index_count - index_end;
+
+        _buffer_copy(pool->positions, positions, 0, 0, vertex_start * stride);
+        _buffer_copy(pool->positions, positions, vertex_end * stride, vertex_start * stride, vertex_tail * stride);
+        _buffer_copy(pool->normals, normals, 0, 0, vertex_start * normal);
+        _buffer_copy(pool->normals, normals, vertex_end * normal, vertex_start * normal, vertex_tail * normal);
+        _buffer_copy(pool->indices, indices, 0, 0, index_start * index);
+        _buffer_copy(pool->indices, indices, index_end * index, index_start * index, index_tail * index);
+        _buffer_copy(pool->edges, edges, 0, 0, index_start / 3);
+        _buffer_copy(pool->edges, edges, index_end / 3, index_start / 3, index_tail / 3);
+
+        glDeleteBuffers(1, &pool->positions);
+        glDeleteBuffers(1, &pool->normals);
+        glDeleteBuffers(1, &pool->indices);
+        glDeleteBuffers(1, &pool->edges);
+    } else {
+        glGenVertexArrays(1, &pool->vao);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    pool->positions        = positions;
+    pool->normals          = normals;
+    pool->indices          = indices;
+    pool->edges            = edges;
+    pool->vertex_count    -= (int)(vertex_end - vertex_start);
+    pool->index_count     -= (int)(index_end - index_start);
+    pool->vertex_capacity  = vertex_capacity;
+    pool->index_capacity   = index_capacity;
+
+    _pool_bind(b, pool, format);
+    return true;
+}
+
+static int _grow_capacity(int capacity, int needed)
+{
+    long long grown = capacity + capacity / 2;
+    if (grown < needed) grown = needed;
+    return grown > INT_MAX ? INT_MAX : (int)grown;
+}
+
+// Copies a single draw model into the pool of its format and frees its own buffers
+static bool _pool_add(batch_t* b, batch_model_t* m)
+{
+    gpu_model_t*  g      = &m->gpu;
+    batch_pool_t* pool   = &b->pools[g->format];
+    size_t        stride = vertex_format_stride(g->format);
+    int           vertex_count = g->vertex_count / 3;
+    int           index_count  = gpu_model_index_count(g);
+
+    if (vertex_count > INT_MAX - pool->vertex_count || index_count > INT_MAX - pool->index_count) return false;
+
+    if (!pool->vao || pool->vertex_count + vertex_count > pool->vertex_capacity
+        || pool->index_count + index_count > pool->index_capacity)
+    {
+        int vertex_capacity = _grow_capacity(pool->vertex_capacity, pool->vertex_count + vertex_count);
+        int index_capacity  = _grow_capacity(pool->index_capacity, pool->index_count + index_count);
+        if (!_pool_rebuild(b, g->format, vertex_capacity, index_capacity, NULL)) return false;
+    }
+
+    _buffer_copy(g->buffers[g->position_buffer], pool->positions, 0, pool->vertex_count * stride,
+                 vertex_count * stride);
+    _buffer_copy(g->buffers[g->normal_buffer], pool->normals, 0, pool->vertex_count * 3 * sizeof(float),
+                 vertex_count * 3 * sizeof(float));
+    _buffer_copy(g->buffers[g->index_buffer], pool->indices, 0, pool->index_count * sizeof(unsigned int),
+                 index_count * sizeof(unsigned int));
+
+    if (g->edge_buffer >= 0) {
+        _buffer_copy(g->buffers[g->edge_buffer], pool->edges, 0, pool->index_count / 3, index_count / 3);
+    } else if (index_count > 0) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool->edges);
+        glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R8UI, pool->index_count / 3, index_count / 3, GL_RED_INTEGER,
+                             GL_UNSIGNED_BYTE, NULL);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    m->pool        = g->format;
+    m->base_vertex = pool->vertex_count;
+    m->first_index = pool->index_count;
+
+    pool->vertex_count += vertex_count;
+    pool->index_count  += index_count;
+
+    gpu_model_release_buffers(g);
+    return true;
+}
+
+// Takes the model out of its pool, or frees its own buffers, the description is reset as well
+static void _model_release(batch_t* b, batch_model_t* m)
+{
+    if (m->pool >= 0) {
+        batch_pool_t* pool = &b->pools[m->pool];
+
+        // Without room for the compacted copy the range just stays unused
+        if (_pool_rebuild(b, m->pool, pool->vertex_capacity, pool->index_capacity, m)) {
+            for (int i = 0; i < b->model_count; i++) {
+                batch_model_t* other = &b->models[i];
+                if (other->pool != m->pool || other->base_vertex <= m->base_vertex) continue;
+
+                other->base_vertex -= m->gpu.vertex_count / 3;
+                other->first_index -= gpu_model_index_count(&m->gpu);
+            }
+        }
+    }
+
+    gpu_model_unload(&m->gpu);
+    m->pool        = -1;
+    m->base_vertex = 0;
+    m->first_index = 0;
+    b->dirty       = true;
+}
+
+int batch_find(const batch_t* b, const char* path)
+{
+    for (int i = 0; i < b->model_count; i++) {
+        if (strcmp(b->models[i].path, path) == 0) return i;
+    }
+    return -1;
+}
+
+int batch_add_model(batch_t* b, gpu_model_t model, const char* path)
+{
+    int index = batch_find(b, path);
+
+    if (index >= 0) {
+        _model_release(b, &b->models[index]);
+    } else {
+        if (b->model_count == b->model_capacity) {
+            int            capacity = b->model_capacity ? b->model_capacity * 2 : 8;
+            batch_model_t* models   = realloc(b->models, capacity * sizeof(batch_model_t));
+            if (!models) {
+                log_error("Failed to grow the scene to %d models", capacity);
+                gpu_model_unload(&model);
+                return -1;
+            }
+            b->models         = models;
+            b->model_capacity = capacity;
+        }
+
+        index            = b->model_count++;
+        b->models[index] = (batch_model_t) { .path = e_strdup(path), .pool = -1 };
+    }
+
+    batch_model_t* m = &b->models[index];
+    m->gpu           = model;
+    b->dirty         = true;
+
+    // Single draw models with normals share the pool of their format, imports keep their own buffers
+    bool poolable = model.position_buffer >= 0 && model.normal_buffer >= 0 && model.index_buffer >= 0;
+    if (poolable && _pool_add(b, m)) return index;
+
+    if (!_ensure_ids(b, 1)) return index;
+    for (int d = 0; d < m->gpu.draw_count; d++) _bind_ids(b, m->gpu.draws[d].vao);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return index;
+}
+
+bool batch_add_instance(batch_t* b, int model, mat4 transform)
+{
+    batch_model_t* m = &b->models[model];
+
+    if (m->instance_count == m->instance_capacity) {
+        int   capacity  = m->instance_capacity ? m->instance_capacity * 2 : 4;
+        mat4* instances = realloc(m->instances, capacity * sizeof(mat4));
+        if (!instances) {
+            log_error("Failed to grow %s to %d instances", m->path, capacity);
+            return false;
+        }
+        m->instances         = instances;
+        m->instance_capacity = capacity;
+    }
+
+    glm_mat4_copy(transform, m->instances[m->instance_count++]);
+    b->dirty = true;
+    return true;
+}
+
+// placement * unit size, the space of the decoded positions and the meshlet bounds
+static void _instance_local(const gpu_model_t* g, mat4 placement, mat4 local)
+{
+    vec3 extent;
+    glm_vec3_sub((float*)g->max_vertex, (float*)g->min_vertex, extent);
+    glm_vec3_scale(extent, 0.5f, extent);
+
+    float max_extent = fmaxf(fmaxf(extent[0], extent[1]), extent[2]);
+    if (max_extent <= 0.0f) max_extent = 1.0f;
+
+    glm_mat4_mul((vec4*)g->model, placement, local);
+    glm_scale_uni(local, 1.0f / max_extent);
+}
+
+static void _instance_fill(_instance_t* out, const gpu_model_t* g, mat4 placement, const gpu_draw_t* draw)
+{
+    // placement * unit size * dequantization * placement in the model
+    mat4 orient, world, decode;
+    glm_mat4_mul((vec4*)g->model, placement, orient);
+    _instance_local(g, placement, world);
+
+    glm_translate_make(decode, (float*)g->decode_offset);
+    glm_scale(decode, (float*)g->decode_scale);
+    glm_mat4_mul(world, decode, world);
+
+    if (draw) {
+        glm_mat4_mul(world, (vec4*)draw->transform, world);
+        glm_mat4_mul(orient, (vec4*)draw->transform, orient);
+    }
+
+    // Normals live in model space, the inverse transpose keeps them perpendicular under non
+    // uniform scale
+    mat3 normal;
+    glm_mat4_pick3(orient, normal);
+    glm_mat3_inv(normal, normal);
+    glm_mat3_transpose(normal);
+
+    memcpy(out->world, world, sizeof(out->world));
+    for (int c = 0; c < 3; c++) {
+        for (int r = 0; r < 3; r++) out->normal[c * 4 + r] = normal[c][r];
+        out->normal[c * 4 + 3] = 0.0f;
+    }
+    out->params[0] = !draw || draw->has_normals ? 1.0f : 0.0f;
+    out->params[1] = out->params[2] = out->params[3] = 0.0f;
+}
+
+static bool _push_call(batch_t* b, batch_call_t call)
+{
+    if (b->call_count == b->call_capacity) {
+        int           capacity = b->call_capacity ? b->call_capacity * 2 : 16;
+        batch_call_t* calls    = realloc(b->calls, capacity * sizeof(batch_call_t));
+        if (!calls) return false;
+        b->calls         = calls;
+        b->call_capacity = capacity;
+    }
+
+    b->calls[b->call_count++] = call;
+    return true;
+}
+
+static bool _push_command(batch_t* b, const void* command, size_t bytes)
+{
+    if (b->command_bytes + bytes > b->command_capacity) {
+        size_t capacity = b->command_capacity ? b->command_capacity * 2 : 64 * sizeof(_elements_command_t);
+        while (capacity < b->command_bytes + bytes) capacity *= 2;
+
+        unsigned char* commands = realloc(b->commands, capacity);
+        if (!commands) {
+            log_error("Failed to grow the indirect commands to %zu bytes", capacity);
+            return false;
+        }
+        b->commands         = commands;
+        b->command_capacity = capacity;
+    }
+
+    memcpy(b->commands + b->command_bytes, command, bytes);
+    b->command_bytes += bytes;
+    return true;
+}
+
+// Records for count instances starting at first_entry, base is where a command finds them
+static bool _push_draws(batch_t* b, int first_entry, int count, unsigned int first_index, int base_vertex,
+                        GLuint* base)
+{
+    if (b->draw_count + count > b->draw_capacity) {
+        size_t capacity = b->draw_capacity ? b->draw_capacity * 2 : 64;
+        while (capacity < b->draw_count + count) capacity *= 2;
+
+        batch_draw_t* draws = realloc(b->draws, capacity * sizeof(batch_draw_t));
+        if (!draws) {
+            log_error("Failed to grow the draw records to %zu", capacity);
+            return false;
+        }
+        b->draws         = draws;
+        b->draw_capacity = capacity;
+    }
+
+    *base = (GLuint)b->draw_count;
+    for (int k = 0; k < count; k++) {
+        b->draws[b->draw_count++] = (batch_draw_t) { (unsigned int)(first_entry + k), first_index, base_vertex, 0 };
+    }
+    return true;
+}
+
+static shader_t* _shader_for(batch_t* b, view_mode_t view, vertex_format_t format)
+{
+    shader_t* s = &b->shaders[view][format];
+    if (!s->program) {
+        char vs[4096], fs[8192];
+        snprintf(vs, sizeof(vs), "%s%s", _position_decls[format], vs_source);
+        snprintf(fs, sizeof(fs), "#version 450 core\n#define OUTLINE %d\n#define FEATURES %d\n#define PACKED %d\n"
+                                 "#define POSITION %s\n%s",
+                 view == VIEW_WIREFRAME || view == VIEW_EDGES, view == VIEW_EDGES, format == VERTEX_FORMAT_UNORM16,
+                 _position_types[format], fs_source);
+        shader_create(s, vs, fs, NULL, 0);
+    }
+    return s;
+}
+
+// Lays out the transforms of every instance, pooled models first, and the calls of the imports.
+// The pool commands depend on the camera and are added by _batch_cull on every render.
+static bool _batch_build(batch_t* b)
+{
+    bool   ok          = false;
+    size_t entry_count = 0;
+    int    meshlets    = 0;
+
+    for (int i = 0; i < b->model_count; i++) {
+        const batch_model_t* m = &b->models[i];
+        entry_count += (size_t)m->instance_count * (m->pool >= 0 ? 1 : m->gpu.draw_count);
+        if (m->pool >= 0 && m->gpu.meshlet_count > meshlets) meshlets = m->gpu.meshlet_count;
+    }
+
+    b->call_count     = 0;
+    b->command_bytes  = 0;
+    b->entry_count    = 0;
+    b->static_calls   = 0;
+    b->static_bytes   = 0;
+    b->static_indices = 0;
+    b->draw_count     = 0;
+    b->static_draws   = 0;
+
+    _instance_t* entries = malloc(entry_count ? entry_count * sizeof(_instance_t) : 1);
+    if (!entries || !_ensure_ids(b, entry_count)) {
+        log_error("Failed to lay out %zu instances", entry_count);
+        goto cleanup;
+    }
+
+    if (meshlets > b->range_capacity) {
+        meshlet_range_t* ranges = realloc(b->ranges, meshlets * sizeof(meshlet_range_t));
+        if (!ranges) {
+            log_error("Failed to allocate %d meshlet ranges", meshlets);
+            goto cleanup;
+        }
+        b->ranges         = ranges;
+        b->range_capacity = meshlets;
+    }
+
+    size_t entry = 0;
+
+    for (int f = 0; f < VERTEX_FORMAT_COUNT; f++) {
+        for (int i = 0; i < b->model_count; i++) {
+            batch_model_t* m = &b->models[i];
+            if (m->pool != f) continue;
+
+            m->first_entry = (int)entry;
+            for (int k = 0; k < m->instance_count; k++) _instance_fill(&entries[entry++], &m->gpu, m->instances[k], NULL);
+        }
+    }
+
+    for (int i = 0; i < b->model_count; i++) {
+        batch_model_t* m = &b->models[i];
+        if (m->pool >= 0 || m->instance_count == 0) continue;
+
+        for (int d = 0; d < m->gpu.draw_count; d++) {
+            const gpu_draw_t* gd   = &m->gpu.draws[d];
+            batch_call_t      call = { gd->vao, VIEW_SHADED, m->gpu.format, gd->mode, gd->index_type, b->command_bytes, 1 };
+            GLuint            base;
+
+            if (gd->index_type) {
+                size_t index_size = gd->index_type == GL_UNSIGNED_BYTE ? 1 : gd->index_type == GL_UNSIGNED_SHORT ? 2 : 4;
+                if (gd->index_offset % index_size != 0) {
+                    log_warn("Skipping a draw of %s, its indices are not aligned", m->path);
+                    continue;
+                }
+
+                GLuint first_index = gd->index_offset / index_size;
+                if (!_push_draws(b, (int)entry, m->instance_count, first_index, 0, &base)) goto cleanup;
+
+                _elements_command_t c = { gd->count, m->instance_count, first_index, 0, base };
+                if (!_push_command(b, &c, sizeof(c))) goto cleanup;
+            } else {
+                if (!_push_draws(b, (int)entry, m->instance_count, 0, 0, &base)) goto cleanup;
+
+                _arrays_command_t c = { gd->count, m->instance_count, 0, base };
+                if (!_push_command(b, &c, sizeof(c))) goto cleanup;
+            }
+
+            b->static_indices += (long long)gd->count * m->instance_count;
+            for (int k = 0; k < m->instance_count; k++) _instance_fill(&entries[entry++], &m->gpu, m->instances[k], gd);
+            if (!_shader_for(b, VIEW_SHADED, m->gpu.format)->program || !_push_call(b, call)) goto cleanup;
+        }
+    }
+
+    if (!b->instance_buffer) glGenBuffers(1, &b->instance_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, b->instance_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, entry ? entry * sizeof(_instance_t) : 1, entries, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    b->entry_count  = entry;
+    b->static_calls = b->call_count;
+    b->static_bytes = b->command_bytes;
+    b->static_draws = b->draw_count;
+    ok              = true;
+
+cleanup:
+    if (!ok) b->call_count = 0;
+    free(entries);
+    b->dirty = false;
+    return ok;
+}
+
+// Coarsest level whose error stays under BATCH_LOD_PIXELS on screen. The distance is the closest
+// the bounding sphere around the model gets to the eye, both in model units.
+static int _lod_select(const gpu_model_t* g, const float* eye, float radius, float pixels_per_unit)
+{
+    float distance = glm_vec3_norm((float*)eye) - radius;
+    if (distance <= 0.0f) return 0;
+
+    int level = 0;
+    while (level + 1 < g->lod_count && g->lods[level + 1].error * pixels_per_unit <= BATCH_LOD_PIXELS * distance) level++;
+    return level;
+}
+
+static bool _sphere_outside(vec4 planes[6], float radius)
+{
+    for (int i = 0; i < 6; i++) {
+        if (planes[i][3] < -radius) return true;
+    }
+    return false;
+}
+
+// Appends one multi draw per pool. Models with meshlets or levels of detail get commands per
+// instance, the visible runs of the full level up close and one coarser level further away. The
+// rest draw all their instances whole. The points mode draws the vertices of every visible
+// instance, culled by their bounding sphere alone.
+static bool _batch_cull(batch_t* b, mat4 view, mat4 projection)
+{
+    b->call_count    = b->static_calls;
+    b->command_bytes = b->static_bytes;
+    b->draw_count    = b->static_draws;
+    b->drawn_indices = b->static_indices;
+
+    // Projected size of one unit at distance one, in pixels
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float pixels_per_unit = projection[1][1] * viewport[3] * 0.5f;
+    bool  points          = b->view_mode == VIEW_POINTS;
+
+    for (int f = 0; f < VERTEX_FORMAT_COUNT; f++) {
+        unsigned int mode = points ? GL_POINTS : GL_TRIANGLES;
+        batch_call_t call = { b->pools[f].vao, b->view_mode, f, mode, points ? 0 : GL_UNSIGNED_INT, b->command_bytes, 0 };
+
+        for (int i = 0; i < b->model_count; i++) {
+            const batch_model_t* m = &b->models[i];
+            const gpu_model_t*   g = &m->gpu;
+            GLuint               base;
+            if (m->pool != f || m->instance_count == 0) continue;
+
+            if (g->meshlet_count == 0 && g->lod_count < 2) {
+                if (!_push_draws(b, m->first_entry, m->instance_count, m->first_index, m->base_vertex, &base)) return false;
+
+                if (points) {
+                    _arrays_command_t c = { g->vertex_count / 3, m->instance_count, m->base_vertex, base };
+                    if (!_push_command(b, &c, sizeof(c))) return false;
+                    b->drawn_indices += (long long)g->vertex_count / 3 * m->instance_count;
+                } else {
+                    _elements_command_t c = { g->indice_count, m->instance_count, m->first_index, m->base_vertex, base };
+                    if (!_push_command(b, &c, sizeof(c))) return false;
+                    b->drawn_indices += (long long)g->indice_count * m->instance_count;
+                }
+                call.count++;
+                continue;
+            }
+
+            vec3 extent;
+            glm_vec3_sub((float*)g->max_vertex, (float*)g->min_vertex, extent);
+            float radius = glm_vec3_norm(extent) * 0.5f;
+
+            for (int k = 0; k < m->instance_count; k++) {
+                mat4 local, modelview, clip, inverse;
+                vec4 planes[6];
+                _instance_local(g, m->instances[k], local);
+                glm_mat4_mul(view, local, modelview);
+                glm_mat4_mul(projection, modelview, clip);
+                meshlets_frustum(clip, planes);
+
+                if (points) {
+                    if (_sphere_outside(planes, radius)) continue;
+                    if (!_push_draws(b, m->first_entry + k, 1, m->first_index, m->base_vertex, &base)) return false;
+
+                    _arrays_command_t c = { g->vertex_count / 3, 1, m->base_vertex, base };
+                    if (!_push_command(b, &c, sizeof(c))) return false;
+                    b->drawn_indices += g->vertex_count / 3;
+                    call.count++;
+                    continue;
+                }
+
+                // The camera sits at the origin of view space
+                glm_mat4_inv(modelview, inverse);
+                const float* eye   = inverse[3];
+                int          level = _lod_select(g, eye, radius, pixels_per_unit);
+
+                if (level == 0 && g->meshlet_count > 0) {
+                    int count = meshlets_cull(g->meshlets, g->nodes, g->node_count, planes,
+                                              b->backface_culling ? eye : NULL, b->ranges);
+                    for (int r = 0; r < count; r++) {
+                        GLuint first_index = m->first_index + b->ranges[r].first_index;
+                        if (!_push_draws(b, m->first_entry + k, 1, first_index, m->base_vertex, &base)) return false;
+
+                        _elements_command_t c = { b->ranges[r].index_count, 1, first_index, m->base_vertex, base };
+                        if (!_push_command(b, &c, sizeof(c))) return false;
+                        b->drawn_indices += b->ranges[r].index_count;
+                    }
+                    call.count += count;
+                    continue;
+                }
+
+                // Coarser levels are few triangles, the whole model is culled or drawn
+                if (_sphere_outside(planes, radius)) continue;
+
+                const model_lod_t* lod         = &g->lods[level];
+                GLuint             first_index = m->first_index + lod->first_index;
+                if (!_push_draws(b, m->first_entry + k, 1, first_index, m->base_vertex, &base)) return false;
+
+                _elements_command_t c = { lod->index_count, 1, first_index, m->base_vertex, base };
+                if (!_push_command(b, &c, sizeof(c))) return false;
+                b->drawn_indices += lod->index_count;
+                call.count++;
+            }
+        }
+
+        if (call.count > 0 && (!_shader_for(b, call.view, f)->program || !_push_call(b, call))) return false;
+    }
+
+    if (!_ensure_ids(b, b->draw_count)) return false;
+
+    if (!b->indirect_buffer) glGenBuffers(1, &b->indirect_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, b->indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, b->command_bytes ? b->command_bytes : 1, b->commands, GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    if (!b->draw_buffer) glGenBuffers(1, &b->draw_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, b->draw_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, b->draw_count ? b->draw_count * sizeof(batch_draw_t) : 1, b->draws,
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return true;
+}
+
+void batch_render(batch_t* b, mat4 view, mat4 projection)
+{
+    if (b->dirty) _batch_build(b);
+    if (b->entry_count == 0 || !_batch_cull(b, view, projection) || b->call_count == 0) return;
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_INSTANCE_BINDING, b->instance_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_DRAW_BINDING, b->draw_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, b->indirect_buffer);
+    glPointSize(BATCH_POINT_SIZE);
+
+    GLuint program = 0;
+    for (int i = 0; i < b->call_count; i++) {
+        const batch_call_t* c = &b->calls[i];
+
+        if (b->shaders[c->view][c->format].program != program) {
+            program = b->shaders[c->view][c->format].program;
+            glUseProgram(program);
+        }
+        glBindVertexArray(c->vao);
+
+        // The pools come last, the cones only drop meshlets that face away so the rest of the
+        // back faces have to go as well
+        if (i == b->static_calls && b->backface_culling) glEnable(GL_CULL_FACE);
+
+        // Outlines read the triangles back from the pool the call draws
+        if (c->view == VIEW_WIREFRAME || c->view == VIEW_EDGES) {
+            const batch_pool_t* pool = &b->pools[c->format];
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_POSITION_BINDING, pool->positions);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_INDEX_BINDING, pool->indices);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_EDGE_BINDING, pool->edges);
+        }
+
+        if (c->index_type) {
+            glMultiDrawElementsIndirect(c->mode, c->index_type, (const void*)c->offset, c->count, 0);
+        } else {
+            glMultiDrawArraysIndirect(c->mode, (const void*)c->offset, c->count, 0);
+        }
+    }
+
+    glDisable(GL_CULL_FACE);
+    glPointSize(1.0f);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glUseProgram(0);
+    glBindVertexArray(0);
+}
+
+const char* view_mode_name(view_mode_t mode)
+{
+    return mode >= 0 && mode < VIEW_MODE_COUNT ? _view_mode_names[mode] : "unknown";
+}
+
+void batch_stats(const batch_t* b, int* vertex_count, int* instance_count, float* size_mb)
+{
+    *vertex_count   = 0;
+    *instance_count = 0;
+    *size_mb        = 0.0f;
+
+    for (int i = 0; i < b->model_count; i++) {
+        *vertex_count   += b->models[i].gpu.vertex_count;
+        *instance_count += b->models[i].instance_count;
+        *size_mb        += gpu_model_get_size_mb(&b->models[i].gpu);
+    }
+}
+
+void batch_clear(batch_t* b)
+{
+    for (int i = 0; i < b->model_count; i++) {
+        gpu_model_unload(&b->models[i].gpu);
+        free(b->models[i].path);
+        free(b->models[i].instances);
+    }
+    b->model_count = 0;
+
+    // The pools keep their storage for whatever comes next
+    for (int f = 0; f < VERTEX_FORMAT_COUNT; f++) {
+        b->pools[f].vertex_count = 0;
+        b->pools[f].index_count  = 0;
+    }
+    b->dirty = true;
+}
+
+void batch_free(batch_t* b)
+{
+    batch_clear(b);
+
+    for (int f = 0; f < VERTEX_FORMAT_COUNT; f++) {
+        batch_pool_t* pool = &b->pools[f];
+        if (pool->vao) {
+            glDeleteVertexArrays(1, &pool->vao);
+            glDeleteBuffers(1, &pool->positions);
+            glDeleteBuffers(1, &pool->normals);
+            glDeleteBuffers(1, &pool->indices);
+            glDeleteBuffers(1, &pool->edges);
+        }
+        for (int v = 0; v < VIEW_MODE_COUNT; v++) shader_destroy(&b->shaders[v][f]);
+    }
+
+    glDeleteBuffers(1, &b->instance_buffer);
+    glDeleteBuffers(1, &b->indirect_buffer);
+    glDeleteBuffers(1, &b->draw_buffer);
+    glDeleteBuffers(1, &b->id_buffer);
+
+    free(b->models);
+    free(b->calls);
+    free(b->commands);
+    free(b->draws);
+    free(b->ranges);
+    batch_init(b);
+}
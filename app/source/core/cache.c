@@ -0,0 +1,493 @@
+#include "core/cache.h"
+
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_MAGIC 0x43564f46u // "FOVC"
+#define CACHE_VERSION 7
+#define CACHE_ALIGN 4096
+#define CACHE_HASH_BLOCK (4 << 20)
+#define CACHE_FLAG_OPTIMIZED 0x1u
+
+// On disk layout: header, then every buffer at a page aligned offset so the
+// mapping can be handed to glBufferData as is
+typedef struct {
+    uint32_t      magic;
+    uint32_t      version;
+    uint64_t      source_size;
+    int64_t       source_mtime;
+    uint64_t      source_hash;
+    uint64_t      path_hash;
+    uint32_t      format;
+    uint32_t      flags;
+    int64_t       vertex_count;
+    int64_t       indice_count;
+    int64_t       normal_count;
+    int64_t       texcrd_count;
+    uint64_t      vertex_offset;
+    uint64_t      vertex_bytes;
+    uint64_t      indice_offset;
+    uint64_t      normal_offset;
+    uint64_t      texcrd_offset;
+    int64_t       meshlet_count;
+    int64_t       node_count;
+    uint64_t      meshlet_offset;
+    uint64_t      node_offset;
+    int64_t       edge_count; // feature edge bytes, one per triangle of every level
+    uint64_t      edge_offset;
+    model_lod_t   lods[MODEL_MAX_LODS];
+    uint32_t      lod_count;
+    float         min_vertex[3];
+    float         max_vertex[3];
+    float         decode_scale[3];
+    float         decode_offset[3];
+    double        import_ms;
+    model_stats_t stats;
+} cache_header_t;
+
+typedef struct {
+    char      path[1024];
+    size_t    size;
+    long long mtime;
+} cache_file_t;
+
+typedef struct {
+    cache_file_t* files;
+    int           count;
+    int           capacity;
+    size_t        total;
+} cache_listing_t;
+
+typedef struct {
+    const unsigned char* data;
+    size_t               size;
+    uint64_t*            block_hashes;
+    int                  block_count;
+    int                  task_count;
+} _hash_job_t;
+
+static struct {
+    char   directory[1024];
+    size_t max_bytes;
+    bool   enabled;
+    bool   initialized;
+} cache = { .enabled = true };
+
+static inline uint64_t _mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Word at a time multiply/rotate hash, plenty for change detection
+static uint64_t _hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* p = data;
+    uint64_t             h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+
+    while (size >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h ^= _mix(w);
+        h = (h << 27 | h >> 37) * 0x9e3779b97f4a7c15ull + 0x52dce729ull;
+        p += 8;
+        size -= 8;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, p, size);
+    h ^= _mix(tail ^ size);
+
+    return _mix(h);
+}
+
+static void _hash_task(void* userdata, int index)
+{
+    _hash_job_t* job = userdata;
+
+    for (int b = index; b < job->block_count; b += job->task_count) {
+        size_t offset = (size_t)b * CACHE_HASH_BLOCK;
+        size_t size   = job->size - offset < CACHE_HASH_BLOCK ? job->size - offset : CACHE_HASH_BLOCK;
+
+        job->block_hashes[b] = _hash_bytes(job->data + offset, size, (uint64_t)b);
+    }
+}
+
+// Hashes fixed size blocks in parallel and then the list of block hashes
+static bool _hash_file(const char* filepath, uint64_t* hash)
+{
+    file_map_t map;
+    if (!file_map(filepath, &map)) return false;
+
+    _hash_job_t job = {
+        .data        = (const unsigned char*)map.data,
+        .size        = map.size,
+        .block_count = (int)((map.size + CACHE_HASH_BLOCK - 1) / CACHE_HASH_BLOCK),
+    };
+
+    job.block_hashes = calloc(job.block_count + 1, sizeof(uint64_t));
+    if (!job.block_hashes) {
+        file_unmap(&map);
+        return false;
+    }
+
+    job.task_count = thread_count() < job.block_count ? thread_count() : job.block_count;
+    thread_parallel(job.task_count, _hash_task, &job);
+
+    *hash = _hash_bytes(job.block_hashes, job.block_count * sizeof(uint64_t), map.size);
+
+    free(job.block_hashes);
+    file_unmap(&map);
+    return true;
+}
+
+static void _default_directory(char* out, size_t size)
+{
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (base) {
+        snprintf(out, size, "%s\\fov\\cache", base);
+        return;
+    }
+#else
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0]) {
+        snprintf(out, size, "%s/fov", xdg);
+        return;
+    }
+
+    const char* home = getenv("HOME");
+    if (home) {
+        snprintf(out, size, "%s/.cache/fov", home);
+        return;
+    }
+#endif
+    snprintf(out, size, ".fovcache");
+}
+
+static void _cache_filepath(const cache_key_t* key, char* out, size_t size)
+{
+    snprintf(out, size, "%s/%016llx-%s%s.fovc", cache.directory, (unsigned long long)key->path_hash,
+             vertex_format_name(key->format), key->optimized ? "-opt" : "");
+}
+
+static uint32_t _key_flags(const cache_key_t* key)
+{
+    return key->optimized ? CACHE_FLAG_OPTIMIZED : 0;
+}
+
+static uint64_t _align(uint64_t offset)
+{
+    return (offset + CACHE_ALIGN - 1) & ~(uint64_t)(CACHE_ALIGN - 1);
+}
+
+void cache_init(const char* directory, size_t max_bytes)
+{
+    if (directory) {
+        snprintf(cache.directory, sizeof(cache.directory), "%s", directory);
+    } else {
+        _default_directory(cache.directory, sizeof(cache.directory));
+    }
+
+    cache.max_bytes   = max_bytes;
+    cache.initialized = file_create_directories(cache.directory);
+
+    if (cache.initialized) {
+        log_info("Model cache at %s (limit %.0fMB)", cache.directory, max_bytes / (1024.0 * 1024.0));
+    } else {
+        log_warn("Model cache disabled, can't create %s", cache.directory);
+    }
+}
+
+void cache_set_enabled(bool enabled)
+{
+    cache.enabled = enabled;
+}
+
+bool cache_is_enabled(void)
+{
+    return cache.enabled && cache.initialized;
+}
+
+bool cache_key(const char* source_path, vertex_format_t format, bool optimized, cache_key_t* key)
+{
+    memset(key, 0, sizeof(*key));
+
+    key->source_path = file_canonical_path(source_path);
+    if (!key->source_path) return false;
+
+    if (!file_stat(key->source_path, &key->source_size, &key->source_mtime)
+        || !_hash_file(key->source_path, &key->source_hash))
+    {
+        cache_key_free(key);
+        return false;
+    }
+
+    key->path_hash = _hash_bytes(key->source_path, strlen(key->source_path), 0);
+    key->format    = format;
+    key->optimized = optimized;
+    return true;
+}
+
+void cache_key_free(cache_key_t* key)
+{
+    free(key->source_path);
+    key->source_path = NULL;
+}
+
+bool cache_load(const cache_key_t* key, cache_entry_t* entry)
+{
+    if (!cache_is_enabled()) return false;
+
+    char filepath[1200];
+    _cache_filepath(key, filepath, sizeof(filepath));
+
+    if (!file_stat(filepath, NULL, NULL)) return false;
+
+    memset(entry, 0, sizeof(*entry));
+    if (!file_map(filepath, &entry->map)) return false;
+
+    const cache_header_t* h = (const cache_header_t*)entry->map.data;
+
+    bool valid = entry->map.size >= sizeof(cache_header_t) && h->magic == CACHE_MAGIC && h->version == CACHE_VERSION
+              && h->format == (uint32_t)key->format && h->flags == _key_flags(key) && h->source_size == key->source_size
+              && h->source_mtime == key->source_mtime && h->source_hash == key->source_hash
+              && h->path_hash == key->path_hash;
+
+    valid = valid && h->vertex_offset + h->vertex_bytes <= entry->map.size
+         && h->indice_offset + h->indice_count * sizeof(unsigned int) <= entry->map.size
+         && h->normal_offset + h->normal_count * sizeof(float) <= entry->map.size
+         && h->texcrd_offset + h->texcrd_count * sizeof(float) <= entry->map.size
+         && h->meshlet_offset + h->meshlet_count * sizeof(meshlet_t) <= entry->map.size
+         && h->node_offset + h->node_count * sizeof(meshlet_node_t) <= entry->map.size
+         && h->edge_offset + h->edge_count <= entry->map.size
+         && (h->edge_count == 0 || h->edge_count * 3 == h->indice_count)
+         && h->lod_count <= MODEL_MAX_LODS;
+
+    for (uint32_t i = 0; valid && i < h->lod_count; i++) {
+        valid = (int64_t)h->lods[i].first_index + h->lods[i].index_count <= h->indice_count;
+    }
+
+    if (!valid) {
+        log_info("Discarding stale cache entry %s", filepath);
+        file_unmap(&entry->map);
+        remove(filepath);
+        return false;
+    }
+
+    packed_model_t* p = &entry->packed;
+    p->format         = (vertex_format_t)h->format;
+    p->vertices       = entry->map.data + h->vertex_offset;
+    p->indices        = (const unsigned int*)(entry->map.data + h->indice_offset);
+    p->normals        = h->normal_count ? (const float*)(entry->map.data + h->normal_offset) : NULL;
+    p->texcrds        = h->texcrd_count ? (const float*)(entry->map.data + h->texcrd_offset) : NULL;
+    p->edges          = h->edge_count ? (const unsigned char*)(entry->map.data + h->edge_offset) : NULL;
+    p->vertex_bytes   = h->vertex_bytes;
+    p->vertex_count   = (int)h->vertex_count;
+    p->indice_count   = (int)h->indice_count;
+    p->normal_count   = (int)h->normal_count;
+    p->texcrd_count   = (int)h->texcrd_count;
+    p->meshlets       = h->meshlet_count ? (const meshlet_t*)(entry->map.data + h->meshlet_offset) : NULL;
+    p->nodes          = h->node_count ? (const meshlet_node_t*)(entry->map.data + h->node_offset) : NULL;
+    p->meshlet_count  = (int)h->meshlet_count;
+    p->node_count     = (int)h->node_count;
+    p->storage        = NULL;
+    p->cull_storage   = NULL;
+    p->lod_count      = (int)h->lod_count;
+    memcpy(p->lods, h->lods, sizeof(p->lods));
+    p->stats          = h->stats;
+
+    memcpy(p->min_vertex, h->min_vertex, sizeof(vec3));
+    memcpy(p->max_vertex, h->max_vertex, sizeof(vec3));
+    memcpy(p->decode_scale, h->decode_scale, sizeof(vec3));
+    memcpy(p->decode_offset, h->decode_offset, sizeof(vec3));
+
+    entry->import_ms = h->import_ms;
+
+    // mtime doubles as the LRU stamp for eviction
+    file_touch(filepath);
+    return true;
+}
+
+void cache_release(cache_entry_t* entry)
+{
+    file_unmap(&entry->map);
+    memset(&entry->packed, 0, sizeof(entry->packed));
+}
+
+static bool _write_section(FILE* file, uint64_t* offset, uint64_t target, const void* data, size_t bytes)
+{
+    static const char zeros[CACHE_ALIGN] = { 0 };
+
+    while (*offset < target) {
+        size_t pad = target - *offset < CACHE_ALIGN ? (size_t)(target - *offset) : CACHE_ALIGN;
+        if (fwrite(zeros, 1, pad, file) != pad) return false;
+        *offset += pad;
+    }
+
+    if (bytes > 0 && fwrite(data, 1, bytes, file) != bytes) return false;
+    *offset += bytes;
+    return true;
+}
+
+bool cache_store(const cache_key_t* key, const packed_model_t* p, double import_ms)
+{
+    if (!cache_is_enabled()) return false;
+
+    double start = timer_now();
+
+    char filepath[1200], temppath[1210];
+    _cache_filepath(key, filepath, sizeof(filepath));
+    snprintf(temppath, sizeof(temppath), "%s.tmp", filepath);
+
+    size_t indice_bytes  = (size_t)p->indice_count * sizeof(unsigned int);
+    size_t normal_bytes  = (size_t)p->normal_count * sizeof(float);
+    size_t texcrd_bytes  = (size_t)p->texcrd_count * sizeof(float);
+    size_t meshlet_bytes = (size_t)p->meshlet_count * sizeof(meshlet_t);
+    size_t node_bytes    = (size_t)p->node_count * sizeof(meshlet_node_t);
+    size_t edge_bytes    = p->edges ? (size_t)p->indice_count / 3 : 0;
+
+    cache_header_t h = {
+        .magic         = CACHE_MAGIC,
+        .version       = CACHE_VERSION,
+        .source_size   = key->source_size,
+        .source_mtime  = key->source_mtime,
+        .source_hash   = key->source_hash,
+        .path_hash     = key->path_hash,
+        .format        = (uint32_t)p->format,
+        .flags         = _key_flags(key),
+        .vertex_count  = p->vertex_count,
+        .indice_count  = p->indice_count,
+        .normal_count  = p->normal_count,
+        .texcrd_count  = p->texcrd_count,
+        .meshlet_count = p->meshlet_count,
+        .node_count    = p->node_count,
+        .edge_count    = (int64_t)edge_bytes,
+        .lod_count     = (uint32_t)p->lod_count,
+        .vertex_bytes  = p->vertex_bytes,
+        .import_ms     = import_ms,
+    };
+
+    h.vertex_offset  = _align(sizeof(cache_header_t));
+    h.indice_offset  = _align(h.vertex_offset + p->vertex_bytes);
+    h.normal_offset  = _align(h.indice_offset + indice_bytes);
+    h.texcrd_offset  = _align(h.normal_offset + normal_bytes);
+    h.meshlet_offset = _align(h.texcrd_offset + texcrd_bytes);
+    h.node_offset    = _align(h.meshlet_offset + meshlet_bytes);
+    h.edge_offset    = _align(h.node_offset + node_bytes);
+
+    memcpy(h.min_vertex, p->min_vertex, sizeof(vec3));
+    memcpy(h.max_vertex, p->max_vertex, sizeof(vec3));
+    memcpy(h.decode_scale, p->decode_scale, sizeof(vec3));
+    memcpy(h.decode_offset, p->decode_offset, sizeof(vec3));
+    memcpy(h.lods, p->lods, sizeof(h.lods));
+    h.stats = p->stats;
+
+    FILE* file = fopen(temppath, "wb");
+    if (!file) {
+        log_warn("Failed to create cache file %s", temppath);
+        return false;
+    }
+
+    uint64_t offset = 0;
+    bool     ok     = _write_section(file, &offset, 0, &h, sizeof(h))
+           && _write_section(file, &offset, h.vertex_offset, p->vertices, p->vertex_bytes)
+           && _write_section(file, &offset, h.indice_offset, p->indices, indice_bytes)
+           && _write_section(file, &offset, h.normal_offset, p->normals, normal_bytes)
+           && _write_section(file, &offset, h.texcrd_offset, p->texcrds, texcrd_bytes)
+           && _write_section(file, &offset, h.meshlet_offset, p->meshlets, meshlet_bytes)
+           && _write_section(file, &offset, h.node_offset, p->nodes, node_bytes)
+           && _write_section(file, &offset, h.edge_offset, p->edges, edge_bytes);
+
+    ok = fclose(file) == 0 && ok;
+
+    // Replace the previous entry in one step so readers never see a partial file
+    remove(filepath);
+    if (!ok || rename(temppath, filepath) != 0) {
+        log_warn("Failed to write cache file %s", filepath);
+        remove(temppath);
+        return false;
+    }
+
+    log_info("Cached %s as %s (%.1fMB in %.1fms)", key->source_path, filepath, offset / (1024.0 * 1024.0),
+             (timer_now() - start) * 1000.0);
+
+    cache_evict();
+    return true;
+}
+
+static void _collect_file(const char* filepath, size_t size, long long mtime, void* userdata)
+{
+    cache_listing_t* listing = userdata;
+
+    size_t len = strlen(filepath);
+    if (len < 5 || strcmp(filepath + len - 5, ".fovc") != 0) return;
+
+    if (listing->count == listing->capacity) {
+        int           capacity = listing->capacity ? listing->capacity * 2 : 64;
+        cache_file_t* files    = realloc(listing->files, capacity * sizeof(cache_file_t));
+        if (!files) return;
+
+        listing->files    = files;
+        listing->capacity = capacity;
+    }
+
+    cache_file_t* f = &listing->files[listing->count++];
+    snprintf(f->path, sizeof(f->path), "%s", filepath);
+    f->size  = size;
+    f->mtime = mtime;
+    listing->total += size;
+}
+
+static int _compare_mtime(const void* a, const void* b)
+{
+    const cache_file_t* fa = a;
+    const cache_file_t* fb = b;
+    return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+void cache_evict(void)
+{
+    if (!cache.initialized) return;
+
+    cache_listing_t listing = { 0 };
+    file_list_directory(cache.directory, _collect_file, &listing);
+
+    if (listing.total > cache.max_bytes) {
+        // Least recently used first
+        qsort(listing.files, listing.count, sizeof(cache_file_t), _compare_mtime);
+
+        for (int i = 0; i < listing.count && listing.total > cache.max_bytes; i++) {
+            if (remove(listing.files[i].path) == 0) {
+                listing.total -= listing.files[i].size;
+                log_info("Evicted cache entry %s", listing.files[i].path);
+            }
+        }
+    }
+
+    free(listing.files);
+}
+
+bool cache_sidecar_path(const char* source_path, const char* extension, char* out, size_t size)
+{
+    if (!cache.initialized) return false;
+
+    char* canonical = file_canonical_path(source_path);
+    if (!canonical) return false;
+
+    // Eviction only lists .fovc files, anything else stays until it is written again
+    uint64_t path_hash = _hash_bytes(canonical, strlen(canonical), 0);
+    snprintf(out, size, "%s/%016llx%s", cache.directory, (unsigned long long)path_hash, extension);
+    free(canonical);
+    return true;
+}
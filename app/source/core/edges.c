@@ -0,0 +1,195 @@
+#include "core/edges.h"
+
+#include "core/weld.h"
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define EDGES_MIN_PARALLEL (1 << 16) // triangles below this are marked on the calling thread
+
+typedef struct {
+    const model_t*      model;
+    const unsigned int* canon;
+    int                 tri_count;                  // of every level
+    int                 level_ends[MODEL_MAX_LODS]; // first triangle past each level
+    int                 level_count;
+    float*              units; // face normal per triangle, zero when degenerate
+    int*                adj_start; // position -> triangles around it, degenerate ones left out
+    unsigned int*       adj;
+    unsigned char*      edges;
+    int*                counts; // feature edges found per task
+    float               cos_crease;
+    int                 task_count;
+} _edges_job_t;
+
+static inline void _task_range(const _edges_job_t* job, int index, int* first, int* last)
+{
+    *first = (int)((long long)job->tri_count * index / job->task_count);
+    *last  = (int)((long long)job->tri_count * (index + 1) / job->task_count);
+}
+
+static inline bool _degenerate(const _edges_job_t* job, int t)
+{
+    const float* u = &job->units[(size_t)t * 3];
+    return u[0] == 0.0f && u[1] == 0.0f && u[2] == 0.0f;
+}
+
+static void _face_task(void* userdata, int index)
+{
+    _edges_job_t*  job = userdata;
+    const model_t* m   = job->model;
+
+    int first, last;
+    _task_range(job, index, &first, &last);
+
+    for (int t = first; t < last; t++) {
+        const unsigned int* tri = &m->indices[(size_t)t * 3];
+        const double*       a   = &m->vertices[(size_t)tri[0] * 3];
+        const double*       b   = &m->vertices[(size_t)tri[1] * 3];
+        const double*       c   = &m->vertices[(size_t)tri[2] * 3];
+
+        double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        double n[3]  = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+
+        double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        bool   degenerate = len <= 0.0 || job->canon[tri[0]] == job->canon[tri[1]]
+                         || job->canon[tri[1]] == job->canon[tri[2]] || job->canon[tri[0]] == job->canon[tri[2]];
+
+        for (int k = 0; k < 3; k++) job->units[(size_t)t * 3 + k] = degenerate ? 0.0f : (float)(n[k] / len);
+    }
+}
+
+static void _edge_task(void* userdata, int index)
+{
+    _edges_job_t*  job = userdata;
+    const model_t* m   = job->model;
+
+    int first, last;
+    _task_range(job, index, &first, &last);
+
+    int level = 0;
+    for (int t = first; t < last; t++) {
+        while (job->level_ends[level] <= t) level++;
+
+        job->edges[t] = 0;
+        if (_degenerate(job, t)) continue;
+
+        // Levels share the vertices, only triangles of the same level are neighbours
+        unsigned int        lo  = level > 0 ? (unsigned int)job->level_ends[level - 1] : 0;
+        unsigned int        hi  = (unsigned int)job->level_ends[level];
+        const unsigned int* tri = &m->indices[(size_t)t * 3];
+        const float*        tu  = &job->units[(size_t)t * 3];
+
+        for (int k = 0; k < 3; k++) {
+            unsigned int a = job->canon[tri[k]], b = job->canon[tri[(k + 1) % 3]];
+
+            int          users  = 0;
+            unsigned int other  = 0;
+            bool         lowest = true;
+            for (int i = job->adj_start[a]; i < job->adj_start[a + 1]; i++) {
+                unsigned int o = job->adj[i];
+                if (o == (unsigned int)t || o < lo || o >= hi) continue;
+
+                const unsigned int* ot = &m->indices[(size_t)o * 3];
+                if (job->canon[ot[0]] != b && job->canon[ot[1]] != b && job->canon[ot[2]] != b) continue;
+                users++;
+                other  = o;
+                lowest = lowest && o > (unsigned int)t;
+            }
+
+            bool feature = users != 1;
+            if (users == 1) {
+                const float* ou = &job->units[(size_t)other * 3];
+                feature         = tu[0] * ou[0] + tu[1] * ou[1] + tu[2] * ou[2] < job->cos_crease;
+            }
+            if (!feature) continue;
+
+            // Every triangle on the edge marks it, the lowest one counts it
+            job->edges[t] |= 1 << k;
+            if (lowest) job->counts[index]++;
+        }
+    }
+}
+
+bool model_build_edges(model_t* m, float crease_degrees)
+{
+    double start        = timer_now();
+    int    vertex_count = m->vertex_count / 3;
+    int    tri_count    = m->indice_count / 3;
+    if (tri_count == 0) return true;
+
+    free(m->edges);
+    m->edges = malloc((size_t)tri_count);
+    if (!m->edges) {
+        log_error("Failed to allocate feature edges for %d triangles", tri_count);
+        return false;
+    }
+
+    _edges_job_t job = {
+        .model       = m,
+        .tri_count   = tri_count,
+        .level_count = m->lod_count > 0 ? m->lod_count : 1,
+        .edges       = m->edges,
+        .cos_crease  = cosf(crease_degrees * (float)M_PI / 180.0f),
+        .task_count  = tri_count > EDGES_MIN_PARALLEL ? thread_count() : 1,
+    };
+    for (int l = 0; l < MODEL_MAX_LODS; l++) job.level_ends[l] = tri_count;
+    for (int l = 0; l < m->lod_count; l++) {
+        job.level_ends[l] = (int)((m->lods[l].first_index + m->lods[l].index_count) / 3);
+    }
+
+    arena_t*      arena = arena_scratch();
+    arena_mark_t  mark  = arena_mark(arena);
+    unsigned int* canon = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    unsigned int* rep   = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    job.canon           = canon;
+    job.units           = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(float));
+    job.adj             = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(unsigned int));
+    job.counts          = arena_calloc(arena, job.task_count, sizeof(int));
+
+    bool ok             = false;
+    int  position_count = canon && rep ? weld_positions(m, canon, rep) : -1;
+    if (position_count < 0 || !job.units || !job.adj || !job.counts) goto cleanup;
+
+    job.adj_start = arena_calloc(arena, (size_t)position_count + 1, sizeof(int));
+    if (!job.adj_start) goto cleanup;
+
+    thread_parallel(job.task_count, _face_task, &job);
+
+    // Triangles per position as a CSR list, the fill advances every start to the next one's
+    for (int t = 0; t < tri_count; t++) {
+        if (_degenerate(&job, t)) continue;
+        for (int k = 0; k < 3; k++) job.adj_start[canon[m->indices[(size_t)t * 3 + k]] + 1]++;
+    }
+    for (int p = 0; p < position_count; p++) job.adj_start[p + 1] += job.adj_start[p];
+    for (int t = 0; t < tri_count; t++) {
+        if (_degenerate(&job, t)) continue;
+        for (int k = 0; k < 3; k++) job.adj[job.adj_start[canon[m->indices[(size_t)t * 3 + k]]]++] = (unsigned int)t;
+    }
+    for (int p = position_count; p > 0; p--) job.adj_start[p] = job.adj_start[p - 1];
+    job.adj_start[0] = 0;
+
+    thread_parallel(job.task_count, _edge_task, &job);
+
+    long long total = 0;
+    for (int i = 0; i < job.task_count; i++) total += job.counts[i];
+
+    log_info("Marked %lld feature edges [crease: %.0f deg;  levels: %d] in %.1fms", total, crease_degrees,
+             job.level_count, (timer_now() - start) * 1000.0);
+    ok = true;
+
+cleanup:
+    if (!ok) {
+        log_error("Failed to allocate feature edge buffers for %d triangles", tri_count);
+        free(m->edges);
+        m->edges = NULL;
+    }
+    arena_release(arena, mark);
+    return ok;
+}
@@ -2,17 +2,17 @@
 
 #include "glad/glad.h"
 
+#include "engine/arena.h"
 #include "engine/shader.h"
 
 static const char* vs_source = "#version 330 core\n"
                                "layout (location = 0) in vec3 aPos;\n"
                                "layout (location = 1) in vec3 aColor;\n"
                                "out vec3 outColor;\n"
-                               "uniform mat4 projection;\n"
-                               "uniform mat4 view;\n"
+                               SHADER_CAMERA_BLOCK
                                "void main()\n"
                                "{\n"
-                               "    gl_Position = projection * view * vec4(aPos, 1.0);\n"
+                               "    gl_Position = uProj * uView * vec4(aPos, 1.0);\n"
                                "    outColor = aColor;\n"
                                "}\0";
 
@@ -33,7 +33,7 @@ grid_t grid_create()
         .vbo        = 0,
         .cbo        = 0,
         .vao        = 0,
-        .program    = 0,
+        .shader     = { 0 },
     };
 }
 
@@ -46,12 +46,14 @@ void grid_build(grid_t* grid, vec3 center, int size, int line_width, float spaci
     int   lines_per_axis = (int)((size / spacing) + 1);
     grid->line_count     = lines_per_axis * 4; // 2 lines per grid line * 2 axes
 
-    float* vertices = malloc(grid->line_count * 3 * sizeof(float));
-    float* colors   = malloc(grid->line_count * 3 * sizeof(float));
+    // Only needed until the buffers are filled
+    arena_t*     arena    = arena_scratch();
+    arena_mark_t mark     = arena_mark(arena);
+    float*       vertices = arena_alloc(arena, grid->line_count * 3 * sizeof(float));
+    float*       colors   = arena_alloc(arena, grid->line_count * 3 * sizeof(float));
 
     if (!vertices || !colors) {
-        free(vertices);
-        free(colors);
+        arena_release(arena, mark);
         return;
     }
     int vertex_count = 0;
@@ -113,29 +115,22 @@ void grid_build(grid_t* grid, vec3 center, int size, int line_width, float spaci
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(1);
 
-    free(vertices);
-    free(colors);
+    arena_release(arena, mark);
 
-    grid->program = load_shader_program(vs_source, fs_source);
+    // The camera comes from the shared block, nothing to resolve
+    if (!grid->shader.program) shader_create(&grid->shader, vs_source, fs_source, NULL, 0);
 }
 void grid_destroy(grid_t* grid)
 {
     glDeleteBuffers(1, &grid->vbo);
     glDeleteVertexArrays(1, &grid->vao);
-    glDeleteProgram(grid->program);
+    shader_destroy(&grid->shader);
 }
 
-void grid_render(const grid_t* grid, mat4 projection, mat4 view)
+void grid_render(const grid_t* grid)
 {
-    glUseProgram(grid->program);
+    glUseProgram(grid->shader.program);
     glLineWidth((float)grid->line_width);
     glBindVertexArray(grid->vao);
-
-    if (projection) {
-        glUniformMatrix4fv(glGetUniformLocation(grid->program, "projection"), 1, GL_FALSE, (float*)projection);
-    }
-    if (view) {
-        glUniformMatrix4fv(glGetUniformLocation(grid->program, "view"), 1, GL_FALSE, (float*)view);
-    }
     glDrawArrays(GL_LINES, 0, grid->line_count);
-}
\ No newline at end of file
+}
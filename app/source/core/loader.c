@@ -0,0 +1,238 @@
+#include "core/loader.h"
+
+#include "core/analyze.h"
+#include "core/edges.h"
+#include "core/meshlet.h"
+#include "core/normals.h"
+#include "core/optimize.h"
+#include "core/simplify.h"
+#include "engine/arena.h"
+#include "engine/profiler.h"
+#include "engine/string.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum { LOADER_RUNNING, LOADER_READY, LOADER_FAILED }; // values of loader_t.result
+
+// Parses the file and builds everything the packed model needs from it
+static bool _loader_import(loader_t* l)
+{
+    profiler_zone_t zone = profiler_begin("parse");
+    bool            ok   = l->reader->parse(&l->model, l->path, &l->progress);
+    profiler_end(&zone);
+    if (!ok) return false;
+
+    zone = profiler_begin("build");
+    ok   = (l->model.normal_count > 0 || model_compute_normals(&l->model, NORMALS_DEFAULT_CREASE))
+      && model_build_meshlets(&l->model) && (!l->optimize || model_optimize(&l->model))
+      && model_build_lods(&l->model) && model_build_edges(&l->model, EDGES_DEFAULT_CREASE)
+      && model_pack(&l->model, l->format, &l->packed) && model_analyze(&l->model, &l->packed.stats);
+    profiler_end(&zone);
+    return ok;
+}
+
+static void _loader_task(void* userdata, int index)
+{
+    (void)index;
+    loader_t* l      = userdata;
+    double    start  = timer_now();
+    int       result = LOADER_FAILED;
+
+    profiler_name_thread("loader");
+
+    cache_key_t key;
+    bool        keyed = l->use_cache && !l->reader->import && cache_key(l->path, l->format, l->optimize, &key);
+
+    profiler_zone_t zone   = profiler_begin("cache load");
+    bool            loaded = keyed && cache_load(&key, &l->entry);
+    profiler_end(&zone);
+
+    if (loaded) {
+        // The packed buffers point into the mapped cache file, no parsing needed
+        l->cached = true;
+        l->packed = l->entry.packed;
+        atomic_store(&l->progress.bytes_total, l->entry.map.size);
+        progress_add(&l->progress, l->entry.map.size);
+
+        double cached_ms = (timer_now() - start) * 1000.0;
+        log_info("Loaded %s from cache in %.1fms (import took %.1fms, %.1fx faster)", l->path, cached_ms,
+                 l->entry.import_ms, l->entry.import_ms / (cached_ms > 0.0 ? cached_ms : 1e-3));
+        result = LOADER_READY;
+    } else if (l->reader->import) {
+        zone    = profiler_begin("import");
+        bool ok = l->reader->import(&l->packed, l->path, &l->progress);
+        profiler_end(&zone);
+
+        if (ok) {
+            log_info("Imported %s in %.1fms", l->path, (timer_now() - start) * 1000.0);
+            result = LOADER_READY;
+        }
+    } else if (_loader_import(l)) {
+        // Every stage's scratch came from this thread's arena, it is unmapped when the thread exits
+        double import_ms = (timer_now() - start) * 1000.0;
+        log_info("Imported %s in %.1fms (scratch peak %.1fMB)", l->path, import_ms,
+                 arena_scratch()->peak / (1024.0 * 1024.0));
+
+        // Packed positions replace the doubles, only f64 uploads straight from the model
+        if (l->format != VERTEX_FORMAT_F64) {
+            free(l->model.vertices);
+            l->model.vertices        = NULL;
+            l->model.vertex_capacity = 0;
+        }
+
+        // The render thread only reads the packed buffers, so the cache is written while it uploads
+        atomic_store(&l->result, LOADER_READY);
+        result = LOADER_READY;
+
+        if (keyed && l->model.vertex_count > 0 && !progress_cancelled(&l->progress)) {
+            zone = profiler_begin("cache store");
+            cache_store(&key, &l->packed, import_ms);
+            profiler_end(&zone);
+        }
+    }
+
+    if (keyed) cache_key_free(&key);
+
+    atomic_store(&l->result, result);
+    atomic_store(&l->finished, true);
+}
+
+static void _release_if_staged(const gpu_upload_t* up, void** data)
+{
+    if (*data && gpu_upload_staged(up, *data)) {
+        free(*data);
+        *data = NULL;
+    }
+}
+
+// Frees the cpu copies the upload has moved to the gpu, so the peak is not the model and the
+// gpu buffers at once. Only for parsed models, imports and the cache point into mappings.
+static void _loader_release_staged(loader_t* l)
+{
+    _release_if_staged(&l->upload, &l->packed.storage);
+    _release_if_staged(&l->upload, (void**)&l->model.vertices);
+    _release_if_staged(&l->upload, (void**)&l->model.normals);
+    _release_if_staged(&l->upload, (void**)&l->model.texcrds);
+    _release_if_staged(&l->upload, (void**)&l->model.indices);
+    _release_if_staged(&l->upload, (void**)&l->model.edges);
+}
+
+static void _loader_reset(loader_t* l)
+{
+    thread_join(l->thread);
+
+    if (!l->delivered) gpu_upload_abort(&l->upload);
+    preview_discard(&l->preview);
+
+    if (l->cached) {
+        cache_release(&l->entry);
+    } else {
+        packed_model_free(&l->packed);
+        model_free(&l->model);
+    }
+
+    free(l->path);
+    loader_init(l);
+}
+
+void loader_init(loader_t* l)
+{
+    memset(l, 0, sizeof(*l));
+    model_init(&l->model);
+    gpu_model_init(&l->upload.model);
+    progress_reset(&l->progress, 0);
+    atomic_init(&l->preview.batches, NULL);
+    l->progress.preview = &l->preview;
+    atomic_store(&l->result, LOADER_RUNNING);
+    atomic_store(&l->finished, false);
+}
+
+bool loader_start(loader_t* l, const char* path, const model_reader_t* reader, vertex_format_t format, bool optimize)
+{
+    loader_cancel(l);
+
+    l->path      = e_strdup(path);
+    l->reader    = reader;
+    l->format    = format;
+    l->optimize  = optimize;
+    l->use_cache = cache_is_enabled();
+    l->thread    = thread_spawn(_loader_task, l);
+
+    if (!l->thread) {
+        log_error("Failed to start loading %s", path);
+        _loader_reset(l);
+        return false;
+    }
+    return true;
+}
+
+void loader_cancel(loader_t* l)
+{
+    if (!l->thread) return;
+
+    // The parser checks the flag about once per megabyte so the join is short
+    atomic_store(&l->progress.cancel, true);
+    _loader_reset(l);
+}
+
+bool loader_poll(loader_t* l, size_t upload_budget, gpu_model_t* out)
+{
+    if (!l->thread) return false;
+
+    if (l->delivered) {
+        // The loader thread may still be writing the cache from the packed buffers
+        if (atomic_load(&l->finished)) _loader_reset(l);
+        return false;
+    }
+
+    int result = atomic_load(&l->result);
+    if (result == LOADER_RUNNING) return false;
+
+    if (result == LOADER_FAILED) {
+        log_error("Failed to load %s", l->path);
+        _loader_reset(l);
+        return false;
+    }
+
+    profiler_zone_t zone = profiler_begin("upload");
+    bool            ok   = l->uploading || gpu_upload_begin(&l->upload, &l->packed);
+    l->uploading         = ok;
+    ok                   = ok && gpu_upload_step(&l->upload, upload_budget);
+    profiler_end(&zone);
+
+    if (!ok) {
+        _loader_reset(l);
+        return false;
+    }
+
+    // The loader thread may still be writing the cache from the same buffers
+    if (!l->cached && !l->reader->import && atomic_load(&l->finished)) _loader_release_staged(l);
+    if (!gpu_upload_done(&l->upload)) return false;
+
+    // Keep the path around for the caller, the next poll cleans up
+    *out         = l->upload.model;
+    l->delivered = true;
+    return true;
+}
+
+loader_stage_t loader_status(loader_t* l, size_t* done, size_t* total)
+{
+    *done  = 0;
+    *total = 0;
+
+    if (!l->thread || l->delivered) return LOADER_IDLE;
+
+    if (l->uploading) {
+        *done  = l->upload.done_bytes;
+        *total = l->upload.total_bytes;
+        return LOADER_UPLOADING;
+    }
+
+    *done  = atomic_load(&l->progress.bytes_done);
+    *total = atomic_load(&l->progress.bytes_total);
+    return LOADER_READING;
+}
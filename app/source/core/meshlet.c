@@ -0,0 +1,387 @@
+#include "core/meshlet.h"
+
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MESHLET_MORTON_BITS 10 // per axis, the key is 30 bits
+#define MESHLET_RADIX_BITS 10  // three passes over the key
+#define MESHLET_MIN_PARALLEL (1 << 18) // triangles below this are keyed on the calling thread
+
+typedef struct {
+    uint32_t key;
+    uint32_t tri;
+} _morton_t;
+
+typedef struct {
+    const model_t* model;
+    _morton_t*     keys;
+    double         min[3];
+    double         scale[3];
+    int            tri_count;
+    int            task_count;
+} _morton_job_t;
+
+typedef struct {
+    const model_t* model;
+    const double*  center;
+    meshlet_t*     meshlets;
+    float (*boxes)[6];
+    int            count;
+    int            task_count;
+} _bounds_job_t;
+
+// Spreads the low 10 bits so two zero bits sit between each
+static uint32_t _part1by2(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x030000ff;
+    x = (x | x << 8) & 0x0300f00f;
+    x = (x | x << 4) & 0x030c30c3;
+    x = (x | x << 2) & 0x09249249;
+    return x;
+}
+
+static void _morton_task(void* userdata, int index)
+{
+    _morton_job_t* job   = userdata;
+    const model_t* m     = job->model;
+    int            first = (int)((long long)job->tri_count * index / job->task_count);
+    int            last  = (int)((long long)job->tri_count * (index + 1) / job->task_count);
+    const double   max   = (1 << MESHLET_MORTON_BITS) - 1;
+
+    for (int t = first; t < last; t++) {
+        uint32_t cell[3];
+        for (int c = 0; c < 3; c++) {
+            double sum = 0.0;
+            for (int k = 0; k < 3; k++) sum += m->vertices[(size_t)m->indices[t * 3 + k] * 3 + c];
+
+            double q = (sum / 3.0 - job->min[c]) * job->scale[c];
+            cell[c]  = (uint32_t)(q < 0.0 ? 0.0 : q > max ? max : q);
+        }
+
+        job->keys[t] = (_morton_t) { _part1by2(cell[0]) | _part1by2(cell[1]) << 1 | _part1by2(cell[2]) << 2, (uint32_t)t };
+    }
+}
+
+// Stable LSD radix sort, triangles in the same cell keep their order
+static void _radix_sort(_morton_t* keys, _morton_t* scratch, int count)
+{
+    const int buckets = 1 << MESHLET_RADIX_BITS;
+    int       offsets[1 << MESHLET_RADIX_BITS];
+
+    for (int shift = 0; shift < 3 * MESHLET_MORTON_BITS; shift += MESHLET_RADIX_BITS) {
+        memset(offsets, 0, sizeof(offsets));
+        for (int i = 0; i < count; i++) offsets[(keys[i].key >> shift) & (buckets - 1)]++;
+
+        int sum = 0;
+        for (int b = 0; b < buckets; b++) {
+            int n      = offsets[b];
+            offsets[b] = sum;
+            sum       += n;
+        }
+
+        for (int i = 0; i < count; i++) scratch[offsets[(keys[i].key >> shift) & (buckets - 1)]++] = keys[i];
+
+        _morton_t* swap = keys;
+        keys            = scratch;
+        scratch         = swap;
+    }
+}
+
+bool model_build_meshlets(model_t* m)
+{
+    free(m->meshlets);
+    m->meshlets      = NULL;
+    m->meshlet_count = 0;
+
+    int tri_count = m->indice_count / 3;
+    if (tri_count == 0) return true;
+
+    double start = timer_now();
+
+    // A trailing partial triangle isn't drawn anyway
+    m->indice_count = tri_count * 3;
+
+    // The sort keys are scratch, the reordered indices and the meshlets stay with the model
+    int           meshlet_count = (tri_count + MESHLET_TRIANGLES - 1) / MESHLET_TRIANGLES;
+    arena_t*      arena         = arena_scratch();
+    arena_mark_t  mark          = arena_mark(arena);
+    _morton_t*    keys          = arena_alloc(arena, (size_t)tri_count * sizeof(_morton_t));
+    _morton_t*    scratch       = arena_alloc(arena, (size_t)tri_count * sizeof(_morton_t));
+    unsigned int* indices       = malloc((size_t)tri_count * 3 * sizeof(unsigned int));
+    meshlet_t*    meshlets      = calloc(meshlet_count, sizeof(meshlet_t));
+    bool          ok            = keys && scratch && indices && meshlets;
+
+    if (!ok) {
+        log_error("Failed to allocate meshlet buffers for %d triangles", tri_count);
+        free(indices);
+        free(meshlets);
+        goto cleanup;
+    }
+
+    double min[3], max[3];
+    model_get_bounds(m, min, max);
+
+    _morton_job_t job = { .model = m, .keys = keys, .tri_count = tri_count };
+    for (int c = 0; c < 3; c++) {
+        double size  = max[c] - min[c];
+        job.min[c]   = min[c];
+        job.scale[c] = size > 0.0 ? ((1 << MESHLET_MORTON_BITS) - 1) / size : 0.0;
+    }
+
+    job.task_count = tri_count > MESHLET_MIN_PARALLEL ? thread_count() : 1;
+    thread_parallel(job.task_count, _morton_task, &job);
+
+    // Each pass swaps the buffers, after the odd number of passes the result is in scratch
+    _radix_sort(keys, scratch, tri_count);
+    const _morton_t* sorted = scratch;
+
+    for (int t = 0; t < tri_count; t++) {
+        memcpy(&indices[t * 3], &m->indices[sorted[t].tri * 3], 3 * sizeof(unsigned int));
+    }
+
+    for (int k = 0; k < meshlet_count; k++) {
+        int first               = k * MESHLET_TRIANGLES;
+        int count               = tri_count - first < MESHLET_TRIANGLES ? tri_count - first : MESHLET_TRIANGLES;
+        meshlets[k].first_index = (unsigned int)first * 3;
+        meshlets[k].index_count = (unsigned int)count * 3;
+        meshlets[k].cone_cutoff = 1.0f;
+    }
+
+    free(m->indices);
+    m->indices         = indices;
+    m->indice_capacity = tri_count * 3;
+    m->meshlets        = meshlets;
+    m->meshlet_count   = meshlet_count;
+
+    log_info("Split %d triangles into %d meshlets in %.1fms", tri_count, meshlet_count,
+             (timer_now() - start) * 1000.0);
+
+cleanup:
+    arena_release(arena, mark);
+    return ok;
+}
+
+// Bounds and normal cone of one meshlet, the box is kept for the bvh
+static void _meshlet_bounds(const model_t* m, const double center[3], meshlet_t* meshlet, float box[6])
+{
+    float normals[MESHLET_TRIANGLES][3];
+    float axis[3] = { 0.0f, 0.0f, 0.0f };
+    int   facing  = 0;
+
+    for (int c = 0; c < 3; c++) {
+        box[c]     = INFINITY;
+        box[c + 3] = -INFINITY;
+    }
+
+    for (unsigned int i = 0; i < meshlet->index_count; i += 3) {
+        float p[3][3];
+        for (int k = 0; k < 3; k++) {
+            const double* v = &m->vertices[(size_t)m->indices[meshlet->first_index + i + k] * 3];
+            for (int c = 0; c < 3; c++) {
+                p[k][c]    = (float)(v[c] - center[c]);
+                box[c]     = fminf(box[c], p[k][c]);
+                box[c + 3] = fmaxf(box[c + 3], p[k][c]);
+            }
+        }
+
+        vec3 e1, e2, n;
+        glm_vec3_sub(p[1], p[0], e1);
+        glm_vec3_sub(p[2], p[0], e2);
+        glm_vec3_cross(e1, e2, n);
+
+        // Degenerate triangles face nowhere and don't widen the cone
+        float len = glm_vec3_norm(n);
+        if (len <= 0.0f) continue;
+
+        glm_vec3_scale(n, 1.0f / len, normals[facing]);
+        glm_vec3_add(axis, normals[facing], axis);
+        facing++;
+    }
+
+    vec3 mid = { (box[0] + box[3]) * 0.5f, (box[1] + box[4]) * 0.5f, (box[2] + box[5]) * 0.5f };
+    float radius = 0.0f;
+    for (unsigned int i = 0; i < meshlet->index_count; i++) {
+        const double* v = &m->vertices[(size_t)m->indices[meshlet->first_index + i] * 3];
+        vec3          p = { (float)(v[0] - center[0]), (float)(v[1] - center[1]), (float)(v[2] - center[2]) };
+        radius          = fmaxf(radius, glm_vec3_distance(p, mid));
+    }
+
+    glm_vec3_copy(mid, meshlet->center);
+    meshlet->radius      = radius;
+    meshlet->cone_cutoff = 1.0f;
+    glm_vec3_zero(meshlet->cone_axis);
+
+    float len = glm_vec3_norm(axis);
+    if (facing == 0 || len <= 0.0f) return;
+    glm_vec3_scale(axis, 1.0f / len, axis);
+
+    float min_dot = 1.0f;
+    for (int t = 0; t < facing; t++) min_dot = fminf(min_dot, glm_vec3_dot(axis, normals[t]));
+
+    // Spread past ~84 degrees leaves no direction from which all triangles face away
+    glm_vec3_copy(axis, meshlet->cone_axis);
+    if (min_dot > 0.1f) meshlet->cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+}
+
+static void _bounds_task(void* userdata, int index)
+{
+    _bounds_job_t* job = userdata;
+
+    for (int k = index; k < job->count; k += job->task_count) {
+        _meshlet_bounds(job->model, job->center, &job->meshlets[k], job->boxes[k]);
+    }
+}
+
+// Halves the meshlet order until the leaves are small, the Morton order makes halves compact
+static void _build_node(float (*boxes)[6], int first, int count, meshlet_node_t* nodes, int* node_count)
+{
+    meshlet_node_t* node = &nodes[(*node_count)++];
+    node->first          = first;
+    node->count          = count;
+
+    for (int c = 0; c < 3; c++) {
+        node->min[c] = INFINITY;
+        node->max[c] = -INFINITY;
+    }
+    for (int k = first; k < first + count; k++) {
+        for (int c = 0; c < 3; c++) {
+            node->min[c] = fminf(node->min[c], boxes[k][c]);
+            node->max[c] = fmaxf(node->max[c], boxes[k][c + 3]);
+        }
+    }
+
+    if (count > MESHLET_LEAF_SIZE) {
+        int half = count / 2;
+        _build_node(boxes, first, half, nodes, node_count);
+        _build_node(boxes, first + half, count - half, nodes, node_count);
+    }
+    node->skip = *node_count;
+}
+
+bool meshlets_build_bounds(const model_t* m, const double center[3], meshlet_t* meshlets, int count,
+                           meshlet_node_t* nodes, int* node_count)
+{
+    *node_count = 0;
+    if (count == 0) return true;
+
+    arena_t*     arena = arena_scratch();
+    arena_mark_t mark  = arena_mark(arena);
+    float (*boxes)[6]  = arena_alloc(arena, (size_t)count * sizeof(*boxes));
+    if (!boxes) {
+        log_error("Failed to allocate bounds for %d meshlets", count);
+        return false;
+    }
+
+    _bounds_job_t job = {
+        .model    = m,
+        .center   = center,
+        .meshlets = meshlets,
+        .boxes    = boxes,
+        .count    = count,
+    };
+    job.task_count = count > 1024 ? thread_count() : 1;
+    thread_parallel(job.task_count, _bounds_task, &job);
+
+    _build_node(boxes, 0, count, nodes, node_count);
+
+    arena_release(arena, mark);
+    return true;
+}
+
+void meshlets_frustum(mat4 clip, vec4 planes[6])
+{
+    // Rows of the matrix combined, see Gribb and Hartmann
+    for (int i = 0; i < 3; i++) {
+        for (int c = 0; c < 4; c++) {
+            planes[i * 2][c]     = clip[c][3] + clip[c][i];
+            planes[i * 2 + 1][c] = clip[c][3] - clip[c][i];
+        }
+    }
+
+    for (int i = 0; i < 6; i++) {
+        float len = glm_vec3_norm(planes[i]);
+        if (len > 0.0f) glm_vec4_scale(planes[i], 1.0f / len, planes[i]);
+    }
+}
+
+// -1 outside a plane, 1 inside all of them, 0 crossing
+static int _box_test(const meshlet_node_t* node, vec4 planes[6])
+{
+    int result = 1;
+    for (int i = 0; i < 6; i++) {
+        const float* p    = planes[i];
+        float        near = p[3], far = p[3];
+
+        for (int c = 0; c < 3; c++) {
+            near += p[c] * (p[c] > 0.0f ? node->max[c] : node->min[c]);
+            far  += p[c] * (p[c] > 0.0f ? node->min[c] : node->max[c]);
+        }
+
+        if (near < 0.0f) return -1;
+        if (far < 0.0f) result = 0;
+    }
+    return result;
+}
+
+static bool _meshlet_visible(const meshlet_t* meshlet, vec4 planes[6], bool test_planes, const float* eye)
+{
+    if (test_planes) {
+        for (int i = 0; i < 6; i++) {
+            if (glm_vec3_dot(planes[i], (float*)meshlet->center) + planes[i][3] < -meshlet->radius) return false;
+        }
+    }
+
+    if (eye && meshlet->cone_cutoff < 1.0f) {
+        vec3 to;
+        glm_vec3_sub((float*)meshlet->center, (float*)eye, to);
+        if (glm_vec3_dot(to, (float*)meshlet->cone_axis) >= meshlet->cone_cutoff * glm_vec3_norm(to) + meshlet->radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int meshlets_cull(const meshlet_t* meshlets, const meshlet_node_t* nodes, int node_count, vec4 planes[6],
+                  const float* eye, meshlet_range_t* ranges)
+{
+    int count = 0;
+
+    for (int i = 0; i < node_count;) {
+        const meshlet_node_t* node = &nodes[i];
+
+        int test = _box_test(node, planes);
+        if (test < 0) {
+            i = node->skip;
+            continue;
+        }
+
+        // Inner nodes that cross the frustum are refined, everything else is decided per meshlet
+        bool leaf = node->skip == i + 1;
+        if (test == 0 && !leaf) {
+            i++;
+            continue;
+        }
+
+        for (int k = node->first; k < node->first + node->count; k++) {
+            const meshlet_t* meshlet = &meshlets[k];
+            if (!_meshlet_visible(meshlet, planes, test == 0, eye)) continue;
+
+            if (count > 0 && ranges[count - 1].first_index + ranges[count - 1].index_count == meshlet->first_index) {
+                ranges[count - 1].index_count += meshlet->index_count;
+            } else {
+                ranges[count++] = (meshlet_range_t) { meshlet->first_index, meshlet->index_count };
+            }
+        }
+        i = node->skip;
+    }
+    return count;
+}
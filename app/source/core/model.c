@@ -1,45 +1,51 @@
 #include "core/model.h"
 
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "glad/glad.h"
 #include "log.h"
 
-#include "engine/shader.h"
-
-static const char* vs_source = "#version 460 core\n"
-                               "layout (location = 0) in dvec3 aPos;\n"
-                               "out vec3 FragPos;\n"
-                               "uniform mat4 uProj;\n"
-                               "uniform mat4 uView;\n"
-                               "uniform mat4 uModel;\n"
-                               "uniform vec3 uModelMin;\n"
-                               "uniform vec3 uModelMax;\n"
-                               "void main() {\n"
-                               "    vec3 center = (uModelMax + uModelMin) * 0.5;\n"
-                               "    vec3 extent = (uModelMax - uModelMin) * 0.5;\n"
-                               "    float maxExtent = max(max(extent.x, extent.y), extent.z);\n"
-                               "    vec3 normalized = (vec3(aPos) - center) / maxExtent;\n"
-                               "    vec3 scaled = normalized * 1.0f;\n"
-                               "    gl_Position = uProj * uView * uModel * vec4(scaled, 1.0);\n"
-                               "    FragPos = vec3(uModel * vec4(scaled, 1.0));\n"
-                               "}\n";
-
-static const char* fs_source = "#version 460 core\n"
-                               "in vec3 FragPos;\n"
-                               "out vec4 FragColor;\n"
-                               "void main() {\n"
-                               "    // Calculate face normal using derivatives\n"
-                               "    vec3 dx = dFdx(FragPos);\n"
-                               "    vec3 dy = dFdy(FragPos);\n"
-                               "    vec3 normal = normalize(cross(dx, dy));\n"
-                               "    vec3 lightDir = normalize(vec3(1.0, 10.0, -1.0));\n"
-                               "    float diff = max(dot(normal, lightDir), 0.0);\n"
-                               "    vec3 baseColor = vec3(0.8, 0.8, 0.8);\n"
-                               "    vec3 ambient = 0.2 * baseColor;\n"
-                               "    vec3 diffuse = diff * baseColor;\n"
-                               "    FragColor = vec4(ambient + diffuse, 1.0);\n"
-                               "}\n";
+#include "core/meshlet.h"
+#include "engine/thread.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MODEL_BOUNDS_AVX // compiled for AVX on its own, see _bounds_range
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MODEL_MIN_PARALLEL (1 << 18) // vertices below this are handled on the calling thread
+#define MODEL_BOUNDS_MAX_TASKS 64
+
+static const char* _format_names[VERTEX_FORMAT_COUNT] = {
+    [VERTEX_FORMAT_F64]     = "f64",
+    [VERTEX_FORMAT_F32]     = "f32",
+    [VERTEX_FORMAT_UNORM16] = "unorm16",
+};
+
+// Bytes per vertex, unorm16 is padded to 4 components to keep attributes 4 byte aligned
+static const int _format_strides[VERTEX_FORMAT_COUNT] = {
+    [VERTEX_FORMAT_F64]     = 3 * sizeof(double),
+    [VERTEX_FORMAT_F32]     = 3 * sizeof(float),
+    [VERTEX_FORMAT_UNORM16] = 4 * sizeof(unsigned short),
+};
+
+typedef struct {
+    const model_t*  model;
+    vertex_format_t format;
+    void*           dst;
+    double          center[3];
+    double          inv_size[3];
+    int             vertex_count;
+    int             task_count;
+} _pack_job_t;
 
 void model_init(model_t* m)
 {
@@ -48,10 +54,21 @@ void model_init(model_t* m)
     m->texcrd_count = 0;
     m->indice_count = 0;
 
-    m->indices  = malloc(MAX_INDICES * sizeof(unsigned int));
-    m->vertices = malloc(MAX_VERTICES * 3 * sizeof(double));
-    m->texcrds  = malloc(MAX_VERTICES * 2 * sizeof(float));
-    m->normals  = malloc(MAX_VERTICES * 3 * sizeof(float));
+    m->vertex_capacity = 0;
+    m->normal_capacity = 0;
+    m->texcrd_capacity = 0;
+    m->indice_capacity = 0;
+
+    // Buffers are allocated on demand through model_reserve
+    m->indices  = NULL;
+    m->vertices = NULL;
+    m->texcrds  = NULL;
+    m->normals  = NULL;
+
+    m->meshlets      = NULL;
+    m->meshlet_count = 0;
+    m->lod_count     = 0;
+    m->edges         = NULL;
 }
 
 void model_free(model_t* m)
@@ -60,98 +77,716 @@ void model_free(model_t* m)
     free(m->vertices);
     free(m->texcrds);
     free(m->normals);
+    free(m->meshlets);
+    free(m->edges);
+    model_init(m);
 }
 
-gpu_model_t model_upload(model_t* m)
+static bool _model_grow(void** buffer, int* capacity, int needed, size_t element_size)
 {
-    gpu_model_t g;
+    if (needed <= *capacity) return true;
 
-    vec3 min = { INFINITY, INFINITY, INFINITY };
-    vec3 max = { -INFINITY, -INFINITY, -INFINITY };
+    // Grow by 1.5x so repeated small reserves stay amortized O(1), the first reserve is exact
+    long long grown = *capacity + *capacity / 2;
+    if (grown < needed) grown = needed;
+    if (grown > INT_MAX) grown = INT_MAX;
 
-    for (int i = 0; i < m->vertex_count; i += 3) {
-        min[0] = fmin(min[0], m->vertices[i]);
-        min[1] = fmin(min[1], m->vertices[i + 1]);
-        min[2] = fmin(min[2], m->vertices[i + 2]);
+    void* data = realloc(*buffer, (size_t)grown * element_size);
+    if (!data) {
+        log_error("Failed to grow model buffer to %lld elements", grown);
+        return false;
+    }
+
+    *buffer   = data;
+    *capacity = (int)grown;
+    return true;
+}
+
+bool model_reserve(model_t* m, int vertex_count, int indice_count, int normal_count, int texcrd_count)
+{
+    if (vertex_count < 0 || indice_count < 0 || normal_count < 0 || texcrd_count < 0) {
+        log_error("Model exceeds the supported element count");
+        return false;
+    }
+
+    return _model_grow((void**)&m->vertices, &m->vertex_capacity, vertex_count, sizeof(double))
+        && _model_grow((void**)&m->indices, &m->indice_capacity, indice_count, sizeof(unsigned int))
+        && _model_grow((void**)&m->normals, &m->normal_capacity, normal_count, sizeof(float))
+        && _model_grow((void**)&m->texcrds, &m->texcrd_capacity, texcrd_count, sizeof(float));
+}
+
+const char* vertex_format_name(vertex_format_t format)
+{
+    return _format_names[format];
+}
+
+int vertex_format_stride(vertex_format_t format)
+{
+    return _format_strides[format];
+}
+
+// The vector paths take whole runs of xyz, so lane l of register r holds component (r * lanes + l) % 3
+// and the lanes are folded by component into min and max at the end. They return the first vertex left.
+#if defined(MODEL_BOUNDS_AVX)
+__attribute__((target("avx"))) static int _bounds_avx(const double* v, int i, int last, double min[3], double max[3])
+{
+    if (last - i < 4) return i;
+
+    __m256d lo[3], hi[3];
+    for (int r = 0; r < 3; r++) lo[r] = hi[r] = _mm256_loadu_pd(&v[(size_t)i * 3 + r * 4]);
+
+    for (i += 4; i + 4 <= last; i += 4) {
+        for (int r = 0; r < 3; r++) {
+            __m256d x = _mm256_loadu_pd(&v[(size_t)i * 3 + r * 4]);
+            lo[r]     = _mm256_min_pd(lo[r], x);
+            hi[r]     = _mm256_max_pd(hi[r], x);
+        }
+    }
+
+    double l[12], h[12];
+    for (int r = 0; r < 3; r++) {
+        _mm256_storeu_pd(&l[r * 4], lo[r]);
+        _mm256_storeu_pd(&h[r * 4], hi[r]);
+    }
+    for (int k = 0; k < 12; k++) {
+        min[k % 3] = fmin(min[k % 3], l[k]);
+        max[k % 3] = fmax(max[k % 3], h[k]);
+    }
+    return i;
+}
+#endif
+
+#if defined(__SSE2__)
+static int _bounds_sse2(const double* v, int i, int last, double min[3], double max[3])
+{
+    if (last - i < 2) return i;
+
+    __m128d lo[3], hi[3];
+    for (int r = 0; r < 3; r++) lo[r] = hi[r] = _mm_loadu_pd(&v[(size_t)i * 3 + r * 2]);
+
+    for (i += 2; i + 2 <= last; i += 2) {
+        for (int r = 0; r < 3; r++) {
+            __m128d x = _mm_loadu_pd(&v[(size_t)i * 3 + r * 2]);
+            lo[r]     = _mm_min_pd(lo[r], x);
+            hi[r]     = _mm_max_pd(hi[r], x);
+        }
+    }
+
+    double l[6], h[6];
+    for (int r = 0; r < 3; r++) {
+        _mm_storeu_pd(&l[r * 2], lo[r]);
+        _mm_storeu_pd(&h[r * 2], hi[r]);
+    }
+    for (int k = 0; k < 6; k++) {
+        min[k % 3] = fmin(min[k % 3], l[k]);
+        max[k % 3] = fmax(max[k % 3], h[k]);
+    }
+    return i;
+}
+#endif
+
+// Bounds of vertices first to last. AVX is picked at runtime since builds don't target it, SSE2
+// takes what AVX leaves of a run and the scalar loop the rest.
+static void _bounds_range(const double* v, int first, int last, double min[3], double max[3])
+{
+    min[0] = min[1] = min[2] = INFINITY;
+    max[0] = max[1] = max[2] = -INFINITY;
+
+    int i = first;
+#if defined(MODEL_BOUNDS_AVX)
+    if (__builtin_cpu_supports("avx")) i = _bounds_avx(v, i, last, min, max);
+#endif
+#if defined(__SSE2__)
+    i = _bounds_sse2(v, i, last, min, max);
+#endif
+
+    for (; i < last; i++) {
+        for (int c = 0; c < 3; c++) {
+            min[c] = fmin(min[c], v[(size_t)i * 3 + c]);
+            max[c] = fmax(max[c], v[(size_t)i * 3 + c]);
+        }
+    }
+}
+
+typedef struct {
+    const double* vertices;
+    int           vertex_count; // vertices, not doubles
+    int           task_count;
+    double        min[MODEL_BOUNDS_MAX_TASKS][3];
+    double        max[MODEL_BOUNDS_MAX_TASKS][3];
+} _bounds_job_t;
+
+static void _bounds_task(void* userdata, int index)
+{
+    _bounds_job_t* job   = userdata;
+    int            first = (int)((long long)job->vertex_count * index / job->task_count);
+    int            last  = (int)((long long)job->vertex_count * (index + 1) / job->task_count);
+    _bounds_range(job->vertices, first, last, job->min[index], job->max[index]);
+}
+
+void model_get_bounds(const model_t* m, double min[3], double max[3])
+{
+    _bounds_job_t job = { .vertices = m->vertices, .vertex_count = m->vertex_count / 3 };
+
+    int tasks      = job.vertex_count > MODEL_MIN_PARALLEL ? thread_count() : 1;
+    job.task_count = tasks < MODEL_BOUNDS_MAX_TASKS ? tasks : MODEL_BOUNDS_MAX_TASKS;
+    thread_parallel(job.task_count, _bounds_task, &job);
+
+    for (int c = 0; c < 3; c++) {
+        min[c] = job.min[0][c];
+        max[c] = job.max[0][c];
+        for (int t = 1; t < job.task_count; t++) {
+            min[c] = fmin(min[c], job.min[t][c]);
+            max[c] = fmax(max[c], job.max[t][c]);
+        }
+    }
+}
+
+static void _pack_task(void* userdata, int index)
+{
+    _pack_job_t* job = userdata;
+
+    int first = (int)((long long)job->vertex_count * index / job->task_count);
+    int last  = (int)((long long)job->vertex_count * (index + 1) / job->task_count);
+
+    const double* src = job->model->vertices;
+
+    if (job->format == VERTEX_FORMAT_F32) {
+        float* dst = job->dst;
+        for (int v = first; v < last; v++) {
+            dst[v * 3 + 0] = (float)(src[v * 3 + 0] - job->center[0]);
+            dst[v * 3 + 1] = (float)(src[v * 3 + 1] - job->center[1]);
+            dst[v * 3 + 2] = (float)(src[v * 3 + 2] - job->center[2]);
+        }
+    } else if (job->format == VERTEX_FORMAT_UNORM16) {
+        // center/inv_size hold the bbox min and 65535 / size here
+        unsigned short* dst = job->dst;
+        for (int v = first; v < last; v++) {
+            for (int c = 0; c < 3; c++) {
+                double q       = (src[v * 3 + c] - job->center[c]) * job->inv_size[c] + 0.5;
+                dst[v * 4 + c] = (unsigned short)(q < 0.0 ? 0.0 : (q > 65535.0 ? 65535.0 : q));
+            }
+            dst[v * 4 + 3] = 0;
+        }
+    } else {
+        memcpy((double*)job->dst + (size_t)first * 3, src + (size_t)first * 3,
+               (size_t)(last - first) * 3 * sizeof(double));
+    }
+}
+
+void model_pack_vertices(const model_t* m, vertex_format_t format, const double min[3], const double max[3],
+                         void* dst, vec3 decode_scale, vec3 decode_offset)
+{
+    _pack_job_t job = {
+        .model        = m,
+        .format       = format,
+        .dst          = dst,
+        .vertex_count = m->vertex_count / 3,
+    };
+
+    for (int c = 0; c < 3; c++) {
+        double center = (min[c] + max[c]) * 0.5;
+        double size   = max[c] - min[c];
+
+        switch (format) {
+        case VERTEX_FORMAT_F64:
+            // Raw positions, re-centred in the shader like before
+            decode_scale[c]  = 1.0f;
+            decode_offset[c] = (float)-center;
+            break;
+        case VERTEX_FORMAT_F32:
+            // Re-centring in double precision keeps float32 precision where the model is
+            job.center[c]    = center;
+            decode_scale[c]  = 1.0f;
+            decode_offset[c] = 0.0f;
+            break;
+        default:
+            job.center[c]    = min[c];
+            job.inv_size[c]  = size > 0.0 ? 65535.0 / size : 0.0;
+            decode_scale[c]  = (float)size;
+            decode_offset[c] = (float)(min[c] - center);
+            break;
+        }
+    }
+
+    job.task_count = job.vertex_count > MODEL_MIN_PARALLEL ? thread_count() : 1;
+    thread_parallel(job.task_count, _pack_task, &job);
+}
+
+bool model_pack(const model_t* m, vertex_format_t format, packed_model_t* p)
+{
+    memset(p, 0, sizeof(*p));
+
+    double min[3], max[3];
+    model_get_bounds(m, min, max);
+
+    for (int c = 0; c < 3; c++) {
+        p->min_vertex[c] = (float)min[c];
+        p->max_vertex[c] = (float)max[c];
+    }
+
+    p->format       = format;
+    p->vertex_count = m->vertex_count;
+    p->indice_count = m->indice_count;
+    p->normal_count = m->normal_count;
+    p->texcrd_count = m->texcrd_count;
+    p->vertex_bytes = (size_t)(m->vertex_count / 3) * vertex_format_stride(format);
+    p->indices      = m->indices;
+    p->normals      = m->normals;
+    p->texcrds      = m->texcrds;
+    p->edges        = m->edges;
+    p->lod_count    = m->lod_count;
+    memcpy(p->lods, m->lods, sizeof(p->lods));
+
+    // f64 is uploaded straight from the model, everything else is packed into owned storage
+    if (format == VERTEX_FORMAT_F64) {
+        p->vertices = m->vertices;
+    } else {
+        p->storage = malloc(p->vertex_bytes ? p->vertex_bytes : 1);
+        if (!p->storage) {
+            log_error("Failed to allocate %zu bytes for packed vertices", p->vertex_bytes);
+            return false;
+        }
+        p->vertices = p->storage;
+    }
+
+    model_pack_vertices(m, format, min, max, (void*)p->vertices, p->decode_scale, p->decode_offset);
+
+    // Culling works on the decoded positions, which are centered on the bbox in every format
+    if (m->meshlet_count > 0) {
+        double center[3];
+        for (int c = 0; c < 3; c++) center[c] = (min[c] + max[c]) * 0.5;
+
+        size_t meshlet_bytes = (size_t)m->meshlet_count * sizeof(meshlet_t);
+        int    node_capacity = 2 * m->meshlet_count;
+
+        p->cull_storage = malloc(meshlet_bytes + (size_t)node_capacity * sizeof(meshlet_node_t));
+        if (!p->cull_storage) {
+            log_error("Failed to allocate %d meshlets", m->meshlet_count);
+            packed_model_free(p);
+            return false;
+        }
+
+        meshlet_t*      meshlets = p->cull_storage;
+        meshlet_node_t* nodes    = (meshlet_node_t*)((char*)p->cull_storage + meshlet_bytes);
+        memcpy(meshlets, m->meshlets, meshlet_bytes);
+
+        if (!meshlets_build_bounds(m, center, meshlets, m->meshlet_count, nodes, &p->node_count)) {
+            packed_model_free(p);
+            return false;
+        }
 
-        max[0] = fmax(max[0], m->vertices[i]);
-        max[1] = fmax(max[1], m->vertices[i + 1]);
-        max[2] = fmax(max[2], m->vertices[i + 2]);
+        // Quantized positions land up to half a step off the exact ones
+        if (format == VERTEX_FORMAT_UNORM16) {
+            float pad = 0.0f;
+            for (int c = 0; c < 3; c++) pad = fmaxf(pad, (float)((max[c] - min[c]) / 65535.0));
+
+            for (int k = 0; k < m->meshlet_count; k++) meshlets[k].radius += pad;
+            for (int k = 0; k < p->node_count; k++) {
+                for (int c = 0; c < 3; c++) {
+                    nodes[k].min[c] -= pad;
+                    nodes[k].max[c] += pad;
+                }
+            }
+        }
+        p->meshlets      = meshlets;
+        p->nodes         = nodes;
+        p->meshlet_count = m->meshlet_count;
     }
+    return true;
+}
 
-    glm_vec3_copy(min, g.min_vertex);
-    glm_vec3_copy(max, g.max_vertex);
+void packed_model_free(packed_model_t* p)
+{
+    for (int i = 0; i < p->map_count; i++) {
+        file_unmap(&p->maps[i]);
+    }
+    free(p->maps);
+    free(p->views);
+    free(p->draws);
+    free(p->storage);
+    free(p->cull_storage);
+    memset(p, 0, sizeof(*p));
+}
 
-    glm_mat4_identity(g.model);
-    glGenVertexArrays(1, &g.vao);
-    glBindVertexArray(g.vao);
+gpu_model_t model_upload(model_t* m, vertex_format_t format)
+{
+    packed_model_t packed;
+    if (!model_pack(m, format, &packed)) {
+        gpu_model_t g;
+        gpu_model_init(&g);
+        return g;
+    }
 
-    // Vertex buffer object
-    glGenBuffers(1, &g.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, g.vbo);
-    glBufferData(GL_ARRAY_BUFFER, m->vertex_count * sizeof(double), m->vertices, GL_STATIC_DRAW);
-    glVertexAttribLPointer(0, 3, GL_DOUBLE, 0, NULL);
-    glEnableVertexAttribArray(0);
+    gpu_model_t g = gpu_model_create(&packed);
+    packed_model_free(&packed);
+    return g;
+}
+
+gpu_model_t gpu_model_create(const packed_model_t* p)
+{
+    gpu_upload_t up;
+    if (!gpu_upload_begin(&up, p) || !gpu_upload_step(&up, SIZE_MAX)) {
+        gpu_model_init(&up.model);
+    }
+    return up.model;
+}
+
+// A model packed from a model_t or the cache is one draw over up to four views
+static void _single_draw(const packed_model_t* p, packed_view_t views[4], int* view_count, packed_draw_t* draw)
+{
+    static const unsigned int position_types[VERTEX_FORMAT_COUNT] = {
+        [VERTEX_FORMAT_F64]     = GL_DOUBLE,
+        [VERTEX_FORMAT_F32]     = GL_FLOAT,
+        [VERTEX_FORMAT_UNORM16] = GL_UNSIGNED_SHORT,
+    };
+
+    memset(draw, 0, sizeof(*draw));
+    glm_mat4_identity(draw->transform);
+
+    int n    = 0;
+    views[n] = (packed_view_t) { GL_ARRAY_BUFFER, p->vertices, p->vertex_bytes };
+
+    draw->position = (packed_attrib_t) {
+        .view       = n++,
+        .stride     = vertex_format_stride(p->format),
+        .type       = position_types[p->format],
+        .size       = 3,
+        .normalized = p->format == VERTEX_FORMAT_UNORM16,
+    };
+    draw->normal.view  = -1;
+    draw->texcrd.view  = -1;
+    draw->vertex_count = p->vertex_count / 3;
+
+    if (p->normal_count > 0) {
+        views[n]     = (packed_view_t) { GL_ARRAY_BUFFER, p->normals, p->normal_count * sizeof(float) };
+        draw->normal = (packed_attrib_t) { .view = n++, .type = GL_FLOAT, .size = 3 };
+    }
+
+    if (p->texcrd_count > 0) {
+        views[n]     = (packed_view_t) { GL_ARRAY_BUFFER, p->texcrds, p->texcrd_count * sizeof(float) };
+        draw->texcrd = (packed_attrib_t) { .view = n++, .type = GL_FLOAT, .size = 2 };
+    }
+
+    views[n]         = (packed_view_t) { GL_ELEMENT_ARRAY_BUFFER, p->indices, p->indice_count * sizeof(unsigned int) };
+    draw->index_view = n++;
+    draw->index_type = GL_UNSIGNED_INT;
+    draw->mode       = GL_TRIANGLES;
+    draw->count      = p->lod_count > 0 ? (int)p->lods[0].index_count : p->indice_count;
+
+    *view_count = n;
+}
+
+static void _bind_attrib(unsigned int location, const packed_attrib_t* a, const unsigned int* buffers)
+{
+    if (a->view < 0) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[a->view]);
+    if (a->type == GL_DOUBLE) {
+        glVertexAttribLPointer(location, a->size, GL_DOUBLE, a->stride, (const void*)a->offset);
+    } else {
+        glVertexAttribPointer(location, a->size, a->type, a->normalized ? GL_TRUE : GL_FALSE, a->stride,
+                              (const void*)a->offset);
+    }
+    glEnableVertexAttribArray(location);
+}
+
+bool gpu_upload_begin(gpu_upload_t* up, const packed_model_t* p)
+{
+    memset(up, 0, sizeof(*up));
+
+    gpu_model_t* g = &up->model;
+    gpu_model_init(g);
+
+    glm_vec3_copy((float*)p->min_vertex, g->min_vertex);
+    glm_vec3_copy((float*)p->max_vertex, g->max_vertex);
+    glm_vec3_copy((float*)p->decode_scale, g->decode_scale);
+    glm_vec3_copy((float*)p->decode_offset, g->decode_offset);
+    g->format = p->format;
+    g->stats  = p->stats;
+
+    packed_view_t        single_views[5];
+    packed_draw_t        single_draw;
+    const packed_view_t* views      = p->views;
+    const packed_draw_t* draws      = p->draws;
+    int                  view_count = p->view_count;
+    int                  draw_count = p->draw_count;
+
+    if (draw_count == 0) {
+        _single_draw(p, single_views, &view_count, &single_draw);
+        views      = single_views;
+        draws      = &single_draw;
+        draw_count = 1;
+
+        g->position_buffer = single_draw.position.view;
+        g->normal_buffer   = single_draw.normal.view;
+        g->index_buffer    = single_draw.index_view;
+        g->lod_count       = p->lod_count;
+
+        // Feature edges are only read by the pools, they get a buffer of their own and no attribute
+        if (p->edges) {
+            single_views[view_count] = (packed_view_t) { GL_ARRAY_BUFFER, p->edges, (size_t)p->indice_count / 3 };
+            g->edge_buffer           = view_count++;
+        }
+        memcpy(g->lods, p->lods, sizeof(g->lods));
+
+        if (p->meshlet_count > 0) {
+            g->meshlets = malloc((size_t)p->meshlet_count * sizeof(meshlet_t));
+            g->nodes    = malloc((size_t)p->node_count * sizeof(meshlet_node_t));
+            if (!g->meshlets || !g->nodes) {
+                log_error("Failed to allocate %d meshlets", p->meshlet_count);
+                gpu_upload_abort(up);
+                return false;
+            }
+            memcpy(g->meshlets, p->meshlets, (size_t)p->meshlet_count * sizeof(meshlet_t));
+            memcpy(g->nodes, p->nodes, (size_t)p->node_count * sizeof(meshlet_node_t));
+            g->meshlet_count = p->meshlet_count;
+            g->node_count    = p->node_count;
+        }
+    }
+
+    g->buffers = calloc(view_count ? view_count : 1, sizeof(unsigned int));
+    g->draws   = calloc(draw_count, sizeof(gpu_draw_t));
+    up->parts  = calloc(view_count ? view_count : 1, sizeof(gpu_upload_part_t));
+
+    if (!g->buffers || !g->draws || !up->parts) {
+        log_error("Failed to allocate upload state for %d buffers", view_count);
+        gpu_upload_abort(up);
+        return false;
+    }
+
+    // Storage only, the contents are streamed in by gpu_upload_step. Allocation goes through the
+    // copy target so the element array binding of whatever vao is bound stays untouched.
+    glGenBuffers(view_count, g->buffers);
+    g->buffer_count = view_count;
+    for (int i = 0; i < view_count; i++) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g->buffers[i]);
+        if (GLAD_GL_VERSION_4_4) {
+            // Dynamic storage keeps glBufferSubData legal should the staging ring fail to map
+            glBufferStorage(GL_COPY_WRITE_BUFFER, views[i].bytes ? views[i].bytes : 1, NULL, GL_DYNAMIC_STORAGE_BIT);
+        } else {
+            glBufferData(GL_COPY_WRITE_BUFFER, views[i].bytes, NULL, GL_STATIC_DRAW);
+        }
+
+        up->parts[up->part_count++] = (gpu_upload_part_t) { views[i].target, g->buffers[i], views[i].data, views[i].bytes };
+        up->total_bytes += views[i].bytes;
+        g->buffer_bytes += views[i].bytes;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (GLAD_GL_VERSION_4_4 && up->total_bytes > 0) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        up->slot_size = up->total_bytes < GPU_UPLOAD_SLOT_SIZE ? up->total_bytes : GPU_UPLOAD_SLOT_SIZE;
+        glGenBuffers(1, &up->staging);
+        glBindBuffer(GL_COPY_READ_BUFFER, up->staging);
+        glBufferStorage(GL_COPY_READ_BUFFER, up->slot_size * GPU_UPLOAD_SLOTS, NULL, flags);
+        up->staging_data = glMapBufferRange(GL_COPY_READ_BUFFER, 0, up->slot_size * GPU_UPLOAD_SLOTS, flags);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        // Without the mapping the chunks still arrive, just through the driver's own staging
+        if (!up->staging_data) {
+            log_warn("Failed to map a %zu byte staging ring, uploading without it", up->slot_size * GPU_UPLOAD_SLOTS);
+            glDeleteBuffers(1, &up->staging);
+            up->staging = 0;
+        }
+    }
+
+    for (int i = 0; i < draw_count; i++) {
+        const packed_draw_t* d  = &draws[i];
+        gpu_draw_t*          gd = &g->draws[i];
+
+        glGenVertexArrays(1, &gd->vao);
+        glBindVertexArray(gd->vao);
+        g->draw_count++;
+
+        _bind_attrib(0, &d->position, g->buffers);
+        _bind_attrib(1, &d->normal, g->buffers);
+        _bind_attrib(2, &d->texcrd, g->buffers);
+
+        // The element buffer binding is vao state
+        if (d->index_view >= 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->buffers[d->index_view]);
+
+        gd->mode         = d->mode;
+        gd->index_type   = d->index_view >= 0 ? d->index_type : 0;
+        gd->index_offset = d->index_offset;
+        gd->count        = d->count;
+        gd->has_normals  = d->normal.view >= 0;
+        glm_mat4_copy((vec4*)d->transform, gd->transform);
+
+        // Inverse transpose keeps normals perpendicular under non uniform scale
+        glm_mat4_pick3((vec4*)d->transform, gd->normal_matrix);
+        glm_mat3_inv(gd->normal_matrix, gd->normal_matrix);
+        glm_mat3_transpose(gd->normal_matrix);
+
+        g->vertex_count += d->vertex_count * 3;
+        g->indice_count += d->index_view >= 0 ? d->count : 0;
+        g->normal_count += d->normal.view >= 0 ? d->vertex_count * 3 : 0;
+        g->texcrd_count += d->texcrd.view >= 0 ? d->vertex_count * 2 : 0;
+    }
+
+    glBindVertexArray(0);
 
     GLenum err = glGetError();
     if (err != GL_NO_ERROR) {
-        log_error("OpenGL error during vertex buffer upload: 0x%x", err);
-        return (gpu_model_t) { 0 };
+        log_error("OpenGL error while allocating model buffers: 0x%x", err);
+        gpu_upload_abort(up);
+        return false;
     }
 
-    if (m->normal_count > 0) {
-        // Normal buffer object
-        glGenBuffers(1, &g.nbo);
-        glBindBuffer(GL_ARRAY_BUFFER, g.nbo);
-        glBufferData(GL_ARRAY_BUFFER, m->normal_count * sizeof(float), m->normals, GL_STATIC_DRAW);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-        glEnableVertexAttribArray(1);
+    return true;
+}
+
+static void _staging_release(gpu_upload_t* up)
+{
+    for (int i = 0; i < GPU_UPLOAD_SLOTS; i++) {
+        if (up->fences[i]) glDeleteSync(up->fences[i]);
+        up->fences[i] = NULL;
+    }
 
-        err = glGetError();
-        if (err != GL_NO_ERROR) {
-            log_error("OpenGL error during normal buffer upload: 0x%x", err);
-            return (gpu_model_t) { 0 };
+    // Copies still in flight keep the buffer alive in the driver
+    if (up->staging) glDeleteBuffers(1, &up->staging);
+    up->staging      = 0;
+    up->staging_data = NULL;
+}
+
+// A slot can be refilled once the gpu copied out of it. Asked to wait it waits for as long as the
+// copy takes, false then means the wait itself failed.
+static bool _staging_slot_ready(gpu_upload_t* up, bool wait)
+{
+    GLsync fence = up->fences[up->slot];
+    if (!fence) return true;
+
+    GLenum status;
+    do {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+    } while (wait && status == GL_TIMEOUT_EXPIRED);
+    if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) return false;
+
+    glDeleteSync(fence);
+    up->fences[up->slot] = NULL;
+    return true;
+}
+
+// Copies up to bytes of the current part, returns the amount copied
+static size_t _upload_chunk(gpu_upload_t* up, size_t bytes, size_t slot_offset)
+{
+    gpu_upload_part_t* part = &up->parts[up->part];
+
+    size_t left = part->bytes - up->part_offset;
+    if (bytes > left) bytes = left;
+
+    if (bytes > 0) {
+        const char* src = (const char*)part->data + up->part_offset;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, part->buffer);
+
+        if (up->staging) {
+            memcpy(up->staging_data + slot_offset, src, bytes);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slot_offset, up->part_offset, bytes);
+        } else {
+            // Element buffers go through the copy target so no vao state is touched
+            glBufferSubData(GL_COPY_WRITE_BUFFER, up->part_offset, bytes, src);
         }
     }
 
-    if (m->texcrd_count > 0) {
-        // Texcoord buffer object
-        glGenBuffers(1, &g.tbo);
-        glBindBuffer(GL_ARRAY_BUFFER, g.tbo);
-        glBufferData(GL_ARRAY_BUFFER, m->texcrd_count * sizeof(float), m->texcrds, GL_STATIC_DRAW);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-        glEnableVertexAttribArray(2);
+    up->part_offset += bytes;
+    up->done_bytes  += bytes;
+
+    if (up->part_offset == part->bytes) {
+        up->part++;
+        up->part_offset = 0;
     }
+    return bytes;
+}
 
-    err = glGetError();
-    if (err != GL_NO_ERROR) {
-        log_error("OpenGL error during texcoord buffer upload: 0x%x", err);
-        return (gpu_model_t) { 0 };
+bool gpu_upload_step(gpu_upload_t* up, size_t budget)
+{
+    if (gpu_upload_done(up)) return true;
+
+    // An unlimited budget is the blocking path, everything else returns when the ring is full
+    bool wait = budget == SIZE_MAX;
+
+    if (up->staging) {
+        glBindBuffer(GL_COPY_READ_BUFFER, up->staging);
+
+        while (budget > 0 && !gpu_upload_done(up) && _staging_slot_ready(up, wait)) {
+            size_t base = (size_t)up->slot * up->slot_size;
+            size_t used = 0;
+
+            // Parts smaller than a slot share it, each one is a separate copy
+            while (used < up->slot_size && budget > 0 && !gpu_upload_done(up)) {
+                size_t room  = up->slot_size - used;
+                size_t bytes = _upload_chunk(up, room < budget ? room : budget, base + used);
+                used        += bytes;
+                budget      -= bytes;
+            }
+
+            up->fences[up->slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            up->slot             = (up->slot + 1) % GPU_UPLOAD_SLOTS;
+        }
+
+        // The blocking path only stops early when a fence could not be waited on
+        if (wait && !gpu_upload_done(up)) {
+            log_error("Failed to wait for the staging ring, %zu of %zu bytes uploaded", up->done_bytes,
+                      up->total_bytes);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            gpu_upload_abort(up);
+            return false;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    } else {
+        while (budget > 0 && !gpu_upload_done(up)) {
+            budget -= _upload_chunk(up, budget, 0);
+        }
     }
 
-    // Element buffer object
-    glGenBuffers(1, &g.ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m->indice_count * sizeof(unsigned int), m->indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-    err = glGetError();
+    GLenum err = glGetError();
     if (err != GL_NO_ERROR) {
-        log_error("OpenGL error during element buffer upload: 0x%x", err);
-        return (gpu_model_t) { 0 };
+        log_error("OpenGL error during model upload: 0x%x", err);
+        gpu_upload_abort(up);
+        return false;
     }
 
-    g.vertex_count = m->vertex_count;
-    g.indice_count = m->indice_count;
-    g.normal_count = m->normal_count;
-    g.texcrd_count = m->texcrd_count;
+    if (gpu_upload_done(up)) {
+        log_info("Successfully uploaded model with %u vertices to the gpu [format: %s;  draws: %d;  size: %.2fMB;  %s]",
+                 up->model.vertex_count, vertex_format_name(up->model.format), up->model.draw_count,
+                 gpu_model_get_size_mb(&up->model), up->staging ? "staging ring" : "buffer sub data");
 
-    g.program = load_shader_program(vs_source, fs_source);
+        free(up->parts);
+        up->parts = NULL;
+        _staging_release(up);
+    }
+    return true;
+}
 
-    log_info("Successfully uploaded model with %u vertices to the gpu", m->vertex_count);
+bool gpu_upload_done(const gpu_upload_t* up)
+{
+    return up->part == up->part_count;
+}
 
-    glBindVertexArray(0);
+bool gpu_upload_staged(const gpu_upload_t* up, const void* data)
+{
+    if (gpu_upload_done(up)) return true;
 
-    return g;
+    // Parts are copied out in order, the finished ones are never read again
+    for (int i = 0; i < up->part; i++) {
+        if (up->parts[i].data == data) return true;
+    }
+    return false;
+}
+
+void gpu_upload_abort(gpu_upload_t* up)
+{
+    _staging_release(up);
+    gpu_model_unload(&up->model);
+    free(up->parts);
+    up->parts       = NULL;
+    up->part        = 0;
+    up->part_count  = 0;
+    up->part_offset = 0;
 }
 
 float model_get_size_mb(const model_t* m)
@@ -167,73 +802,74 @@ float model_get_size_mb(const model_t* m)
 
 void gpu_model_init(gpu_model_t* model)
 {
-    model->vao     = 0;
-    model->vbo     = 0;
-    model->nbo     = 0;
-    model->tbo     = 0;
-    model->ebo     = 0;
-    model->program = 0;
-
+    model->buffers         = NULL;
+    model->draws           = NULL;
+    model->buffer_count    = 0;
+    model->draw_count      = 0;
+    model->position_buffer = -1;
+    model->normal_buffer   = -1;
+    model->index_buffer    = -1;
+    model->edge_buffer     = -1;
+    model->format          = VERTEX_FORMAT_F32;
+
+    model->buffer_bytes = 0;
     model->vertex_count = 0;
     model->indice_count = 0;
     model->normal_count = 0;
     model->texcrd_count = 0;
     glm_vec3_zero(model->min_vertex);
     glm_vec3_zero(model->max_vertex);
+    glm_vec3_one(model->decode_scale);
+    glm_vec3_zero(model->decode_offset);
     glm_mat4_identity(model->model);
+
+    model->meshlets      = NULL;
+    model->nodes         = NULL;
+    model->meshlet_count = 0;
+    model->node_count    = 0;
+    model->lod_count     = 0;
+    memset(&model->stats, 0, sizeof(model->stats));
 }
 
-void gpu_model_render(const gpu_model_t* g, mat4 proj, mat4 view)
+float gpu_model_get_size_mb(const gpu_model_t* g)
 {
-    glUseProgram(g->program);
-    glBindVertexArray(g->vao);
-
-    if (proj) {
-        glUniformMatrix4fv(glGetUniformLocation(g->program, "uProj"), 1, GL_FALSE, (float*)proj);
-    }
-
-    if (view) {
-        glUniformMatrix4fv(glGetUniformLocation(g->program, "uView"), 1, GL_FALSE, (float*)view);
-    }
-
-    // glm_rotate(g->model, 90.0f, (vec3) { 1.0f, 0.0f, 0.0f });
-    glUniformMatrix4fv(glGetUniformLocation(g->program, "uModel"), 1, GL_FALSE, (float*)g->model);
-    glUniform3fv(glGetUniformLocation(g->program, "uModelMin"), 1, (float*)g->min_vertex);
-    glUniform3fv(glGetUniformLocation(g->program, "uModelMax"), 1, (float*)g->max_vertex);
-    glDrawElements(GL_TRIANGLES, g->indice_count, GL_UNSIGNED_INT, 0);
-
-    glUseProgram(0);
-    glBindVertexArray(0);
+    return g->buffer_bytes / (1024.0f * 1024.0f);
 }
 
-float gpu_model_get_size_mb(const gpu_model_t* g)
+int gpu_model_index_count(const gpu_model_t* g)
 {
-    float mbs = ((g->vertex_count * sizeof(double) +       //
-                  g->indice_count * sizeof(unsigned int) + //
-                  g->normal_count * sizeof(float) +        //
-                  g->texcrd_count * sizeof(float))         //
-                 / (1024.0f * 1024.0f));
+    if (g->lod_count == 0) return g->indice_count;
 
-    return mbs;
+    const model_lod_t* last = &g->lods[g->lod_count - 1];
+    return (int)(last->first_index + last->index_count);
 }
 
-void gpu_model_unload(gpu_model_t* g)
+void gpu_model_release_buffers(gpu_model_t* g)
 {
-    if (g->ebo > 0) {
-        glDeleteBuffers(1, &g->ebo);
-    }
-    if (g->nbo > 0) {
-        glDeleteBuffers(1, &g->nbo);
-    }
-    if (g->vbo > 0) {
-        glDeleteBuffers(1, &g->vbo);
-    }
-    if (g->tbo > 0) {
-        glDeleteBuffers(1, &g->tbo);
+    for (int i = 0; i < g->draw_count; i++) {
+        glDeleteVertexArrays(1, &g->draws[i].vao);
     }
-    if (g->vao > 0) {
-        glDeleteVertexArrays(1, &g->vao);
+
+    if (g->buffer_count > 0) {
+        glDeleteBuffers(g->buffer_count, g->buffers);
     }
 
-    glDeleteProgram(g->program);
+    free(g->buffers);
+    free(g->draws);
+    g->buffers         = NULL;
+    g->draws           = NULL;
+    g->buffer_count    = 0;
+    g->draw_count      = 0;
+    g->position_buffer = -1;
+    g->normal_buffer   = -1;
+    g->index_buffer    = -1;
+    g->edge_buffer     = -1;
+}
+
+void gpu_model_unload(gpu_model_t* g)
+{
+    gpu_model_release_buffers(g);
+    free(g->meshlets);
+    free(g->nodes);
+    gpu_model_init(g);
 }
@@ -0,0 +1,303 @@
+#include "core/normals.h"
+
+#include "core/weld.h"
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NORMALS_MIN_PARALLEL (1 << 15)
+
+typedef struct {
+    const model_t* in;
+    model_t*       out;
+    float          cos_crease;
+    int            task_count;
+    int            vertex_count;
+    int            tri_count;
+
+    const unsigned int* canon;        // position of every vertex
+    double*             face_normals; // area weighted, 3 per triangle
+    float*              face_units;   // normalized, 3 per triangle
+    int*                corner_start; // CSR of the corners around every vertex
+    int*                corners;
+    int*                parents;        // union find over the corners of a vertex, indexed like corners
+    uint64_t*           keys;           // two per entry of corners, sort keys of the grouping
+    float*              corner_normals; // 3 per corner
+    int*                corner_groups;  // vertex local group of every corner
+    int*                vertex_bases;   // fill cursor, then group count, then first new vertex of every old vertex
+} _normals_job_t;
+
+static inline void _task_range(int count, int index, int task_count, int* first, int* last)
+{
+    *first = (int)((long long)count * index / task_count);
+    *last  = (int)((long long)count * (index + 1) / task_count);
+}
+
+static void _face_task(void* userdata, int index)
+{
+    _normals_job_t* job = userdata;
+    const model_t*  m   = job->in;
+
+    int first, last;
+    _task_range(job->tri_count, index, job->task_count, &first, &last);
+
+    for (int t = first; t < last; t++) {
+        const double* a = &m->vertices[(size_t)m->indices[t * 3] * 3];
+        const double* b = &m->vertices[(size_t)m->indices[t * 3 + 1] * 3];
+        const double* c = &m->vertices[(size_t)m->indices[t * 3 + 2] * 3];
+
+        double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+        // Twice the area as length, which is the weight
+        double* n = &job->face_normals[(size_t)t * 3];
+        n[0]      = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1]      = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2]      = e1[0] * e2[1] - e1[1] * e2[0];
+
+        double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int i = 0; i < 3; i++) {
+            job->face_units[(size_t)t * 3 + i] = len > 0.0 ? (float)(n[i] / len) : 0.0f;
+        }
+    }
+}
+
+static inline int _find(int* parents, int i)
+{
+    while (parents[i] != i) i = parents[i] = parents[parents[i]];
+    return i;
+}
+
+// The lower root wins, so every group's root is its first corner
+static inline void _join(int* parents, int a, int b)
+{
+    a = _find(parents, a);
+    b = _find(parents, b);
+    if (a < b) parents[b] = a;
+    if (b < a) parents[a] = b;
+}
+
+static int _compare_keys(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Vertices have a handful of corners, except for poles and fan centres which qsort takes
+static void _sort_keys(uint64_t* keys, int count)
+{
+    if (count > 16) {
+        qsort(keys, (size_t)count, sizeof(uint64_t), _compare_keys);
+        return;
+    }
+    for (int i = 1; i < count; i++) {
+        uint64_t key = keys[i];
+        int      j   = i;
+        for (; j > 0 && keys[j - 1] > key; j--) keys[j] = keys[j - 1];
+        keys[j] = key;
+    }
+}
+
+// Faces around a vertex that share an edge through it and meet within the crease angle form one
+// group, which sums its faces once. Edges are matched by position, so uv seams don't split a group.
+static void _smooth_task(void* userdata, int index)
+{
+    _normals_job_t*     job = userdata;
+    const unsigned int* idx = job->in->indices;
+
+    int first, last;
+    _task_range(job->vertex_count, index, job->task_count, &first, &last);
+
+    for (int v = first; v < last; v++) {
+        int        start   = job->corner_start[v];
+        const int* list    = &job->corners[start];
+        int        count   = job->corner_start[v + 1] - start;
+        int*       parents = &job->parents[start];
+        uint64_t*  keys    = &job->keys[(size_t)start * 2];
+        int        groups  = 0;
+
+        // Both other corners of every face by position, equal positions are a shared edge
+        for (int i = 0; i < count; i++) {
+            int c    = list[i];
+            int base = c - c % 3;
+
+            parents[i]      = i;
+            keys[i * 2]     = (uint64_t)job->canon[idx[base + (c + 1) % 3]] << 32 | (uint32_t)i;
+            keys[i * 2 + 1] = (uint64_t)job->canon[idx[base + (c + 2) % 3]] << 32 | (uint32_t)i;
+        }
+        _sort_keys(keys, count * 2);
+
+        for (int k = 1; k < count * 2; k++) {
+            if (keys[k] >> 32 != keys[k - 1] >> 32) continue;
+
+            int          a  = (int)(uint32_t)keys[k - 1], b = (int)(uint32_t)keys[k];
+            const float* au = &job->face_units[(size_t)(list[a] / 3) * 3];
+            const float* bu = &job->face_units[(size_t)(list[b] / 3) * 3];
+            if (au[0] * bu[0] + au[1] * bu[1] + au[2] * bu[2] >= job->cos_crease) _join(parents, a, b);
+        }
+
+        // Groups numbered in corner order, then the corners sorted by group to sum each one once
+        for (int i = 0; i < count; i++) {
+            int root = _find(parents, i);
+            int g    = root == i ? groups++ : job->corner_groups[list[root]];
+
+            job->corner_groups[list[i]] = g;
+            keys[i]                     = (uint64_t)g << 32 | (uint32_t)i;
+        }
+        _sort_keys(keys, count);
+
+        for (int k = 0; k < count;) {
+            int    end    = k;
+            double sum[3] = { 0.0, 0.0, 0.0 };
+            for (; end < count && keys[end] >> 32 == keys[k] >> 32; end++) {
+                const double* n = &job->face_normals[(size_t)(list[(uint32_t)keys[end]] / 3) * 3];
+                for (int i = 0; i < 3; i++) sum[i] += n[i];
+            }
+
+            double len = sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+            for (; k < end; k++) {
+                float* out = &job->corner_normals[(size_t)list[(uint32_t)keys[k]] * 3];
+                for (int i = 0; i < 3; i++) out[i] = len > 0.0 ? (float)(sum[i] / len) : 0.0f;
+            }
+        }
+
+        job->vertex_bases[v] = groups;
+    }
+}
+
+static void _emit_task(void* userdata, int index)
+{
+    _normals_job_t* job = userdata;
+    const model_t*  in  = job->in;
+    model_t*        out = job->out;
+    int             uv  = in->texcrd_count == job->vertex_count * 2;
+
+    int first, last;
+    _task_range(job->vertex_count, index, job->task_count, &first, &last);
+
+    for (int v = first; v < last; v++) {
+        const int* list  = &job->corners[job->corner_start[v]];
+        int        count = job->corner_start[v + 1] - job->corner_start[v];
+        int        next  = 0;
+
+        for (int i = 0; i < count; i++) {
+            int c     = list[i];
+            int group = job->corner_groups[c];
+            int nv    = job->vertex_bases[v] + group;
+
+            out->indices[c] = (unsigned int)nv;
+
+            // Groups are numbered in corner order, so the first corner of a group is its leader
+            if (group != next) continue;
+            next++;
+
+            memcpy(&out->vertices[(size_t)nv * 3], &in->vertices[(size_t)v * 3], 3 * sizeof(double));
+            memcpy(&out->normals[(size_t)nv * 3], &job->corner_normals[(size_t)c * 3], 3 * sizeof(float));
+            if (uv) memcpy(&out->texcrds[(size_t)nv * 2], &in->texcrds[(size_t)v * 2], 2 * sizeof(float));
+        }
+    }
+}
+
+bool model_compute_normals(model_t* m, float crease_degrees)
+{
+    double start = timer_now();
+    bool   ok    = false;
+
+    int tri_count    = m->indice_count / 3;
+    int vertex_count = m->vertex_count / 3;
+    if (tri_count == 0) return true;
+
+    model_t out;
+    model_init(&out);
+
+    _normals_job_t job = {
+        .in           = m,
+        .out          = &out,
+        .cos_crease   = cosf(crease_degrees * (float)M_PI / 180.0f),
+        .task_count   = tri_count > NORMALS_MIN_PARALLEL ? thread_count() : 1,
+        .vertex_count = vertex_count,
+        .tri_count    = tri_count,
+    };
+
+    arena_t*     arena = arena_scratch();
+    arena_mark_t mark  = arena_mark(arena);
+    job.face_normals   = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(double));
+    job.face_units     = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(float));
+    job.corner_start   = arena_calloc(arena, (size_t)vertex_count + 1, sizeof(int));
+    job.corners        = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(int));
+    job.corner_normals = arena_alloc(arena, (size_t)tri_count * 3 * 3 * sizeof(float));
+    job.corner_groups  = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(int));
+    job.vertex_bases   = arena_alloc(arena, ((size_t)vertex_count + 1) * sizeof(int));
+    job.parents        = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(int));
+    job.keys           = arena_alloc(arena, (size_t)tri_count * 3 * 2 * sizeof(uint64_t));
+
+    unsigned int* canon = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    unsigned int* rep   = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    job.canon           = canon;
+
+    if (!job.face_normals || !job.face_units || !job.corner_start || !job.corners || !job.corner_normals
+        || !job.corner_groups || !job.vertex_bases || !job.parents || !job.keys || !canon || !rep)
+    {
+        log_error("Failed to allocate normal generation buffers for %d triangles", tri_count);
+        goto cleanup;
+    }
+
+    if (weld_positions(m, canon, rep) < 0) {
+        log_error("Failed to number the positions of %d vertices", vertex_count);
+        goto cleanup;
+    }
+
+    thread_parallel(job.task_count, _face_task, &job);
+
+    // Corners per vertex, filled in corner order so the grouping is deterministic
+    for (int c = 0; c < tri_count * 3; c++) job.corner_start[m->indices[c] + 1]++;
+    for (int v = 0; v < vertex_count; v++) job.corner_start[v + 1] += job.corner_start[v];
+    memcpy(job.vertex_bases, job.corner_start, (size_t)vertex_count * sizeof(int));
+    for (int c = 0; c < tri_count * 3; c++) job.corners[job.vertex_bases[m->indices[c]]++] = c;
+
+    thread_parallel(job.task_count, _smooth_task, &job);
+
+    long long total = 0;
+    for (int v = 0; v < vertex_count; v++) {
+        int groups           = job.vertex_bases[v];
+        job.vertex_bases[v]  = (int)total;
+        total               += groups;
+    }
+    job.vertex_bases[vertex_count] = (int)total;
+
+    int has_texcrds = m->texcrd_count == vertex_count * 2;
+    if (total * 3 > INT_MAX
+        || !model_reserve(&out, (int)total * 3, tri_count * 3, (int)total * 3, has_texcrds ? (int)total * 2 : 0))
+    {
+        log_error("Failed to allocate model storage for %lld vertices with normals", total);
+        goto cleanup;
+    }
+
+    out.vertex_count = (int)total * 3;
+    out.indice_count = tri_count * 3;
+    out.normal_count = (int)total * 3;
+    out.texcrd_count = has_texcrds ? (int)total * 2 : 0;
+
+    thread_parallel(job.task_count, _emit_task, &job);
+
+    log_info("Generated normals [crease: %.0f deg;  verts: %d -> %lld] in %.1fms", crease_degrees, vertex_count, total,
+             (timer_now() - start) * 1000.0);
+
+    model_free(m);
+    *m = out;
+    model_init(&out);
+    ok = true;
+
+cleanup:
+    model_free(&out);
+    arena_release(arena, mark);
+    return ok;
+}
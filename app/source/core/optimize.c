@@ -0,0 +1,446 @@
+#include "core/optimize.h"
+
+#include "core/meshlet.h"
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPTIMIZE_MAX_VALENCE 32
+#define OPTIMIZE_MESHLET_SLOTS 1024 // power of two hash for the vertices of one meshlet, at least twice 3 * MESHLET_TRIANGLES
+
+typedef struct {
+    float key;
+    int   first; // first triangle in the vertex cache order
+    int   count;
+} _cluster_t;
+
+static float _cache_scores[OPTIMIZE_CACHE_SIZE];
+static float _valence_scores[OPTIMIZE_MAX_VALENCE + 1];
+
+// Scores from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": the last triangle's
+// vertices get a fixed score, older entries decay, and vertices with few triangles left are boosted
+static void _init_scores(void)
+{
+    for (int i = 0; i < OPTIMIZE_CACHE_SIZE; i++) {
+        _cache_scores[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) / (float)(OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+    }
+    _valence_scores[0] = 0.0f;
+    for (int i = 1; i <= OPTIMIZE_MAX_VALENCE; i++) {
+        _valence_scores[i] = 2.0f / sqrtf((float)i);
+    }
+}
+
+static inline float _vertex_score(int cache_pos, int live)
+{
+    if (live == 0) return -1.0f;
+
+    float score = cache_pos >= 0 && cache_pos < OPTIMIZE_CACHE_SIZE ? _cache_scores[cache_pos] : 0.0f;
+    return score + _valence_scores[live < OPTIMIZE_MAX_VALENCE ? live : OPTIMIZE_MAX_VALENCE];
+}
+
+void optimize_vcache_stats(const unsigned int* indices, int indice_count, int vertex_count, vcache_stats_t* stats)
+{
+    stats->acmr = 0.0f;
+    stats->atvr = 0.0f;
+
+    arena_t*     arena  = arena_scratch();
+    arena_mark_t mark   = arena_mark(arena);
+    int*         stamps = arena_alloc(arena, (size_t)(vertex_count > 0 ? vertex_count : 1) * sizeof(int));
+    if (!stamps) return;
+
+    // A vertex is in the FIFO if it was inserted within the last OPTIMIZE_FIFO_SIZE misses
+    for (int v = 0; v < vertex_count; v++) stamps[v] = -OPTIMIZE_FIFO_SIZE - 1;
+
+    int misses = 0;
+    for (int i = 0; i < indice_count; i++) {
+        unsigned int v = indices[i];
+        if (misses - stamps[v] > OPTIMIZE_FIFO_SIZE) {
+            stamps[v] = misses++;
+        }
+    }
+
+    if (indice_count > 0) stats->acmr = misses / (float)(indice_count / 3);
+    if (vertex_count > 0) stats->atvr = misses / (float)vertex_count;
+    arena_release(arena, mark);
+}
+
+// Greedy triangle order for an LRU cache, runs in O(triangles * cache size)
+static bool _optimize_vcache(const unsigned int* indices, int tri_count, int vertex_count, unsigned int* out)
+{
+    arena_t*     arena     = arena_scratch();
+    arena_mark_t mark      = arena_mark(arena);
+    int*         live      = arena_calloc(arena, vertex_count + 1, sizeof(int));
+    int*         adj_start = arena_alloc(arena, (vertex_count + 1) * sizeof(int));
+    int*         adj       = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(int));
+    int*         cache_pos = arena_alloc(arena, (vertex_count + 1) * sizeof(int));
+    float*       vscores   = arena_alloc(arena, (vertex_count + 1) * sizeof(float));
+    float*       tscores   = arena_alloc(arena, (tri_count + 1) * sizeof(float));
+    char*        emitted   = arena_calloc(arena, tri_count + 1, 1);
+    bool         ok        = live && adj_start && adj && cache_pos && vscores && tscores && emitted;
+
+    if (!ok) goto cleanup;
+
+    // Triangles per vertex as a CSR list, the live prefix of every list shrinks as triangles are emitted
+    for (int i = 0; i < tri_count * 3; i++) live[indices[i]]++;
+
+    adj_start[0] = 0;
+    for (int v = 0; v < vertex_count; v++) {
+        adj_start[v + 1] = adj_start[v] + live[v];
+        live[v]          = 0;
+    }
+    for (int t = 0; t < tri_count; t++) {
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[t * 3 + k];
+
+            adj[adj_start[v] + live[v]++] = t;
+        }
+    }
+
+    for (int v = 0; v < vertex_count; v++) {
+        cache_pos[v] = -1;
+        vscores[v]   = _vertex_score(-1, live[v]);
+    }
+
+    int   best       = -1;
+    float best_score = -1.0f;
+    for (int t = 0; t < tri_count; t++) {
+        tscores[t] = vscores[indices[t * 3]] + vscores[indices[t * 3 + 1]] + vscores[indices[t * 3 + 2]];
+        if (tscores[t] > best_score) {
+            best_score = tscores[t];
+            best       = t;
+        }
+    }
+
+    // Three slots of headroom for the vertices pushed out by the newest triangle
+    unsigned int cache[OPTIMIZE_CACHE_SIZE + 3];
+    unsigned int next_cache[OPTIMIZE_CACHE_SIZE + 3];
+    int          cache_count = 0;
+    int          cursor      = 0;
+
+    for (int emit = 0; emit < tri_count; emit++) {
+        if (best < 0) {
+            // Nothing in the cache has triangles left, continue in file order
+            while (emitted[cursor]) cursor++;
+            best = cursor;
+        }
+
+        const unsigned int* tri = &indices[best * 3];
+        memcpy(&out[emit * 3], tri, 3 * sizeof(unsigned int));
+        emitted[best] = 1;
+
+        int next_count = 0;
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = tri[k];
+
+            // Drop the triangle from the vertex's live list
+            int* list = &adj[adj_start[v]];
+            for (int i = 0; i < live[v]; i++) {
+                if (list[i] == best) {
+                    list[i] = list[--live[v]];
+                    break;
+                }
+            }
+
+            if (cache_pos[v] != -2) {
+                next_cache[next_count++] = v;
+                cache_pos[v]             = -2; // marks a vertex that is already in next_cache
+            }
+        }
+        for (int i = 0; i < cache_count; i++) {
+            if (cache_pos[cache[i]] != -2) next_cache[next_count++] = cache[i];
+        }
+
+        // Rescore everything that was or is in the cache, evicted vertices fall back to their valence score
+        for (int i = 0; i < next_count; i++) {
+            unsigned int v = next_cache[i];
+            cache_pos[v]   = i < OPTIMIZE_CACHE_SIZE ? i : -1;
+            vscores[v]     = _vertex_score(cache_pos[v], live[v]);
+        }
+
+        best       = -1;
+        best_score = -1.0f;
+        for (int i = 0; i < next_count; i++) {
+            unsigned int v = next_cache[i];
+            for (int j = 0; j < live[v]; j++) {
+                int t = adj[adj_start[v] + j];
+
+                const unsigned int* tv = &indices[t * 3];
+                tscores[t]             = vscores[tv[0]] + vscores[tv[1]] + vscores[tv[2]];
+                if (tscores[t] > best_score) {
+                    best_score = tscores[t];
+                    best       = t;
+                }
+            }
+        }
+
+        cache_count = next_count < OPTIMIZE_CACHE_SIZE ? next_count : OPTIMIZE_CACHE_SIZE;
+        memcpy(cache, next_cache, cache_count * sizeof(unsigned int));
+    }
+
+cleanup:
+    arena_release(arena, mark);
+    return ok;
+}
+
+typedef struct {
+    model_t*    model;
+    int         task_count;
+    atomic_bool failed;
+} _meshlet_job_t;
+
+// Vertex cache order within each meshlet, on indices renumbered to the meshlet's own vertices
+static void _meshlet_task(void* userdata, int index)
+{
+    _meshlet_job_t* job = userdata;
+    model_t*        m   = job->model;
+
+    unsigned int keys[OPTIMIZE_MESHLET_SLOTS];
+    unsigned int slots[OPTIMIZE_MESHLET_SLOTS];
+    unsigned int globals[3 * MESHLET_TRIANGLES];
+    unsigned int local[3 * MESHLET_TRIANGLES];
+    unsigned int ordered[3 * MESHLET_TRIANGLES];
+
+    for (int k = index; k < m->meshlet_count; k += job->task_count) {
+        unsigned int* indices      = &m->indices[m->meshlets[k].first_index];
+        int           count        = (int)m->meshlets[k].index_count;
+        int           vertex_count = 0;
+
+        memset(slots, 0xff, sizeof(slots));
+        for (int i = 0; i < count; i++) {
+            unsigned int v = indices[i];
+            unsigned int h = (v * 2654435761u) & (OPTIMIZE_MESHLET_SLOTS - 1);
+            while (slots[h] != 0xffffffffu && keys[h] != v) h = (h + 1) & (OPTIMIZE_MESHLET_SLOTS - 1);
+
+            if (slots[h] == 0xffffffffu) {
+                keys[h]                 = v;
+                slots[h]                = vertex_count;
+                globals[vertex_count++] = v;
+            }
+            local[i] = slots[h];
+        }
+
+        if (!_optimize_vcache(local, count / 3, vertex_count, ordered)) {
+            atomic_store(&job->failed, true);
+            return;
+        }
+        for (int i = 0; i < count; i++) indices[i] = globals[ordered[i]];
+    }
+}
+
+static bool _optimize_meshlets(model_t* m)
+{
+    _meshlet_job_t job = { .model = m };
+    atomic_init(&job.failed, false);
+
+    job.task_count = m->meshlet_count > 1024 ? thread_count() : 1;
+    thread_parallel(job.task_count, _meshlet_task, &job);
+    return !atomic_load(&job.failed);
+}
+
+static int _compare_clusters(const void* a, const void* b)
+{
+    const _cluster_t* ca = a;
+    const _cluster_t* cb = b;
+
+    if (ca->key != cb->key) return ca->key > cb->key ? -1 : 1;
+    return ca->first - cb->first;
+}
+
+// Splits the cache order where the FIFO restarts (a triangle with three misses) and sorts
+// the clusters outside-in so front facing geometry tends to be drawn first. Cutting only
+// at restarts keeps the cache efficiency of the input order.
+static bool _optimize_overdraw(const double* vertices, const unsigned int* indices, int tri_count, int vertex_count,
+                               unsigned int* out, int* cluster_count)
+{
+    arena_t*     arena    = arena_scratch();
+    arena_mark_t mark     = arena_mark(arena);
+    int*         stamps   = arena_alloc(arena, (vertex_count + 1) * sizeof(int));
+    _cluster_t*  clusters = arena_alloc(arena, (tri_count + 1) * sizeof(_cluster_t));
+    bool         ok       = stamps && clusters;
+
+    *cluster_count = 0;
+    if (!ok) goto cleanup;
+
+    for (int v = 0; v < vertex_count; v++) stamps[v] = -OPTIMIZE_FIFO_SIZE - 1;
+
+    int misses = 0;
+    for (int t = 0; t < tri_count; t++) {
+        int tri_misses = 0;
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[t * 3 + k];
+            if (misses - stamps[v] > OPTIMIZE_FIFO_SIZE) {
+                stamps[v] = misses++;
+                tri_misses++;
+            }
+        }
+
+        if (t == 0 || tri_misses == 3) {
+            clusters[(*cluster_count)++] = (_cluster_t) { .first = t };
+        }
+        clusters[*cluster_count - 1].count++;
+    }
+
+    // Mesh centroid over all triangle corners
+    double center[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < tri_count * 3; i++) {
+        for (int c = 0; c < 3; c++) center[c] += vertices[(size_t)indices[i] * 3 + c];
+    }
+    for (int c = 0; c < 3; c++) center[c] /= tri_count * 3.0;
+
+    // Area weighted centroid and normal of every cluster
+    for (int k = 0; k < *cluster_count; k++) {
+        _cluster_t* cl        = &clusters[k];
+        double      area      = 0.0;
+        double      normal[3] = { 0.0, 0.0, 0.0 };
+        double      mid[3]    = { 0.0, 0.0, 0.0 };
+
+        for (int t = cl->first; t < cl->first + cl->count; t++) {
+            const double* a = &vertices[(size_t)indices[t * 3] * 3];
+            const double* b = &vertices[(size_t)indices[t * 3 + 1] * 3];
+            const double* c = &vertices[(size_t)indices[t * 3 + 2] * 3];
+
+            double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+            double n[3]  = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                             e1[0] * e2[1] - e1[1] * e2[0] };
+            double w     = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (int i = 0; i < 3; i++) {
+                normal[i] += n[i];
+                mid[i] += (a[i] + b[i] + c[i]) / 3.0 * w;
+            }
+            area += w;
+        }
+
+        double len = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        double dot = 0.0;
+        if (area > 0.0 && len > 0.0) {
+            for (int i = 0; i < 3; i++) dot += (mid[i] / area - center[i]) * normal[i] / len;
+        }
+        cl->key = (float)dot;
+    }
+
+    qsort(clusters, *cluster_count, sizeof(_cluster_t), _compare_clusters);
+
+    int emit = 0;
+    for (int k = 0; k < *cluster_count; k++) {
+        memcpy(&out[emit * 3], &indices[clusters[k].first * 3], (size_t)clusters[k].count * 3 * sizeof(unsigned int));
+        emit += clusters[k].count;
+    }
+
+cleanup:
+    arena_release(arena, mark);
+    return ok;
+}
+
+// Renumbers vertices in first use order so the vertex fetch walks the buffers linearly
+static bool _optimize_fetch(model_t* m)
+{
+    int vertex_count = m->vertex_count / 3;
+    int has_normals  = m->normal_count == m->vertex_count;
+    int has_texcrds  = m->texcrd_count == vertex_count * 2;
+
+    // The new buffers replace the model's, only the remap is scratch
+    arena_t*      arena    = arena_scratch();
+    arena_mark_t  mark     = arena_mark(arena);
+    unsigned int* remap    = arena_alloc(arena, (vertex_count + 1) * sizeof(unsigned int));
+    double*       vertices = malloc((size_t)m->vertex_count * sizeof(double) + 1);
+    float*        normals  = has_normals ? malloc((size_t)m->normal_count * sizeof(float)) : NULL;
+    float*        texcrds  = has_texcrds ? malloc((size_t)m->texcrd_count * sizeof(float)) : NULL;
+
+    if (!remap || !vertices || (has_normals && !normals) || (has_texcrds && !texcrds)) {
+        arena_release(arena, mark);
+        free(vertices);
+        free(normals);
+        free(texcrds);
+        return false;
+    }
+
+    memset(remap, 0xff, (vertex_count + 1) * sizeof(unsigned int));
+
+    unsigned int next = 0;
+    for (int i = 0; i < m->indice_count; i++) {
+        unsigned int v = m->indices[i];
+        if (remap[v] == 0xffffffffu) {
+            remap[v] = next;
+            memcpy(&vertices[(size_t)next * 3], &m->vertices[(size_t)v * 3], 3 * sizeof(double));
+            if (normals) memcpy(&normals[(size_t)next * 3], &m->normals[(size_t)v * 3], 3 * sizeof(float));
+            if (texcrds) memcpy(&texcrds[(size_t)next * 2], &m->texcrds[(size_t)v * 2], 2 * sizeof(float));
+            next++;
+        }
+        m->indices[i] = remap[v];
+    }
+
+    // Vertices no face uses are dropped
+    free(m->vertices);
+    m->vertices        = vertices;
+    m->vertex_count    = (int)next * 3;
+    m->vertex_capacity = vertex_count * 3;
+
+    if (normals) {
+        free(m->normals);
+        m->normals         = normals;
+        m->normal_count    = (int)next * 3;
+        m->normal_capacity = vertex_count * 3;
+    }
+    if (texcrds) {
+        free(m->texcrds);
+        m->texcrds         = texcrds;
+        m->texcrd_count    = (int)next * 2;
+        m->texcrd_capacity = vertex_count * 2;
+    }
+
+    arena_release(arena, mark);
+    return true;
+}
+
+bool model_optimize(model_t* m)
+{
+    int tri_count    = m->indice_count / 3;
+    int vertex_count = m->vertex_count / 3;
+    if (tri_count == 0) return true;
+
+    double start = timer_now();
+    if (_cache_scores[0] == 0.0f) _init_scores();
+
+    // A trailing partial triangle isn't drawn anyway
+    m->indice_count = tri_count * 3;
+
+    vcache_stats_t before, after;
+    optimize_vcache_stats(m->indices, tri_count * 3, vertex_count, &before);
+
+    arena_t*      arena    = arena_scratch();
+    arena_mark_t  mark     = arena_mark(arena);
+    unsigned int* ordered  = NULL;
+    int           clusters = 0;
+    if (m->meshlet_count == 0) ordered = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(unsigned int));
+
+    bool ok;
+    if (m->meshlet_count > 0) {
+        // Triangles stay in their meshlet, the overdraw clusters would scatter them
+        clusters = m->meshlet_count;
+        ok       = _optimize_meshlets(m) && _optimize_fetch(m);
+    } else {
+        ok = ordered && _optimize_vcache(m->indices, tri_count, vertex_count, ordered)
+             && _optimize_overdraw(m->vertices, ordered, tri_count, vertex_count, m->indices, &clusters)
+             && _optimize_fetch(m);
+    }
+    arena_release(arena, mark);
+
+    if (!ok) {
+        log_error("Failed to allocate mesh optimization buffers");
+        return false;
+    }
+
+    optimize_vcache_stats(m->indices, m->indice_count, m->vertex_count / 3, &after);
+    log_info("Optimized mesh [ACMR: %.3f -> %.3f;  ATVR: %.3f -> %.3f;  clusters: %d] in %.1fms", before.acmr,
+             after.acmr, before.atvr, after.atvr, clusters, (timer_now() - start) * 1000.0);
+    return true;
+}
@@ -0,0 +1,1121 @@
+#include "core/paged.h"
+
+#include "core/meshlet.h"
+#include "engine/arena.h"
+#include "engine/string.h"
+#include "engine/timer.h"
+#include "parsers/gltf.h"
+#include "parsers/obj.h"
+#include "parsers/stl.h"
+
+#include "glad/glad.h"
+#include "log.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define PAGED_MAGIC 0x50564f46u // "FOVP"
+#define PAGED_VERSION 1
+#define PAGED_MAX_LEVEL 7        // octree depth of the cells the centroids are counted in
+#define PAGED_CELL_TRIANGLES 64  // triangles per cell the depth aims for
+#define PAGED_BLOCK (1 << 16)    // triangles a task takes at a time
+#define PAGED_MIN_WINDOW ((size_t)256 << 20)
+#define PAGED_MAX_WINDOW ((size_t)4 << 30)
+#define PAGED_SNIFF_SIZE 512
+
+#define PAGED_TRIANGLE_BYTES (9 * sizeof(float))
+#define PAGED_SLOT_BYTES (PAGED_PAGE_TRIANGLES * PAGED_TRIANGLE_BYTES)
+
+// Positions only, the face normal comes from the derivatives like any draw without normals
+static const char* vs_source = "#version 450 core\n"
+                               "layout (location = 0) in vec3 aPos;\n"
+                               "out vec3 FragPos;\n"
+                               SHADER_CAMERA_BLOCK
+                               "uniform mat4 uModel;\n"
+                               "void main() {\n"
+                               "    vec4 world = uModel * vec4(aPos, 1.0);\n"
+                               "    gl_Position = uProj * uView * world;\n"
+                               "    FragPos = world.xyz;\n"
+                               "}\n";
+
+static const char* fs_source = "#version 450 core\n"
+                               "in vec3 FragPos;\n"
+                               "out vec4 FragColor;\n"
+                               "void main() {\n"
+                               "    vec3 normal = normalize(cross(dFdx(FragPos), dFdy(FragPos)));\n"
+                               "    vec3 lightDir = normalize(vec3(1.0, 10.0, -1.0));\n"
+                               "    float diff = max(dot(normal, lightDir), 0.0);\n"
+                               "    vec3 baseColor = vec3(0.8, 0.8, 0.8);\n"
+                               "    vec3 ambient = 0.2 * baseColor;\n"
+                               "    vec3 diffuse = diff * baseColor;\n"
+                               "    FragColor = vec4(ambient + diffuse, 1.0);\n"
+                               "}\n";
+
+static const char* _uniforms[] = { "uModel" };
+
+// On disk layout: every triangle as nine floats in page order, the base triangles the same way,
+// the page table and this header last, so the file is written front to back in one go
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_size;
+    int64_t  source_mtime;
+    uint64_t triangle_count;
+    uint64_t base_count;
+    uint64_t page_count;
+    uint64_t base_offset;
+    uint64_t page_offset;
+    float    min_vertex[3];
+    float    max_vertex[3];
+    float    base_cell;
+    uint32_t reserved;
+    double   origin[3]; // what the stored positions are relative to
+} _header_t;
+
+typedef enum {
+    _SOURCE_NONE,
+    _SOURCE_STL,
+    _SOURCE_OBJ,
+} _source_kind_t;
+
+// Triangles of the source, binary STL records as they are or streamed OBJ indices into positions
+typedef struct {
+    const char*         records;
+    const float*        positions;
+    const unsigned int* triangles;
+    size_t              count;
+} _source_t;
+
+typedef struct {
+    _source_t         source;
+    int               task_count;
+    size_t            block_count;
+    int               level;
+    float             min[3];
+    float             max[3];
+    float             cell_scale[3]; // centroid to cell coordinate
+    float             (*task_bounds)[6];
+    atomic_uint*      counts;  // triangles per cell
+    uint64_t*         offsets; // first triangle of every cell, one past the last cell too
+    atomic_ullong*    cursors; // next free triangle of every cell during the scatter
+    paged_page_t*     pages;
+    uint32_t*         page_cells; // first cell and one past the last per page
+    int               page_count;
+    int               page_capacity;
+    uint32_t          window_cells[2];
+    uint64_t          window_first;
+    int               window_pages[2];
+    float*            window; // triangles of the window in page order
+    float*            window_base; // base triangles of a page at the offset of its triangles
+    float             base_cell;
+    load_progress_t*  progress;
+    atomic_bool       failed;
+} _build_t;
+
+static size_t _physical_memory(void)
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status = { .dwLength = sizeof(status) };
+    return GlobalMemoryStatusEx(&status) ? (size_t)status.ullTotalPhys : 0;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES), size = sysconf(_SC_PAGE_SIZE);
+    return pages > 0 && size > 0 ? (size_t)pages * (size_t)size : 0;
+#endif
+}
+
+static bool _has_extension(const char* path, const char* ext)
+{
+    size_t len = strlen(path), ext_len = strlen(ext);
+    if (len < ext_len) return false;
+
+    for (size_t i = 0; i < ext_len; i++) {
+        char c = path[len - ext_len + i];
+        if ((c >= 'A' && c <= 'Z' ? c + 32 : c) != ext[i]) return false;
+    }
+    return true;
+}
+
+// Binary STL records and OBJ faces stream, ASCII STL and glTF go through the loader
+static _source_kind_t _source_kind(const char* path, size_t file_size)
+{
+    char   head[PAGED_SNIFF_SIZE];
+    size_t head_size = 0;
+
+    FILE* f = fopen(path, "rb");
+    if (!f) return _SOURCE_NONE;
+    head_size = fread(head, 1, sizeof(head), f);
+    fclose(f);
+
+    if (gltf_detect(head, head_size)) return _SOURCE_NONE;
+
+    stl_kind_t stl = stl_detect(head, head_size, file_size);
+    if (stl == STL_BINARY) return _SOURCE_STL;
+    if (stl != STL_NONE || _has_extension(path, ".stl")) return _SOURCE_NONE;
+    return _has_extension(path, ".obj") ? _SOURCE_OBJ : _SOURCE_NONE;
+}
+
+bool paged_wanted(const char* source_path)
+{
+    size_t size, memory = _physical_memory();
+    if (memory == 0 || !file_stat(source_path, &size, NULL) || size < memory / 4) return false;
+    return _source_kind(source_path, size) != _SOURCE_NONE;
+}
+
+static inline void _source_triangle(const _source_t* s, size_t t, float out[9])
+{
+    if (s->records) {
+        memcpy(out, s->records + t * STL_RECORD_SIZE + 3 * sizeof(float), PAGED_TRIANGLE_BYTES);
+        return;
+    }
+
+    const unsigned int* k = &s->triangles[t * 3];
+    for (int i = 0; i < 3; i++) memcpy(out + i * 3, s->positions + (size_t)k[i] * 3, 3 * sizeof(float));
+}
+
+// Spreads the low 10 bits so two zero bits sit between each
+static uint32_t _part1by2(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x030000ff;
+    x = (x | x << 8) & 0x0300f00f;
+    x = (x | x << 4) & 0x030c30c3;
+    x = (x | x << 2) & 0x09249249;
+    return x;
+}
+
+// Morton code of the cell holding the centroid, so every octree node is a run of cells
+static inline uint32_t _cell_of(const _build_t* b, const float tri[9])
+{
+    uint32_t side = 1u << b->level, cell[3];
+    for (int i = 0; i < 3; i++) {
+        float c = ((tri[i] + tri[i + 3] + tri[i + 6]) / 3.0f - b->min[i]) * b->cell_scale[i];
+        cell[i] = c <= 0.0f ? 0 : c >= (float)(side - 1) ? side - 1 : (uint32_t)c;
+    }
+    return _part1by2(cell[0]) | _part1by2(cell[1]) << 1 | _part1by2(cell[2]) << 2;
+}
+
+static void _block_range(const _build_t* b, size_t block, size_t* first, size_t* last)
+{
+    *first = block * PAGED_BLOCK;
+    *last  = *first + PAGED_BLOCK < b->source.count ? *first + PAGED_BLOCK : b->source.count;
+}
+
+static void _bounds_task(void* userdata, int index)
+{
+    _build_t* b      = userdata;
+    float*    bounds = b->task_bounds[index];
+
+    for (int i = 0; i < 3; i++) {
+        bounds[i]     = INFINITY;
+        bounds[i + 3] = -INFINITY;
+    }
+
+    for (size_t block = index; block < b->block_count; block += b->task_count) {
+        if (progress_cancelled(b->progress)) return;
+
+        size_t first, last;
+        _block_range(b, block, &first, &last);
+        for (size_t t = first; t < last; t++) {
+            float tri[9];
+            _source_triangle(&b->source, t, tri);
+            for (int v = 0; v < 9; v++) {
+                if (tri[v] < bounds[v % 3]) bounds[v % 3] = tri[v];
+                if (tri[v] > bounds[v % 3 + 3]) bounds[v % 3 + 3] = tri[v];
+            }
+        }
+        progress_add(b->progress, (last - first) * PAGED_TRIANGLE_BYTES);
+    }
+}
+
+static void _count_task(void* userdata, int index)
+{
+    _build_t* b = userdata;
+
+    for (size_t block = index; block < b->block_count; block += b->task_count) {
+        if (progress_cancelled(b->progress)) return;
+
+        size_t first, last;
+        _block_range(b, block, &first, &last);
+        for (size_t t = first; t < last; t++) {
+            float tri[9];
+            _source_triangle(&b->source, t, tri);
+            atomic_fetch_add_explicit(&b->counts[_cell_of(b, tri)], 1, memory_order_relaxed);
+        }
+        progress_add(b->progress, (last - first) * PAGED_TRIANGLE_BYTES);
+    }
+}
+
+// Copies the triangles of the window's cells to their place in page order
+static void _scatter_task(void* userdata, int index)
+{
+    _build_t* b = userdata;
+
+    for (size_t block = index; block < b->block_count; block += b->task_count) {
+        if (progress_cancelled(b->progress)) return;
+
+        size_t first, last;
+        _block_range(b, block, &first, &last);
+        for (size_t t = first; t < last; t++) {
+            float tri[9];
+            _source_triangle(&b->source, t, tri);
+
+            uint32_t cell = _cell_of(b, tri);
+            if (cell < b->window_cells[0] || cell >= b->window_cells[1]) continue;
+
+            uint64_t slot = atomic_fetch_add_explicit(&b->cursors[cell], 1, memory_order_relaxed);
+            memcpy(b->window + (slot - b->window_first) * 9, tri, PAGED_TRIANGLE_BYTES);
+        }
+        progress_add(b->progress, (last - first) * PAGED_TRIANGLE_BYTES);
+    }
+}
+
+static inline uint32_t _base_key(const _build_t* b, const float* v)
+{
+    uint32_t cell[3];
+    for (int i = 0; i < 3; i++) {
+        float c = (v[i] - b->min[i]) / b->base_cell;
+        cell[i] = c <= 0.0f ? 0 : c >= PAGED_BASE_GRID - 1 ? PAGED_BASE_GRID - 1 : (uint32_t)c;
+    }
+    return (cell[0] * PAGED_BASE_GRID + cell[1]) * PAGED_BASE_GRID + cell[2];
+}
+
+static inline void _base_center(const _build_t* b, uint32_t key, float* out)
+{
+    uint32_t cell[3] = { key / (PAGED_BASE_GRID * PAGED_BASE_GRID), key / PAGED_BASE_GRID % PAGED_BASE_GRID,
+                         key % PAGED_BASE_GRID };
+    for (int i = 0; i < 3; i++) out[i] = b->min[i] + ((float)cell[i] + 0.5f) * b->base_cell;
+}
+
+// Bounds of one page and its base: vertices snap to the centers of a grid shared by all pages, so
+// neighbouring bases meet without cracks, and triangles that collapse or repeat are dropped
+static void _page_finish(_build_t* b, paged_page_t* page)
+{
+    const float* tris = b->window + (page->first_triangle - b->window_first) * 9;
+    float*       base = b->window_base + (page->first_triangle - b->window_first) * 9;
+
+    float lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (size_t v = 0; v < (size_t)page->triangle_count * 3; v++) {
+        for (int i = 0; i < 3; i++) {
+            if (tris[v * 3 + i] < lo[i]) lo[i] = tris[v * 3 + i];
+            if (tris[v * 3 + i] > hi[i]) hi[i] = tris[v * 3 + i];
+        }
+    }
+
+    vec3 extent;
+    for (int i = 0; i < 3; i++) {
+        page->center[i] = (lo[i] + hi[i]) * 0.5f;
+        extent[i]       = hi[i] - lo[i];
+    }
+    page->radius = glm_vec3_norm(extent) * 0.5f;
+
+    arena_t*     arena    = arena_scratch();
+    arena_mark_t mark     = arena_mark(arena);
+    uint32_t     capacity = 1;
+    while (capacity < page->triangle_count * 2) capacity *= 2;
+
+    // Open addressing over the sorted cell triple, all ones marks an empty slot
+    uint32_t (*table)[3] = arena_alloc(arena, capacity * sizeof(*table));
+    page->base_count     = 0;
+    if (!table) {
+        atomic_store(&b->failed, true);
+        return;
+    }
+    memset(table, 0xff, capacity * sizeof(*table));
+
+    for (uint32_t t = 0; t < page->triangle_count; t++) {
+        uint32_t k[3] = { _base_key(b, tris + t * 9), _base_key(b, tris + t * 9 + 3), _base_key(b, tris + t * 9 + 6) };
+        if (k[0] == k[1] || k[1] == k[2] || k[0] == k[2]) continue;
+
+        uint32_t s[3] = { k[0], k[1], k[2] }, swap;
+        if (s[0] > s[1]) swap = s[0], s[0] = s[1], s[1] = swap;
+        if (s[1] > s[2]) swap = s[1], s[1] = s[2], s[2] = swap;
+        if (s[0] > s[1]) swap = s[0], s[0] = s[1], s[1] = swap;
+
+        uint32_t slot = (uint32_t)((s[0] * 0x9e3779b1u) ^ (s[1] * 0x85ebca6bu) ^ (s[2] * 0xc2b2ae35u)) & (capacity - 1);
+        bool     seen = false;
+        while (table[slot][0] != UINT32_MAX) {
+            if (table[slot][0] == s[0] && table[slot][1] == s[1] && table[slot][2] == s[2]) {
+                seen = true;
+                break;
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (seen) continue;
+
+        memcpy(table[slot], s, sizeof(s));
+        for (int i = 0; i < 3; i++) _base_center(b, k[i], base + ((size_t)page->base_count * 3 + i) * 3);
+        page->base_count++;
+    }
+
+    arena_release(arena, mark);
+}
+
+static void _page_task(void* userdata, int index)
+{
+    _build_t* b = userdata;
+
+    for (int p = b->window_pages[0] + index; p < b->window_pages[1]; p += b->task_count) {
+        _page_finish(b, &b->pages[p]);
+    }
+}
+
+static bool _push_page(_build_t* b, uint64_t first_triangle, uint32_t count, uint32_t first_cell, uint32_t last_cell)
+{
+    if (b->page_count == b->page_capacity) {
+        int capacity = b->page_capacity ? b->page_capacity * 2 : 256;
+
+        paged_page_t* pages = realloc(b->pages, capacity * sizeof(paged_page_t));
+        if (!pages) return false;
+        b->pages = pages;
+
+        uint32_t* cells = realloc(b->page_cells, capacity * 2 * sizeof(uint32_t));
+        if (!cells) return false;
+        b->page_cells    = cells;
+        b->page_capacity = capacity;
+    }
+
+    b->pages[b->page_count]              = (paged_page_t) { .first_triangle = first_triangle, .triangle_count = count };
+    b->page_cells[b->page_count * 2]     = first_cell;
+    b->page_cells[b->page_count * 2 + 1] = last_cell;
+    b->page_count++;
+    return true;
+}
+
+// Cuts the octree into pages, a node becomes one once its triangles fit a slot. A cell that is
+// still too full is split into several pages in the order its triangles came in.
+static bool _emit_pages(_build_t* b, uint32_t first, int level)
+{
+    uint32_t cells = 1u << 3 * (b->level - level);
+    uint64_t total = b->offsets[first + cells] - b->offsets[first];
+    if (total == 0) return true;
+
+    if (total > PAGED_PAGE_TRIANGLES && level < b->level) {
+        for (uint32_t child = 0; child < 8; child++) {
+            if (!_emit_pages(b, first + child * (cells / 8), level + 1)) return false;
+        }
+        return true;
+    }
+
+    for (uint64_t t = 0; t < total; t += PAGED_PAGE_TRIANGLES) {
+        uint32_t count = total - t < PAGED_PAGE_TRIANGLES ? (uint32_t)(total - t) : PAGED_PAGE_TRIANGLES;
+        if (!_push_page(b, b->offsets[first] + t, count, first, first + cells)) return false;
+    }
+    return true;
+}
+
+// Pages up to the window size, a window only ends where a cell does
+static int _window_end(const _build_t* b, int first, size_t window_bytes)
+{
+    size_t bytes = 0;
+    int    last  = first;
+    while (last < b->page_count) {
+        size_t page_bytes = (size_t)b->pages[last].triangle_count * PAGED_TRIANGLE_BYTES;
+        bool   split_cell = last > first && b->page_cells[last * 2] == b->page_cells[(last - 1) * 2];
+        if (last > first && !split_cell && bytes + page_bytes > window_bytes) break;
+
+        bytes += page_bytes;
+        last++;
+    }
+    return last;
+}
+
+// The page table and the header hold 64 bit fields, the triangles before them only floats
+static uint64_t _align(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static bool _write(FILE* file, const void* data, size_t bytes)
+{
+    return bytes == 0 || fwrite(data, 1, bytes, file) == bytes;
+}
+
+bool paged_build(const char* source_path, const char* paged_path, load_progress_t* progress)
+{
+    double start = timer_now();
+    bool   ok    = false;
+
+    size_t    source_size;
+    long long source_mtime;
+    if (!file_stat(source_path, &source_size, &source_mtime)) {
+        log_error("Failed to open %s", source_path);
+        return false;
+    }
+
+    _source_kind_t kind = _source_kind(source_path, source_size);
+    if (kind == _SOURCE_NONE) {
+        log_error("Only binary STL and OBJ files can be paged, %s is neither", source_path);
+        return false;
+    }
+
+    char temppath[1210], positions_path[1210], triangles_path[1210];
+    snprintf(temppath, sizeof(temppath), "%s.tmp", paged_path);
+    snprintf(positions_path, sizeof(positions_path), "%s.pos", paged_path);
+    snprintf(triangles_path, sizeof(triangles_path), "%s.tri", paged_path);
+
+    arena_t*     arena = arena_scratch();
+    arena_mark_t mark  = arena_mark(arena);
+    _build_t     b     = { .progress = progress };
+    _header_t    h     = { .magic = PAGED_MAGIC, .version = PAGED_VERSION };
+    file_map_t   source, positions, triangles;
+    bool         source_mapped = false, positions_mapped = false, triangles_mapped = false;
+    float*       base          = NULL;
+    size_t       base_capacity = 0;
+    FILE*        out           = NULL;
+
+    h.source_size  = source_size;
+    h.source_mtime = source_mtime;
+
+    b.task_count  = thread_count();
+    b.task_bounds = arena_alloc(arena, b.task_count * sizeof(*b.task_bounds));
+    if (!b.task_bounds) goto cleanup;
+
+    if (kind == _SOURCE_STL) {
+        if (!(source_mapped = file_map(source_path, &source)) || source.size < STL_HEADER_SIZE) goto cleanup;
+
+        uint32_t declared;
+        memcpy(&declared, source.data + 80, sizeof(declared));
+        b.source.records = source.data + STL_HEADER_SIZE;
+        b.source.count   = (source.size - STL_HEADER_SIZE) / STL_RECORD_SIZE;
+        if (declared < b.source.count) b.source.count = declared;
+        if (progress) atomic_store(&progress->bytes_total, b.source.count * PAGED_TRIANGLE_BYTES);
+    } else {
+        // The faces need every vertex at hand, the streamed positions are mapped back in instead
+        FILE* pos = fopen(positions_path, "wb");
+        FILE* tri = fopen(triangles_path, "wb");
+
+        obj_stream_t stream;
+        bool         streamed = pos && tri && obj_stream(source_path, pos, tri, &stream, progress);
+        streamed              = (!pos || fclose(pos) == 0) && streamed;
+        streamed              = (!tri || fclose(tri) == 0) && streamed;
+        if (!streamed) goto cleanup;
+
+        if (!(positions_mapped = file_map(positions_path, &positions))) goto cleanup;
+        if (!(triangles_mapped = file_map(triangles_path, &triangles))) goto cleanup;
+
+        b.source.positions = (const float*)positions.data;
+        b.source.triangles = (const unsigned int*)triangles.data;
+        b.source.count     = stream.triangle_count;
+        memcpy(h.origin, stream.origin, sizeof(h.origin));
+    }
+
+    b.block_count = (b.source.count + PAGED_BLOCK - 1) / PAGED_BLOCK;
+    if (b.source.count == 0) {
+        log_error("No triangles to page in %s", source_path);
+        goto cleanup;
+    }
+
+    // The window is what one scatter pass over the source fills, the rest of the pages wait for
+    // the next pass so the writes never go beyond memory
+    size_t window_bytes = _physical_memory() / 8;
+    if (window_bytes < PAGED_MIN_WINDOW) window_bytes = PAGED_MIN_WINDOW;
+    if (window_bytes > PAGED_MAX_WINDOW) window_bytes = PAGED_MAX_WINDOW;
+
+    size_t pass_bytes = b.source.count * PAGED_TRIANGLE_BYTES;
+    if (progress) {
+        size_t passes = 3 + pass_bytes / window_bytes;
+        atomic_store(&progress->bytes_total, atomic_load(&progress->bytes_done) + passes * pass_bytes);
+    }
+
+    thread_parallel(b.task_count, _bounds_task, &b);
+    if (progress_cancelled(progress)) goto cleanup;
+
+    for (int i = 0; i < 3; i++) {
+        b.min[i] = INFINITY;
+        b.max[i] = -INFINITY;
+        for (int t = 0; t < b.task_count; t++) {
+            if (b.task_bounds[t][i] < b.min[i]) b.min[i] = b.task_bounds[t][i];
+            if (b.task_bounds[t][i + 3] > b.max[i]) b.max[i] = b.task_bounds[t][i + 3];
+        }
+    }
+
+    b.level = 1;
+    while (b.level < PAGED_MAX_LEVEL && ((size_t)1 << 3 * b.level) * PAGED_CELL_TRIANGLES < b.source.count) b.level++;
+
+    uint32_t cell_count = 1u << 3 * b.level;
+    float    extent     = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        float size      = b.max[i] - b.min[i];
+        b.cell_scale[i] = size > 0.0f ? (float)(1u << b.level) / size : 0.0f;
+        if (size > extent) extent = size;
+    }
+    b.base_cell = extent > 0.0f ? extent / PAGED_BASE_GRID : 1.0f;
+
+    b.counts  = arena_calloc(arena, cell_count, sizeof(atomic_uint));
+    b.offsets = arena_alloc(arena, (cell_count + 1) * sizeof(uint64_t));
+    b.cursors = arena_alloc(arena, cell_count * sizeof(atomic_ullong));
+    if (!b.counts || !b.offsets || !b.cursors) goto cleanup;
+
+    thread_parallel(b.task_count, _count_task, &b);
+    if (progress_cancelled(progress)) goto cleanup;
+
+    b.offsets[0] = 0;
+    for (uint32_t c = 0; c < cell_count; c++) {
+        b.offsets[c + 1] = b.offsets[c] + atomic_load_explicit(&b.counts[c], memory_order_relaxed);
+        atomic_init(&b.cursors[c], b.offsets[c]);
+    }
+
+    if (!_emit_pages(&b, 0, 0)) {
+        log_error("Failed to allocate the pages of %s", source_path);
+        goto cleanup;
+    }
+
+    // Every window gets the same buffers, sized for the largest
+    size_t largest = 0;
+    int    windows = 0;
+    for (int first = 0, last; first < b.page_count; first = last, windows++) {
+        last         = _window_end(&b, first, window_bytes);
+        size_t bytes = (b.pages[last - 1].first_triangle + b.pages[last - 1].triangle_count - b.pages[first].first_triangle)
+                     * PAGED_TRIANGLE_BYTES;
+        if (bytes > largest) largest = bytes;
+    }
+
+    if (progress) {
+        atomic_store(&progress->bytes_total, atomic_load(&progress->bytes_done) + windows * pass_bytes);
+    }
+
+    b.window      = arena_alloc(arena, largest);
+    b.window_base = arena_alloc(arena, largest);
+    if (!b.window || !b.window_base) goto cleanup;
+
+    if (!(out = fopen(temppath, "wb"))) {
+        log_error("Failed to create page file %s", temppath);
+        goto cleanup;
+    }
+
+    for (int first = 0, last; first < b.page_count; first = last) {
+        last             = _window_end(&b, first, window_bytes);
+        b.window_pages[0] = first;
+        b.window_pages[1] = last;
+        b.window_cells[0] = b.page_cells[first * 2];
+        b.window_cells[1] = b.page_cells[(last - 1) * 2 + 1];
+        b.window_first    = b.pages[first].first_triangle;
+
+        thread_parallel(b.task_count, _scatter_task, &b);
+        if (progress_cancelled(progress)) goto cleanup;
+
+        thread_parallel(b.task_count < last - first ? b.task_count : last - first, _page_task, &b);
+        if (atomic_load(&b.failed)) goto cleanup;
+
+        // The bases follow all triangles in the file, they stay in memory until then
+        for (int p = first; p < last; p++) {
+            paged_page_t* page  = &b.pages[p];
+            size_t        count = h.base_count + page->base_count;
+            if (count > base_capacity) {
+                size_t capacity = base_capacity ? base_capacity * 2 : (size_t)1 << 20;
+                while (capacity < count) capacity *= 2;
+
+                float* grown = realloc(base, capacity * PAGED_TRIANGLE_BYTES);
+                if (!grown) {
+                    log_error("Failed to grow the base of %s to %zu triangles", source_path, capacity);
+                    goto cleanup;
+                }
+                base          = grown;
+                base_capacity = capacity;
+            }
+
+            memcpy(base + h.base_count * 9, b.window_base + (page->first_triangle - b.window_first) * 9,
+                   (size_t)page->base_count * PAGED_TRIANGLE_BYTES);
+            page->first_base  = h.base_count;
+            h.base_count     += page->base_count;
+        }
+
+        size_t bytes = (b.pages[last - 1].first_triangle + b.pages[last - 1].triangle_count - b.window_first)
+                     * PAGED_TRIANGLE_BYTES;
+        if (!_write(out, b.window, bytes)) goto cleanup;
+    }
+
+    h.triangle_count = b.source.count;
+    h.page_count     = (uint64_t)b.page_count;
+    h.base_offset    = h.triangle_count * PAGED_TRIANGLE_BYTES;
+    h.page_offset    = _align(h.base_offset + h.base_count * PAGED_TRIANGLE_BYTES);
+    h.base_cell      = b.base_cell;
+    memcpy(h.min_vertex, b.min, sizeof(b.min));
+    memcpy(h.max_vertex, b.max, sizeof(b.max));
+
+    static const char zeros[8] = { 0 };
+    ok = _write(out, base, h.base_count * PAGED_TRIANGLE_BYTES)
+      && _write(out, zeros, h.page_offset - h.base_offset - h.base_count * PAGED_TRIANGLE_BYTES)
+      && _write(out, b.pages, (size_t)b.page_count * sizeof(paged_page_t)) && _write(out, &h, sizeof(h));
+
+cleanup:
+    if (out) {
+        ok  = fclose(out) == 0 && ok;
+        out = NULL;
+
+        remove(paged_path);
+        if (ok && rename(temppath, paged_path) != 0) ok = false;
+        if (!ok) remove(temppath);
+    }
+
+    if (ok) {
+        log_info("Paged %s into %d pages of %llu triangles, %llu base triangles in %.1fms", source_path,
+                 b.page_count, (unsigned long long)h.triangle_count, (unsigned long long)h.base_count,
+                 (timer_now() - start) * 1000.0);
+    } else if (!progress_cancelled(progress)) {
+        log_error("Failed to page %s", source_path);
+    }
+
+    if (source_mapped) file_unmap(&source);
+    if (positions_mapped) file_unmap(&positions);
+    if (triangles_mapped) file_unmap(&triangles);
+    if (kind == _SOURCE_OBJ) {
+        remove(positions_path);
+        remove(triangles_path);
+    }
+
+    free(base);
+    free(b.pages);
+    free(b.page_cells);
+    arena_release(arena, mark);
+    return ok;
+}
+
+// Maps the page file, false if it is missing, damaged or older than the source
+static bool _map(paged_model_t* p)
+{
+    size_t    source_size;
+    long long source_mtime;
+    if (!file_stat(p->source_path, &source_size, &source_mtime) || !file_stat(p->paged_path, NULL, NULL)) {
+        return false;
+    }
+    if (!file_map(p->paged_path, &p->map)) return false;
+
+    const _header_t* h     = NULL;
+    bool             valid = p->map.size >= sizeof(_header_t);
+    if (valid) h = (const _header_t*)(p->map.data + p->map.size - sizeof(_header_t));
+
+    valid = valid && h->magic == PAGED_MAGIC && h->version == PAGED_VERSION
+              && h->source_size == source_size && h->source_mtime == source_mtime && h->page_count > 0
+              && h->page_count <= INT_MAX && h->base_offset == h->triangle_count * PAGED_TRIANGLE_BYTES
+              && h->page_offset == _align(h->base_offset + h->base_count * PAGED_TRIANGLE_BYTES)
+              && h->page_offset + h->page_count * sizeof(paged_page_t) + sizeof(_header_t) == p->map.size;
+
+    const paged_page_t* pages = valid ? (const paged_page_t*)(p->map.data + h->page_offset) : NULL;
+    for (uint64_t i = 0; valid && i < h->page_count; i++) {
+        valid = pages[i].triangle_count <= PAGED_PAGE_TRIANGLES
+             && pages[i].first_triangle + pages[i].triangle_count <= h->triangle_count
+             && pages[i].first_base + pages[i].base_count <= h->base_count;
+    }
+
+    if (!valid) {
+        log_info("Discarding stale page file %s", p->paged_path);
+        file_unmap(&p->map);
+        return false;
+    }
+
+    p->pages          = pages;
+    p->page_count     = (int)h->page_count;
+    p->triangle_count = (long long)h->triangle_count;
+    p->base_count     = (long long)h->base_count;
+    p->base_cell      = h->base_cell;
+    p->triangles      = (const float*)p->map.data;
+    p->base           = (const float*)(p->map.data + h->base_offset);
+    memcpy(p->min_vertex, h->min_vertex, sizeof(p->min_vertex));
+    memcpy(p->max_vertex, h->max_vertex, sizeof(p->max_vertex));
+    return true;
+}
+
+static void _builder_main(void* userdata, int index)
+{
+    (void)index;
+    paged_model_t* p = userdata;
+
+    bool ready = _map(p) || (paged_build(p->source_path, p->paged_path, &p->progress) && _map(p));
+    atomic_store(&p->state, ready ? PAGED_READY : PAGED_FAILED);
+}
+
+// Reads the queued pages oldest first, the render thread uploads them
+static void _io_main(void* userdata, int index)
+{
+    (void)index;
+    paged_model_t* p = userdata;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        paged_request_t* next = NULL;
+        for (int i = 0; i < PAGED_MAX_INFLIGHT; i++) {
+            paged_request_t* r = &p->requests[i];
+            if (r->state == PAGED_REQUEST_QUEUED && (!next || r->sequence < next->sequence)) next = r;
+        }
+
+        if (!next) {
+            if (p->stopping) break;
+            pthread_cond_wait(&p->wake, &p->lock);
+            continue;
+        }
+
+        next->state = PAGED_REQUEST_READING;
+        pthread_mutex_unlock(&p->lock);
+
+        // Touching the mapping is the read, the page cache keeps what other pages share
+        const paged_page_t* page = &p->pages[next->page];
+        memcpy(next->staging, p->triangles + page->first_triangle * 9, page->triangle_count * PAGED_TRIANGLE_BYTES);
+
+        pthread_mutex_lock(&p->lock);
+        next->state = PAGED_REQUEST_DONE;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void paged_init(paged_model_t* p)
+{
+    memset(p, 0, sizeof(*p));
+    atomic_init(&p->state, PAGED_IDLE);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    p->gpu_budget = PAGED_GPU_BUDGET;
+}
+
+bool paged_open(paged_model_t* p, const char* source_path, const char* paged_path, vec3 position)
+{
+    paged_close(p);
+
+    p->source_path = e_strdup(source_path);
+    p->paged_path  = e_strdup(paged_path);
+    glm_vec3_copy(position, p->position);
+    progress_reset(&p->progress, 0);
+    atomic_store(&p->state, PAGED_BUILDING);
+
+    p->builder = thread_spawn(_builder_main, p);
+    if (!p->builder) {
+        atomic_store(&p->state, PAGED_FAILED);
+        return false;
+    }
+    return true;
+}
+
+static void _vao_create(unsigned int* vao, unsigned int buffer)
+{
+    glGenVertexArrays(1, vao);
+    glBindVertexArray(*vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), NULL);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Slots, the base and the io thread, once the page file is mapped
+static bool _gpu_create(paged_model_t* p)
+{
+    size_t slots  = p->gpu_budget / PAGED_SLOT_BYTES;
+    p->slot_count = (int)(slots < 1 ? 1 : slots < (size_t)p->page_count ? slots : (size_t)p->page_count);
+
+    p->page_slot    = malloc(p->page_count * sizeof(int));
+    p->page_loading = calloc(p->page_count, sizeof(bool));
+    p->page_used    = calloc(p->page_count, sizeof(long long));
+    p->slot_page    = malloc(p->slot_count * sizeof(int));
+    p->firsts       = malloc(p->page_count * sizeof(int));
+    p->counts       = malloc(p->page_count * sizeof(int));
+    p->ranking      = malloc(p->page_count * sizeof(paged_rank_t));
+    if (!p->page_slot || !p->page_loading || !p->page_used || !p->slot_page || !p->firsts || !p->counts
+        || !p->ranking)
+    {
+        log_error("Failed to allocate the residency of %d pages", p->page_count);
+        return false;
+    }
+    for (int i = 0; i < p->page_count; i++) p->page_slot[i] = -1;
+    for (int i = 0; i < p->slot_count; i++) p->slot_page[i] = -1;
+
+    for (int i = 0; i < PAGED_MAX_INFLIGHT; i++) {
+        p->requests[i] = (paged_request_t) { .state = PAGED_REQUEST_FREE, .staging = malloc(PAGED_SLOT_BYTES) };
+        if (!p->requests[i].staging) return false;
+    }
+
+    if (!shader_create(&p->shader, vs_source, fs_source, _uniforms, 1)) return false;
+
+    glGenBuffers(1, &p->slot_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, p->slot_buffer);
+    glBufferData(GL_ARRAY_BUFFER, (size_t)p->slot_count * PAGED_SLOT_BYTES, NULL, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &p->base_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, p->base_buffer);
+    glBufferData(GL_ARRAY_BUFFER, p->base_count ? p->base_count * PAGED_TRIANGLE_BYTES : 1, p->base, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        log_error("OpenGL error 0x%x while allocating %d page slots", err, p->slot_count);
+        return false;
+    }
+
+    _vao_create(&p->slot_vao, p->slot_buffer);
+    _vao_create(&p->base_vao, p->base_buffer);
+
+    // Unit size at the placement, like every other model
+    vec3 center, extent;
+    glm_vec3_add(p->min_vertex, p->max_vertex, center);
+    glm_vec3_scale(center, -0.5f, center);
+    glm_vec3_sub(p->max_vertex, p->min_vertex, extent);
+
+    float max_extent = fmaxf(fmaxf(extent[0], extent[1]), extent[2]) * 0.5f;
+    glm_translate_make(p->model, p->position);
+    glm_scale_uni(p->model, 1.0f / (max_extent > 0.0f ? max_extent : 1.0f));
+    glm_translate(p->model, center);
+
+    p->stopping = false;
+    p->io       = thread_spawn(_io_main, p);
+
+    log_info("Paging %s through %d slots (%.0fMB), %lld base triangles resident", p->source_path, p->slot_count,
+             p->slot_count * (double)PAGED_SLOT_BYTES / (1024.0 * 1024.0), p->base_count);
+    return p->io != NULL;
+}
+
+// Uploads what the io thread finished, the pages are drawn in full from the next render on
+static bool _upload(paged_model_t* p)
+{
+    bool uploaded = false;
+
+    for (int i = 0; i < PAGED_MAX_INFLIGHT; i++) {
+        paged_request_t* r = &p->requests[i];
+
+        pthread_mutex_lock(&p->lock);
+        bool done = r->state == PAGED_REQUEST_DONE;
+        pthread_mutex_unlock(&p->lock);
+        if (!done) continue;
+
+        size_t bytes = p->pages[r->page].triangle_count * PAGED_TRIANGLE_BYTES;
+        glBindBuffer(GL_ARRAY_BUFFER, p->slot_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, (size_t)r->slot * PAGED_SLOT_BYTES, bytes, r->staging);
+
+        p->page_slot[r->page]     = r->slot;
+        p->page_loading[r->page]  = false;
+        p->resident_count        += 1;
+        p->streamed_bytes        += bytes;
+        uploaded                  = true;
+
+        pthread_mutex_lock(&p->lock);
+        r->state = PAGED_REQUEST_FREE;
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return uploaded;
+}
+
+// A free slot or the one of the least recently wanted page, -1 when all hold pages wanted now
+static int _take_slot(paged_model_t* p)
+{
+    int victim = -1;
+    for (int s = 0; s < p->slot_count; s++) {
+        int page = p->slot_page[s];
+        if (page < 0) return s;
+        if (p->page_loading[page] || p->page_used[page] == p->frame) continue;
+        if (victim < 0 || p->page_used[page] < p->page_used[p->slot_page[victim]]) victim = s;
+    }
+
+    if (victim >= 0) {
+        p->page_slot[p->slot_page[victim]]  = -1;
+        p->resident_count                  -= 1;
+    }
+    return victim;
+}
+
+static int _compare_rank(const void* a, const void* b)
+{
+    float x = ((const paged_rank_t*)a)->pixels, y = ((const paged_rank_t*)b)->pixels;
+    return (x < y) - (x > y);
+}
+
+static bool _page_outside(const paged_page_t* page, vec4 planes[6])
+{
+    for (int i = 0; i < 6; i++) {
+        if (glm_vec3_dot(planes[i], (float*)page->center) + planes[i][3] < -page->radius) return true;
+    }
+    return false;
+}
+
+// Ranks the visible pages by how far their base is off on screen and streams the worst ones in,
+// as many as the slots hold. Returns false while wanted pages are still waiting for a request.
+static bool _residency(paged_model_t* p, mat4 view, mat4 projection, int viewport_height)
+{
+    mat4 modelview, clip, inverse;
+    vec4 planes[6];
+    glm_mat4_mul(view, p->model, modelview);
+    glm_mat4_mul(projection, modelview, clip);
+    glm_mat4_inv(modelview, inverse);
+    meshlets_frustum(clip, planes);
+
+    const float* eye             = inverse[3];
+    float        pixels_per_unit = projection[1][1] * viewport_height * 0.5f;
+
+    paged_rank_t* wanted = p->ranking;
+    int           count  = 0;
+
+    p->frame++;
+    for (int i = 0; i < p->page_count; i++) {
+        const paged_page_t* page = &p->pages[i];
+        if (_page_outside(page, planes)) continue;
+
+        float distance = glm_vec3_distance((float*)eye, (float*)page->center) - page->radius;
+        float pixels   = distance > 0.0f ? p->base_cell * pixels_per_unit / distance : INFINITY;
+        if (pixels >= PAGED_DETAIL_PIXELS) wanted[count++] = (paged_rank_t) { i, pixels };
+    }
+
+    qsort(wanted, count, sizeof(paged_rank_t), _compare_rank);
+    if (count > p->slot_count) count = p->slot_count;
+    for (int i = 0; i < count; i++) p->page_used[wanted[i].page] = p->frame;
+
+    bool settled = true;
+    int  request = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (int i = 0; i < count; i++) {
+        int page = wanted[i].page;
+        if (p->page_slot[page] >= 0 || p->page_loading[page]) continue;
+
+        while (request < PAGED_MAX_INFLIGHT && p->requests[request].state != PAGED_REQUEST_FREE) request++;
+        int slot = request < PAGED_MAX_INFLIGHT ? _take_slot(p) : -1;
+        if (slot < 0) {
+            settled = false;
+            break;
+        }
+
+        p->slot_page[slot]     = page;
+        p->page_loading[page]  = true;
+        p->requests[request]   = (paged_request_t) { PAGED_REQUEST_QUEUED, page, slot, p->next_sequence++,
+                                                     p->requests[request].staging };
+    }
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    return settled;
+}
+
+bool paged_update(paged_model_t* p, mat4 view, mat4 projection, int viewport_height)
+{
+    int state = atomic_load(&p->state);
+
+    if (p->builder && state != PAGED_BUILDING) {
+        thread_join(p->builder);
+        p->builder = NULL;
+
+        if (state == PAGED_READY && !_gpu_create(p)) {
+            log_error("Failed to open the pages of %s", p->source_path);
+            atomic_store(&p->state, PAGED_FAILED);
+        }
+        return true;
+    }
+    if (state != PAGED_READY || !p->io) return false;
+
+    bool uploaded = _upload(p);
+    bool moved    = memcmp(view, p->view, sizeof(mat4)) != 0 || memcmp(projection, p->projection, sizeof(mat4)) != 0;
+
+    if (uploaded || moved || p->pending) {
+        glm_mat4_copy(view, p->view);
+        glm_mat4_copy(projection, p->projection);
+        p->pending = !_residency(p, view, projection, viewport_height);
+    }
+    return uploaded;
+}
+
+void paged_render(paged_model_t* p, mat4 view, mat4 projection)
+{
+    p->drawn_triangles = 0;
+    if (!paged_is_loaded(p)) return;
+
+    mat4 clip;
+    vec4 planes[6];
+    glm_mat4_mul(view, p->model, clip);
+    glm_mat4_mul(projection, clip, clip);
+    meshlets_frustum(clip, planes);
+
+    glUseProgram(p->shader.program);
+    glUniformMatrix4fv(p->shader.locations[0], 1, GL_FALSE, (float*)p->model);
+
+    // Resident pages in full from their slots, the others as their base
+    for (int pass = 0; pass < 2; pass++) {
+        int count = 0;
+        for (int i = 0; i < p->page_count; i++) {
+            const paged_page_t* page     = &p->pages[i];
+            bool                resident = p->page_slot[i] >= 0;
+            if (resident != (pass == 0) || _page_outside(page, planes)) continue;
+
+            if (resident) {
+                p->firsts[count] = p->page_slot[i] * PAGED_PAGE_TRIANGLES * 3;
+                p->counts[count] = (int)page->triangle_count * 3;
+            } else {
+                if (page->base_count == 0) continue;
+                p->firsts[count] = (int)page->first_base * 3;
+                p->counts[count] = (int)page->base_count * 3;
+            }
+            p->drawn_triangles += p->counts[count] / 3;
+            count++;
+        }
+
+        if (count == 0) continue;
+        glBindVertexArray(pass == 0 ? p->slot_vao : p->base_vao);
+        glMultiDrawArrays(GL_TRIANGLES, p->firsts, p->counts, count);
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+void paged_close(paged_model_t* p)
+{
+    if (p->builder) {
+        atomic_store(&p->progress.cancel, true);
+        thread_join(p->builder);
+        p->builder = NULL;
+    }
+
+    if (p->io) {
+        pthread_mutex_lock(&p->lock);
+        p->stopping = true;
+        pthread_cond_signal(&p->wake);
+        pthread_mutex_unlock(&p->lock);
+        thread_join(p->io);
+        p->io = NULL;
+    }
+
+    if (p->slot_vao) glDeleteVertexArrays(1, &p->slot_vao);
+    if (p->base_vao) glDeleteVertexArrays(1, &p->base_vao);
+    if (p->slot_buffer) glDeleteBuffers(1, &p->slot_buffer);
+    if (p->base_buffer) glDeleteBuffers(1, &p->base_buffer);
+    shader_destroy(&p->shader);
+
+    for (int i = 0; i < PAGED_MAX_INFLIGHT; i++) free(p->requests[i].staging);
+    free(p->page_slot);
+    free(p->page_loading);
+    free(p->page_used);
+    free(p->slot_page);
+    free(p->firsts);
+    free(p->counts);
+    free(p->ranking);
+    if (p->map.data) file_unmap(&p->map);
+    free(p->source_path);
+    free(p->paged_path);
+
+    size_t gpu_budget = p->gpu_budget;
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    paged_init(p);
+    p->gpu_budget = gpu_budget;
+}
+
+bool paged_is_loaded(const paged_model_t* p)
+{
+    return atomic_load(&p->state) == PAGED_READY && p->io != NULL;
+}
+
+bool paged_is_busy(paged_model_t* p)
+{
+    if (p->builder) return true;
+    if (!p->io) return false;
+
+    bool busy = p->pending;
+    pthread_mutex_lock(&p->lock);
+    for (int i = 0; i < PAGED_MAX_INFLIGHT && !busy; i++) busy = p->requests[i].state != PAGED_REQUEST_FREE;
+    pthread_mutex_unlock(&p->lock);
+    return busy;
+}
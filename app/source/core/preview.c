@@ -0,0 +1,209 @@
+#include "core/preview.h"
+
+#include "glad/glad.h"
+#include "log.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREVIEW_TRIANGLE_BYTES (9 * sizeof(float))
+#define PREVIEW_POINT_BYTES (3 * sizeof(float))
+
+static const char* vs_source = "#version 450 core\n"
+                               "layout (location = 0) in vec3 aPos;\n"
+                               "out vec3 FragPos;\n"
+                               SHADER_CAMERA_BLOCK
+                               "uniform mat4 uModel;\n"
+                               "void main() {\n"
+                               "    vec4 world = uModel * vec4(aPos, 1.0);\n"
+                               "    gl_Position = uProj * uView * world;\n"
+                               "    FragPos = world.xyz;\n"
+                               "}\n";
+
+// Triangles are lit by the face normal from the derivatives, points have none
+static const char* fs_source = "#version 450 core\n"
+                               "in vec3 FragPos;\n"
+                               "out vec4 FragColor;\n"
+                               "uniform bool uPoints;\n"
+                               "void main() {\n"
+                               "    vec3 baseColor = vec3(0.8, 0.8, 0.8);\n"
+                               "    if (uPoints) {\n"
+                               "        FragColor = vec4(0.6 * baseColor, 1.0);\n"
+                               "        return;\n"
+                               "    }\n"
+                               "    vec3 normal = normalize(cross(dFdx(FragPos), dFdy(FragPos)));\n"
+                               "    vec3 lightDir = normalize(vec3(1.0, 10.0, -1.0));\n"
+                               "    float diff = max(dot(normal, lightDir), 0.0);\n"
+                               "    vec3 ambient = 0.2 * baseColor;\n"
+                               "    vec3 diffuse = diff * baseColor;\n"
+                               "    FragColor = vec4(ambient + diffuse, 1.0);\n"
+                               "}\n";
+
+static const char* _uniforms[] = { "uModel", "uPoints" };
+
+void preview_publish(load_preview_t* source, preview_batch_t* batch)
+{
+    batch->next = atomic_load(&source->batches);
+    while (!atomic_compare_exchange_weak(&source->batches, &batch->next, batch)) {}
+}
+
+preview_batch_t* preview_take(load_preview_t* source)
+{
+    return atomic_exchange(&source->batches, NULL);
+}
+
+void preview_batch_free(preview_batch_t* batch)
+{
+    while (batch) {
+        preview_batch_t* next = batch->next;
+        free(batch->triangles);
+        free(batch->points);
+        free(batch);
+        batch = next;
+    }
+}
+
+void preview_discard(load_preview_t* source)
+{
+    preview_batch_free(preview_take(source));
+}
+
+void preview_init(preview_t* p)
+{
+    memset(p, 0, sizeof(*p));
+    glm_vec3_fill(p->min, INFINITY);
+    glm_vec3_fill(p->max, -INFINITY);
+}
+
+static void _vao_create(unsigned int* vao, unsigned int buffer)
+{
+    glGenVertexArrays(1, vao);
+    glBindVertexArray(*vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), NULL);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+}
+
+// Appends count elements, the buffer doubles and keeps what it held when it runs out
+static bool _append(unsigned int* vao, unsigned int* buffer, int* used, int* capacity, const float* data, int count,
+                    size_t element_size)
+{
+    if (*used + count > *capacity) {
+        int grown = *capacity ? *capacity : 1 << 16;
+        while (grown < *used + count) grown *= 2;
+
+        unsigned int target;
+        glGenBuffers(1, &target);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+        glBufferData(GL_COPY_WRITE_BUFFER, (size_t)grown * element_size, NULL, GL_STATIC_DRAW);
+        if (glGetError() != GL_NO_ERROR) {
+            glDeleteBuffers(1, &target);
+            return false;
+        }
+
+        if (*used > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (size_t)*used * element_size);
+        }
+
+        glDeleteVertexArrays(1, vao);
+        glDeleteBuffers(1, buffer);
+        *buffer   = target;
+        *capacity = grown;
+        _vao_create(vao, *buffer);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, (size_t)*used * element_size, (size_t)count * element_size, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    *used += count;
+    return true;
+}
+
+bool preview_update(preview_t* p, load_preview_t* source)
+{
+    preview_batch_t* batches = preview_take(source);
+    if (!batches) return false;
+
+    if (!p->shader.program && !shader_create(&p->shader, vs_source, fs_source, _uniforms, 2)) {
+        preview_batch_free(batches);
+        return false;
+    }
+
+    for (preview_batch_t* b = batches; b; b = b->next) {
+        glm_vec3_minv(p->min, b->min, p->min);
+        glm_vec3_maxv(p->max, b->max, p->max);
+
+        // Past the limits the rest of the file only refines the bounds
+        int triangles = b->triangle_count < PREVIEW_TRIANGLES - p->triangle_count
+                          ? b->triangle_count
+                          : PREVIEW_TRIANGLES - p->triangle_count;
+        int points    = b->point_count < PREVIEW_POINTS - p->point_count ? b->point_count
+                                                                         : PREVIEW_POINTS - p->point_count;
+
+        if ((triangles > 0
+             && !_append(&p->triangle_vao, &p->triangle_buffer, &p->triangle_count, &p->triangle_capacity,
+                         b->triangles, triangles, PREVIEW_TRIANGLE_BYTES))
+            || (points > 0
+                && !_append(&p->point_vao, &p->point_buffer, &p->point_count, &p->point_capacity, b->points, points,
+                            PREVIEW_POINT_BYTES)))
+        {
+            log_warn("Failed to grow the preview past %d triangles and %d points", p->triangle_count,
+                     p->point_count);
+        }
+    }
+
+    preview_batch_free(batches);
+    return true;
+}
+
+void preview_render(preview_t* p, vec3 position)
+{
+    if (!preview_is_loaded(p) || p->min[0] > p->max[0]) return;
+
+    // Unit size at the placement the model will take, like paged and batched models
+    vec3 center, extent;
+    glm_vec3_add(p->min, p->max, center);
+    glm_vec3_scale(center, -0.5f, center);
+    glm_vec3_sub(p->max, p->min, extent);
+
+    mat4  model;
+    float max_extent = fmaxf(fmaxf(extent[0], extent[1]), extent[2]) * 0.5f;
+    glm_translate_make(model, position);
+    glm_scale_uni(model, 1.0f / (max_extent > 0.0f ? max_extent : 1.0f));
+    glm_translate(model, center);
+
+    glUseProgram(p->shader.program);
+    glUniformMatrix4fv(p->shader.locations[0], 1, GL_FALSE, (float*)model);
+
+    // The vertices stand in until the first faces are read
+    if (p->triangle_count > 0) {
+        glUniform1i(p->shader.locations[1], 0);
+        glBindVertexArray(p->triangle_vao);
+        glDrawArrays(GL_TRIANGLES, 0, p->triangle_count * 3);
+    } else {
+        glUniform1i(p->shader.locations[1], 1);
+        glBindVertexArray(p->point_vao);
+        glDrawArrays(GL_POINTS, 0, p->point_count);
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+void preview_clear(preview_t* p)
+{
+    if (p->triangle_vao) glDeleteVertexArrays(1, &p->triangle_vao);
+    if (p->point_vao) glDeleteVertexArrays(1, &p->point_vao);
+    if (p->triangle_buffer) glDeleteBuffers(1, &p->triangle_buffer);
+    if (p->point_buffer) glDeleteBuffers(1, &p->point_buffer);
+    shader_destroy(&p->shader);
+    preview_init(p);
+}
+
+bool preview_is_loaded(const preview_t* p)
+{
+    return p->triangle_count > 0 || p->point_count > 0;
+}
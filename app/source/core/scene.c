@@ -1,23 +1,21 @@
 #include "core/scene.h"
 
+#include "core/cache.h"
+#include "engine/file.h"
+#include "engine/profiler.h"
+#include "engine/string.h"
+#include "parsers/gltf.h"
 #include "parsers/obj.h"
+#include "parsers/stl.h"
 
 #include "glad/glad.h"
 #include "log.h"
 
-#define NK_INCLUDE_FIXED_TYPES
-#define NK_INCLUDE_STANDARD_IO
-#define NK_INCLUDE_STANDARD_VARARGS
-#define NK_INCLUDE_DEFAULT_ALLOCATOR
-#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
-#define NK_INCLUDE_FONT_BAKING
-#define NK_INCLUDE_DEFAULT_FONT
-#include "nuklear.h"
-
-#include "nuklear_glfw_gl4.h"
-
+#include <stdio.h>
 #include <string.h>
 
+#define SCENE_SNIFF_SIZE 512
+
 void _scale_model_size(vec3 min, vec3 max, vec3 scaled)
 {
     vec3 center, extent, normalized;
@@ -35,6 +33,81 @@ void _scale_model_size(vec3 min, vec3 max, vec3 scaled)
     glm_vec3_scale(normalized, 1.0f, scaled);
 }
 
+static void _frame_destroy(scene_t* scene)
+{
+    glDeleteFramebuffers(1, &scene->frame_fbo);
+    glDeleteRenderbuffers(1, &scene->frame_color);
+    glDeleteRenderbuffers(1, &scene->frame_depth);
+    scene->frame_fbo    = 0;
+    scene->frame_color  = 0;
+    scene->frame_depth  = 0;
+    scene->frame_width  = 0;
+    scene->frame_height = 0;
+}
+
+// (Re)creates the cached frame at the window size, false leaves the scene drawing directly
+static bool _frame_prepare(scene_t* scene)
+{
+    if (scene->frame_fbo && scene->frame_width == scene->window_width && scene->frame_height == scene->window_height) {
+        return true;
+    }
+
+    _frame_destroy(scene);
+    if (scene->window_width <= 0 || scene->window_height <= 0) return false;
+
+    glGenRenderbuffers(1, &scene->frame_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, scene->frame_color);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, SCENE_SAMPLES, GL_RGBA8, scene->window_width,
+                                     scene->window_height);
+
+    glGenRenderbuffers(1, &scene->frame_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, scene->frame_depth);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, SCENE_SAMPLES, GL_DEPTH_COMPONENT24, scene->window_width,
+                                     scene->window_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &scene->frame_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene->frame_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, scene->frame_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, scene->frame_depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        log_error("Failed to create a %dx%d frame buffer, drawing every frame", scene->window_width,
+                  scene->window_height);
+        _frame_destroy(scene);
+        return false;
+    }
+
+    scene->frame_width  = scene->window_width;
+    scene->frame_height = scene->window_height;
+    scene->dirty        = true;
+    return true;
+}
+
+// Square rings around the origin, ring r holds the 8r slots after the first (2r - 1)^2
+static void _placement_slot(int n, vec3 position)
+{
+    int r = 0;
+    while ((2 * r + 1) * (2 * r + 1) <= n) r++;
+
+    int x = 0, z = 0;
+    if (r > 0) {
+        int k    = n - (2 * r - 1) * (2 * r - 1);
+        int side = k / (2 * r);
+        int step = k % (2 * r);
+
+        // Counter clockwise from the slot after the corner at (r, -r)
+        int xs[4] = { r, r - 1 - step, -r, -r + 1 + step };
+        int zs[4] = { -r + 1 + step, r, r - 1 - step, -r };
+        x         = xs[side];
+        z         = zs[side];
+    }
+
+    position[0] = x * SCENE_PLACEMENT_SPACING;
+    position[1] = 0.0f;
+    position[2] = z * SCENE_PLACEMENT_SPACING;
+}
+
 void scene_init(scene_t* scene, int width, int heigth)
 {
     scene_resize(scene, width, heigth);
@@ -44,60 +117,363 @@ void scene_init(scene_t* scene, int width, int heigth)
 
     scene->grid = grid_create();
 
-    gpu_model_init(&scene->gpu_model);
+    batch_init(&scene->batch);
+    paged_init(&scene->paged);
+    preview_init(&scene->preview);
+    loader_init(&scene->loader);
 
-    scene->dirty      = true;
-    scene->modelpath  = NULL;
-    scene->model_size = 0;
+    scene->dirty           = true;
+    scene->queue           = NULL;
+    scene->queue_count     = 0;
+    scene->queue_capacity  = 0;
+    scene->drops           = NULL;
+    scene->drop_count      = 0;
+    scene->drop_capacity   = 0;
+    scene->placement_count = 0;
+    scene->vertex_format   = VERTEX_FORMAT_F32;
+    scene->optimize_meshes = true;
+    scene->frame_fbo       = 0;
+    scene->frame_color     = 0;
+    scene->frame_depth     = 0;
+    scene->frame_width     = 0;
+    scene->frame_height    = 0;
 }
 
 void scene_unload(scene_t* scene)
 {
-    scene->modelpath  = NULL;
-    scene->model_size = 0;
-    gpu_model_unload(&scene->gpu_model);
+    scene_clear(scene);
+    free(scene->queue);
+    scene->queue          = NULL;
+    scene->queue_capacity = 0;
+    free(scene->drops);
+    scene->drops         = NULL;
+    scene->drop_capacity = 0;
+
+    batch_free(&scene->batch);
     grid_destroy(&scene->grid);
-    free(scene->modelpath);
+    _frame_destroy(scene);
+    shader_camera_destroy();
 }
 
 void scene_render(scene_t* scene)
 {
-    gpu_model_render(&scene->gpu_model, scene->projection, scene->camera.view);
-    grid_render(&scene->grid, scene->projection, scene->camera.view);
-    scene->dirty = false;
+    GLint target;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+
+    bool cached = _frame_prepare(scene);
+
+    // Every program reads the camera from the shared block, it only uploads when it moved
+    shader_camera_update(scene->projection, scene->camera.view, scene->screen);
+
+    if (scene->dirty || !cached) {
+        glBindFramebuffer(GL_FRAMEBUFFER, cached ? scene->frame_fbo : (GLuint)target);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        profiler_zone_t zone = profiler_begin("model draw");
+        profiler_gpu_begin("model draw");
+        batch_render(&scene->batch, scene->camera.view, scene->projection);
+        paged_render(&scene->paged, scene->camera.view, scene->projection);
+        if (preview_is_loaded(&scene->preview)) {
+            vec3 position;
+            _placement_slot(scene->placement_count, position);
+            preview_render(&scene->preview, position);
+        }
+        profiler_gpu_end();
+        profiler_end(&zone);
+
+        zone = profiler_begin("grid draw");
+        profiler_gpu_begin("grid draw");
+        grid_render(&scene->grid);
+        profiler_gpu_end();
+        profiler_end(&zone);
+
+        scene->dirty = false;
+    }
+
+    if (cached) {
+        // Resolves the samples, so a static model costs one blit however many triangles it has
+        profiler_gpu_begin("resolve");
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, scene->frame_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)target);
+        glBlitFramebuffer(0, 0, scene->frame_width, scene->frame_height, 0, 0, scene->frame_width, scene->frame_height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        profiler_gpu_end();
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)target);
+}
+
+static bool _has_extension(const char* path, const char* ext)
+{
+    size_t len = strlen(path), ext_len = strlen(ext);
+    if (len < ext_len) return false;
+
+    for (size_t i = 0; i < ext_len; i++) {
+        char c = path[len - ext_len + i];
+        if ((c >= 'A' && c <= 'Z' ? c + 32 : c) != ext[i]) return false;
+    }
+    return true;
+}
+
+static const model_reader_t _obj_reader  = { "obj", parse_obj, NULL };
+static const model_reader_t _stl_reader  = { "stl", parse_stl, NULL };
+static const model_reader_t _gltf_reader = { "gltf", NULL, parse_gltf };
+
+const model_reader_t* scene_sniff_reader(const char* path)
+{
+    char   head[SCENE_SNIFF_SIZE];
+    size_t head_size = 0, file_size = 0;
+
+    FILE* f = fopen(path, "rb");
+    if (f) {
+        head_size = fread(head, 1, sizeof(head), f);
+        fclose(f);
+    }
+    file_stat(path, &file_size, NULL);
+
+    if (gltf_detect(head, head_size)) return &_gltf_reader;
+    if (stl_detect(head, head_size, file_size) != STL_NONE) return &_stl_reader;
+    if (_has_extension(path, ".stl")) return &_stl_reader;
+    if (_has_extension(path, ".gltf") || _has_extension(path, ".glb")) return &_gltf_reader;
+    return &_obj_reader;
+}
+
+// Each placement takes the next slot, so earlier ones never move and none overlap
+static void _place_instance(scene_t* scene, int model)
+{
+    vec3 position;
+    mat4 transform;
+    _placement_slot(scene->placement_count, position);
+    glm_translate_make(transform, position);
+
+    if (!batch_add_instance(&scene->batch, model, transform)) return;
+    scene->placement_count++;
+    scene->dirty = true;
+}
+
+static bool _is_queued(const scene_t* scene, const char* modelpath)
+{
+    if (scene->loader.path && strcmp(modelpath, scene->loader.path) == 0) return true;
+
+    for (int i = 0; i < scene->queue_count; i++) {
+        if (strcmp(modelpath, scene->queue[i]) == 0) return true;
+    }
+    return false;
+}
+
+static void _queue_push(scene_t* scene, const char* modelpath)
+{
+    if (_is_queued(scene, modelpath)) return;
+
+    if (scene->queue_count == scene->queue_capacity) {
+        int    capacity = scene->queue_capacity ? scene->queue_capacity * 2 : 8;
+        char** queue    = realloc(scene->queue, capacity * sizeof(char*));
+        if (!queue) {
+            log_error("Failed to queue %s", modelpath);
+            return;
+        }
+        scene->queue          = queue;
+        scene->queue_capacity = capacity;
+    }
+
+    scene->queue[scene->queue_count++] = e_strdup(modelpath);
+}
+
+static void _drop_push(scene_t* scene, const char* modelpath)
+{
+    if (scene->drop_count == scene->drop_capacity) {
+        int    capacity = scene->drop_capacity ? scene->drop_capacity * 2 : 8;
+        char** drops    = realloc(scene->drops, capacity * sizeof(char*));
+        if (!drops) {
+            log_error("Failed to remember another placement of %s", modelpath);
+            return;
+        }
+        scene->drops         = drops;
+        scene->drop_capacity = capacity;
+    }
+
+    scene->drops[scene->drop_count++] = e_strdup(modelpath);
+    log_info("%s is still loading, it gets another placement once it is in", modelpath);
+}
+
+// Places the extra instances of files that came in, the ones of files that failed are dropped
+static void _drops_apply(scene_t* scene)
+{
+    int kept = 0;
+    for (int i = 0; i < scene->drop_count; i++) {
+        char* modelpath = scene->drops[i];
+        int   model     = batch_find(&scene->batch, modelpath);
+
+        if (model >= 0) {
+            _place_instance(scene, model);
+        } else if (_is_queued(scene, modelpath)) {
+            scene->drops[kept++] = modelpath;
+            continue;
+        } else {
+            log_warn("Dropping another placement of %s, it failed to load", modelpath);
+        }
+        free(modelpath);
+    }
+    scene->drop_count = kept;
+}
+
+// Starts the next queued file once the loader is done, cache write included
+static void _queue_next(scene_t* scene)
+{
+    if (scene->loader.thread || scene->queue_count == 0) return;
+
+    char* modelpath = scene->queue[0];
+    scene->queue_count--;
+    memmove(scene->queue, scene->queue + 1, scene->queue_count * sizeof(char*));
+
+    loader_start(&scene->loader, modelpath, scene_sniff_reader(modelpath), scene->vertex_format,
+                 scene->optimize_meshes);
+    free(modelpath);
+}
+
+// The page file lives in the cache directory, without one the file goes through the loader
+static bool _open_paged(scene_t* scene, const char* modelpath)
+{
+    char pagedpath[1200];
+    if (!cache_sidecar_path(modelpath, ".fovp", pagedpath, sizeof(pagedpath))) {
+        log_warn("No cache directory for the pages of %s, loading it whole", modelpath);
+        return false;
+    }
+
+    vec3 position;
+    _placement_slot(scene->placement_count, position);
+    if (!paged_open(&scene->paged, modelpath, pagedpath, position)) return false;
+
+    scene->placement_count++;
+    scene->dirty = true;
+    return true;
 }
 
 void scene_load_model(scene_t* scene, const char* modelpath)
 {
-    // Ingnore if model paths match
-    if (scene->modelpath && strcmp(modelpath, scene->modelpath) == 0) return;
+    // Too large to hold in memory, its pages stream in as the view needs them
+    if (paged_wanted(modelpath) && _open_paged(scene, modelpath)) return;
+
+    // Repeated parts share the model, only the placement is new
+    int model = batch_find(&scene->batch, modelpath);
+    if (model >= 0) {
+        _place_instance(scene, model);
+        return;
+    }
+
+    if (_is_queued(scene, modelpath)) {
+        _drop_push(scene, modelpath);
+        return;
+    }
+
+    _queue_push(scene, modelpath);
+    _queue_next(scene);
+}
+
+void scene_clear(scene_t* scene)
+{
+    loader_cancel(&scene->loader);
 
-    free(scene->modelpath);
-    scene->modelpath = malloc(strlen(modelpath) + 1);
+    for (int i = 0; i < scene->queue_count; i++) free(scene->queue[i]);
+    scene->queue_count = 0;
+    for (int i = 0; i < scene->drop_count; i++) free(scene->drops[i]);
+    scene->drop_count = 0;
 
-    strcpy(scene->modelpath, modelpath);
+    batch_clear(&scene->batch);
+    paged_close(&scene->paged);
+    preview_clear(&scene->preview);
+    scene->placement_count = 0;
+    scene->dirty           = true;
+}
+
+void scene_reload_model(scene_t* scene)
+{
+    // A load in flight used the old settings as well
+    char* loading = scene->loader.path && !scene->loader.delivered ? e_strdup(scene->loader.path) : NULL;
+    loader_cancel(&scene->loader);
+
+    if (loading) _queue_push(scene, loading);
+    free(loading);
+
+    for (int i = 0; i < scene->batch.model_count; i++) {
+        _queue_push(scene, scene->batch.models[i].path);
+    }
+    _queue_next(scene);
+}
+
+// The grid sits under the lowest model
+static void _grid_update(scene_t* scene)
+{
+    float floor = 0.0f;
+    bool  found = false;
+    for (int i = 0; i < scene->batch.model_count; i++) {
+        vec3 scaled;
+        _scale_model_size(scene->batch.models[i].gpu.min_vertex, scene->batch.models[i].gpu.max_vertex, scaled);
+        if (!found || scaled[1] < floor) floor = scaled[1];
+        found = true;
+    }
+
+    if (paged_is_loaded(&scene->paged)) {
+        vec3 lowest;
+        glm_mat4_mulv3(scene->paged.model, scene->paged.min_vertex, 1.0f, lowest);
+        if (!found || lowest[1] < floor) floor = lowest[1];
+    }
+
+    grid_build(&scene->grid, (vec3) { 0.0f, floor, 0.0f }, 10, 1.0f, .25f);
+}
+
+// The model being parsed shows on the placement it will take, a reload keeps showing the old one
+static void _preview_update(scene_t* scene)
+{
+    size_t done, total;
+    if (loader_status(&scene->loader, &done, &total) == LOADER_IDLE) {
+        if (preview_is_loaded(&scene->preview)) {
+            preview_clear(&scene->preview);
+            scene->dirty = true;
+        }
+        return;
+    }
 
-    gpu_model_unload(&scene->gpu_model);
+    if (batch_find(&scene->batch, scene->loader.path) >= 0) {
+        preview_discard(&scene->loader.preview);
+        return;
+    }
+    if (preview_update(&scene->preview, &scene->loader.preview)) scene->dirty = true;
+}
 
-    model_t model;
+void scene_update(scene_t* scene)
+{
+    _queue_next(scene);
+    _preview_update(scene);
 
-    model_init(&model);
-    parse_obj(&model, modelpath);
-    scene->gpu_model = model_upload(&model);
+    bool opened = scene->paged.builder != NULL;
+    if (paged_update(&scene->paged, scene->camera.view, scene->projection, scene->window_height)) {
+        if (opened) _grid_update(scene);
+        scene->dirty = true;
+    }
 
-    vec3 scaled;
-    _scale_model_size(scene->gpu_model.min_vertex, scene->gpu_model.max_vertex, scaled);
+    gpu_model_t model;
+    if (loader_poll(&scene->loader, LOADER_UPLOAD_BUDGET, &model)) scene_set_model(scene, model, scene->loader.path);
+    _drops_apply(scene);
+}
 
-    grid_build(&scene->grid, (vec3) { 0.0f, scaled[1], 0.0f }, 10, 1.0f, .25f);
-    model_free(&model);
-    scene->dirty      = true;
-    scene->model_size = gpu_model_get_size_mb(&scene->gpu_model);
+void scene_set_model(scene_t* scene, gpu_model_t model, const char* modelpath)
+{
+    bool replaced = batch_find(&scene->batch, modelpath) >= 0;
+    int  index    = batch_add_model(&scene->batch, model, modelpath);
+    if (index < 0) return;
+
+    if (!replaced) _place_instance(scene, index);
+
+    preview_clear(&scene->preview);
+    _grid_update(scene);
+    scene->dirty = true;
 }
 
 void scene_resize(scene_t* scene, int width, int height)
 {
     glViewport(0, 0, width, height);
     glm_perspective(glm_rad(45.0f), width / (float)height, 0.1f, 100.0f, scene->projection);
+    glm_ortho(0.0f, (float)width, (float)height, 0.0f, -1.0f, 1.0f, scene->screen);
     scene->window_width  = width;
     scene->window_height = height;
     scene->dirty         = true;
@@ -124,5 +500,17 @@ void scene_handle_mouse_move(scene_t* scene, float dx, float dy)
 
 bool scene_is_loaded(scene_t* scene)
 {
-    return scene->modelpath != NULL;
+    return scene->batch.model_count > 0 || paged_is_loaded(&scene->paged) || preview_is_loaded(&scene->preview);
+}
+
+bool scene_is_loading(scene_t* scene)
+{
+    size_t done, total;
+    return loader_status(&scene->loader, &done, &total) != LOADER_IDLE || scene->queue_count > 0
+        || scene->paged.builder != NULL;
+}
+
+bool scene_is_busy(scene_t* scene)
+{
+    return scene->loader.thread != NULL || scene->queue_count > 0 || paged_is_busy(&scene->paged);
 }
\ No newline at end of file
@@ -0,0 +1,453 @@
+#include "core/simplify.h"
+#include "core/weld.h"
+
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIMPLIFY_BORDER_WEIGHT 10.0 // open edges resist moving off their line this much more than faces
+#define SIMPLIFY_PASS_RATIO 0.25    // share of the triangles one pass may remove
+#define SIMPLIFY_MIN_DOT 0.25       // cosine a triangle's facing may turn by at most in one collapse
+
+// Sum of squared distances to a set of area weighted planes, see Garland and Heckbert
+typedef struct {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double w; // summed weight, the error is per unit of it
+} _quadric_t;
+
+// Cheapest collapse of a triangle's edges, key holds the float bits of its error so the unsigned
+// order is the error order
+typedef struct {
+    uint32_t     key;
+    unsigned int from;
+    unsigned int to;
+} _candidate_t;
+
+// Collapses work on positions, vertices that only differ in their normals move together
+typedef struct {
+    unsigned int*  canon;     // vertex -> position
+    unsigned int*  rep;       // position -> a vertex at it
+    double*        positions; // relative to the bounds center for precision
+    unsigned char* locked;    // positions collapsed or collapsed onto in the current pass
+    _quadric_t*    quadrics;
+    int            position_count;
+    unsigned int*  tris;    // positions of the remaining triangles
+    unsigned int*  corners; // their vertices, what the levels are made of
+    int            tri_count;
+    int*           adj_start; // position -> remaining triangles around it
+    unsigned int*  adj;
+    _candidate_t*  candidates;
+    _candidate_t*  scratch;
+    double         error; // largest collapse so far
+    int            task_count;
+} _simplify_t;
+
+static inline void _position(const _simplify_t* s, unsigned int p, double out[3])
+{
+    memcpy(out, &s->positions[(size_t)p * 3], 3 * sizeof(double));
+}
+
+static inline void _cross(const double a[3], const double b[3], const double c[3], double n[3])
+{
+    double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    n[0]         = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1]         = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2]         = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static inline double _dot(const double a[3], const double b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void _quadric_plane(_quadric_t* q, const double n[3], double d, double w)
+{
+    q->a00 += w * n[0] * n[0];
+    q->a01 += w * n[0] * n[1];
+    q->a02 += w * n[0] * n[2];
+    q->a11 += w * n[1] * n[1];
+    q->a12 += w * n[1] * n[2];
+    q->a22 += w * n[2] * n[2];
+    q->b0  += w * n[0] * d;
+    q->b1  += w * n[1] * d;
+    q->b2  += w * n[2] * d;
+    q->c   += w * d * d;
+    q->w   += w;
+}
+
+static void _quadric_add(_quadric_t* q, const _quadric_t* other)
+{
+    q->a00 += other->a00;
+    q->a01 += other->a01;
+    q->a02 += other->a02;
+    q->a11 += other->a11;
+    q->a12 += other->a12;
+    q->a22 += other->a22;
+    q->b0  += other->b0;
+    q->b1  += other->b1;
+    q->b2  += other->b2;
+    q->c   += other->c;
+    q->w   += other->w;
+}
+
+static double _quadric_eval(const _quadric_t* q, const double p[3])
+{
+    double x = p[0], y = p[1], z = p[2];
+    return q->a00 * x * x + q->a11 * y * y + q->a22 * z * z + 2.0 * (q->a01 * x * y + q->a02 * x * z + q->a12 * y * z)
+         + 2.0 * (q->b0 * x + q->b1 * y + q->b2 * z) + q->c;
+}
+
+// Remaining triangles per position as a CSR list
+static void _build_adjacency(_simplify_t* s)
+{
+    memset(s->adj_start, 0, (s->position_count + 1) * sizeof(int));
+    for (int i = 0; i < s->tri_count * 3; i++) s->adj_start[s->tris[i] + 1]++;
+    for (int p = 0; p < s->position_count; p++) s->adj_start[p + 1] += s->adj_start[p];
+
+    for (int t = 0; t < s->tri_count; t++) {
+        for (int k = 0; k < 3; k++) s->adj[s->adj_start[s->tris[t * 3 + k]]++] = (unsigned int)t;
+    }
+
+    // Filling advanced every start to the next one's, shift them back
+    for (int p = s->position_count; p > 0; p--) s->adj_start[p] = s->adj_start[p - 1];
+    s->adj_start[0] = 0;
+}
+
+// Everything comes from the arena, the caller releases it in one go
+static bool _simplify_init(_simplify_t* s, const model_t* m, arena_t* arena)
+{
+    memset(s, 0, sizeof(*s));
+
+    int vertex_count = m->vertex_count / 3;
+    int tri_count    = m->indice_count / 3;
+    s->canon         = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    s->rep           = arena_alloc(arena, (size_t)vertex_count * sizeof(unsigned int));
+    s->tris          = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(unsigned int));
+    s->corners       = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(unsigned int));
+    s->adj           = arena_alloc(arena, (size_t)tri_count * 3 * sizeof(unsigned int));
+    s->candidates    = arena_alloc(arena, (size_t)tri_count * sizeof(_candidate_t));
+    s->scratch       = arena_alloc(arena, (size_t)tri_count * sizeof(_candidate_t));
+
+    if (!s->canon || !s->rep || !s->tris || !s->corners || !s->adj || !s->candidates || !s->scratch) return false;
+
+    s->position_count = weld_positions(m, s->canon, s->rep);
+    if (s->position_count < 0) return false;
+
+    s->positions = arena_alloc(arena, (size_t)s->position_count * 3 * sizeof(double));
+    s->locked    = arena_alloc(arena, (size_t)s->position_count);
+    s->quadrics  = arena_calloc(arena, s->position_count, sizeof(_quadric_t));
+    s->adj_start = arena_alloc(arena, (size_t)(s->position_count + 1) * sizeof(int));
+    if (!s->positions || !s->locked || !s->quadrics || !s->adj_start) return false;
+
+    double min[3], max[3];
+    model_get_bounds(m, min, max);
+    for (int p = 0; p < s->position_count; p++) {
+        const double* v = &m->vertices[(size_t)s->rep[p] * 3];
+        for (int c = 0; c < 3; c++) s->positions[(size_t)p * 3 + c] = v[c] - (min[c] + max[c]) * 0.5;
+    }
+
+    // Triangles already collapsed in position space don't take part
+    for (int t = 0; t < tri_count; t++) {
+        const unsigned int* tri = &m->indices[t * 3];
+        unsigned int        a = s->canon[tri[0]], b = s->canon[tri[1]], c = s->canon[tri[2]];
+        if (a == b || b == c || a == c) continue;
+
+        unsigned int* out = &s->tris[s->tri_count * 3];
+        out[0]            = a;
+        out[1]            = b;
+        out[2]            = c;
+        memcpy(&s->corners[s->tri_count * 3], tri, 3 * sizeof(unsigned int));
+        s->tri_count++;
+    }
+
+    _build_adjacency(s);
+
+    for (int t = 0; t < s->tri_count; t++) {
+        const unsigned int* tri = &s->tris[t * 3];
+
+        double p[3][3], n[3];
+        for (int k = 0; k < 3; k++) _position(s, tri[k], p[k]);
+        _cross(p[0], p[1], p[2], n);
+
+        double len = sqrt(_dot(n, n));
+        if (len <= 0.0) continue;
+        for (int c = 0; c < 3; c++) n[c] /= len;
+
+        for (int k = 0; k < 3; k++) _quadric_plane(&s->quadrics[tri[k]], n, -_dot(n, p[0]), len * 0.5);
+
+        // An edge no other triangle shares is open, a plane through it upright to the face keeps it in place
+        for (int k = 0; k < 3; k++) {
+            unsigned int a = tri[k], b = tri[(k + 1) % 3];
+
+            bool shared = false;
+            for (int i = s->adj_start[a]; i < s->adj_start[a + 1] && !shared; i++) {
+                const unsigned int* other = &s->tris[s->adj[i] * 3];
+                shared = s->adj[i] != (unsigned int)t && (other[0] == b || other[1] == b || other[2] == b);
+            }
+            if (shared) continue;
+
+            const double* pa   = p[k];
+            const double* pb   = p[(k + 1) % 3];
+            double        e[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+            double        u[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+
+            double ulen = sqrt(_dot(u, u));
+            if (ulen <= 0.0) continue;
+            for (int c = 0; c < 3; c++) u[c] /= ulen;
+
+            double weight = _dot(e, e) * SIMPLIFY_BORDER_WEIGHT;
+            _quadric_plane(&s->quadrics[a], u, -_dot(u, pa), weight);
+            _quadric_plane(&s->quadrics[b], u, -_dot(u, pa), weight);
+        }
+    }
+    return true;
+}
+
+static void _candidate_task(void* userdata, int index)
+{
+    _simplify_t* s     = userdata;
+    int          first = (int)((long long)s->tri_count * index / s->task_count);
+    int          last  = (int)((long long)s->tri_count * (index + 1) / s->task_count);
+
+    for (int t = first; t < last; t++) {
+        const unsigned int* tri  = &s->tris[t * 3];
+        float               best = INFINITY;
+        unsigned int        from = tri[0], to = tri[1];
+
+        for (int k = 0; k < 3; k++) {
+            unsigned int      a = tri[k], b = tri[(k + 1) % 3];
+            const _quadric_t* qa = &s->quadrics[a];
+            const _quadric_t* qb = &s->quadrics[b];
+
+            double pa[3], pb[3];
+            _position(s, a, pa);
+            _position(s, b, pb);
+
+            double w     = qa->w + qb->w;
+            double scale = w > 0.0 ? 1.0 / w : 0.0;
+            float  to_b  = (float)sqrt(fmax(0.0, (_quadric_eval(qa, pb) + _quadric_eval(qb, pb)) * scale));
+            float  to_a  = (float)sqrt(fmax(0.0, (_quadric_eval(qa, pa) + _quadric_eval(qb, pa)) * scale));
+
+            if (to_b < best) {
+                best = to_b;
+                from = a;
+                to   = b;
+            }
+            if (to_a < best) {
+                best = to_a;
+                from = b;
+                to   = a;
+            }
+        }
+
+        _candidate_t* c = &s->candidates[t];
+        memcpy(&c->key, &best, sizeof(c->key));
+        c->from = from;
+        c->to   = to;
+    }
+}
+
+// Stable LSD radix sort on the key, four passes leave the result where it started
+static void _sort_candidates(_candidate_t* items, _candidate_t* scratch, int count)
+{
+    int offsets[256];
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        memset(offsets, 0, sizeof(offsets));
+        for (int i = 0; i < count; i++) offsets[(items[i].key >> shift) & 0xff]++;
+
+        int sum = 0;
+        for (int b = 0; b < 256; b++) {
+            int n      = offsets[b];
+            offsets[b] = sum;
+            sum       += n;
+        }
+
+        for (int i = 0; i < count; i++) scratch[offsets[(items[i].key >> shift) & 0xff]++] = items[i];
+
+        _candidate_t* swap = items;
+        items              = scratch;
+        scratch            = swap;
+    }
+}
+
+// Whether moving u onto v turns any triangle that survives the collapse too far
+static bool _collapse_flips(const _simplify_t* s, unsigned int u, unsigned int v)
+{
+    double pv[3];
+    _position(s, v, pv);
+
+    for (int i = s->adj_start[u]; i < s->adj_start[u + 1]; i++) {
+        const unsigned int* tri = &s->tris[s->adj[i] * 3];
+        if (tri[0] == v || tri[1] == v || tri[2] == v) continue;
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) continue;
+
+        double before[3][3], after[3][3], n0[3], n1[3];
+        for (int k = 0; k < 3; k++) {
+            _position(s, tri[k], before[k]);
+            memcpy(after[k], tri[k] == u ? pv : before[k], sizeof(after[k]));
+        }
+        _cross(before[0], before[1], before[2], n0);
+        _cross(after[0], after[1], after[2], n1);
+
+        if (_dot(n0, n1) <= SIMPLIFY_MIN_DOT * sqrt(_dot(n0, n0) * _dot(n1, n1))) return true;
+    }
+    return false;
+}
+
+// Drops the triangles the collapses of a pass made degenerate
+static void _compact(_simplify_t* s)
+{
+    int count = 0;
+
+    for (int t = 0; t < s->tri_count; t++) {
+        const unsigned int* tri = &s->tris[t * 3];
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) continue;
+
+        if (count != t) {
+            memcpy(&s->tris[count * 3], tri, 3 * sizeof(unsigned int));
+            memcpy(&s->corners[count * 3], &s->corners[t * 3], 3 * sizeof(unsigned int));
+        }
+        count++;
+    }
+    s->tri_count = count;
+}
+
+// Collapses the cheapest edges in passes of independent collapses until target triangles remain
+// or nothing can collapse anymore. Each pass scores every edge in parallel, the picking is serial.
+// A collapse rewrites the triangles around u right away, so its neighbours see the new shape and
+// may still collapse in the same pass. Only u and v sit the pass out, v's adjacency is stale.
+static void _simplify_to(_simplify_t* s, int target)
+{
+    while (s->tri_count > target) {
+        _build_adjacency(s);
+
+        s->task_count = s->tri_count > (1 << 16) ? thread_count() : 1;
+        thread_parallel(s->task_count, _candidate_task, s);
+        _sort_candidates(s->candidates, s->scratch, s->tri_count);
+
+        int limit = s->tri_count - target;
+        int cap   = (int)(s->tri_count * SIMPLIFY_PASS_RATIO);
+        if (limit > cap && cap > 0) limit = cap;
+
+        memset(s->locked, 0, s->position_count);
+
+        int removed = 0, collapses = 0;
+        for (int i = 0; i < s->tri_count && removed < limit; i++) {
+            const _candidate_t* c = &s->candidates[i];
+            unsigned int        u = c->from, v = c->to;
+            if (s->locked[u] || s->locked[v] || _collapse_flips(s, u, v)) continue;
+
+            for (int j = s->adj_start[u]; j < s->adj_start[u + 1]; j++) {
+                unsigned int* tri     = &s->tris[s->adj[j] * 3];
+                unsigned int* corners = &s->corners[s->adj[j] * 3];
+                if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) continue;
+                if (tri[0] == v || tri[1] == v || tri[2] == v) removed++;
+
+                for (int k = 0; k < 3; k++) {
+                    if (tri[k] != u) continue;
+                    tri[k]     = v;
+                    corners[k] = s->rep[v];
+                }
+            }
+
+            float error;
+            memcpy(&error, &c->key, sizeof(error));
+
+            s->locked[u] = 1;
+            s->locked[v] = 1;
+            _quadric_add(&s->quadrics[v], &s->quadrics[u]);
+            s->error = fmax(s->error, error);
+            collapses++;
+        }
+
+        if (collapses == 0) break;
+        _compact(s);
+    }
+}
+
+bool model_build_lods(model_t* m)
+{
+    // Building again starts over from the full level
+    if (m->lod_count > 0) m->indice_count = (int)m->lods[0].index_count;
+
+    int tri_count   = m->indice_count / 3;
+    m->indice_count = tri_count * 3;
+    m->lods[0]      = (model_lod_t) { 0, (unsigned int)m->indice_count, 0.0f };
+    m->lod_count    = 1;
+    if (tri_count / SIMPLIFY_LOD_RATIO < SIMPLIFY_MIN_TRIANGLES) return true;
+
+    double start = timer_now();
+
+    _simplify_t   s;
+    arena_t*      arena          = arena_scratch();
+    arena_mark_t  mark           = arena_mark(arena);
+    unsigned int* levels         = NULL;
+    size_t        level_count    = 0;
+    size_t        level_capacity = 0;
+    bool          ok             = _simplify_init(&s, m, arena);
+
+    for (int target = tri_count / SIMPLIFY_LOD_RATIO; ok && m->lod_count < MODEL_MAX_LODS && target >= SIMPLIFY_MIN_TRIANGLES;
+         target /= SIMPLIFY_LOD_RATIO)
+    {
+        _simplify_to(&s, target);
+
+        // Stuck well short of the target, open edges and folds lock up the rest of the mesh
+        if (s.tri_count > target * 2) break;
+
+        size_t count = (size_t)s.tri_count * 3;
+        if (level_count + count > level_capacity) {
+            size_t        capacity = (level_count + count) * 2;
+            unsigned int* grown    = realloc(levels, capacity * sizeof(unsigned int));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            levels         = grown;
+            level_capacity = capacity;
+        }
+
+        memcpy(&levels[level_count], s.corners, count * sizeof(unsigned int));
+        m->lods[m->lod_count++] = (model_lod_t) {
+            .first_index = (unsigned int)(m->indice_count + level_count),
+            .index_count = (unsigned int)count,
+            .error       = (float)s.error,
+        };
+        level_count += count;
+    }
+
+    if (ok && level_count > 0) {
+        unsigned int* indices = realloc(m->indices, (m->indice_count + level_count) * sizeof(unsigned int));
+        if (indices) {
+            memcpy(&indices[m->indice_count], levels, level_count * sizeof(unsigned int));
+            m->indices         = indices;
+            m->indice_count   += (int)level_count;
+            m->indice_capacity = m->indice_count;
+        }
+        ok = indices != NULL;
+    }
+
+    if (ok && m->lod_count > 1) {
+        log_info("Built %d levels of detail down to %u triangles (error %.3g) in %.1fms", m->lod_count - 1,
+                 m->lods[m->lod_count - 1].index_count / 3, m->lods[m->lod_count - 1].error,
+                 (timer_now() - start) * 1000.0);
+    } else if (!ok) {
+        log_error("Failed to allocate simplification buffers for %d triangles", tri_count);
+        m->lod_count    = 1;
+        m->indice_count = tri_count * 3;
+    }
+
+    arena_release(arena, mark);
+    free(levels);
+    return ok;
+}
@@ -0,0 +1,546 @@
+#include "core/weld.h"
+
+#include "engine/arena.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+
+#include "log.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WELD_PARTITION_BITS 8
+#define WELD_PARTITIONS (1 << WELD_PARTITION_BITS)
+#define WELD_MIN_PARALLEL (1 << 16)
+
+// Exact bits or grid cell of the position plus the attribute bits, hashed and compared as raw words
+typedef struct {
+    int64_t  p[3];
+    uint32_t t[2];
+    uint32_t n[3];
+    uint32_t pad;
+} _weld_key_t;
+
+typedef struct {
+    unsigned int* slots; // corner ids, WELD_NONE if empty
+    unsigned int  mask;
+} _weld_table_t;
+
+typedef struct {
+    const weld_input_t* in;
+    model_t*            out;
+    double              epsilon;
+    double              inv_epsilon;
+    int                 task_count;
+
+    uint64_t*     hashes;
+    unsigned int* order;  // corners grouped by partition, reused as the new vertex index per corner
+    unsigned int* reps;   // first corner with the same key
+    unsigned int* links;  // lowest representative within epsilon, only for epsilon welds
+    int*          cursors; // per task and partition write offsets
+    int*          uniques; // per task unique vertex counts, then their prefix sum
+    int           partition_offsets[WELD_PARTITIONS + 1];
+
+    _weld_table_t tables[WELD_PARTITIONS];
+    atomic_int    next_partition;
+} _weld_job_t;
+
+static inline uint64_t _mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint32_t _float_bits(float f)
+{
+    // Adding zero folds -0 into +0
+    f += 0.0f;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static inline void _task_range(int count, int index, int task_count, int* first, int* last)
+{
+    *first = (int)((long long)count * index / task_count);
+    *last  = (int)((long long)count * (index + 1) / task_count);
+}
+
+static inline unsigned int _texcrd_index(const weld_input_t* in, int c)
+{
+    if (!in->attribs || !in->texcrds) return WELD_NONE;
+    unsigned int t = in->attribs[(size_t)c * 2];
+    return t < (unsigned int)in->texcrd_count ? t : WELD_NONE;
+}
+
+static inline unsigned int _normal_index(const weld_input_t* in, int c)
+{
+    if (!in->attribs || !in->normals) return WELD_NONE;
+    unsigned int n = in->attribs[(size_t)c * 2 + 1];
+    return n < (unsigned int)in->normal_count ? n : WELD_NONE;
+}
+
+static inline void _corner_position(const weld_input_t* in, int c, double p[3])
+{
+    size_t i = in->indices ? in->indices[c] : (size_t)c;
+
+    if (in->positions) {
+        memcpy(p, &in->positions[i * 3], 3 * sizeof(double));
+        return;
+    }
+
+    // Records are packed, so the floats may be unaligned
+    float f[3];
+    memcpy(f, in->records + i / in->record_positions * in->record_stride + i % in->record_positions * sizeof(f),
+           sizeof(f));
+    p[0] = f[0];
+    p[1] = f[1];
+    p[2] = f[2];
+}
+
+static void _corner_key(const _weld_job_t* job, int c, _weld_key_t* key)
+{
+    const weld_input_t* in = job->in;
+
+    double p[3];
+    _corner_position(in, c, p);
+
+    memset(key, 0, sizeof(*key));
+
+    for (int i = 0; i < 3; i++) {
+        if (job->epsilon > 0.0) {
+            key->p[i] = (int64_t)floor(p[i] * job->inv_epsilon);
+        } else {
+            double v = p[i] + 0.0;
+            memcpy(&key->p[i], &v, sizeof(v));
+        }
+    }
+
+    unsigned int t = _texcrd_index(in, c);
+    for (int i = 0; i < 2; i++) {
+        key->t[i] = t != WELD_NONE ? _float_bits(in->texcrds[(size_t)t * 2 + i]) : WELD_NONE;
+    }
+
+    unsigned int n = _normal_index(in, c);
+    for (int i = 0; i < 3; i++) {
+        key->n[i] = n != WELD_NONE ? _float_bits(in->normals[(size_t)n * 3 + i]) : WELD_NONE;
+    }
+}
+
+static uint64_t _key_hash(const _weld_key_t* key)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < sizeof(*key); i += 8) {
+        uint64_t w;
+        memcpy(&w, (const char*)key + i, 8);
+        h = _mix(h ^ w) + 0x52dce729ull;
+    }
+    return h;
+}
+
+static inline int _partition(uint64_t hash)
+{
+    return (int)(hash >> (64 - WELD_PARTITION_BITS));
+}
+
+static bool _same_key(const _weld_job_t* job, int a, const _weld_key_t* key)
+{
+    _weld_key_t other;
+    _corner_key(job, a, &other);
+    return memcmp(&other, key, sizeof(other)) == 0;
+}
+
+// Pass 0: corners without a normal, counted into uniques before it is needed for the vertices
+static void _missing_task(void* userdata, int index)
+{
+    _weld_job_t* job = userdata;
+
+    int first, last;
+    _task_range(job->in->corner_count, index, job->task_count, &first, &last);
+
+    int count = 0;
+    for (int c = first; c < last; c++) count += _normal_index(job->in, c) == WELD_NONE;
+    job->uniques[index] = count;
+}
+
+// Pass 1: key hash per corner and how many corners each task sends to each partition
+static void _hash_task(void* userdata, int index)
+{
+    _weld_job_t* job    = userdata;
+    int*         counts = &job->cursors[index * WELD_PARTITIONS];
+
+    int first, last;
+    _task_range(job->in->corner_count, index, job->task_count, &first, &last);
+
+    for (int c = first; c < last; c++) {
+        _weld_key_t key;
+        _corner_key(job, c, &key);
+        job->hashes[c] = _key_hash(&key);
+        counts[_partition(job->hashes[c])]++;
+    }
+}
+
+// Pass 2: group corners by partition, each partition stays in corner order
+static void _scatter_task(void* userdata, int index)
+{
+    _weld_job_t* job     = userdata;
+    int*         cursors = &job->cursors[index * WELD_PARTITIONS];
+
+    int first, last;
+    _task_range(job->in->corner_count, index, job->task_count, &first, &last);
+
+    for (int c = first; c < last; c++) {
+        job->order[cursors[_partition(job->hashes[c])]++] = (unsigned int)c;
+    }
+}
+
+// Pass 3: one open addressing table per partition, the first corner of every key becomes its representative
+static void _table_task(void* userdata, int index)
+{
+    (void)index;
+    _weld_job_t* job = userdata;
+
+    int p;
+    while ((p = atomic_fetch_add(&job->next_partition, 1)) < WELD_PARTITIONS) {
+        int            first = job->partition_offsets[p];
+        int            count = job->partition_offsets[p + 1] - first;
+        _weld_table_t* table = &job->tables[p];
+        memset(table->slots, 0xff, ((size_t)table->mask + 1) * sizeof(unsigned int));
+
+        for (int i = first; i < first + count; i++) {
+            unsigned int c    = job->order[i];
+            uint64_t     hash = job->hashes[c];
+
+            _weld_key_t key;
+            _corner_key(job, (int)c, &key);
+
+            for (unsigned int s = (unsigned int)hash & table->mask;; s = (s + 1) & table->mask) {
+                unsigned int other = table->slots[s];
+                if (other == WELD_NONE) {
+                    table->slots[s] = c;
+                    job->reps[c]    = c;
+                    break;
+                }
+                if (job->hashes[other] == hash && _same_key(job, (int)other, &key)) {
+                    job->reps[c] = other;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static unsigned int _table_find(const _weld_job_t* job, const _weld_key_t* key)
+{
+    uint64_t             hash  = _key_hash(key);
+    const _weld_table_t* table = &job->tables[_partition(hash)];
+
+    for (unsigned int s = (unsigned int)hash & table->mask;; s = (s + 1) & table->mask) {
+        unsigned int other = table->slots[s];
+        if (other == WELD_NONE) return WELD_NONE;
+        if (job->hashes[other] == hash && _same_key(job, (int)other, key)) return other;
+    }
+}
+
+// Pass 4 (epsilon only): link every representative to the lowest one within epsilon in the 26 neighbour cells,
+// the tables are read only by now
+static void _link_task(void* userdata, int index)
+{
+    _weld_job_t*        job  = userdata;
+    const weld_input_t* in   = job->in;
+    double              eps2 = job->epsilon * job->epsilon;
+
+    int first, last;
+    _task_range(in->corner_count, index, job->task_count, &first, &last);
+
+    for (int c = first; c < last; c++) {
+        job->links[c] = (unsigned int)c;
+        if (job->reps[c] != (unsigned int)c) continue;
+
+        _weld_key_t key;
+        _corner_key(job, c, &key);
+
+        double p[3];
+        _corner_position(in, c, p);
+
+        for (int n = 0; n < 27; n++) {
+            if (n == 13) continue;
+
+            _weld_key_t cell = key;
+            cell.p[0] += n % 3 - 1;
+            cell.p[1] += n / 3 % 3 - 1;
+            cell.p[2] += n / 9 - 1;
+
+            unsigned int other = _table_find(job, &cell);
+            if (other == WELD_NONE || other >= job->links[c]) continue;
+
+            double q[3];
+            _corner_position(in, (int)other, q);
+
+            double dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+            if (dx * dx + dy * dy + dz * dz <= eps2) job->links[c] = other;
+        }
+    }
+}
+
+// Pass 5 (epsilon only): links always point to a lower corner, so following them ends at the welded vertex
+static void _resolve_task(void* userdata, int index)
+{
+    _weld_job_t* job = userdata;
+
+    int first, last;
+    _task_range(job->in->corner_count, index, job->task_count, &first, &last);
+
+    for (int c = first; c < last; c++) {
+        unsigned int r = job->reps[c];
+        while (job->links[r] != r) r = job->links[r];
+        job->reps[c] = r;
+    }
+}
+
+static void _count_task(void* userdata, int index)
+{
+    _weld_job_t* job = userdata;
+
+    int first, last;
+    _task_range(job->in->corner_count, index, job->task_count, &first, &last);
+
+    int count = 0;
+    for (int c = first; c < last; c++) {
+        count += job->reps[c] == (unsigned int)c;
+    }
+    job->uniques[index] = count;
+}
+
+// Pass 6: new vertices in first occurrence order, then the remapped indices and attributes
+static void _remap_task(void* userdata, int index)
+{
+    _weld_job_t* job = userdata;
+
+    int first, last;
+    _task_range(job->in->corner_count, index, job->task_count, &first, &last);
+
+    unsigned int next = (unsigned int)job->uniques[index];
+    for (int c = first; c < last; c++) {
+        if (job->reps[c] == (unsigned int)c) job->order[c] = next++;
+    }
+}
+
+static void _emit_task(void* userdata, int index)
+{
+    _weld_job_t*        job = userdata;
+    const weld_input_t* in  = job->in;
+    model_t*            out = job->out;
+
+    int first, last;
+    _task_range(in->corner_count, index, job->task_count, &first, &last);
+
+    for (int c = first; c < last; c++) {
+        unsigned int r  = job->reps[c];
+        unsigned int v  = job->order[r];
+        out->indices[c] = v;
+
+        if (r != (unsigned int)c) continue;
+
+        _corner_position(in, c, &out->vertices[(size_t)v * 3]);
+
+        if (out->texcrd_count > 0) {
+            unsigned int t   = _texcrd_index(in, c);
+            float*       dst = &out->texcrds[(size_t)v * 2];
+            if (t != WELD_NONE) {
+                memcpy(dst, &in->texcrds[(size_t)t * 2], 2 * sizeof(float));
+            } else {
+                dst[0] = dst[1] = 0.0f;
+            }
+        }
+
+        if (out->normal_count > 0) {
+            unsigned int n   = _normal_index(in, c);
+            float*       dst = &out->normals[(size_t)v * 3];
+            if (n != WELD_NONE) {
+                memcpy(dst, &in->normals[(size_t)n * 3], 3 * sizeof(float));
+            } else {
+                dst[0] = dst[1] = dst[2] = 0.0f;
+            }
+        }
+    }
+}
+
+bool weld_model(model_t* out, const weld_input_t* in, double epsilon)
+{
+    double start   = timer_now();
+    bool   ok      = false;
+    int    corners = in->corner_count;
+
+    _weld_job_t job = {
+        .in          = in,
+        .out         = out,
+        .epsilon     = epsilon > 0.0 ? epsilon : 0.0,
+        .inv_epsilon = epsilon > 0.0 ? 1.0 / epsilon : 0.0,
+        .task_count  = corners > WELD_MIN_PARALLEL ? thread_count() : 1,
+    };
+    atomic_store(&job.next_partition, 0);
+
+    arena_t*     arena = arena_scratch();
+    arena_mark_t mark  = arena_mark(arena);
+    job.hashes         = arena_alloc(arena, (size_t)corners * sizeof(uint64_t));
+    job.order          = arena_alloc(arena, (size_t)corners * sizeof(unsigned int));
+    job.reps           = arena_alloc(arena, (size_t)corners * sizeof(unsigned int));
+    job.links          = job.epsilon > 0.0 ? arena_alloc(arena, (size_t)corners * sizeof(unsigned int)) : NULL;
+    job.cursors        = arena_calloc(arena, (size_t)job.task_count * WELD_PARTITIONS, sizeof(int));
+    job.uniques        = arena_calloc(arena, job.task_count, sizeof(int));
+
+    if (!job.hashes || !job.order || !job.reps || (job.epsilon > 0.0 && !job.links) || !job.cursors || !job.uniques) {
+        log_error("Failed to allocate weld state for %d corners", corners);
+        goto cleanup;
+    }
+
+    // Zero normals on some faces would shade them black, with any missing all are generated instead
+    weld_input_t trimmed = *in;
+    if (in->attribs && in->normals && in->normal_count > 0) {
+        thread_parallel(job.task_count, _missing_task, &job);
+
+        long long missing = 0;
+        for (int t = 0; t < job.task_count; t++) missing += job.uniques[t];
+        if (missing > 0) {
+            log_warn("%lld of %d corners have no normal, dropping the supplied normals to generate them all", missing,
+                     corners);
+            trimmed.normals = NULL;
+            job.in          = &trimmed;
+        }
+    }
+
+    thread_parallel(job.task_count, _hash_task, &job);
+
+    // Turn the per task partition counts into write cursors
+    int offset = 0;
+    for (int p = 0; p < WELD_PARTITIONS; p++) {
+        job.partition_offsets[p] = offset;
+        for (int t = 0; t < job.task_count; t++) {
+            int count = job.cursors[t * WELD_PARTITIONS + p];
+            job.cursors[t * WELD_PARTITIONS + p] = offset;
+            offset += count;
+        }
+    }
+    job.partition_offsets[WELD_PARTITIONS] = offset;
+
+    // One block for all tables, each at least twice the size of its partition
+    size_t slot_count = 0;
+    for (int p = 0; p < WELD_PARTITIONS; p++) {
+        unsigned int size = 16;
+        while (size < (unsigned int)(job.partition_offsets[p + 1] - job.partition_offsets[p]) * 2) size *= 2;
+        job.tables[p].mask  = size - 1;
+        slot_count         += size;
+    }
+
+    unsigned int* slots = arena_alloc(arena, slot_count * sizeof(unsigned int));
+    if (!slots) {
+        log_error("Failed to allocate weld tables for %d corners", corners);
+        goto cleanup;
+    }
+    for (int p = 0; p < WELD_PARTITIONS; p++) {
+        job.tables[p].slots  = slots;
+        slots               += job.tables[p].mask + 1;
+    }
+
+    thread_parallel(job.task_count, _scatter_task, &job);
+    thread_parallel(job.task_count < WELD_PARTITIONS ? job.task_count : WELD_PARTITIONS, _table_task, &job);
+
+    if (job.epsilon > 0.0) {
+        thread_parallel(job.task_count, _link_task, &job);
+        thread_parallel(job.task_count, _resolve_task, &job);
+    }
+
+    thread_parallel(job.task_count, _count_task, &job);
+
+    int unique = 0;
+    for (int t = 0; t < job.task_count; t++) {
+        int count      = job.uniques[t];
+        job.uniques[t] = unique;
+        unique += count;
+    }
+
+    thread_parallel(job.task_count, _remap_task, &job);
+
+    bool has_texcrds = in->attribs && in->texcrds && in->texcrd_count > 0;
+    bool has_normals = job.in->attribs && job.in->normals && job.in->normal_count > 0;
+
+    if ((long long)unique * 3 > INT_MAX
+        || !model_reserve(out, unique * 3, corners, has_normals ? unique * 3 : 0, has_texcrds ? unique * 2 : 0))
+    {
+        log_error("Failed to allocate welded model storage for %d vertices", unique);
+        goto cleanup;
+    }
+
+    out->vertex_count = unique * 3;
+    out->indice_count = corners;
+    out->normal_count = has_normals ? unique * 3 : 0;
+    out->texcrd_count = has_texcrds ? unique * 2 : 0;
+
+    thread_parallel(job.task_count, _emit_task, &job);
+
+    log_info("Welded %d positions into %d vertices (%d corners, epsilon %g) in %.1fms", in->position_count, unique,
+             corners, job.epsilon, (timer_now() - start) * 1000.0);
+    ok = true;
+
+cleanup:
+    arena_release(arena, mark);
+    return ok;
+}
+
+static uint32_t _hash_position(const double* v)
+{
+    uint64_t h = 0;
+    for (int c = 0; c < 3; c++) {
+        // Adding zero turns -0 into 0, the two compare equal and have to hash the same
+        double   x = v[c] + 0.0;
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        h = _mix(h ^ bits);
+    }
+    return (uint32_t)h;
+}
+
+int weld_positions(const model_t* m, unsigned int* canon, unsigned int* rep)
+{
+    int    vertex_count = m->vertex_count / 3;
+    size_t slot_count   = 1;
+    while (slot_count < (size_t)vertex_count * 2) slot_count <<= 1;
+
+    // Slots hold vertex + 1, 0 is empty
+    arena_t*      arena = arena_scratch();
+    arena_mark_t  mark  = arena_mark(arena);
+    unsigned int* slots = arena_calloc(arena, slot_count, sizeof(unsigned int));
+    if (!slots) return -1;
+
+    int position_count = 0;
+    for (int v = 0; v < vertex_count; v++) {
+        const double* pos = &m->vertices[(size_t)v * 3];
+        size_t        h   = _hash_position(pos) & (slot_count - 1);
+
+        while (slots[h]) {
+            const double* other = &m->vertices[(size_t)(slots[h] - 1) * 3];
+            if (other[0] == pos[0] && other[1] == pos[1] && other[2] == pos[2]) break;
+            h = (h + 1) & (slot_count - 1);
+        }
+
+        if (slots[h]) {
+            canon[v] = canon[slots[h] - 1];
+        } else {
+            slots[h]            = (unsigned int)v + 1;
+            canon[v]            = (unsigned int)position_count;
+            rep[position_count] = (unsigned int)v;
+            position_count++;
+        }
+    }
+
+    arena_release(arena, mark);
+    return position_count;
+}
@@ -0,0 +1,222 @@
+#include "engine/arena.h"
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define ARENA_HUGE_PAGE ((size_t)2 << 20) // base alignment, so huge pages can back the big buffers
+#define ARENA_COMMIT_STEP ((size_t)4 << 20)
+#define ARENA_KEEP ((size_t)64 << 20) // committed bytes a release keeps for the next stage, the rest goes back
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static atomic_int     _arena_count;
+static atomic_size_t  _committed;
+static atomic_size_t  _peak;
+static pthread_once_t _scratch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  _scratch_key;
+static bool           _scratch_keyed;
+static arena_t        _no_scratch; // handed out when a thread's arena can't be mapped, every allocation fails
+
+#ifdef _WIN32
+
+static char* _reserve(size_t bytes)
+{
+    return VirtualAlloc(NULL, bytes, MEM_RESERVE, PAGE_READWRITE);
+}
+
+static bool _commit(char* base, size_t from, size_t to)
+{
+    return VirtualAlloc(base + from, to - from, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+static void _decommit(char* base, size_t from, size_t to)
+{
+    VirtualFree(base + from, to - from, MEM_DECOMMIT);
+}
+
+static void _unmap(char* base, size_t bytes)
+{
+    (void)bytes;
+    VirtualFree(base, 0, MEM_RELEASE);
+}
+
+#else
+
+static char* _reserve(size_t bytes)
+{
+    // Over reserve to round the base up to a huge page, the slack on both ends goes back
+    size_t mapped = bytes + ARENA_HUGE_PAGE;
+    char*  data   = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) return NULL;
+
+    char* base = (char*)(((uintptr_t)data + ARENA_HUGE_PAGE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE - 1));
+    if (base > data) munmap(data, (size_t)(base - data));
+    if (base + bytes < data + mapped) munmap(base + bytes, (size_t)(data + mapped - (base + bytes)));
+
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages, the import arrays span hundreds of megabytes and fault in 2MB at a time
+    madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+    return base;
+}
+
+// The kernel backs the pages as they are touched
+static bool _commit(char* base, size_t from, size_t to)
+{
+    (void)base;
+    (void)from;
+    (void)to;
+    return true;
+}
+
+// Private anonymous pages read back as zero once dropped
+static void _decommit(char* base, size_t from, size_t to)
+{
+    madvise(base + from, to - from, MADV_DONTNEED);
+}
+
+static void _unmap(char* base, size_t bytes)
+{
+    munmap(base, bytes);
+}
+
+#endif
+
+bool arena_init(arena_t* a, size_t reserve)
+{
+    memset(a, 0, sizeof(*a));
+    reserve = (reserve + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+
+    a->base = _reserve(reserve);
+    if (!a->base) {
+        log_error("Failed to reserve a %zuMB arena", reserve >> 20);
+        return false;
+    }
+
+    a->reserved = reserve;
+    atomic_fetch_add(&_arena_count, 1);
+    return true;
+}
+
+void arena_free(arena_t* a)
+{
+    if (!a->base) return;
+
+    _unmap(a->base, a->reserved);
+    atomic_fetch_sub(&_committed, a->committed);
+    atomic_fetch_sub(&_arena_count, 1);
+    memset(a, 0, sizeof(*a));
+}
+
+void* arena_alloc(arena_t* a, size_t bytes)
+{
+    size_t start = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (start > a->reserved || bytes > a->reserved - start) {
+        log_error("Arena of %zuMB can't fit another %zuMB", a->reserved >> 20, bytes >> 20);
+        return NULL;
+    }
+
+    size_t end = start + bytes;
+    if (end > a->committed) {
+        size_t commit = (end + ARENA_COMMIT_STEP - 1) & ~(ARENA_COMMIT_STEP - 1);
+        if (commit > a->reserved) commit = a->reserved;
+        if (!_commit(a->base, a->committed, commit)) {
+            log_error("Failed to commit %zuMB of arena memory", commit >> 20);
+            return NULL;
+        }
+
+        atomic_fetch_add(&_committed, commit - a->committed);
+        a->committed = commit;
+        if (commit > a->peak) a->peak = commit;
+
+        size_t peak = atomic_load(&_peak);
+        while (peak < commit && !atomic_compare_exchange_weak(&_peak, &peak, commit)) {}
+    }
+
+    a->used = end;
+    if (end > a->clean) a->clean = end;
+    return a->base + start;
+}
+
+void* arena_calloc(arena_t* a, size_t count, size_t size)
+{
+    if (size > 0 && count > SIZE_MAX / size) return NULL;
+
+    // Only what an earlier allocation handed out can be dirty, fresh pages come zeroed
+    size_t clean = a->clean;
+    char*  data  = arena_alloc(a, count * size);
+    if (data && data - a->base < (ptrdiff_t)clean) {
+        size_t dirty = clean - (size_t)(data - a->base);
+        memset(data, 0, dirty < count * size ? dirty : count * size);
+    }
+    return data;
+}
+
+arena_mark_t arena_mark(const arena_t* a)
+{
+    return a->used;
+}
+
+void arena_release(arena_t* a, arena_mark_t mark)
+{
+    if (mark >= a->used) return;
+    a->used = mark;
+
+    // A stage hundreds of megabytes big shouldn't stay resident through the ones after it
+    size_t keep = (mark + ARENA_COMMIT_STEP - 1) & ~(ARENA_COMMIT_STEP - 1);
+    if (keep < ARENA_KEEP) keep = ARENA_KEEP;
+    if (keep >= a->committed) return;
+
+    _decommit(a->base, keep, a->committed);
+    atomic_fetch_sub(&_committed, a->committed - keep);
+    a->committed = keep;
+    if (a->clean > keep) a->clean = keep;
+}
+
+static void _scratch_destroy(void* arena)
+{
+    arena_free(arena);
+    free(arena);
+}
+
+static void _scratch_key_init(void)
+{
+    _scratch_keyed = pthread_key_create(&_scratch_key, _scratch_destroy) == 0;
+}
+
+arena_t* arena_scratch(void)
+{
+    pthread_once(&_scratch_once, _scratch_key_init);
+    if (!_scratch_keyed) return &_no_scratch;
+
+    arena_t* a = pthread_getspecific(_scratch_key);
+    if (a) return a;
+
+    a = malloc(sizeof(*a));
+    if (!a || !arena_init(a, ARENA_RESERVE) || pthread_setspecific(_scratch_key, a) != 0) {
+        if (a) arena_free(a);
+        free(a);
+        return &_no_scratch;
+    }
+    return a;
+}
+
+void arena_stats(arena_stats_t* stats)
+{
+    stats->arena_count = atomic_load(&_arena_count);
+    stats->committed   = atomic_load(&_committed);
+    stats->peak        = atomic_load(&_peak);
+}
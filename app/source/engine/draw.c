@@ -7,7 +7,8 @@
 
 typedef struct {
     int    vertex_count;
-    GLuint vbo, vao, program;
+    GLuint   vbo, vao;
+    shader_t shader;
     float* vertices;
     int    max_vertices;
 } Renderer;
@@ -18,10 +19,10 @@ static const char* vs = "#version 460\n"
                         "layout(location = 0) in vec2 aPos;\n"
                         "layout(location = 1) in vec3 aColor;\n"
                         "out vec3 ourColor;\n"
-                        "uniform mat4 uProjection;\n"
+                        SHADER_CAMERA_BLOCK
                         "void main()\n"
                         "{\n"
-                        "    gl_Position = uProjection * vec4(aPos, 0.0, 1.0);\n"
+                        "    gl_Position = uScreen * vec4(aPos, 0.0, 1.0);\n"
                         "    ourColor = aColor;\n"
                         "}\n";
 
@@ -33,9 +34,10 @@ static const char* fs = "#version 460\n"
                         "    FragColor = vec4(ourColor, 1.0);\n"
                         "}\n";
 
-void draw_init(int screen_width, int screen_height)
+// The pixel space projection comes from the camera block, see shader_camera_update
+void draw_init()
 {
-    rd.program = load_shader_program(vs, fs);
+    shader_create(&rd.shader, vs, fs, NULL, 0);
     glGenVertexArrays(1, &rd.vao);
     glGenBuffers(1, &rd.vbo);
 
@@ -51,22 +53,13 @@ void draw_init(int screen_width, int screen_height)
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(1);
-
-    // Calculate orthographic projection matrix
-    mat4 ortho;
-    glm_ortho(0.0f, (float)screen_width, (float)screen_height, 0.0f, -1.0f, 1.0f, ortho);
-
-    // Pass orthographic projection matrix to the shader
-    glUseProgram(rd.program);
-    GLint projLoc = glGetUniformLocation(rd.program, "uProjection");
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, (const GLfloat*)ortho);
 }
 
 void draw_cleanup()
 {
     glDeleteVertexArrays(1, &rd.vao);
     glDeleteBuffers(1, &rd.vbo);
-    glDeleteProgram(rd.program);
+    shader_destroy(&rd.shader);
     free(rd.vertices);
 }
 
@@ -94,7 +87,7 @@ void draw_flush()
     glBindBuffer(GL_ARRAY_BUFFER, rd.vbo);
     glBufferSubData(GL_ARRAY_BUFFER, 0, rd.vertex_count * 5 * sizeof(float), rd.vertices);
 
-    glUseProgram(rd.program);
+    glUseProgram(rd.shader.program);
     glBindVertexArray(rd.vao);
     glDrawArrays(GL_TRIANGLES, 0, rd.vertex_count);
 
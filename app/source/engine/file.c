@@ -3,6 +3,23 @@
 #include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
 
 char* file_read_bytes(const char* filepath, long* bytes_read)
 {
@@ -28,4 +45,230 @@ char* file_read_bytes(const char* filepath, long* bytes_read)
 
     fclose(file);
     return buffer;
-}
\ No newline at end of file
+}
+
+#ifdef _WIN32
+
+bool file_map(const char* filepath, file_map_t* map)
+{
+    map->data           = NULL;
+    map->size           = 0;
+    map->file_handle    = INVALID_HANDLE_VALUE;
+    map->mapping_handle = NULL;
+
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        log_error("Failed to open file: %s", filepath);
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        log_error("Failed to query file size: %s", filepath);
+        CloseHandle(file);
+        return false;
+    }
+
+    map->file_handle = file;
+    map->size        = (size_t)size.QuadPart;
+
+    // Zero sized files can't be mapped, hand out an empty view instead
+    if (map->size == 0) return true;
+
+    map->mapping_handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!map->mapping_handle) {
+        log_error("Failed to create file mapping: %s", filepath);
+        file_unmap(map);
+        return false;
+    }
+
+    map->data = MapViewOfFile(map->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (!map->data) {
+        log_error("Failed to map view of file: %s", filepath);
+        file_unmap(map);
+        return false;
+    }
+
+    return true;
+}
+
+void file_unmap(file_map_t* map)
+{
+    if (map->data) {
+        UnmapViewOfFile(map->data);
+    }
+    if (map->mapping_handle) {
+        CloseHandle(map->mapping_handle);
+    }
+    if (map->file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(map->file_handle);
+    }
+
+    map->data           = NULL;
+    map->size           = 0;
+    map->file_handle    = INVALID_HANDLE_VALUE;
+    map->mapping_handle = NULL;
+}
+
+#else
+
+bool file_map(const char* filepath, file_map_t* map)
+{
+    map->data = NULL;
+    map->size = 0;
+
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        log_error("Failed to open file: %s", filepath);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        log_error("Failed to query file size: %s", filepath);
+        close(fd);
+        return false;
+    }
+
+    map->size = (size_t)st.st_size;
+
+    // Zero sized files can't be mapped, hand out an empty view instead
+    if (map->size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        log_error("Failed to map file: %s", filepath);
+        map->size = 0;
+        return false;
+    }
+
+    // The parsers walk the mapping front to back
+    madvise(data, map->size, MADV_SEQUENTIAL);
+
+    map->data = data;
+    return true;
+}
+
+void file_unmap(file_map_t* map)
+{
+    if (map->data) {
+        munmap((void*)map->data, map->size);
+    }
+
+    map->data = NULL;
+    map->size = 0;
+}
+
+#endif
+
+bool file_stat(const char* filepath, size_t* size, long long* mtime)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(filepath, &st) != 0) return false;
+#else
+    struct stat st;
+    if (stat(filepath, &st) != 0) return false;
+#endif
+
+    if (size) *size = (size_t)st.st_size;
+    if (mtime) *mtime = (long long)st.st_mtime;
+    return true;
+}
+
+bool file_touch(const char* filepath)
+{
+#ifdef _WIN32
+    return _utime(filepath, NULL) == 0;
+#else
+    return utime(filepath, NULL) == 0;
+#endif
+}
+
+bool file_create_directories(const char* path)
+{
+    size_t len = strlen(path);
+    char*  buf = malloc(len + 1);
+    if (!buf) return false;
+
+    memcpy(buf, path, len + 1);
+
+    // Create every parent in turn, existing ones are fine
+    for (size_t i = 1; i <= len; i++) {
+        if (i != len && buf[i] != '/' && buf[i] != '\\') continue;
+
+        char saved = buf[i];
+        buf[i]     = '\0';
+#ifdef _WIN32
+        int failed = _mkdir(buf) != 0;
+#else
+        int failed = mkdir(buf, 0755) != 0;
+#endif
+        if (failed && !file_stat(buf, NULL, NULL)) {
+            log_error("Failed to create directory: %s", buf);
+            free(buf);
+            return false;
+        }
+        buf[i] = saved;
+    }
+
+    free(buf);
+    return true;
+}
+
+void file_list_directory(const char* path, file_visit_fn visit, void* userdata)
+{
+    char filepath[1024];
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    snprintf(filepath, sizeof(filepath), "%s\\*", path);
+
+    HANDLE find = FindFirstFileA(filepath, &data);
+    if (find == INVALID_HANDLE_VALUE) return;
+
+    do {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+
+        size_t    size;
+        long long mtime;
+        snprintf(filepath, sizeof(filepath), "%s\\%s", path, data.cFileName);
+        if (file_stat(filepath, &size, &mtime)) {
+            visit(filepath, size, mtime, userdata);
+        }
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+#else
+    DIR* dir = opendir(path);
+    if (!dir) return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+
+        struct stat st;
+        snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
+        if (stat(filepath, &st) == 0 && S_ISREG(st.st_mode)) {
+            visit(filepath, (size_t)st.st_size, (long long)st.st_mtime, userdata);
+        }
+    }
+
+    closedir(dir);
+#endif
+}
+
+char* file_canonical_path(const char* filepath)
+{
+#ifdef _WIN32
+    return _fullpath(NULL, filepath, 0);
+#else
+    return realpath(filepath, NULL);
+#endif
+}
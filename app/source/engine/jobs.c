@@ -0,0 +1,376 @@
+#include "engine/jobs.h"
+#include "engine/thread.h"
+
+#include "log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define JOBS_DEQUE_CAPACITY 256      // initial jobs per deque, a full one doubles
+#define JOBS_SHARED JOBS_MAX_WORKERS // deque of the threads outside the pool
+
+typedef struct {
+    job_fn         fn;
+    void*          userdata;
+    int            index;
+    job_counter_t* counter;
+} _job_t;
+
+// A job waiting for a counter
+struct job_node_s {
+    _job_t             job;
+    struct job_node_s* next;
+};
+
+// Ring of jobs, the owner pushes and pops at the tail so it keeps working on what is hot in its
+// cache, thieves take the oldest from the head
+typedef struct {
+    pthread_mutex_t lock;
+    _job_t*         jobs;
+    unsigned int    head;
+    unsigned int    tail;
+    unsigned int    capacity; // power of two
+} _deque_t;
+
+static struct {
+    pthread_once_t  once;
+    int             requested; // workers asked for by jobs_init, -1 for the default
+    bool            running;
+    atomic_bool     stopping;
+    int             worker_count;
+    pthread_t       threads[JOBS_MAX_WORKERS];
+    _deque_t        deques[JOBS_MAX_WORKERS + 1];
+    atomic_int      queued; // jobs in all deques together
+    atomic_int      sleepers;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t  wake; // new jobs or a counter reached zero
+    pthread_mutex_t main_lock;
+    _job_t*         main_jobs;
+    int             main_count;
+    int             main_capacity;
+} jobs = {
+    .once       = PTHREAD_ONCE_INIT,
+    .requested  = -1,
+    .sleep_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake       = PTHREAD_COND_INITIALIZER,
+    .main_lock  = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct job_node_s _released; // waiting list of a counter that reached zero
+static _Thread_local int _worker = -1;
+
+static bool _push(_deque_t* d, const _job_t* job)
+{
+    pthread_mutex_lock(&d->lock);
+
+    if (d->tail - d->head == d->capacity) {
+        _job_t* grown = malloc((size_t)d->capacity * 2 * sizeof(_job_t));
+        if (!grown) {
+            pthread_mutex_unlock(&d->lock);
+            return false;
+        }
+        for (unsigned int i = d->head; i != d->tail; i++) {
+            grown[i & (d->capacity * 2 - 1)] = d->jobs[i & (d->capacity - 1)];
+        }
+        free(d->jobs);
+        d->jobs      = grown;
+        d->capacity *= 2;
+    }
+
+    d->jobs[d->tail++ & (d->capacity - 1)] = *job;
+    pthread_mutex_unlock(&d->lock);
+    return true;
+}
+
+static bool _pop(_deque_t* d, _job_t* job)
+{
+    pthread_mutex_lock(&d->lock);
+    bool found = d->tail != d->head;
+    if (found) *job = d->jobs[--d->tail & (d->capacity - 1)];
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static bool _steal(_deque_t* d, _job_t* job)
+{
+    pthread_mutex_lock(&d->lock);
+    bool found = d->tail != d->head;
+    if (found) *job = d->jobs[d->head++ & (d->capacity - 1)];
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+// Own deque first, then the shared one, then the other workers starting past this one
+static bool _take(_job_t* job)
+{
+    if (atomic_load(&jobs.queued) <= 0) return false;
+
+    bool found = (_worker >= 0 && _pop(&jobs.deques[_worker], job)) || _steal(&jobs.deques[JOBS_SHARED], job);
+    for (int i = 1; !found && i <= jobs.worker_count; i++) {
+        int victim = (_worker + i) % jobs.worker_count;
+        if (victim != _worker) found = _steal(&jobs.deques[victim], job);
+    }
+
+    if (found) atomic_fetch_sub(&jobs.queued, 1);
+    return found;
+}
+
+// Sleepers register before they check for work, so either they see the change or get woken
+static void _notify(void)
+{
+    if (atomic_load(&jobs.sleepers) == 0) return;
+    pthread_mutex_lock(&jobs.sleep_lock);
+    pthread_cond_broadcast(&jobs.wake);
+    pthread_mutex_unlock(&jobs.sleep_lock);
+}
+
+static void _execute(const _job_t* job);
+
+static void _submit(const _job_t* job)
+{
+    atomic_fetch_add(&jobs.queued, 1);
+    if (!jobs.running || !_push(&jobs.deques[_worker >= 0 ? _worker : JOBS_SHARED], job)) {
+        atomic_fetch_sub(&jobs.queued, 1);
+        _execute(job);
+        return;
+    }
+    _notify();
+}
+
+// A waiter may return as soon as pending reaches zero, finishing keeps it waiting until the last
+// access to the counter is done
+static void _finish(job_counter_t* counter)
+{
+    atomic_fetch_add(&counter->finishing, 1);
+    if (atomic_fetch_sub(&counter->pending, 1) != 1) {
+        atomic_fetch_sub(&counter->finishing, 1);
+        return;
+    }
+
+    struct job_node_s* node = atomic_exchange(&counter->waiting, &_released);
+    atomic_fetch_sub(&counter->finishing, 1);
+
+    while (node && node != &_released) {
+        struct job_node_s* next = node->next;
+        _submit(&node->job);
+        free(node);
+        node = next;
+    }
+    _notify();
+}
+
+static void _execute(const _job_t* job)
+{
+    job->fn(job->userdata, job->index);
+    if (job->counter) _finish(job->counter);
+}
+
+static void* _worker_main(void* arg)
+{
+    _worker = (int)(intptr_t)arg;
+
+    for (;;) {
+        _job_t job;
+        if (_take(&job)) {
+            _execute(&job);
+            continue;
+        }
+
+        pthread_mutex_lock(&jobs.sleep_lock);
+        atomic_fetch_add(&jobs.sleepers, 1);
+        while (atomic_load(&jobs.queued) <= 0 && !atomic_load(&jobs.stopping)) {
+            pthread_cond_wait(&jobs.wake, &jobs.sleep_lock);
+        }
+        atomic_fetch_sub(&jobs.sleepers, 1);
+        bool stop = atomic_load(&jobs.stopping) && atomic_load(&jobs.queued) <= 0;
+        pthread_mutex_unlock(&jobs.sleep_lock);
+
+        if (stop) return NULL;
+    }
+}
+
+static bool _deque_init(_deque_t* d)
+{
+    pthread_mutex_init(&d->lock, NULL);
+    d->jobs     = malloc(JOBS_DEQUE_CAPACITY * sizeof(_job_t));
+    d->capacity = JOBS_DEQUE_CAPACITY;
+    return d->jobs != NULL;
+}
+
+static void _start(void)
+{
+    int count = jobs.requested >= 0 ? jobs.requested : thread_count() - 1;
+    if (count > JOBS_MAX_WORKERS) count = JOBS_MAX_WORKERS;
+
+    // Without the shared deque every job runs where it is queued
+    jobs.running = _deque_init(&jobs.deques[JOBS_SHARED]);
+    if (!jobs.running) {
+        log_error("Failed to allocate the job queues, jobs run serially");
+        return;
+    }
+
+    // Waiting threads run the queued jobs themselves, so fewer workers only cost speed
+    for (int i = 0; i < count; i++) {
+        if (!_deque_init(&jobs.deques[i])
+            || pthread_create(&jobs.threads[i], NULL, _worker_main, (void*)(intptr_t)i) != 0)
+        {
+            log_warn("Started %d of %d job workers", i, count);
+            break;
+        }
+        jobs.worker_count++;
+    }
+}
+
+static void _ensure_started(void)
+{
+    pthread_once(&jobs.once, _start);
+}
+
+void jobs_init(int worker_count)
+{
+    jobs.requested = worker_count > 0 ? worker_count : -1;
+    _ensure_started();
+}
+
+void jobs_shutdown(void)
+{
+    _ensure_started();
+    if (!jobs.running) return;
+
+    atomic_store(&jobs.stopping, true);
+    pthread_mutex_lock(&jobs.sleep_lock);
+    pthread_cond_broadcast(&jobs.wake);
+    pthread_mutex_unlock(&jobs.sleep_lock);
+
+    for (int i = 0; i < jobs.worker_count; i++) pthread_join(jobs.threads[i], NULL);
+
+    // Whatever the workers left behind runs here, later jobs run where they are queued
+    _job_t job;
+    while (_take(&job)) _execute(&job);
+    jobs.running = false;
+
+    for (int i = 0; i < jobs.worker_count; i++) free(jobs.deques[i].jobs);
+    free(jobs.deques[JOBS_SHARED].jobs);
+    jobs.worker_count = 0;
+}
+
+int jobs_worker_count(void)
+{
+    _ensure_started();
+    return jobs.worker_count;
+}
+
+void jobs_counter_init(job_counter_t* counter)
+{
+    atomic_store(&counter->pending, 0);
+    atomic_store(&counter->finishing, 0);
+    atomic_store(&counter->waiting, NULL);
+}
+
+void jobs_run(job_fn fn, void* userdata, int index, job_counter_t* counter)
+{
+    _ensure_started();
+    if (counter) atomic_fetch_add(&counter->pending, 1);
+    _submit(&(_job_t) { fn, userdata, index, counter });
+}
+
+void jobs_run_after(job_counter_t* after, job_fn fn, void* userdata, int index, job_counter_t* counter)
+{
+    _ensure_started();
+    if (counter) atomic_fetch_add(&counter->pending, 1);
+
+    _job_t             job  = { fn, userdata, index, counter };
+    struct job_node_s* node = malloc(sizeof(*node));
+    if (!node) {
+        jobs_wait(after);
+        _submit(&job);
+        return;
+    }
+    node->job = job;
+
+    // The counter may reach zero meanwhile, then the list is released and the job goes right away
+    struct job_node_s* head = atomic_load(&after->waiting);
+    do {
+        if (head == &_released || (!head && atomic_load(&after->pending) == 0)) {
+            free(node);
+            _submit(&job);
+            return;
+        }
+        node->next = head;
+    } while (!atomic_compare_exchange_weak(&after->waiting, &head, node));
+}
+
+void jobs_wait(job_counter_t* counter)
+{
+    while (atomic_load(&counter->pending) > 0) {
+        _job_t job;
+        if (_take(&job)) {
+            _execute(&job);
+            continue;
+        }
+
+        pthread_mutex_lock(&jobs.sleep_lock);
+        atomic_fetch_add(&jobs.sleepers, 1);
+        while (atomic_load(&counter->pending) > 0 && atomic_load(&jobs.queued) <= 0) {
+            pthread_cond_wait(&jobs.wake, &jobs.sleep_lock);
+        }
+        atomic_fetch_sub(&jobs.sleepers, 1);
+        pthread_mutex_unlock(&jobs.sleep_lock);
+    }
+
+    // Only a few instructions are left in _finish, not worth a sleep
+    while (atomic_load(&counter->finishing) > 0) sched_yield();
+}
+
+void jobs_parallel_for(int count, job_fn fn, void* userdata)
+{
+    if (count <= 1) {
+        if (count == 1) fn(userdata, 0);
+        return;
+    }
+
+    job_counter_t counter;
+    jobs_counter_init(&counter);
+    for (int i = count - 1; i > 0; i--) jobs_run(fn, userdata, i, &counter);
+
+    fn(userdata, 0);
+    jobs_wait(&counter);
+}
+
+void jobs_post_main(job_fn fn, void* userdata, int index)
+{
+    pthread_mutex_lock(&jobs.main_lock);
+
+    if (jobs.main_count == jobs.main_capacity) {
+        int     capacity = jobs.main_capacity ? jobs.main_capacity * 2 : 16;
+        _job_t* grown    = realloc(jobs.main_jobs, (size_t)capacity * sizeof(_job_t));
+        if (!grown) {
+            pthread_mutex_unlock(&jobs.main_lock);
+            log_error("Failed to queue a job for the main thread");
+            return;
+        }
+        jobs.main_jobs     = grown;
+        jobs.main_capacity = capacity;
+    }
+
+    jobs.main_jobs[jobs.main_count++] = (_job_t) { fn, userdata, index, NULL };
+    pthread_mutex_unlock(&jobs.main_lock);
+}
+
+int jobs_run_main(void)
+{
+    // Jobs may post more, those wait for the next call
+    pthread_mutex_lock(&jobs.main_lock);
+    _job_t* queued     = jobs.main_jobs;
+    int     count      = jobs.main_count;
+    jobs.main_jobs     = NULL;
+    jobs.main_count    = 0;
+    jobs.main_capacity = 0;
+    pthread_mutex_unlock(&jobs.main_lock);
+
+    for (int i = 0; i < count; i++) _execute(&queued[i]);
+    free(queued);
+    return count;
+}
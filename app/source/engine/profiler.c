@@ -0,0 +1,288 @@
+#include "engine/profiler.h"
+#include "engine/timer.h"
+
+#include "glad/glad.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _PROFILER_NAMED_THREADS 64 // threads past this many get an unnamed track
+#define _PROFILER_GPU_TRACK 0      // trace track of the gpu zones, cpu threads count up from 1
+
+typedef struct {
+    const char* name;
+    double      start;
+    double      duration;
+    int         track;
+} _event_t;
+
+// The gpu zones of one frame, read back once all of its queries finished
+typedef struct {
+    GLuint      queries[PROFILER_GPU_ZONES];
+    const char* names[PROFILER_GPU_ZONES];
+    double      starts[PROFILER_GPU_ZONES];
+    int         count;
+    bool        pending;
+} _gpu_frame_t;
+
+static struct {
+    atomic_bool     running;
+    pthread_mutex_t lock; // guards the events and thread names, zones end on any thread
+    double          origin;
+    _event_t*       events;
+    long long       event_count; // ever recorded, the ring keeps the last PROFILER_MAX_EVENTS
+    const char*     thread_names[_PROFILER_NAMED_THREADS];
+
+    // Render thread only from here on
+    double       history[PROFILER_HISTORY];
+    int          history_count;
+    int          history_next;
+    double       frame_start;
+    bool         in_frame;
+    _gpu_frame_t gpu[PROFILER_GPU_FRAMES];
+    int          gpu_frame;  // slot the current frame writes
+    bool         gpu_skip;   // the slot is still in flight, this frame goes untimed
+    bool         gpu_active; // between gpu begin and end
+    int          gpu_count;
+    const char*  gpu_names[PROFILER_GPU_ZONES];
+    double       gpu_ms[PROFILER_GPU_ZONES];
+} p = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static atomic_int       _next_track = _PROFILER_GPU_TRACK + 1;
+static _Thread_local int _track;
+
+static int _thread_track(void)
+{
+    if (_track == 0) _track = atomic_fetch_add(&_next_track, 1);
+    return _track;
+}
+
+static void _record(const char* name, double start, double duration, int track)
+{
+    pthread_mutex_lock(&p.lock);
+    if (p.events) {
+        p.events[p.event_count % PROFILER_MAX_EVENTS] = (_event_t) { name, start, duration, track };
+        p.event_count++;
+    }
+    pthread_mutex_unlock(&p.lock);
+}
+
+// Reads back a frame's queries if the last one finished, they complete in order
+static bool _gpu_resolve(_gpu_frame_t* frame)
+{
+    if (!frame->pending) return true;
+
+    GLint available = 0;
+    glGetQueryObjectiv(frame->queries[frame->count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return false;
+
+    for (int i = 0; i < frame->count; i++) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(frame->queries[i], GL_QUERY_RESULT, &ns);
+
+        p.gpu_names[i] = frame->names[i];
+        p.gpu_ms[i]    = (double)ns * 1e-6;
+        _record(frame->names[i], frame->starts[i], (double)ns * 1e-9, _PROFILER_GPU_TRACK);
+    }
+    p.gpu_count    = frame->count;
+    frame->pending = false;
+    return true;
+}
+
+void profiler_init(void)
+{
+    if (atomic_load(&p.running)) return;
+
+    _event_t* events = malloc(PROFILER_MAX_EVENTS * sizeof(_event_t));
+    if (!events) {
+        log_error("Failed to allocate the profiler's %d events", PROFILER_MAX_EVENTS);
+        return;
+    }
+
+    pthread_mutex_lock(&p.lock);
+    p.events      = events;
+    p.event_count = 0;
+    p.origin      = timer_now();
+    pthread_mutex_unlock(&p.lock);
+
+    for (int i = 0; i < PROFILER_GPU_FRAMES; i++) {
+        glGenQueries(PROFILER_GPU_ZONES, p.gpu[i].queries);
+        p.gpu[i].count   = 0;
+        p.gpu[i].pending = false;
+    }
+    p.history_count = 0;
+    p.history_next  = 0;
+    p.gpu_frame     = 0;
+    p.gpu_count     = 0;
+    p.in_frame      = false;
+    p.gpu_active    = false;
+
+    atomic_store(&p.running, true);
+}
+
+void profiler_shutdown(void)
+{
+    if (!atomic_load(&p.running)) return;
+    atomic_store(&p.running, false);
+
+    for (int i = 0; i < PROFILER_GPU_FRAMES; i++) glDeleteQueries(PROFILER_GPU_ZONES, p.gpu[i].queries);
+
+    pthread_mutex_lock(&p.lock);
+    free(p.events);
+    p.events = NULL;
+    pthread_mutex_unlock(&p.lock);
+}
+
+void profiler_name_thread(const char* name)
+{
+    int track = _thread_track();
+    if (track >= _PROFILER_NAMED_THREADS) return;
+
+    pthread_mutex_lock(&p.lock);
+    p.thread_names[track] = name;
+    pthread_mutex_unlock(&p.lock);
+}
+
+void profiler_frame_begin(void)
+{
+    if (!atomic_load(&p.running)) return;
+
+    p.frame_start = timer_now();
+    p.in_frame    = true;
+
+    // Waiting on the slot would stall the pipeline, the frame goes without gpu zones instead
+    _gpu_frame_t* frame = &p.gpu[p.gpu_frame];
+    p.gpu_skip          = !_gpu_resolve(frame);
+    if (!p.gpu_skip) frame->count = 0;
+}
+
+void profiler_frame_end(void)
+{
+    if (!atomic_load(&p.running) || !p.in_frame) return;
+    if (p.gpu_active) profiler_gpu_end();
+
+    double end = timer_now();
+    _record("frame", p.frame_start, end - p.frame_start, _thread_track());
+
+    p.history[p.history_next] = (end - p.frame_start) * 1000.0;
+    p.history_next            = (p.history_next + 1) % PROFILER_HISTORY;
+    if (p.history_count < PROFILER_HISTORY) p.history_count++;
+
+    if (!p.gpu_skip) p.gpu[p.gpu_frame].pending = p.gpu[p.gpu_frame].count > 0;
+    p.gpu_frame = (p.gpu_frame + 1) % PROFILER_GPU_FRAMES;
+    p.in_frame  = false;
+
+    // Oldest first so the stats end up with the newest finished frame
+    for (int i = 0; i < PROFILER_GPU_FRAMES; i++) {
+        if (!_gpu_resolve(&p.gpu[(p.gpu_frame + i) % PROFILER_GPU_FRAMES])) break;
+    }
+}
+
+profiler_zone_t profiler_begin(const char* name)
+{
+    return (profiler_zone_t) { name, atomic_load(&p.running) ? timer_now() : 0.0 };
+}
+
+void profiler_end(const profiler_zone_t* zone)
+{
+    // A zone that began before the profiler started has no start time
+    if (!atomic_load(&p.running) || zone->start == 0.0) return;
+    _record(zone->name, zone->start, timer_now() - zone->start, _thread_track());
+}
+
+void profiler_gpu_begin(const char* name)
+{
+    if (!atomic_load(&p.running) || !p.in_frame || p.gpu_skip || p.gpu_active) return;
+
+    _gpu_frame_t* frame = &p.gpu[p.gpu_frame];
+    if (frame->count == PROFILER_GPU_ZONES) return;
+
+    glBeginQuery(GL_TIME_ELAPSED, frame->queries[frame->count]);
+    frame->names[frame->count]  = name;
+    frame->starts[frame->count] = timer_now();
+    p.gpu_active                = true;
+}
+
+void profiler_gpu_end(void)
+{
+    if (!p.gpu_active) return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    p.gpu[p.gpu_frame].count++;
+    p.gpu_active = false;
+}
+
+static int _compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+void profiler_stats(profiler_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!atomic_load(&p.running)) return;
+
+    double sorted[PROFILER_HISTORY];
+    int    n = p.history_count;
+    memcpy(sorted, p.history, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), _compare_double);
+
+    stats->frame_count = n;
+    if (n > 0) {
+        stats->frame_p50 = sorted[(int)(0.50 * (n - 1) + 0.5)];
+        stats->frame_p95 = sorted[(int)(0.95 * (n - 1) + 0.5)];
+        stats->frame_p99 = sorted[(int)(0.99 * (n - 1) + 0.5)];
+    }
+
+    stats->gpu_count = p.gpu_count;
+    memcpy(stats->gpu_names, p.gpu_names, sizeof(stats->gpu_names));
+    memcpy(stats->gpu_ms, p.gpu_ms, sizeof(stats->gpu_ms));
+}
+
+bool profiler_write_trace(const char* path)
+{
+    if (!atomic_load(&p.running)) return false;
+
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        log_error("Failed to open %s for the trace", path);
+        return false;
+    }
+
+    pthread_mutex_lock(&p.lock);
+
+    // Timestamps and durations are in microseconds
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"gpu\"}}",
+            _PROFILER_GPU_TRACK);
+    for (int i = 0; i < _PROFILER_NAMED_THREADS; i++) {
+        if (!p.thread_names[i]) continue;
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i,
+                p.thread_names[i]);
+    }
+
+    long long first = p.event_count > PROFILER_MAX_EVENTS ? p.event_count - PROFILER_MAX_EVENTS : 0;
+    for (long long i = first; i < p.event_count; i++) {
+        const _event_t* e = &p.events[i % PROFILER_MAX_EVENTS];
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", e->name,
+                e->track, (e->start - p.origin) * 1e6, e->duration * 1e6);
+    }
+    fprintf(file, "\n]}\n");
+
+    long long written = p.event_count - first;
+    pthread_mutex_unlock(&p.lock);
+
+    bool ok = ferror(file) == 0;
+    ok      = fclose(file) == 0 && ok;
+    if (ok) {
+        log_info("Wrote %lld profiler zones to %s", written, path);
+    } else {
+        log_error("Failed to write the trace to %s", path);
+    }
+    return ok;
+}
@@ -2,6 +2,8 @@
 
 #include "log.h"
 
+#include <string.h>
+
 GLuint _shader_compile(GLenum type, const char* source)
 {
     GLuint shader = glCreateShader(type);
@@ -42,4 +44,73 @@ GLuint load_shader_program(const char* vs_source, const char* fs_source)
     glDeleteShader(fs);
 
     return prog;
-}
\ No newline at end of file
+}
+
+bool shader_create(shader_t* shader, const char* vs_source, const char* fs_source, const char* const* uniforms,
+                   int uniform_count)
+{
+    shader->program = load_shader_program(vs_source, fs_source);
+    for (int i = 0; i < SHADER_MAX_UNIFORMS; i++) shader->locations[i] = -1;
+
+    if (!shader->program) return false;
+
+    if (uniform_count > SHADER_MAX_UNIFORMS) {
+        log_warn("Shader asks for %d uniforms, only the first %d are resolved", uniform_count, SHADER_MAX_UNIFORMS);
+        uniform_count = SHADER_MAX_UNIFORMS;
+    }
+
+    for (int i = 0; i < uniform_count; i++) {
+        shader->locations[i] = glGetUniformLocation(shader->program, uniforms[i]);
+    }
+
+    // Programs without the camera block simply don't have the index
+    GLuint camera = glGetUniformBlockIndex(shader->program, "Camera");
+    if (camera != GL_INVALID_INDEX) glUniformBlockBinding(shader->program, camera, SHADER_CAMERA_BINDING);
+
+    return true;
+}
+
+void shader_destroy(shader_t* shader)
+{
+    if (shader->program) glDeleteProgram(shader->program);
+    shader->program = 0;
+}
+
+typedef struct {
+    mat4 proj;
+    mat4 view;
+    mat4 screen;
+} _camera_block_t;
+
+static GLuint          _camera_ubo;
+static _camera_block_t _camera_uploaded;
+
+void shader_camera_update(mat4 proj, mat4 view, mat4 screen)
+{
+    _camera_block_t block;
+    glm_mat4_copy(proj, block.proj);
+    glm_mat4_copy(view, block.view);
+    glm_mat4_copy(screen, block.screen);
+
+    if (!_camera_ubo) {
+        glGenBuffers(1, &_camera_ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, _camera_ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        _camera_uploaded = block;
+    } else if (memcmp(&block, &_camera_uploaded, sizeof(block)) != 0) {
+        glBindBuffer(GL_UNIFORM_BUFFER, _camera_ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        _camera_uploaded = block;
+    }
+
+    // Rebound every time, the binding point is shared with whatever else uses uniform buffers
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_CAMERA_BINDING, _camera_ubo);
+}
+
+void shader_camera_destroy(void)
+{
+    if (_camera_ubo) glDeleteBuffers(1, &_camera_ubo);
+    _camera_ubo = 0;
+}
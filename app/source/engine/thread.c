@@ -0,0 +1,72 @@
+#include "engine/thread.h"
+#include "engine/jobs.h"
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct {
+    thread_task_fn task;
+    void*          userdata;
+    int            index;
+} _thread_arg_t;
+
+struct thread_s {
+    pthread_t     handle;
+    _thread_arg_t arg;
+};
+
+static void* _thread_entry(void* arg)
+{
+    _thread_arg_t* a = arg;
+    a->task(a->userdata, a->index);
+    return NULL;
+}
+
+int thread_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? count : 1;
+}
+
+void thread_parallel(int count, thread_task_fn task, void* userdata)
+{
+    jobs_parallel_for(count, task, userdata);
+}
+
+thread_t thread_spawn(thread_task_fn task, void* userdata)
+{
+    thread_t t = malloc(sizeof(*t));
+    if (!t) {
+        log_error("Failed to allocate thread");
+        return NULL;
+    }
+
+    t->arg = (_thread_arg_t) { .task = task, .userdata = userdata, .index = 0 };
+    if (pthread_create(&t->handle, NULL, _thread_entry, &t->arg) != 0) {
+        log_error("Failed to spawn thread");
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void thread_join(thread_t t)
+{
+    if (!t) return;
+    pthread_join(t->handle, NULL);
+    free(t);
+}
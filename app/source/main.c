@@ -8,9 +8,13 @@
 #include <string.h>
 #include <time.h>
 
+#include "core/cache.h"
 #include "core/grid.h"
+#include "engine/arena.h"
 #include "engine/input.h"
+#include "engine/jobs.h"
 #include "engine/orbit.h"
+#include "engine/profiler.h"
 #include "engine/window.h"
 #define STR_IMPL
 #include "engine/string.h"
@@ -30,9 +34,14 @@
 #include "core/scene.h"
 #include "parsers/obj.h"
 
+#define LOAD_POLL_INTERVAL (1.0 / 60.0) // seconds between wake ups while a load is in flight
+#define TRACE_PATH "fov_trace.json"      // profiler trace, written on T and at exit
+
 scene_t scene;
 int     window_width  = 1280;
 int     window_height = 720;
+bool    needs_frame   = true; // the window lost its contents, the cached scene frame is still good
+bool    show_profiler = false;
 
 void scroll_callback(GLFWwindow*, double, double yoffset)
 {
@@ -70,11 +79,72 @@ void resize_callback(GLFWwindow*, int width, int height)
     scene_resize(&scene, width, height);
 }
 
+void refresh_callback(GLFWwindow*)
+{
+    needs_frame = true;
+}
+
 void drop_callback(GLFWwindow*, int count, const char** paths)
 {
-    if (count > 0) {
-        scene_load_model(&scene, paths[0]);
+    for (int i = 0; i < count; i++) {
+        scene_load_model(&scene, paths[i]);
+    }
+}
+
+// Formats the state of the load in flight, returns the percentage done
+nk_size load_progress_label(char* label, size_t size)
+{
+    size_t         done, total;
+    loader_stage_t stage = loader_status(&scene.loader, &done, &total);
+    const char*    verb  = stage == LOADER_UPLOADING ? "Uploading" : "Loading";
+    const char*    name  = scene.loader.path ? scene.loader.path : "";
+
+    // A paged model writes its page file before anything else loads
+    if (stage == LOADER_IDLE && scene.paged.builder) {
+        done  = atomic_load(&scene.paged.progress.bytes_done);
+        total = atomic_load(&scene.paged.progress.bytes_total);
+        verb  = "Paging";
+        name  = scene.paged.source_path;
+    }
+
+    for (const char* c = name; *c; c++) {
+        if (*c == '/' || *c == '\\') name = c + 1;
     }
+
+    nk_size percent = total > 0 ? (nk_size)((double)done / total * 100.0) : 0;
+    snprintf(label, size, "%s %s  %d%%  (%.1f / %.1fMB)", verb, name, (int)percent, done / (1024.0 * 1024.0),
+             total / (1024.0 * 1024.0));
+    return percent;
+}
+
+// Rolling frame time percentiles, the gpu zones of the last timed frame and the scratch arenas
+void profiler_panel(struct nk_context* ctx)
+{
+    profiler_stats_t stats;
+    profiler_stats(&stats);
+    arena_stats_t arenas;
+    arena_stats(&arenas);
+
+    nk_style_push_style_item(ctx, &ctx->style.window.fixed_background, nk_style_item_color(nk_rgba(20, 20, 20, 220)));
+    nk_style_push_vec2(ctx, &ctx->style.window.padding, nk_vec2(8, 4));
+
+    if (nk_begin(ctx, "Profiler", nk_rect((float)window_width - 370, 40, 360, 112 + 22 * PROFILER_GPU_ZONES),
+                 NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_MOVABLE | NK_WINDOW_NO_SCROLLBAR))
+    {
+        nk_layout_row_dynamic(ctx, 22, 1);
+        nk_labelf(ctx, NK_TEXT_ALIGN_LEFT, "cpu frame  p50 %.2f  p95 %.2f  p99 %.2f ms", stats.frame_p50,
+                  stats.frame_p95, stats.frame_p99);
+        for (int i = 0; i < stats.gpu_count; i++) {
+            nk_labelf(ctx, NK_TEXT_ALIGN_LEFT, "gpu %s  %.3f ms", stats.gpu_names[i], stats.gpu_ms[i]);
+        }
+        nk_labelf(ctx, NK_TEXT_ALIGN_LEFT, "over %d frames, T writes %s", stats.frame_count, TRACE_PATH);
+        nk_labelf(ctx, NK_TEXT_ALIGN_LEFT, "arenas %d  %.1fMB  peak %.1fMB", arenas.arena_count,
+                  arenas.committed / (1024.0 * 1024.0), arenas.peak / (1024.0 * 1024.0));
+    }
+    nk_end(ctx);
+
+    nk_style_pop_vec2(ctx);
+    nk_style_pop_style_item(ctx);
 }
 
 int main(int argc, char const* argv[])
@@ -96,13 +166,18 @@ int main(int argc, char const* argv[])
     glfwSetFramebufferSizeCallback(window, resize_callback);
     glfwSetCursorPosCallback(window, cursor_position_callback);
     glfwSetDropCallback(window, drop_callback);
+    glfwSetWindowRefreshCallback(window, refresh_callback);
 
     input_init(window);
 
+    profiler_init();
+    profiler_name_thread("main");
+
     scene_init(&scene, window_width, window_height);
+    cache_init(NULL, CACHE_DEFAULT_MAX_BYTES);
 
     if (argc >= 2) {
-        scene_load_model(&scene, argv[1]);
+        for (int i = 1; i < argc; i++) scene_load_model(&scene, argv[i]);
     }
 
 #ifdef DEBUG_BUILD
@@ -119,46 +194,89 @@ int main(int argc, char const* argv[])
     log_set_quiet(true);
 #endif // RELEASE_BUILD
 
-    float  fps         = 0.0f;
-    double dt          = 0.0;
-    double last_frame  = 0.0;
-    double this_frame  = 0.0;
-    double fps_timeout = 1.0;
+    // Only the work of a frame is timed, the waits for events in between are idle time
+    double frame_start = 0.0;
+    double frame_time  = 0.0;
+    double label_time  = -1.0;
+
+    char label[256];
 
     GLFWcursor* hand_cursor = glfwCreateStandardCursor(GLFW_RESIZE_ALL_CURSOR);
     GLFWcursor* norm_cursor = glfwCreateStandardCursor(GLFW_ARROW_CURSOR);
 
     while (!glfwWindowShouldClose(window)) {
         input_update(window);
-        glfwPollEvents();
 
-        this_frame = glfwGetTime();
-        dt         = this_frame - last_frame;
-        last_frame = this_frame;
+        // Sleep until something happens while the view is static, loads wake up to make progress
+        if (scene.dirty || needs_frame) {
+            glfwPollEvents();
+        } else if (scene_is_busy(&scene)) {
+            glfwWaitEventsTimeout(LOAD_POLL_INTERVAL);
+        } else {
+            glfwWaitEvents();
+        }
+
+        frame_start = glfwGetTime();
 
         // Exit on escape
         if (get_key(GLFW_KEY_ESCAPE)) break;
         // Reload model
         if (get_key(GLFW_KEY_R) && scene_is_loaded(&scene)) {
-
-            char* temp = e_strdup(scene.modelpath);
-
-            scene_unload(&scene);
-            scene_load_model(&scene, temp);
-            free(temp);
+            scene_reload_model(&scene);
+        }
+        // Cycle vertex format and reload
+        if (get_key(GLFW_KEY_F) && scene_is_loaded(&scene)) {
+            scene.vertex_format = (scene.vertex_format + 1) % VERTEX_FORMAT_COUNT;
+            scene_reload_model(&scene);
+        }
+        // Toggle mesh optimization and reload
+        if (get_key(GLFW_KEY_O) && scene_is_loaded(&scene)) {
+            scene.optimize_meshes = !scene.optimize_meshes;
+            log_info("Mesh optimization %s", scene.optimize_meshes ? "enabled" : "disabled");
+            scene_reload_model(&scene);
+        }
+        // Toggle model cache
+        if (get_key(GLFW_KEY_C)) {
+            cache_set_enabled(!cache_is_enabled());
+            log_info("Model cache %s", cache_is_enabled() ? "enabled" : "disabled");
+        }
+        // Toggle back face and meshlet cone culling
+        if (get_key(GLFW_KEY_B) && scene_is_loaded(&scene)) {
+            scene.batch.backface_culling = !scene.batch.backface_culling;
+            log_info("Back face culling %s", scene.batch.backface_culling ? "enabled" : "disabled");
+            scene.dirty = true;
+        }
+        // Cycle the view mode of the pooled models
+        if (get_key(GLFW_KEY_V) && scene_is_loaded(&scene)) {
+            scene.batch.view_mode = (scene.batch.view_mode + 1) % VIEW_MODE_COUNT;
+            log_info("View mode %s", view_mode_name(scene.batch.view_mode));
+            scene.dirty = true;
+        }
+        // Toggle the profiler panel
+        if (get_key(GLFW_KEY_P)) {
+            show_profiler = !show_profiler;
+            needs_frame   = true;
+        }
+        // Write the profiler trace
+        if (get_key(GLFW_KEY_T)) {
+            profiler_write_trace(TRACE_PATH);
         }
         // Reset camera
         if (get_key(GLFW_KEY_H) && scene_is_loaded(&scene)) {
             scene.camera.radius = 5.0f;
             orbit_init(&scene.camera);
+            scene.dirty = true;
         }
 
-        // Update fps label
-        if (fps_timeout > 1.0) {
-            fps         = (float)(1.0 / dt);
-            fps_timeout = 0.0;
-        }
-        fps_timeout += dt;
+        // Gl work the job pool handed back, then the loader thread's result streams to the gpu
+        jobs_run_main();
+        scene_update(&scene);
+
+        // Events that changed nothing visible don't cost a frame
+        if (!scene.dirty && !needs_frame && !scene_is_busy(&scene)) continue;
+        needs_frame = false;
+
+        profiler_frame_begin();
 
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_BLEND);
@@ -185,11 +303,49 @@ int main(int argc, char const* argv[])
 
                 nk_layout_row_begin(ctx, NK_DYNAMIC, 30, 2);
                 nk_layout_row_push(ctx, 0.5f);
-                nk_labelf(ctx, NK_TEXT_ALIGN_LEFT, "fps: %.1f", fps);
+                nk_labelf(ctx, NK_TEXT_ALIGN_LEFT, "frame: %.2fms (%.0f fps)", frame_time * 1000.0,
+                          frame_time > 0.0 ? 1.0 / frame_time : 0.0);
                 nk_layout_row_push(ctx, 0.5f);
-                nk_labelf(ctx, NK_TEXT_ALIGN_RIGHT, "verts: %i  size: %.2fMB", scene.gpu_model.vertex_count,
-                          scene.model_size);
+                int   vertex_count, instance_count;
+                float size_mb;
+                batch_stats(&scene.batch, &vertex_count, &instance_count, &size_mb);
+                nk_labelf(ctx, NK_TEXT_ALIGN_RIGHT, "models: %i  instances: %i  verts: %i  size: %.2fMB  (%s, %s)",
+                          scene.batch.model_count, instance_count, vertex_count, size_mb,
+                          vertex_format_name(scene.vertex_format), view_mode_name(scene.batch.view_mode));
                 nk_layout_row_end(ctx);
+
+                // Measurements of the newest model, for checking scans
+                const model_stats_t* stats =
+                    scene.batch.model_count > 0 ? &scene.batch.models[scene.batch.model_count - 1].gpu.stats : NULL;
+                if (stats && stats->valid) {
+                    nk_layout_row_dynamic(ctx, 30, 1);
+                    nk_labelf(ctx, NK_TEXT_ALIGN_RIGHT,
+                              "tris: %i  area: %.4g  volume: %.4g  extent: %.3g x %.3g x %.3g  degenerate: %i  "
+                              "boundary loops: %i  non-manifold edges: %i",
+                              stats->triangle_count, stats->area, stats->volume, stats->max[0] - stats->min[0],
+                              stats->max[1] - stats->min[1], stats->max[2] - stats->min[2], stats->degenerate_count,
+                              stats->boundary_loops, stats->non_manifold_edges);
+                }
+
+                if (paged_is_loaded(&scene.paged)) {
+                    const paged_model_t* paged = &scene.paged;
+                    nk_layout_row_dynamic(ctx, 30, 1);
+                    nk_labelf(ctx, NK_TEXT_ALIGN_RIGHT,
+                              "paged tris: %lld  pages: %d / %d resident  slots: %d  streamed: %.1fMB  drawn: %lld",
+                              paged->triangle_count, paged->resident_count, paged->page_count, paged->slot_count,
+                              paged->streamed_bytes / (1024.0 * 1024.0), paged->drawn_triangles);
+                }
+
+                if (scene_is_loading(&scene)) {
+                    nk_size percent = load_progress_label(label, sizeof(label));
+
+                    nk_layout_row_begin(ctx, NK_DYNAMIC, 30, 2);
+                    nk_layout_row_push(ctx, 0.5f);
+                    nk_label(ctx, label, NK_TEXT_ALIGN_LEFT);
+                    nk_layout_row_push(ctx, 0.5f);
+                    nk_progress(ctx, &percent, 100, NK_FIXED);
+                    nk_layout_row_end(ctx);
+                }
             }
             nk_end(ctx);
 
@@ -208,25 +364,61 @@ int main(int argc, char const* argv[])
                 nk_style_set_font(ctx, &large_font->handle);
 
                 // Center the text vertically and horizontally
-                nk_layout_space_begin(ctx, NK_STATIC, window_height, 1);
-                nk_layout_space_push(ctx, nk_rect(0, window_height / 2 - 15, window_width, 30));
-                nk_label(ctx, "Drop a supported 3d model file.", NK_TEXT_ALIGN_CENTERED);
-                nk_layout_space_end(ctx);
+                if (scene_is_loading(&scene)) {
+                    nk_size percent = load_progress_label(label, sizeof(label));
+
+                    nk_layout_space_begin(ctx, NK_STATIC, window_height, 2);
+                    nk_layout_space_push(ctx, nk_rect(0, window_height / 2 - 15, window_width, 30));
+                    nk_label(ctx, label, NK_TEXT_ALIGN_CENTERED);
+                    nk_layout_space_push(ctx, nk_rect(window_width / 4, window_height / 2 + 30, window_width / 2, 20));
+                    nk_progress(ctx, &percent, 100, NK_FIXED);
+                    nk_layout_space_end(ctx);
+                } else {
+                    nk_layout_space_begin(ctx, NK_STATIC, window_height, 1);
+                    nk_layout_space_push(ctx, nk_rect(0, window_height / 2 - 15, window_width, 30));
+                    nk_label(ctx, "Drop a supported 3d model file.", NK_TEXT_ALIGN_CENTERED);
+                    nk_layout_space_end(ctx);
+                }
 
                 nk_style_set_font(ctx, &norm_font->handle);
             }
             nk_end(ctx);
+
+            // Nothing to cache without a model, the next load marks the scene again
+            scene.dirty = false;
         }
 
+        if (show_profiler) profiler_panel(ctx);
+
+        profiler_zone_t zone = profiler_begin("ui render");
+        profiler_gpu_begin("ui render");
         nk_glfw3_render(NK_ANTI_ALIASING_ON);
+        profiler_gpu_end();
+        profiler_end(&zone);
+
         glfwSwapBuffers(window);
+        profiler_frame_end();
+
+        // Update, render and swap of this frame, the label picks it up once a second
+        double frame_end = glfwGetTime();
+        if (frame_end - label_time > 1.0) {
+            frame_time = frame_end - frame_start;
+            label_time = frame_end;
+        }
+
+        // The panel shows live numbers, keep drawing while it is open
+        if (show_profiler) needs_frame = true;
     }
 
+    profiler_write_trace(TRACE_PATH);
+
 #ifdef RELEASE_BUILD
     fclose(log_file);
 #endif // RELEASE_BUILD
 
     scene_unload(&scene);
+    profiler_shutdown();
+    jobs_shutdown();
 
     glfwDestroyCursor(hand_cursor);
     glfwDestroyCursor(norm_cursor);
@@ -0,0 +1,737 @@
+#include "parsers/gltf.h"
+
+#include "engine/file.h"
+#include "engine/timer.h"
+#include "parsers/json.h"
+
+#include "glad/glad.h"
+#include "log.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLTF_MAGIC 0x46546c67u      // "glTF"
+#define GLTF_CHUNK_JSON 0x4e4f534au // "JSON"
+#define GLTF_CHUNK_BIN 0x004e4942u  // "BIN\0"
+#define GLTF_MAX_NODE_DEPTH 64
+#define GLTF_MAX_PATH 4096
+
+typedef struct {
+    const char* data;
+    size_t      size;
+} gltf_buffer_t;
+
+typedef struct {
+    int    buffer;
+    size_t offset;
+    size_t length;
+    int    stride;       // 0 when tightly packed
+    int    array_view;   // packed view when used for vertex attributes, -1 until then
+    int    element_view; // packed view when used for indices, -1 until then
+} gltf_view_t;
+
+typedef struct {
+    int          view; // -1 for accessors without data (sparse only or all zeros)
+    size_t       offset;
+    unsigned int type;
+    int          components;
+    int          count;
+    bool         normalized;
+    bool         sparse;
+    bool         has_bounds;
+    float        min[3];
+    float        max[3];
+} gltf_accessor_t;
+
+typedef struct {
+    const char*     path;
+    json_t          json;
+    packed_model_t* packed;
+
+    gltf_buffer_t*   buffers;
+    gltf_view_t*     views;
+    gltf_accessor_t* accessors;
+    int              buffer_count;
+    int              view_count;
+    int              accessor_count;
+    int              meshes; // json array token
+    int              nodes;  // json array token
+
+    int  view_capacity;
+    int  draw_capacity;
+    int  skipped;
+    bool has_bounds;
+    vec3 min;
+    vec3 max;
+} gltf_job_t;
+
+static inline uint32_t _read_u32(const char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int _component_size(unsigned int type)
+{
+    switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE: return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT: return 2;
+    case GL_UNSIGNED_INT:
+    case GL_FLOAT: return 4;
+    default: return 0;
+    }
+}
+
+static int _type_components(const json_t* json, int token)
+{
+    static const struct {
+        const char* name;
+        int         components;
+    } types[] = { { "SCALAR", 1 }, { "VEC2", 2 }, { "VEC3", 3 }, { "VEC4", 4 }, { "MAT2", 4 }, { "MAT3", 9 }, { "MAT4", 16 } };
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (json_is(json, token, types[i].name)) return types[i].components;
+    }
+    return 0;
+}
+
+// Element i of the array token, walking from the start
+static int _element(const json_t* json, int array, int index)
+{
+    if (index < 0 || index >= json_count(json, array)) return -1;
+
+    int t = json_first(json, array);
+    for (int i = 0; i < index; i++) t = json_next(json, t);
+    return t;
+}
+
+bool gltf_detect(const char* head, size_t head_size)
+{
+    if (head_size >= 4 && _read_u32(head) == GLTF_MAGIC) return true;
+
+    size_t i = 0;
+    while (i < head_size && (head[i] == ' ' || head[i] == '\t' || head[i] == '\r' || head[i] == '\n')) i++;
+    if (i >= head_size || head[i] != '{') return false;
+
+    for (; i + 7 <= head_size; i++) {
+        if (memcmp(head + i, "\"asset\"", 7) == 0) return true;
+    }
+    return false;
+}
+
+static int _base64_value(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+' || c == '-') return 62;
+    if (c == '/' || c == '_') return 63;
+    return -1;
+}
+
+// Decodes at most size bytes, returns the number written
+static size_t _base64_decode(const char* src, size_t length, char* dst, size_t size)
+{
+    size_t   n    = 0;
+    uint32_t bits = 0;
+    int      have = 0;
+
+    for (size_t i = 0; i < length && n < size; i++) {
+        int v = _base64_value(src[i]);
+        if (v < 0) continue;
+
+        bits  = bits << 6 | (uint32_t)v;
+        have += 6;
+        if (have >= 8) {
+            have     -= 8;
+            dst[n++]  = (char)(bits >> have);
+        }
+    }
+    return n;
+}
+
+static int _hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Percent escapes in place, uris are the only place they appear
+static void _uri_decode(char* uri)
+{
+    char* out = uri;
+    for (const char* p = uri; *p; p++) {
+        int hi = *p == '%' ? _hex_value(p[1]) : -1;
+        int lo = hi >= 0 ? _hex_value(p[2]) : -1;
+        if (lo >= 0) {
+            *out++  = (char)(hi * 16 + lo);
+            p      += 2;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+static bool _load_buffers(gltf_job_t* job, const char* bin, size_t bin_size)
+{
+    const json_t*   json    = &job->json;
+    packed_model_t* packed  = job->packed;
+    int             buffers = json_find(json, 0, "buffers");
+
+    job->buffer_count = json_count(json, buffers);
+    job->buffers      = calloc(job->buffer_count + 1, sizeof(gltf_buffer_t));
+    packed->maps      = calloc(job->buffer_count + 1, sizeof(file_map_t));
+    if (!job->buffers || !packed->maps) return false;
+
+    // Embedded base64 buffers are the only copies, they share one allocation
+    size_t embedded = 0;
+    for (int i = 0, t = json_first(json, buffers); i < job->buffer_count; i++, t = json_next(json, t)) {
+        int uri = json_find(json, t, "uri");
+        if (uri >= 0 && job->json.tokens[uri].end - job->json.tokens[uri].start > 5
+            && memcmp(json->text + job->json.tokens[uri].start, "data:", 5) == 0)
+        {
+            embedded += (size_t)json_number(json, json_find(json, t, "byteLength"), 0.0);
+        }
+    }
+
+    if (embedded > 0 && !(packed->storage = malloc(embedded))) {
+        log_error("Failed to allocate %zu bytes for the embedded buffers of %s", embedded, job->path);
+        return false;
+    }
+
+    char*  storage = packed->storage;
+    size_t used    = 0;
+
+    for (int i = 0, t = json_first(json, buffers); i < job->buffer_count; i++, t = json_next(json, t)) {
+        size_t length = (size_t)json_number(json, json_find(json, t, "byteLength"), 0.0);
+        int    uri    = json_find(json, t, "uri");
+
+        gltf_buffer_t* b = &job->buffers[i];
+
+        if (uri < 0) {
+            // The binary chunk of a .glb
+            if (i != 0 || !bin) {
+                log_error("%s: buffer %d has no uri and there is no binary chunk", job->path, i);
+                return false;
+            }
+            b->data = bin;
+            b->size = bin_size;
+        } else if (json->tokens[uri].end - json->tokens[uri].start > 5
+                   && memcmp(json->text + json->tokens[uri].start, "data:", 5) == 0)
+        {
+            const char* start = json->text + json->tokens[uri].start;
+            const char* end   = json->text + json->tokens[uri].end;
+            const char* comma = memchr(start, ',', end - start);
+            if (!comma) {
+                log_error("%s: buffer %d has a malformed data uri", job->path, i);
+                return false;
+            }
+
+            b->data = storage + used;
+            b->size = _base64_decode(comma + 1, end - comma - 1, storage + used, embedded - used);
+            used   += b->size;
+        } else {
+            char name[GLTF_MAX_PATH], path[GLTF_MAX_PATH];
+            if (!json_string(json, uri, name, sizeof(name))) {
+                log_error("%s: buffer %d has an invalid uri", job->path, i);
+                return false;
+            }
+            _uri_decode(name);
+
+            // Relative to the directory of the gltf file
+            const char* slash = strrchr(job->path, '/');
+            const char* back  = strrchr(job->path, '\\');
+            if (back > slash) slash = back;
+            int dir = slash ? (int)(slash - job->path + 1) : 0;
+            if (snprintf(path, sizeof(path), "%.*s%s", dir, job->path, name) >= (int)sizeof(path)) {
+                log_error("%s: the path of buffer %d is too long", job->path, i);
+                return false;
+            }
+
+            if (!file_map(path, &packed->maps[packed->map_count])) {
+                log_error("%s: failed to open buffer %s", job->path, path);
+                return false;
+            }
+            b->data = packed->maps[packed->map_count].data;
+            b->size = packed->maps[packed->map_count].size;
+            packed->map_count++;
+        }
+
+        if (b->size < length) {
+            log_error("%s: buffer %d holds %zu bytes but declares %zu", job->path, i, b->size, length);
+            return false;
+        }
+        b->size = length;
+    }
+
+    return true;
+}
+
+static bool _load_views(gltf_job_t* job)
+{
+    const json_t* json  = &job->json;
+    int           views = json_find(json, 0, "bufferViews");
+
+    job->view_count = json_count(json, views);
+    job->views      = calloc(job->view_count + 1, sizeof(gltf_view_t));
+    if (!job->views) return false;
+
+    for (int i = 0, t = json_first(json, views); i < job->view_count; i++, t = json_next(json, t)) {
+        gltf_view_t* v = &job->views[i];
+
+        v->buffer       = json_int(json, json_find(json, t, "buffer"), -1);
+        v->offset       = (size_t)json_number(json, json_find(json, t, "byteOffset"), 0.0);
+        v->length       = (size_t)json_number(json, json_find(json, t, "byteLength"), 0.0);
+        v->stride       = json_int(json, json_find(json, t, "byteStride"), 0);
+        v->array_view   = -1;
+        v->element_view = -1;
+
+        if (v->buffer < 0 || v->buffer >= job->buffer_count || v->offset > job->buffers[v->buffer].size
+            || v->length > job->buffers[v->buffer].size - v->offset || v->stride < 0 || v->stride > 252)
+        {
+            log_error("%s: buffer view %d is out of bounds", job->path, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool _load_accessors(gltf_job_t* job)
+{
+    const json_t* json      = &job->json;
+    int           accessors = json_find(json, 0, "accessors");
+
+    job->accessor_count = json_count(json, accessors);
+    job->accessors      = calloc(job->accessor_count + 1, sizeof(gltf_accessor_t));
+    if (!job->accessors) return false;
+
+    for (int i = 0, t = json_first(json, accessors); i < job->accessor_count; i++, t = json_next(json, t)) {
+        gltf_accessor_t* a = &job->accessors[i];
+
+        a->view       = json_int(json, json_find(json, t, "bufferView"), -1);
+        a->offset     = (size_t)json_number(json, json_find(json, t, "byteOffset"), 0.0);
+        a->type       = (unsigned int)json_int(json, json_find(json, t, "componentType"), 0);
+        a->components = _type_components(json, json_find(json, t, "type"));
+        a->count      = json_int(json, json_find(json, t, "count"), 0);
+        a->normalized = json_bool(json, json_find(json, t, "normalized"), false);
+        a->sparse     = json_find(json, t, "sparse") >= 0;
+
+        int min = json_find(json, t, "min"), max = json_find(json, t, "max");
+        if (a->components == 3 && json_count(json, min) == 3 && json_count(json, max) == 3) {
+            for (int c = 0, mn = json_first(json, min), mx = json_first(json, max); c < 3;
+                 c++, mn = json_next(json, mn), mx = json_next(json, mx))
+            {
+                a->min[c] = (float)json_number(json, mn, 0.0);
+                a->max[c] = (float)json_number(json, mx, 0.0);
+            }
+            a->has_bounds = true;
+        }
+
+        int size = _component_size(a->type) * a->components;
+        if (size == 0 || a->count < 0 || a->view >= job->view_count) {
+            log_error("%s: accessor %d is invalid", job->path, i);
+            return false;
+        }
+
+        if (a->view >= 0 && a->count > 0) {
+            const gltf_view_t* v      = &job->views[a->view];
+            size_t             stride = v->stride ? (size_t)v->stride : (size_t)size;
+            if (a->offset > v->length || (size_t)(a->count - 1) * stride + size > v->length - a->offset) {
+                log_error("%s: accessor %d reads past its buffer view", job->path, i);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// The gltf view as a packed view for the given target, each one is uploaded once
+static int _packed_view(gltf_job_t* job, int view, unsigned int target)
+{
+    gltf_view_t* v    = &job->views[view];
+    int*         slot = target == GL_ELEMENT_ARRAY_BUFFER ? &v->element_view : &v->array_view;
+    if (*slot >= 0) return *slot;
+
+    packed_model_t* packed = job->packed;
+    if (packed->view_count == job->view_capacity) {
+        int            capacity = job->view_capacity ? job->view_capacity * 2 : 16;
+        packed_view_t* views    = realloc(packed->views, (size_t)capacity * sizeof(packed_view_t));
+        if (!views) return -1;
+
+        packed->views      = views;
+        job->view_capacity = capacity;
+    }
+
+    packed->views[packed->view_count] = (packed_view_t) {
+        .target = target,
+        .data   = job->buffers[v->buffer].data + v->offset,
+        .bytes  = v->length,
+    };
+    *slot = packed->view_count++;
+    return *slot;
+}
+
+static bool _attrib(gltf_job_t* job, int accessor, int min_components, int max_components, packed_attrib_t* out)
+{
+    out->view = -1;
+    if (accessor < 0) return true;
+
+    const gltf_accessor_t* a = &job->accessors[accessor];
+    if (a->view < 0 || a->sparse || a->components < min_components || a->components > max_components
+        || a->type == GL_UNSIGNED_INT)
+    {
+        return false;
+    }
+
+    int view = _packed_view(job, a->view, GL_ARRAY_BUFFER);
+    if (view < 0) return false;
+
+    *out = (packed_attrib_t) {
+        .view       = view,
+        .offset     = a->offset,
+        .stride     = job->views[a->view].stride,
+        .type       = a->type,
+        .size       = a->components,
+        .normalized = a->normalized,
+    };
+    return true;
+}
+
+static void _grow_bounds(gltf_job_t* job, const gltf_accessor_t* a, mat4 world)
+{
+    if (!a->has_bounds) return;
+
+    // Quantized positions without normalization are stored as integers, the bounds are in the same space
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 p = {
+            corner & 1 ? a->max[0] : a->min[0],
+            corner & 2 ? a->max[1] : a->min[1],
+            corner & 4 ? a->max[2] : a->min[2],
+        };
+        glm_mat4_mulv3(world, p, 1.0f, p);
+
+        if (!job->has_bounds) {
+            glm_vec3_copy(p, job->min);
+            glm_vec3_copy(p, job->max);
+            job->has_bounds = true;
+        } else {
+            glm_vec3_minv(job->min, p, job->min);
+            glm_vec3_maxv(job->max, p, job->max);
+        }
+    }
+}
+
+static bool _add_primitive(gltf_job_t* job, int primitive, mat4 world)
+{
+    const json_t*   json   = &job->json;
+    packed_model_t* packed = job->packed;
+
+    int attributes = json_find(json, primitive, "attributes");
+    int position   = json_int(json, json_find(json, attributes, "POSITION"), -1);
+    int normal     = json_int(json, json_find(json, attributes, "NORMAL"), -1);
+    int texcrd     = json_int(json, json_find(json, attributes, "TEXCOORD_0"), -1);
+    int indices    = json_int(json, json_find(json, primitive, "indices"), -1);
+    int mode       = json_int(json, json_find(json, primitive, "mode"), GL_TRIANGLES);
+
+    if (position < 0 || position >= job->accessor_count || normal >= job->accessor_count
+        || texcrd >= job->accessor_count || indices >= job->accessor_count || mode < 0 || mode > GL_TRIANGLE_FAN)
+    {
+        job->skipped++;
+        return true;
+    }
+
+    if (packed->draw_count == job->draw_capacity) {
+        int            capacity = job->draw_capacity ? job->draw_capacity * 2 : 16;
+        packed_draw_t* draws    = realloc(packed->draws, (size_t)capacity * sizeof(packed_draw_t));
+        if (!draws) return false;
+
+        packed->draws      = draws;
+        job->draw_capacity = capacity;
+    }
+
+    packed_draw_t* d = &packed->draws[packed->draw_count];
+    memset(d, 0, sizeof(*d));
+
+    // Attributes that can't be drawn as stored (sparse, 32 bit integers) skip the primitive,
+    // decoding them would mean the copy this importer exists to avoid
+    if (!_attrib(job, position, 3, 3, &d->position) || !_attrib(job, normal, 3, 3, &d->normal)
+        || !_attrib(job, texcrd, 2, 2, &d->texcrd))
+    {
+        job->skipped++;
+        return true;
+    }
+
+    const gltf_accessor_t* p = &job->accessors[position];
+    d->vertex_count          = p->count;
+    d->mode                  = (unsigned int)mode;
+    d->index_view            = -1;
+    d->count                 = p->count;
+
+    if (indices >= 0) {
+        const gltf_accessor_t* a = &job->accessors[indices];
+        if (a->view < 0 || a->sparse || a->components != 1 || job->views[a->view].stride != 0
+            || (a->type != GL_UNSIGNED_BYTE && a->type != GL_UNSIGNED_SHORT && a->type != GL_UNSIGNED_INT))
+        {
+            job->skipped++;
+            return true;
+        }
+
+        d->index_view   = _packed_view(job, a->view, GL_ELEMENT_ARRAY_BUFFER);
+        d->index_offset = a->offset;
+        d->index_type   = a->type;
+        d->count        = a->count;
+        if (d->index_view < 0) return false;
+    }
+
+    glm_mat4_copy(world, d->transform);
+    _grow_bounds(job, p, world);
+
+    packed->vertex_count += d->vertex_count * 3;
+    packed->indice_count += indices >= 0 ? d->count : 0;
+    packed->normal_count += d->normal.view >= 0 ? d->vertex_count * 3 : 0;
+    packed->texcrd_count += d->texcrd.view >= 0 ? d->vertex_count * 2 : 0;
+    packed->draw_count++;
+    return true;
+}
+
+static bool _add_mesh(gltf_job_t* job, int mesh, mat4 world)
+{
+    const json_t* json       = &job->json;
+    int           token      = _element(json, job->meshes, mesh);
+    int           primitives = json_find(json, token, "primitives");
+
+    if (token < 0) {
+        job->skipped++;
+        return true;
+    }
+
+    for (int i = 0, t = json_first(json, primitives); i < json_count(json, primitives); i++, t = json_next(json, t)) {
+        if (!_add_primitive(job, t, world)) return false;
+    }
+    return true;
+}
+
+static void _node_matrix(const json_t* json, int node, mat4 local)
+{
+    int matrix = json_find(json, node, "matrix");
+    if (json_count(json, matrix) == 16) {
+        float* m = (float*)local;
+        for (int i = 0, t = json_first(json, matrix); i < 16; i++, t = json_next(json, t)) {
+            m[i] = (float)json_number(json, t, i % 5 == 0 ? 1.0 : 0.0);
+        }
+        return;
+    }
+
+    vec3   translation = { 0.0f, 0.0f, 0.0f };
+    versor rotation    = { 0.0f, 0.0f, 0.0f, 1.0f };
+    vec3   scale       = { 1.0f, 1.0f, 1.0f };
+
+    int t = json_find(json, node, "translation");
+    int r = json_find(json, node, "rotation");
+    int s = json_find(json, node, "scale");
+
+    if (json_count(json, t) == 3) {
+        for (int i = 0, e = json_first(json, t); i < 3; i++, e = json_next(json, e)) {
+            translation[i] = (float)json_number(json, e, 0.0);
+        }
+    }
+    if (json_count(json, r) == 4) {
+        for (int i = 0, e = json_first(json, r); i < 4; i++, e = json_next(json, e)) {
+            rotation[i] = (float)json_number(json, e, i == 3 ? 1.0 : 0.0);
+        }
+    }
+    if (json_count(json, s) == 3) {
+        for (int i = 0, e = json_first(json, s); i < 3; i++, e = json_next(json, e)) {
+            scale[i] = (float)json_number(json, e, 1.0);
+        }
+    }
+
+    // T * R * S, like the spec
+    glm_translate_make(local, translation);
+    glm_quat_rotate(local, rotation, local);
+    glm_scale(local, scale);
+}
+
+static bool _visit_node(gltf_job_t* job, int node, mat4 parent, int depth)
+{
+    const json_t* json  = &job->json;
+    int           token = _element(json, job->nodes, node);
+
+    if (token < 0 || depth > GLTF_MAX_NODE_DEPTH) {
+        log_warn("%s: skipping node %d, it is missing or nested too deep", job->path, node);
+        return true;
+    }
+
+    mat4 local, world;
+    _node_matrix(json, token, local);
+    glm_mat4_mul(parent, local, world);
+
+    int mesh = json_int(json, json_find(json, token, "mesh"), -1);
+    if (mesh >= 0 && !_add_mesh(job, mesh, world)) return false;
+
+    int children = json_find(json, token, "children");
+    for (int i = 0, t = json_first(json, children); i < json_count(json, children); i++, t = json_next(json, t)) {
+        if (!_visit_node(job, json_int(json, t, -1), world, depth + 1)) return false;
+    }
+    return true;
+}
+
+static bool _check_extensions(gltf_job_t* job)
+{
+    // Everything optional only affects materials, which are not drawn yet
+    static const char* supported[] = { "KHR_mesh_quantization", "KHR_texture_transform", "KHR_materials_" };
+
+    const json_t* json     = &job->json;
+    int           required = json_find(json, 0, "extensionsRequired");
+
+    for (int i = 0, t = json_first(json, required); i < json_count(json, required); i++, t = json_next(json, t)) {
+        char name[128];
+        if (!json_string(json, t, name, sizeof(name))) continue;
+
+        bool known = false;
+        for (size_t s = 0; s < sizeof(supported) / sizeof(supported[0]); s++) {
+            known |= strncmp(name, supported[s], strlen(supported[s])) == 0;
+        }
+
+        if (!known) {
+            log_error("%s requires the unsupported extension %s", job->path, name);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_gltf(packed_model_t* packed, const char* fp, load_progress_t* progress)
+{
+    double start = timer_now();
+    bool   ok    = false;
+
+    memset(packed, 0, sizeof(*packed));
+
+    gltf_job_t job = { .path = fp, .packed = packed };
+
+    file_map_t map;
+    if (!file_map(fp, &map)) {
+        log_fatal("Failed to open glTF file to parse %s", fp);
+        return false;
+    }
+
+    if (progress) atomic_store(&progress->bytes_total, map.size);
+    size_t file_size = map.size;
+
+    const char* text      = map.data;
+    size_t      text_size = map.size;
+    const char* bin       = NULL;
+    size_t      bin_size  = 0;
+
+    if (map.size >= 12 && _read_u32(map.data) == GLTF_MAGIC) {
+        size_t length = _read_u32(map.data + 8);
+        if (_read_u32(map.data + 4) != 2 || length > map.size || length < 20
+            || _read_u32(map.data + 16) != GLTF_CHUNK_JSON)
+        {
+            log_error("%s is not a valid glTF 2.0 binary", fp);
+            goto cleanup;
+        }
+
+        text      = map.data + 20;
+        text_size = _read_u32(map.data + 12);
+        if (text_size > length - 20) {
+            log_error("%s: the JSON chunk is truncated", fp);
+            goto cleanup;
+        }
+
+        size_t next = 20 + ((text_size + 3) & ~(size_t)3);
+        if (next + 8 <= length && _read_u32(map.data + next + 4) == GLTF_CHUNK_BIN) {
+            bin      = map.data + next + 8;
+            bin_size = _read_u32(map.data + next);
+            if (bin_size > length - next - 8) {
+                log_error("%s: the binary chunk is truncated", fp);
+                goto cleanup;
+            }
+        }
+    }
+
+    if (!json_parse(&job.json, text, text_size) || job.json.tokens[0].type != JSON_OBJECT) {
+        log_error("%s: invalid JSON", fp);
+        goto cleanup;
+    }
+
+    if (!_check_extensions(&job)) goto cleanup;
+
+    if (!_load_buffers(&job, bin, bin_size) || !_load_views(&job) || !_load_accessors(&job)) {
+        goto cleanup;
+    }
+
+    // The main mapping goes last so the external buffers keep their indices
+    packed->maps[packed->map_count++] = map;
+    map.data                          = NULL;
+
+    job.meshes = json_find(&job.json, 0, "meshes");
+    job.nodes  = json_find(&job.json, 0, "nodes");
+
+    mat4 identity;
+    glm_mat4_identity(identity);
+
+    int scenes = json_find(&job.json, 0, "scenes");
+    int scene  = _element(&job.json, scenes, json_int(&job.json, json_find(&job.json, 0, "scene"), 0));
+
+    if (scene >= 0) {
+        int roots = json_find(&job.json, scene, "nodes");
+        for (int i = 0, t = json_first(&job.json, roots); i < json_count(&job.json, roots);
+             i++, t = json_next(&job.json, t))
+        {
+            if (!_visit_node(&job, json_int(&job.json, t, -1), identity, 0)) goto cleanup;
+        }
+    } else {
+        // Without a scene every mesh is shown once where it was modelled
+        for (int i = 0; i < json_count(&job.json, job.meshes); i++) {
+            if (!_add_mesh(&job, i, identity)) goto cleanup;
+        }
+    }
+
+    if (packed->draw_count == 0) {
+        log_error("%s has no primitives that can be drawn", fp);
+        goto cleanup;
+    }
+
+    if (job.skipped > 0) log_warn("%s: skipped %d primitives that can't be drawn as stored", fp, job.skipped);
+    if (!job.has_bounds) log_warn("%s: positions have no bounds, the model may be placed wrong", fp);
+
+    // Positions are drawn as stored, only re-centred through the decode offset
+    packed->format = VERTEX_FORMAT_F32;
+    for (int c = 0; c < 3; c++) {
+        packed->min_vertex[c]    = job.has_bounds ? job.min[c] : -1.0f;
+        packed->max_vertex[c]    = job.has_bounds ? job.max[c] : 1.0f;
+        packed->decode_scale[c]  = 1.0f;
+        packed->decode_offset[c] = -(packed->min_vertex[c] + packed->max_vertex[c]) * 0.5f;
+    }
+
+    size_t bytes = 0;
+    for (int i = 0; i < packed->view_count; i++) bytes += packed->views[i].bytes;
+
+    progress_add(progress, file_size);
+    log_info("Imported glTF %s in %.1fms [draws: %d;  buffers: %d;  %.2fMB used as stored]", fp,
+             (timer_now() - start) * 1000.0, packed->draw_count, packed->view_count, bytes / (1024.0 * 1024.0));
+    ok = true;
+
+cleanup:
+    if (map.data) file_unmap(&map);
+    if (!ok) packed_model_free(packed);
+
+    json_free(&job.json);
+    free(job.buffers);
+    free(job.views);
+    free(job.accessors);
+    return ok;
+}
@@ -0,0 +1,283 @@
+#include "parsers/json.h"
+
+#include "parsers/scan.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct {
+    json_t*     json;
+    const char* p;
+    const char* end;
+} _json_reader_t;
+
+static inline void _skip_space(_json_reader_t* r)
+{
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r')) r->p++;
+}
+
+static int _push(_json_reader_t* r, json_type_t type, const char* start, const char* end)
+{
+    json_t* json = r->json;
+
+    if (json->count == json->capacity) {
+        int           capacity = json->capacity ? json->capacity * 2 : 256;
+        json_token_t* tokens   = realloc(json->tokens, (size_t)capacity * sizeof(json_token_t));
+        if (!tokens) return -1;
+
+        json->tokens   = tokens;
+        json->capacity = capacity;
+    }
+
+    json->tokens[json->count] = (json_token_t) {
+        .type  = type,
+        .start = (size_t)(start - json->text),
+        .end   = (size_t)(end - json->text),
+    };
+    return json->count++;
+}
+
+static bool _read_string(_json_reader_t* r, int* token)
+{
+    const char* start = ++r->p;
+    while (r->p < r->end && *r->p != '"') {
+        if (*r->p == '\\') r->p++;
+        r->p++;
+    }
+    if (r->p >= r->end) return false;
+
+    *token = _push(r, JSON_STRING, start, r->p);
+    r->p++;
+    return *token >= 0;
+}
+
+static bool _read_value(_json_reader_t* r, int depth)
+{
+    _skip_space(r);
+    if (r->p >= r->end || depth > JSON_MAX_DEPTH) return false;
+
+    int  token = -1;
+    char c     = *r->p;
+
+    if (c == '{' || c == '[') {
+        token = _push(r, c == '{' ? JSON_OBJECT : JSON_ARRAY, r->p, r->p);
+        if (token < 0) return false;
+
+        char close    = c == '{' ? '}' : ']';
+        int  children = 0;
+        r->p++;
+
+        _skip_space(r);
+        if (r->p < r->end && *r->p == close) {
+            r->p++;
+        } else {
+            for (;;) {
+                if (c == '{') {
+                    int key;
+                    _skip_space(r);
+                    if (r->p >= r->end || *r->p != '"' || !_read_string(r, &key)) return false;
+                    r->json->tokens[key].next = key + 1;
+
+                    _skip_space(r);
+                    if (r->p >= r->end || *r->p != ':') return false;
+                    r->p++;
+                }
+
+                if (!_read_value(r, depth + 1)) return false;
+                children++;
+
+                _skip_space(r);
+                if (r->p < r->end && *r->p == ',') {
+                    r->p++;
+                } else if (r->p < r->end && *r->p == close) {
+                    r->p++;
+                    break;
+                } else {
+                    return false;
+                }
+            }
+        }
+
+        r->json->tokens[token].children = children;
+        r->json->tokens[token].end      = (size_t)(r->p - r->json->text);
+    } else if (c == '"') {
+        if (!_read_string(r, &token)) return false;
+    } else if (c == 't' && r->end - r->p >= 4 && memcmp(r->p, "true", 4) == 0) {
+        token = _push(r, JSON_TRUE, r->p, r->p + 4);
+        r->p += 4;
+    } else if (c == 'f' && r->end - r->p >= 5 && memcmp(r->p, "false", 5) == 0) {
+        token = _push(r, JSON_FALSE, r->p, r->p + 5);
+        r->p += 5;
+    } else if (c == 'n' && r->end - r->p >= 4 && memcmp(r->p, "null", 4) == 0) {
+        token = _push(r, JSON_NULL, r->p, r->p + 4);
+        r->p += 4;
+    } else if (c == '-' || scan_is_digit(c)) {
+        const char* start = r->p;
+        while (r->p < r->end && (scan_is_digit(*r->p) || *r->p == '-' || *r->p == '+' || *r->p == '.' || *r->p == 'e'
+                                 || *r->p == 'E'))
+        {
+            r->p++;
+        }
+        token = _push(r, JSON_NUMBER, start, r->p);
+    } else {
+        return false;
+    }
+
+    if (token < 0) return false;
+    r->json->tokens[token].next = r->json->count;
+    return true;
+}
+
+bool json_parse(json_t* json, const char* text, size_t size)
+{
+    memset(json, 0, sizeof(*json));
+    json->text = text;
+
+    _json_reader_t r = { .json = json, .p = text, .end = text + size };
+
+    bool ok = _read_value(&r, 0);
+    _skip_space(&r);
+
+    // Trailing zero padding is allowed, GLB pads its JSON chunk with spaces but some writers use zeros
+    while (ok && r.p < r.end && *r.p == '\0') r.p++;
+
+    if (!ok || r.p != r.end) {
+        json_free(json);
+        return false;
+    }
+    return true;
+}
+
+void json_free(json_t* json)
+{
+    free(json->tokens);
+    memset(json, 0, sizeof(*json));
+}
+
+int json_find(const json_t* json, int object, const char* key)
+{
+    if (object < 0 || json->tokens[object].type != JSON_OBJECT) return -1;
+
+    int k = object + 1;
+    for (int i = 0; i < json->tokens[object].children; i++) {
+        if (json_is(json, k, key)) return k + 1;
+        k = json->tokens[k + 1].next;
+    }
+    return -1;
+}
+
+int json_count(const json_t* json, int token)
+{
+    if (token < 0) return 0;
+    json_type_t type = json->tokens[token].type;
+    return type == JSON_ARRAY || type == JSON_OBJECT ? json->tokens[token].children : 0;
+}
+
+int json_first(const json_t* json, int array)
+{
+    return array >= 0 && json->tokens[array].type == JSON_ARRAY && json->tokens[array].children > 0 ? array + 1 : -1;
+}
+
+// Only valid for array elements, the caller bounds the walk with json_count
+int json_next(const json_t* json, int element)
+{
+    return element >= 0 ? json->tokens[element].next : -1;
+}
+
+bool json_is(const json_t* json, int token, const char* string)
+{
+    if (token < 0 || json->tokens[token].type != JSON_STRING) return false;
+
+    const json_token_t* t   = &json->tokens[token];
+    size_t              len = strlen(string);
+    return t->end - t->start == len && memcmp(json->text + t->start, string, len) == 0;
+}
+
+double json_number(const json_t* json, int token, double fallback)
+{
+    if (token < 0 || json->tokens[token].type != JSON_NUMBER) return fallback;
+
+    const json_token_t* t = &json->tokens[token];
+    double              value;
+    if (!scan_double(json->text + t->start, json->text + t->end, &value)) return fallback;
+    return value;
+}
+
+int json_int(const json_t* json, int token, int fallback)
+{
+    double value = json_number(json, token, fallback);
+    return value >= INT32_MIN && value <= INT32_MAX ? (int)value : fallback;
+}
+
+bool json_bool(const json_t* json, int token, bool fallback)
+{
+    if (token < 0) return fallback;
+    if (json->tokens[token].type == JSON_TRUE) return true;
+    if (json->tokens[token].type == JSON_FALSE) return false;
+    return fallback;
+}
+
+static int _hex(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Unescapes a string value into out, code points beyond ascii are written as utf-8
+bool json_string(const json_t* json, int token, char* out, size_t size)
+{
+    if (token < 0 || json->tokens[token].type != JSON_STRING || size == 0) return false;
+
+    const char* p   = json->text + json->tokens[token].start;
+    const char* end = json->text + json->tokens[token].end;
+    size_t      n   = 0;
+
+    while (p < end) {
+        unsigned int c = (unsigned char)*p++;
+
+        if (c == '\\' && p < end) {
+            char e = *p++;
+            switch (e) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                c = 0;
+                for (int i = 0; i < 4; i++) {
+                    int h = p < end ? _hex(*p++) : -1;
+                    if (h < 0) return false;
+                    c = c * 16 + (unsigned int)h;
+                }
+                break;
+            default: c = (unsigned char)e; break;
+            }
+        }
+
+        char   utf8[3];
+        size_t len = 0;
+        if (c < 0x80) {
+            utf8[len++] = (char)c;
+        } else if (c < 0x800) {
+            utf8[len++] = (char)(0xc0 | c >> 6);
+            utf8[len++] = (char)(0x80 | (c & 0x3f));
+        } else {
+            utf8[len++] = (char)(0xe0 | c >> 12);
+            utf8[len++] = (char)(0x80 | (c >> 6 & 0x3f));
+            utf8[len++] = (char)(0x80 | (c & 0x3f));
+        }
+
+        if (n + len >= size) return false;
+        memcpy(out + n, utf8, len);
+        n += len;
+    }
+
+    out[n] = '\0';
+    return true;
+}
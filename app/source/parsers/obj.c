@@ -1,103 +1,1338 @@
 #include "parsers/obj.h"
 
+#include "core/preview.h"
+#include "core/weld.h"
+#include "engine/arena.h"
+#include "engine/file.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+#include "parsers/scan.h"
+
 #include "log.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void parse_obj(model_t* m, const char* fp)
+#define OBJ_CHUNK_SIZE (4 << 20)
+#define OBJ_CHUNKS_PER_THREAD 4
+#define OBJ_MAX_WARNINGS 8
+#define OBJ_PROGRESS_STEP (1 << 20)
+#define OBJ_POLYGON_STACK 64
+#define OBJ_PREVIEW_CHUNK_SIZE (16 << 20) // with a preview the first chunk shows after this much
+// Positions closer than this are welded into one vertex, 0 only merges exact duplicates
+#define OBJ_WELD_EPSILON 0.0
+
+enum { OBJ_WARN_VERTEX, OBJ_WARN_NORMAL, OBJ_WARN_TEXCRD, OBJ_WARN_FACE_FORMAT, OBJ_WARN_FACE_INDEX };
+
+// Set for corner values that are chunk relative because they came from a negative index
+enum { OBJ_REL_VERTEX = 1, OBJ_REL_TEXCRD = 2, OBJ_REL_NORMAL = 4 };
+
+typedef struct {
+    long line;
+    int  kind;
+} obj_warning_t;
+
+typedef struct {
+    unsigned int v;
+    unsigned int t; // WELD_NONE if absent
+    unsigned int n; // WELD_NONE if absent
+    int          relative;
+} obj_corner_t;
+
+typedef struct {
+    int slot;    // first index of the fan
+    int corners;
+} obj_polygon_t;
+
+typedef struct {
+    const char* begin;
+    const char* end;
+
+    double*       vertices;
+    unsigned int* indices;
+    int           vertex_count;
+    int           vertex_capacity;
+    int           indice_count;
+    int           indice_capacity;
+    float*        normals;
+    float*        texcrds;
+    unsigned int* attribs; // texcoord and normal per index, allocated by the first face that has either
+    int           normal_count;
+    int           normal_capacity;
+    int           texcrd_count;
+    int           texcrd_capacity;
+    int           attrib_capacity;
+
+    // Slots in indices/attribs holding chunk relative values, the merge adds the chunk base
+    int* rel_indices;
+    int* rel_attribs;
+    int  rel_indice_count;
+    int  rel_indice_capacity;
+    int  rel_attrib_count;
+    int  rel_attrib_capacity;
+
+    // Faces with more than three corners, fanned while parsing and re-checked for concavity after the merge
+    obj_polygon_t* polygons;
+    int            polygon_count;
+    int            polygon_capacity;
+
+    long      line_count;
+    long long max_excess;   // max face index minus vertices seen so far in the chunk
+    long long min_relative; // lowest chunk relative vertex a negative index resolved to
+    long      face_count;
+    long      skipped_count;
+    long      concave_count;
+    int       failed;
+    int       cancelled;
+
+    obj_warning_t warnings[OBJ_MAX_WARNINGS];
+    int           warning_count;
+} obj_chunk_t;
+
+typedef struct {
+    obj_chunk_t* chunks;
+    int          chunk_count;
+    atomic_int   next_chunk;
+
+    // Resolved after the optimistic pass, used by the strict re-parse
+    int*     vertex_bases;
+    model_t* model;
+    int*     indice_offsets;
+
+    // Merged attribute pools, indexed by the face corners until the weld
+    int*          normal_bases;
+    int*          texcrd_bases;
+    float*        normals;
+    float*        texcrds;
+    unsigned int* attribs;
+
+    // Pass 1 publishes a sampled preview of every chunk once the chunks before it are parsed too,
+    // their vertex bases are known then and faces into earlier chunks resolve
+    load_preview_t* preview;
+    atomic_bool*    parsed;
+    pthread_mutex_t preview_lock;
+    int             preview_next;  // first chunk not published yet
+    int*            preview_bases; // first vertex of every published chunk
+    double          preview_origin[3];
+    bool            preview_stopped; // a chunk failed, its counts can't place the ones after it
+    size_t          file_size;
+
+    load_progress_t* progress;
+} obj_job_t;
+
+// Scans a signed face index, magnitudes beyond the int range are clamped so they fail validation
+static const char* _scan_index(const char* p, const char* end, long long* out)
 {
-    FILE* file = fopen(fp, "r");
-    if (!file) {
-        log_fatal("Failed to open .obj file to parse %s", fp);
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
     }
 
-    int  face_format = -1;
-    char line[96];
-    long line_num = 1;
+    if (p >= end || !scan_is_digit(*p)) return NULL;
 
-    while (fgets(line, sizeof(line), file)) {
-        // Check buffer limits
-        if (m->vertex_count >= MAX_VERTICES * 3 || m->indice_count >= MAX_INDICES) {
-            log_error("Buffer limits exceeded at line %ld", line_num);
-            break;
+    long long value = 0;
+    while (p < end && scan_is_digit(*p)) {
+        if (value <= INT_MAX) value = value * 10 + (*p - '0');
+        p++;
+    }
+
+    *out = neg ? -value : value;
+    return p;
+}
+
+// One "v", "v/vt", "v//vn" or "v/vt/vn" corner, absent attributes are returned as 0
+static const char* _scan_corner(const char* p, const char* end, long long k[3])
+{
+    k[1] = 0;
+    k[2] = 0;
+
+    if (!(p = _scan_index(p, end, &k[0]))) return NULL;
+
+    if (p < end && *p == '/') {
+        p++;
+        if (p < end && *p != '/' && !(p = _scan_index(p, end, &k[1]))) return NULL;
+        if (p < end && *p == '/' && !(p = _scan_index(p + 1, end, &k[2]))) return NULL;
+    }
+
+    return p < end && !scan_is_blank(*p) ? NULL : p;
+}
+
+static void _chunk_warn(obj_chunk_t* c, long line, int kind)
+{
+    if (c->warning_count < OBJ_MAX_WARNINGS) {
+        c->warnings[c->warning_count] = (obj_warning_t) { .line = line, .kind = kind };
+    }
+    c->warning_count++;
+}
+
+static int _chunk_reserve(void** buffer, int* capacity, int needed, size_t element_size)
+{
+    if (needed <= *capacity) return 1;
+
+    int new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < needed) new_capacity *= 2;
+
+    void* grown = realloc(*buffer, (size_t)new_capacity * element_size);
+    if (!grown) return 0;
+
+    *buffer   = grown;
+    *capacity = new_capacity;
+    return 1;
+}
+
+
+// Resolves a texcoord or normal index, out of range values are left for the weld to drop
+static unsigned int _resolve_attrib(long long k, int seen, int strict, int base, int* relative, int flag)
+{
+    if (k > 0) return (unsigned int)(k - 1);
+    if (k == 0) return WELD_NONE;
+
+    long long local = seen + k;
+    if (strict) return base + local >= 0 ? (unsigned int)(base + local) : WELD_NONE;
+
+    *relative |= flag;
+    return (unsigned int)(int)local;
+}
+
+// Resolves a corner against what the chunk has seen so far. Without a known base
+// (strict == 0) negative indices stay chunk relative and the bounds are recorded instead.
+static int _resolve_corner(obj_chunk_t* c, const long long k[3], int strict, const int bases[3], obj_corner_t* out,
+                           long long* max_excess, long long* min_relative)
+{
+    long long seen = c->vertex_count / 3;
+
+    out->relative = 0;
+
+    if (k[0] > 0) {
+        long long excess = k[0] - seen;
+        if (strict && excess > bases[0]) return 0;
+        if (excess > *max_excess) *max_excess = excess;
+        out->v = (unsigned int)(k[0] - 1);
+    } else if (k[0] < 0) {
+        long long local = seen + k[0];
+        if (strict) {
+            if (bases[0] + local < 0) return 0;
+            out->v = (unsigned int)(bases[0] + local);
+        } else {
+            if (local < *min_relative) *min_relative = local;
+            out->v = (unsigned int)(int)local;
+            out->relative |= OBJ_REL_VERTEX;
         }
+    } else {
+        return 0;
+    }
 
-        switch (line[0]) {
-        case 'v': {
-            if (line[1] == ' ') {
-                if (sscanf(line + 2, "%lf %lf %lf", &m->vertices[m->vertex_count], &m->vertices[m->vertex_count + 1],
-                           &m->vertices[m->vertex_count + 2])
-                    != 3)
-                {
-                    log_warn("Invalid vertex at line %ld", line_num);
-                    continue;
-                }
-                m->vertex_count += 3;
-            } else if (line[1] == 'n') {
-                // if (sscanf(line + 3, "%f %f %f", &m->normals[m->normal_count], &m->normals[m->normal_count + 1],
-                //            &m->normals[m->normal_count + 2])
-                //     != 3)
-                // {
-                //     log_warn("Invalid normal at line %ld", line_num);
-                //     continue;
-                // }
-                // m->normal_count += 3;
-            } else if (line[1] == 't') {
-                // if (sscanf(line + 3, "%f %f", &m->texcrds[m->texcrd_count], &m->texcrds[m->texcrd_count + 1]) != 2) {
-                //     log_warn("Invalid texcoord at line %ld", line_num);
-                //     continue;
-                // }
-                // m->texcrd_count += 2;
-            }
+    out->t = _resolve_attrib(k[1], c->texcrd_count / 2, strict, bases[1], &out->relative, OBJ_REL_TEXCRD);
+    out->n = _resolve_attrib(k[2], c->normal_count / 3, strict, bases[2], &out->relative, OBJ_REL_NORMAL);
+    return 1;
+}
+
+// The first face with a texcoord or normal switches the chunk to per index attributes
+static int _chunk_enable_attribs(obj_chunk_t* c)
+{
+    if (!_chunk_reserve((void**)&c->attribs, &c->attrib_capacity, (c->indice_capacity > 0 ? c->indice_capacity : 1) * 2,
+                        sizeof(unsigned int)))
+    {
+        return 0;
+    }
+    memset(c->attribs, 0xff, (size_t)c->indice_count * 2 * sizeof(unsigned int));
+    return 1;
+}
+
+static int _emit_triangle(obj_chunk_t* c, const obj_corner_t* a, const obj_corner_t* b, const obj_corner_t* d)
+{
+    const obj_corner_t* tri[3]   = { a, b, d };
+    int                 relative = a->relative | b->relative | d->relative;
+
+    if (!_chunk_reserve((void**)&c->indices, &c->indice_capacity, c->indice_count + 3, sizeof(unsigned int))
+        || (c->attribs
+            && !_chunk_reserve((void**)&c->attribs, &c->attrib_capacity, (c->indice_count + 3) * 2,
+                               sizeof(unsigned int)))
+        || (relative
+            && (!_chunk_reserve((void**)&c->rel_indices, &c->rel_indice_capacity, c->rel_indice_count + 3,
+                                sizeof(int))
+                || !_chunk_reserve((void**)&c->rel_attribs, &c->rel_attrib_capacity, c->rel_attrib_count + 6,
+                                   sizeof(int)))))
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        int slot = c->indice_count++;
+
+        c->indices[slot] = tri[i]->v;
+        if (tri[i]->relative & OBJ_REL_VERTEX) c->rel_indices[c->rel_indice_count++] = slot;
+
+        if (c->attribs) {
+            c->attribs[slot * 2]     = tri[i]->t;
+            c->attribs[slot * 2 + 1] = tri[i]->n;
+            if (tri[i]->relative & OBJ_REL_TEXCRD) c->rel_attribs[c->rel_attrib_count++] = slot * 2;
+            if (tri[i]->relative & OBJ_REL_NORMAL) c->rel_attribs[c->rel_attrib_count++] = slot * 2 + 1;
+        }
+    }
+    return 1;
+}
+
+// Tokenizes one face line of any size and fans it into triangles as it goes. An invalid
+// corner rolls the whole face back. Returns 0 only when out of memory.
+static int _parse_face(obj_chunk_t* c, const char* p, const char* end, long line, int strict, const int bases[3])
+{
+    int       start_indices  = c->indice_count;
+    int       start_rel_i    = c->rel_indice_count;
+    int       start_rel_a    = c->rel_attrib_count;
+    long long max_excess     = LLONG_MIN;
+    long long min_relative   = 0;
+    int       corners        = 0;
+    int       warning        = -1;
+
+    obj_corner_t first, prev, corner;
+
+    for (;;) {
+        p = scan_skip_blank(p, end);
+        if (p >= end || *p == '#') break;
+
+        long long k[3];
+        if (!(p = _scan_corner(p, end, k))) {
+            warning = OBJ_WARN_FACE_FORMAT;
             break;
         }
-        case 'f': {
-            if (face_format < 0) {
-                face_format = strchr(line, '/') ? 1 : 2;
+        if (!_resolve_corner(c, k, strict, bases, &corner, &max_excess, &min_relative)) {
+            warning = OBJ_WARN_FACE_INDEX;
+            break;
+        }
+        if ((k[1] || k[2]) && !c->attribs && !_chunk_enable_attribs(c)) return 0;
+
+        if (corners == 0) {
+            first = corner;
+        } else if (corners >= 2 && !_emit_triangle(c, &first, &prev, &corner)) {
+            return 0;
+        }
+
+        prev = corner;
+        corners++;
+    }
+
+    if (warning < 0 && corners < 3) warning = OBJ_WARN_FACE_FORMAT;
+
+    if (warning >= 0) {
+        c->indice_count     = start_indices;
+        c->rel_indice_count = start_rel_i;
+        c->rel_attrib_count = start_rel_a;
+        c->skipped_count++;
+        _chunk_warn(c, line, warning);
+        return 1;
+    }
+
+    if (corners > 3) {
+        if (!_chunk_reserve((void**)&c->polygons, &c->polygon_capacity, c->polygon_count + 1, sizeof(obj_polygon_t))) {
+            return 0;
+        }
+        c->polygons[c->polygon_count++] = (obj_polygon_t) { .slot = start_indices, .corners = corners };
+    }
+
+    if (max_excess > c->max_excess) c->max_excess = max_excess;
+    if (min_relative < c->min_relative) c->min_relative = min_relative;
+    c->face_count++;
+    return 1;
+}
+
+// Parses one newline aligned range of the file. Without known bases (strict == 0) faces
+// are validated optimistically and the chunk records what it assumed, so the merge step
+// can re-run it strictly in the rare case the guess was wrong.
+static void _parse_chunk(obj_chunk_t* c, int strict, const int bases[3], load_progress_t* progress)
+{
+    c->vertex_count     = 0;
+    c->indice_count     = 0;
+    c->normal_count     = 0;
+    c->texcrd_count     = 0;
+    c->rel_indice_count = 0;
+    c->rel_attrib_count = 0;
+    c->polygon_count    = 0;
+    c->line_count       = 0;
+    c->max_excess       = LLONG_MIN;
+    c->min_relative     = 0;
+    c->face_count       = 0;
+    c->skipped_count    = 0;
+    c->concave_count    = 0;
+    c->failed           = 0;
+    c->cancelled        = 0;
+    c->warning_count    = 0;
+
+    if (!c->vertices) {
+        // Rough guess of the vertex density to avoid most of the regrowth
+        int guess = (int)((c->end - c->begin) / 12) + 16;
+        _chunk_reserve((void**)&c->vertices, &c->vertex_capacity, guess, sizeof(double));
+        _chunk_reserve((void**)&c->indices, &c->indice_capacity, guess, sizeof(unsigned int));
+    }
+
+    const char* p        = c->begin;
+    const char* reported = c->begin;
+    while (p < c->end) {
+        // Publish progress and honour cancellation about once per megabyte
+        if (p - reported >= OBJ_PROGRESS_STEP) {
+            progress_add(progress, p - reported);
+            reported = p;
+            if (progress_cancelled(progress)) {
+                c->cancelled = 1;
+                return;
             }
+        }
 
-            unsigned int v1, v2, v3;
-            unsigned int vt1, vt2, vt3;
-            unsigned int vn1, vn2, vn3;
-            int          result;
+        const char* eol = memchr(p, '\n', c->end - p);
+        if (!eol) eol = c->end;
 
-            if (face_format == 1) {
-                result
-                    = sscanf(line + 2, "%u/%u/%u %u/%u/%u %u/%u/%u", &v1, &vt1, &vn1, &v2, &vt2, &vn2, &v3, &vt3, &vn3);
-                if (result != 9) {
-                    log_warn("Invalid face format at line %ld", line_num);
-                    continue;
-                }
+        long   line = c->line_count++;
+        size_t len  = eol - p;
+
+        if (len >= 2 && p[0] == 'v' && p[1] == ' ') {
+            if (!_chunk_reserve((void**)&c->vertices, &c->vertex_capacity, c->vertex_count + 3, sizeof(double))) {
+                c->failed = 1;
+                return;
+            }
+
+            double*     out = &c->vertices[c->vertex_count];
+            const char* q   = p + 2;
+            if ((q = scan_double(q, eol, &out[0])) && (q = scan_double(q, eol, &out[1]))
+                && (q = scan_double(q, eol, &out[2])))
+            {
+                c->vertex_count += 3;
             } else {
-                result = sscanf(line + 2, "%u %u %u", &v1, &v2, &v3);
-                if (result != 3) {
-                    log_warn("Invalid face format at line %ld", line_num);
-                    continue;
-                }
+                _chunk_warn(c, line, OBJ_WARN_VERTEX);
+            }
+        } else if (len >= 3 && p[0] == 'v' && p[1] == 'n' && scan_is_blank(p[2])) {
+            if (!_chunk_reserve((void**)&c->normals, &c->normal_capacity, c->normal_count + 3, sizeof(float))) {
+                c->failed = 1;
+                return;
             }
 
-            // Validate indices
-            if (v1 == 0 || v2 == 0 || v3 == 0 || v1 > (unsigned int)m->vertex_count / 3
-                || v2 > (unsigned int)m->vertex_count / 3 || v3 > (unsigned int)m->vertex_count / 3)
+            double      n[3];
+            const char* q = p + 3;
+            if ((q = scan_double(q, eol, &n[0])) && (q = scan_double(q, eol, &n[1])) && (q = scan_double(q, eol, &n[2])))
             {
-                log_warn("Invalid vertex index at line %ld", line_num);
-                continue;
+                for (int i = 0; i < 3; i++) c->normals[c->normal_count++] = (float)n[i];
+            } else {
+                _chunk_warn(c, line, OBJ_WARN_NORMAL);
             }
+        } else if (len >= 3 && p[0] == 'v' && p[1] == 't' && scan_is_blank(p[2])) {
+            if (!_chunk_reserve((void**)&c->texcrds, &c->texcrd_capacity, c->texcrd_count + 2, sizeof(float))) {
+                c->failed = 1;
+                return;
+            }
+
+            // An optional w component is ignored
+            double      t[2];
+            const char* q = p + 3;
+            if ((q = scan_double(q, eol, &t[0])) && (q = scan_double(q, eol, &t[1]))) {
+                c->texcrds[c->texcrd_count++] = (float)t[0];
+                c->texcrds[c->texcrd_count++] = (float)t[1];
+            } else {
+                _chunk_warn(c, line, OBJ_WARN_TEXCRD);
+            }
+        } else if (p[0] == 'f' && (len == 1 || scan_is_blank(p[1]))) {
+            if (!_parse_face(c, p + 1, eol, line, strict, bases)) {
+                c->failed = 1;
+                return;
+            }
+        }
+
+        p = eol + 1;
+    }
+
+    progress_add(progress, c->end - reported);
+}
+
+// A published vertex, the chunks before the one being published no longer change
+static const double* _preview_vertex(const obj_job_t* job, int last, long long vertex)
+{
+    int lo = 0, hi = last;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (job->preview_bases[mid] <= vertex) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return &job->chunks[lo].vertices[(vertex - job->preview_bases[lo]) * 3];
+}
+
+// Every vertex counts towards the bounds, the points and triangles are sampled down to the
+// chunk's share of the preview limits
+static preview_batch_t* _preview_chunk(obj_job_t* job, int n)
+{
+    const obj_chunk_t* c         = &job->chunks[n];
+    int                vertices  = c->vertex_count / 3;
+    int                triangles = c->indice_count / 3;
+    if (vertices == 0 && triangles == 0) return NULL;
+
+    // The first vertex of the file, floats relative to it keep far off models precise enough
+    if (job->preview_bases[n] == 0 && vertices > 0) memcpy(job->preview_origin, c->vertices, sizeof(double) * 3);
+
+    double share         = (double)(c->end - c->begin) / job->file_size;
+    int    point_step    = (int)(vertices / (PREVIEW_POINTS * share + 1.0)) + 1;
+    int    triangle_step = (int)(triangles / (PREVIEW_TRIANGLES * share + 1.0)) + 1;
+
+    preview_batch_t* b = calloc(1, sizeof(preview_batch_t));
+    if (!b) return NULL;
+    b->points    = malloc(((size_t)vertices / point_step + 1) * 3 * sizeof(float));
+    b->triangles = malloc(((size_t)triangles / triangle_step + 1) * 9 * sizeof(float));
+    if (!b->points || !b->triangles) {
+        preview_batch_free(b);
+        return NULL;
+    }
+
+    const double* origin = job->preview_origin;
+    glm_vec3_fill(b->min, INFINITY);
+    glm_vec3_fill(b->max, -INFINITY);
+    for (int v = 0; v < vertices; v++) {
+        float p[3];
+        for (int k = 0; k < 3; k++) p[k] = (float)(c->vertices[v * 3 + k] - origin[k]);
+        glm_vec3_minv(b->min, p, b->min);
+        glm_vec3_maxv(b->max, p, b->max);
+        if (v % point_step == 0) memcpy(&b->points[b->point_count++ * 3], p, sizeof(p));
+    }
+
+    // Negative indices are chunk relative, their slots are listed in order
+    long long base = job->preview_bases[n], end = job->preview_bases[n + 1];
+    int       rel  = 0;
+    for (int t = 0; t < triangles; t += triangle_step) {
+        float* out = &b->triangles[b->triangle_count * 9];
+        int    k   = 0;
+        for (; k < 3; k++) {
+            int slot = t * 3 + k;
+            while (rel < c->rel_indice_count && c->rel_indices[rel] < slot) rel++;
+
+            long long vertex = c->indices[slot];
+            if (rel < c->rel_indice_count && c->rel_indices[rel] == slot) vertex = base + (int)c->indices[slot];
 
-            m->indices[m->indice_count++] = v1 - 1;
-            m->indices[m->indice_count++] = v2 - 1;
-            m->indices[m->indice_count++] = v3 - 1;
+            // Forward references wait for the full parse
+            if (vertex < 0 || vertex >= end) break;
+
+            const double* p = _preview_vertex(job, n, vertex);
+            for (int i = 0; i < 3; i++) out[k * 3 + i] = (float)(p[i] - origin[i]);
+        }
+        if (k == 3) b->triangle_count++;
+    }
+    return b;
+}
+
+static void _preview_publish(obj_job_t* job, int i)
+{
+    atomic_store(&job->parsed[i], true);
+
+    // Whoever holds the lock publishes every chunk that became ready in file order
+    pthread_mutex_lock(&job->preview_lock);
+    while (!job->preview_stopped && job->preview_next < job->chunk_count
+           && atomic_load(&job->parsed[job->preview_next]))
+    {
+        int                n = job->preview_next++;
+        const obj_chunk_t* c = &job->chunks[n];
+        if (c->failed || c->cancelled) {
+            job->preview_stopped = true;
             break;
         }
+
+        job->preview_bases[n + 1] = job->preview_bases[n] + c->vertex_count / 3;
+        preview_batch_t* batch    = _preview_chunk(job, n);
+        if (batch) preview_publish(job->preview, batch);
+    }
+    pthread_mutex_unlock(&job->preview_lock);
+}
+
+static void _parse_task(void* userdata, int index)
+{
+    (void)index;
+    obj_job_t* job = userdata;
+
+    static const int no_bases[3] = { 0, 0, 0 };
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        _parse_chunk(&job->chunks[i], 0, no_bases, job->progress);
+        if (job->preview) _preview_publish(job, i);
+    }
+}
+
+static int _needs_reparse(const obj_chunk_t* c, int vertex_base)
+{
+    return c->max_excess > vertex_base || vertex_base + c->min_relative < 0;
+}
+
+static void _reparse_task(void* userdata, int index)
+{
+    (void)index;
+    obj_job_t* job = userdata;
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        obj_chunk_t* c = &job->chunks[i];
+
+        if (_needs_reparse(c, job->vertex_bases[i])) {
+            int bases[3] = { job->vertex_bases[i], job->texcrd_bases[i] / 2, job->normal_bases[i] / 3 };
+            _parse_chunk(c, 1, bases, NULL);
+        }
+    }
+}
+
+static void _copy_task(void* userdata, int index)
+{
+    (void)index;
+    obj_job_t* job = userdata;
+    model_t*   m   = job->model;
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        obj_chunk_t* c      = &job->chunks[i];
+        int          offset = job->indice_offsets[i];
+
+        if (c->vertex_count > 0) {
+            memcpy(&m->vertices[(size_t)job->vertex_bases[i] * 3], c->vertices, c->vertex_count * sizeof(double));
+        }
+        if (c->indice_count > 0) {
+            memcpy(&m->indices[offset], c->indices, c->indice_count * sizeof(unsigned int));
+        }
+        for (int r = 0; r < c->rel_indice_count; r++) {
+            unsigned int* index = &m->indices[offset + c->rel_indices[r]];
+            *index              = (unsigned int)(job->vertex_bases[i] + (int)*index);
+        }
+        if (c->normal_count > 0) {
+            memcpy(&job->normals[job->normal_bases[i]], c->normals, c->normal_count * sizeof(float));
+        }
+        if (c->texcrd_count > 0) {
+            memcpy(&job->texcrds[job->texcrd_bases[i]], c->texcrds, c->texcrd_count * sizeof(float));
+        }
+
+        if (job->attribs && c->indice_count > 0) {
+            unsigned int* dst = &job->attribs[(size_t)offset * 2];
+            if (c->attribs) {
+                memcpy(dst, c->attribs, (size_t)c->indice_count * 2 * sizeof(unsigned int));
+
+                // Even slots are texcoords, odd ones normals
+                for (int r = 0; r < c->rel_attrib_count; r++) {
+                    int       slot   = c->rel_attribs[r];
+                    long long base   = slot & 1 ? job->normal_bases[i] / 3 : job->texcrd_bases[i] / 2;
+                    long long global = base + (int)dst[slot];
+                    dst[slot]        = global >= 0 ? (unsigned int)global : WELD_NONE;
+                }
+            } else {
+                memset(dst, 0xff, (size_t)c->indice_count * 2 * sizeof(unsigned int));
+            }
+        }
+
+        // Release chunk storage as soon as it is merged to keep the peak down
+        free(c->vertices);
+        free(c->indices);
+        free(c->normals);
+        free(c->texcrds);
+        free(c->attribs);
+        free(c->rel_indices);
+        free(c->rel_attribs);
+        c->vertices    = NULL;
+        c->indices     = NULL;
+        c->normals     = NULL;
+        c->texcrds     = NULL;
+        c->attribs     = NULL;
+        c->rel_indices = NULL;
+        c->rel_attribs = NULL;
+    }
+}
+
+static inline double _cross2(const double* a, const double* b, const double* c)
+{
+    return (b[0] - a[0]) * (c[1] - b[1]) - (b[1] - a[1]) * (c[0] - b[0]);
+}
+
+static inline int _inside2(const double* p, const double* a, const double* b, const double* c)
+{
+    return _cross2(a, b, p) >= 0.0 && _cross2(b, c, p) >= 0.0 && _cross2(c, a, p) >= 0.0;
+}
+
+// Rewrites a fanned polygon with ear clipping if it turns out to be concave. Both give
+// corners - 2 triangles, so the polygon keeps its slots. Returns 1 if it was concave.
+static int _triangulate_polygon(const obj_job_t* job, int slot, int n)
+{
+    const model_t* m       = job->model;
+    unsigned int*  indices = m->indices;
+    unsigned int*  attribs = job->attribs;
+
+    unsigned int stack_corners[OBJ_POLYGON_STACK * 3];
+    double       stack_points[OBJ_POLYGON_STACK * 2];
+    int          stack_ring[OBJ_POLYGON_STACK];
+
+    unsigned int* corners = stack_corners;
+    double*       points  = stack_points;
+    int*          ring    = stack_ring;
+    int           concave = 0;
+
+    if (n > OBJ_POLYGON_STACK) {
+        corners = malloc((size_t)n * 3 * sizeof(unsigned int));
+        points  = malloc((size_t)n * 2 * sizeof(double));
+        ring    = malloc((size_t)n * sizeof(int));
+        if (!corners || !points || !ring) goto cleanup;
+    }
+
+    // Corners come back out of the fan (0 1 2) (0 2 3) (0 3 4) ...
+    for (int k = 0; k < n; k++) {
+        int s              = k < 2 ? slot + k : slot + 3 * (k - 2) + 2;
+        corners[k * 3]     = indices[s];
+        corners[k * 3 + 1] = attribs ? attribs[(size_t)s * 2] : WELD_NONE;
+        corners[k * 3 + 2] = attribs ? attribs[(size_t)s * 2 + 1] : WELD_NONE;
+    }
+
+    // Newell normal, the polygon is projected on the plane of its dominant axis
+    double normal[3] = { 0.0, 0.0, 0.0 };
+    for (int k = 0; k < n; k++) {
+        const double* a = &m->vertices[(size_t)corners[k * 3] * 3];
+        const double* b = &m->vertices[(size_t)corners[(k + 1) % n * 3] * 3];
+        normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+        normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+        normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
+    }
+
+    int axis = 0;
+    if (fabs(normal[1]) > fabs(normal[axis])) axis = 1;
+    if (fabs(normal[2]) > fabs(normal[axis])) axis = 2;
+    if (normal[axis] == 0.0) goto cleanup;
+
+    // Keep the projection counter clockwise
+    int    u    = (axis + 1) % 3;
+    int    v    = (axis + 2) % 3;
+    double flip = normal[axis] > 0.0 ? 1.0 : -1.0;
+
+    for (int k = 0; k < n; k++) {
+        const double* p   = &m->vertices[(size_t)corners[k * 3] * 3];
+        points[k * 2]     = p[u];
+        points[k * 2 + 1] = p[v] * flip;
+    }
+
+    for (int k = 0; k < n && !concave; k++) {
+        concave = _cross2(&points[(k + n - 1) % n * 2], &points[k * 2], &points[(k + 1) % n * 2]) < 0.0;
+    }
+    if (!concave) goto cleanup;
+
+    for (int k = 0; k < n; k++) ring[k] = k;
+
+    int count = n;
+    int emit  = 0;
+    int i     = 0;
+    int stuck = 0;
+
+    while (count > 3) {
+        int a = ring[(i + count - 1) % count];
+        int b = ring[i];
+        int c = ring[(i + 1) % count];
+
+        int ear = stuck >= count || _cross2(&points[a * 2], &points[b * 2], &points[c * 2]) > 0.0;
+        for (int k = 0; ear && stuck < count && k < count; k++) {
+            int o = ring[k];
+            if (o != a && o != b && o != c && _inside2(&points[o * 2], &points[a * 2], &points[b * 2], &points[c * 2])) {
+                ear = 0;
+            }
+        }
+
+        if (!ear) {
+            // Degenerate input may have no ear left, stuck >= count then clips whatever comes next
+            i = (i + 1) % count;
+            stuck++;
+            continue;
+        }
+
+        int tri[3] = { a, b, c };
+        for (int t = 0; t < 3; t++) {
+            int s      = slot + emit++;
+            indices[s] = corners[tri[t] * 3];
+            if (attribs) {
+                attribs[(size_t)s * 2]     = corners[tri[t] * 3 + 1];
+                attribs[(size_t)s * 2 + 1] = corners[tri[t] * 3 + 2];
+            }
+        }
+
+        memmove(&ring[i], &ring[i + 1], (count - i - 1) * sizeof(int));
+        count--;
+        if (i >= count) i = 0;
+        stuck = 0;
+    }
+
+    for (int t = 0; t < 3; t++) {
+        int s      = slot + emit++;
+        indices[s] = corners[ring[t] * 3];
+        if (attribs) {
+            attribs[(size_t)s * 2]     = corners[ring[t] * 3 + 1];
+            attribs[(size_t)s * 2 + 1] = corners[ring[t] * 3 + 2];
+        }
+    }
+
+cleanup:
+    if (corners != stack_corners) {
+        free(corners);
+        free(points);
+        free(ring);
+    }
+    return concave;
+}
+
+static void _triangulate_task(void* userdata, int index)
+{
+    (void)index;
+    obj_job_t* job = userdata;
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        obj_chunk_t* c = &job->chunks[i];
+
+        for (int k = 0; k < c->polygon_count; k++) {
+            const obj_polygon_t* poly = &c->polygons[k];
+            c->concave_count += _triangulate_polygon(job, job->indice_offsets[i] + poly->slot, poly->corners);
         }
-        line_num++;
+
+        free(c->polygons);
+        c->polygons = NULL;
+    }
+}
+
+static const char* _warning_text(int kind)
+{
+    switch (kind) {
+    case OBJ_WARN_VERTEX:
+        return "Invalid vertex";
+    case OBJ_WARN_NORMAL:
+        return "Invalid vertex normal";
+    case OBJ_WARN_TEXCRD:
+        return "Invalid texture coordinate";
+    case OBJ_WARN_FACE_FORMAT:
+        return "Invalid face format";
+    default:
+        return "Invalid vertex index";
+    }
+}
+
+// Splits the mapping into chunks that start right after a newline
+static int _split_chunks(const char* data, size_t size, int chunk_count, obj_chunk_t* chunks)
+{
+    size_t target = size / chunk_count;
+    int    count  = 0;
+
+    const char* begin = data;
+    const char* end   = data + size;
+
+    while (begin < end && count < chunk_count) {
+        const char* cut = begin + target;
+        if (count == chunk_count - 1 || cut >= end) {
+            cut = end;
+        } else {
+            const char* nl = memchr(cut, '\n', end - cut);
+            cut            = nl ? nl + 1 : end;
+        }
+
+        chunks[count++] = (obj_chunk_t) { .begin = begin, .end = cut };
+        begin           = cut;
+    }
+
+    return count;
+}
+
+bool parse_obj(model_t* m, const char* fp, load_progress_t* progress)
+{
+    double start = timer_now();
+    bool   ok    = false;
+
+    file_map_t map;
+    if (!file_map(fp, &map)) {
+        log_fatal("Failed to open .obj file to parse %s", fp);
+        return false;
+    }
+
+    if (progress) atomic_store(&progress->bytes_total, map.size);
+
+    int threads     = thread_count();
+    int chunk_count = (int)(map.size / OBJ_CHUNK_SIZE) + 1;
+    if (chunk_count > threads * OBJ_CHUNKS_PER_THREAD) chunk_count = threads * OBJ_CHUNKS_PER_THREAD;
+
+    // Smaller chunks for a preview, the first one shows as soon as it is parsed
+    bool preview = progress && progress->preview && map.size >= PREVIEW_MIN_FILE_SIZE;
+    if (preview && chunk_count < (int)(map.size / OBJ_PREVIEW_CHUNK_SIZE)) {
+        chunk_count = (int)(map.size / OBJ_PREVIEW_CHUNK_SIZE);
+    }
+    if (threads > chunk_count) threads = chunk_count;
+
+    // Parser state and the merged attributes are scratch, the chunks grow their own buffers
+    arena_t*     arena        = arena_scratch();
+    arena_mark_t mark         = arena_mark(arena);
+    obj_chunk_t* chunks       = arena_calloc(arena, chunk_count, sizeof(obj_chunk_t));
+    int*         vertex_bases = arena_calloc(arena, chunk_count + 1, sizeof(int));
+    int*         indice_offs  = arena_calloc(arena, chunk_count + 1, sizeof(int));
+    int*         normal_bases = arena_calloc(arena, chunk_count + 1, sizeof(int));
+    int*         texcrd_bases = arena_calloc(arena, chunk_count + 1, sizeof(int));
+    atomic_bool* parsed       = preview ? arena_calloc(arena, chunk_count, sizeof(atomic_bool)) : NULL;
+    int*         preview_base = preview ? arena_calloc(arena, chunk_count + 1, sizeof(int)) : NULL;
+    model_t      welded;
+
+    model_init(&welded);
+
+    obj_job_t job = {
+        .chunks         = chunks,
+        .vertex_bases   = vertex_bases,
+        .indice_offsets = indice_offs,
+        .normal_bases   = normal_bases,
+        .texcrd_bases   = texcrd_bases,
+        .model          = m,
+        .preview        = preview ? progress->preview : NULL,
+        .parsed         = parsed,
+        .preview_bases  = preview_base,
+        .file_size      = map.size,
+        .progress       = progress,
+    };
+    pthread_mutex_init(&job.preview_lock, NULL);
+
+    if (!chunks || !vertex_bases || !indice_offs || !normal_bases || !texcrd_bases
+        || (preview && (!parsed || !preview_base)))
+    {
+        log_error("Failed to allocate parser state for %s", fp);
+        goto cleanup;
+    }
+
+    chunk_count     = _split_chunks(map.data, map.size, chunk_count, chunks);
+    job.chunk_count = chunk_count;
+
+    // Pass 1: optimistic parse of every chunk
+    atomic_store(&job.next_chunk, 0);
+    thread_parallel(threads, _parse_task, &job);
+
+    // Vertex, texcoord and normal counts don't depend on faces, so the per chunk bases are final after pass 1
+    int needs_reparse = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        obj_chunk_t* c = &chunks[i];
+        if (c->cancelled) {
+            log_info("Cancelled parsing %s", fp);
+            goto cleanup;
+        }
+        if (c->failed) {
+            log_error("Ran out of memory while parsing %s", fp);
+            goto cleanup;
+        }
+        if ((long long)vertex_bases[i] + c->vertex_count / 3 > INT_MAX / 3
+            || (long long)normal_bases[i] + c->normal_count > INT_MAX
+            || (long long)texcrd_bases[i] + c->texcrd_count > INT_MAX)
+        {
+            log_error("Model exceeds the supported vertex count: %s", fp);
+            goto cleanup;
+        }
+        vertex_bases[i + 1] = vertex_bases[i] + c->vertex_count / 3;
+        normal_bases[i + 1] = normal_bases[i] + c->normal_count;
+        texcrd_bases[i + 1] = texcrd_bases[i] + c->texcrd_count;
+    }
+    for (int i = 0; i < chunk_count; i++) {
+        if (_needs_reparse(&chunks[i], vertex_bases[i])) needs_reparse = 1;
+    }
+
+    // Pass 2: strict re-parse of chunks whose optimistic guesses didn't hold
+    if (needs_reparse) {
+        atomic_store(&job.next_chunk, 0);
+        thread_parallel(threads, _reparse_task, &job);
+    }
+
+    long line_base   = 1;
+    int  has_attribs = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        obj_chunk_t* c = &chunks[i];
+        if (c->failed) {
+            log_error("Ran out of memory while parsing %s", fp);
+            goto cleanup;
+        }
+
+        for (int w = 0; w < c->warning_count && w < OBJ_MAX_WARNINGS; w++) {
+            log_warn("%s at line %ld", _warning_text(c->warnings[w].kind), line_base + c->warnings[w].line);
+        }
+        if (c->warning_count > OBJ_MAX_WARNINGS) {
+            log_warn("... and %d more invalid lines", c->warning_count - OBJ_MAX_WARNINGS);
+        }
+
+        if ((long long)indice_offs[i] + c->indice_count > INT_MAX) {
+            log_error("Model exceeds the supported index count: %s", fp);
+            goto cleanup;
+        }
+        indice_offs[i + 1] = indice_offs[i] + c->indice_count;
+        line_base += c->line_count;
+        has_attribs |= c->attribs != NULL && c->indice_count > 0;
+    }
+
+    long long vertex_total = (long long)vertex_bases[chunk_count] * 3;
+    long long indice_total = indice_offs[chunk_count];
+
+    // The chunk totals are exact, so the model is sized once instead of grown
+    if (vertex_total > INT_MAX || indice_total > INT_MAX
+        || !model_reserve(m, (int)vertex_total, (int)indice_total, m->normal_count, m->texcrd_count))
+    {
+        log_error("Failed to allocate model storage for %lld vertices and %lld indices", vertex_total / 3,
+                  indice_total);
+        goto cleanup;
+    }
+
+    int normal_total = normal_bases[chunk_count];
+    int texcrd_total = texcrd_bases[chunk_count];
+    has_attribs      = has_attribs && (normal_total > 0 || texcrd_total > 0);
+
+    job.normals = normal_total > 0 ? arena_alloc(arena, normal_total * sizeof(float)) : NULL;
+    job.texcrds = texcrd_total > 0 ? arena_alloc(arena, texcrd_total * sizeof(float)) : NULL;
+    job.attribs = has_attribs ? arena_alloc(arena, indice_total * 2 * sizeof(unsigned int)) : NULL;
+
+    if ((normal_total > 0 && !job.normals) || (texcrd_total > 0 && !job.texcrds) || (has_attribs && !job.attribs)) {
+        log_error("Failed to allocate attribute storage for %s", fp);
+        goto cleanup;
+    }
+
+    // Pass 3: scatter the chunks into the model at their prefix sum offsets
+    atomic_store(&job.next_chunk, 0);
+    thread_parallel(threads, _copy_task, &job);
+
+    m->vertex_count = (int)vertex_total;
+    m->indice_count = (int)indice_total;
+
+    // Pass 4: concave polygons need the merged positions, their fans are replaced by ear clipping
+    atomic_store(&job.next_chunk, 0);
+    thread_parallel(threads, _triangulate_task, &job);
+
+    long faces = 0, polygons = 0, concave = 0, skipped = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        faces += chunks[i].face_count;
+        polygons += chunks[i].polygon_count;
+        concave += chunks[i].concave_count;
+        skipped += chunks[i].skipped_count;
+    }
+
+    double elapsed = timer_now() - start;
+    log_info("Parsed %s in %.1fms (%.1fMB/s, %d threads, %d chunks)", fp, elapsed * 1000.0,
+             map.size / (1024.0 * 1024.0) / (elapsed > 0.0 ? elapsed : 1e-9), threads, chunk_count);
+    log_info("Faces [triangles: %ld;  triangulated: %ld (%ld concave);  skipped: %ld]", faces - polygons, polygons,
+             concave, skipped);
+
+    // Pass 5: one vertex per distinct position/texcoord/normal tuple, point clouds are kept as is
+    if (m->indice_count > 0) {
+        weld_input_t weld = {
+            .positions      = m->vertices,
+            .texcrds        = job.attribs ? job.texcrds : NULL,
+            .normals        = job.attribs ? job.normals : NULL,
+            .indices        = m->indices,
+            .attribs        = job.attribs,
+            .position_count = m->vertex_count / 3,
+            .texcrd_count   = texcrd_total / 2,
+            .normal_count   = normal_total / 3,
+            .corner_count   = m->indice_count,
+        };
+
+        if (!weld_model(&welded, &weld, OBJ_WELD_EPSILON)) goto cleanup;
+
+        model_free(m);
+        *m = welded;
+        model_init(&welded);
     }
 
     float sz = model_get_size_mb(m);
     log_info("Loaded model [verts: %d;  approx. size: %.4fMB]", m->vertex_count, sz);
+    ok = true;
+
+cleanup:
+    if (chunks) {
+        for (int i = 0; i < chunk_count; i++) {
+            free(chunks[i].vertices);
+            free(chunks[i].indices);
+            free(chunks[i].normals);
+            free(chunks[i].texcrds);
+            free(chunks[i].attribs);
+            free(chunks[i].rel_indices);
+            free(chunks[i].rel_attribs);
+            free(chunks[i].polygons);
+        }
+    }
+    arena_release(arena, mark);
+    pthread_mutex_destroy(&job.preview_lock);
+    model_free(&welded);
+    file_unmap(&map);
+    return ok;
+}
+
+// One chunk of a streamed window, its buffers are reused by the next window
+typedef struct {
+    const char*   begin;
+    const char*   end;
+    float*        positions;   // relative to the origin
+    long long*    corners;     // fanned triangles, zero based
+    int*          rel_corners; // slots in corners counting from the chunk's first vertex
+    unsigned int* indices;     // the corners that resolved, as written
+    int           position_count;
+    int           position_capacity;
+    int           corner_count;
+    int           corner_capacity;
+    int           rel_count;
+    int           rel_capacity;
+    int           indice_capacity;
+    double        min[3];
+    double        max[3];
+    int           failed;
+    int           cancelled;
+} obj_stream_chunk_t;
+
+typedef struct {
+    obj_stream_chunk_t* chunks;
+    int                 chunk_count;
+    atomic_int          next_chunk;
+    const double*       origin;
+    load_progress_t*    progress;
+} obj_stream_job_t;
+
+// Negative indices count back from the vertices the chunk has seen, the append adds its base
+static int _stream_corner(obj_stream_chunk_t* c, long long k)
+{
+    if (!_chunk_reserve((void**)&c->corners, &c->corner_capacity, c->corner_count + 1, sizeof(long long))) return 0;
+
+    if (k < 0) {
+        if (!_chunk_reserve((void**)&c->rel_corners, &c->rel_capacity, c->rel_count + 1, sizeof(int))) return 0;
+        c->rel_corners[c->rel_count++] = c->corner_count;
+        c->corners[c->corner_count++]  = c->position_count / 3 + k;
+        return 1;
+    }
+
+    c->corners[c->corner_count++] = k - 1;
+    return 1;
+}
+
+// Fans the face from its first corner, faces with a malformed or zero index are skipped
+static int _stream_face(obj_stream_chunk_t* c, const char* p, const char* end)
+{
+    long long first = 0, prev = 0, k[3];
+    int       corners      = 0;
+    int       corner_count = c->corner_count;
+    int       rel_count    = c->rel_count;
+
+    while ((p = scan_skip_blank(p, end)) < end) {
+        // Take back the triangles fanned so far
+        if (!(p = _scan_corner(p, end, k)) || k[0] == 0) {
+            c->corner_count = corner_count;
+            c->rel_count    = rel_count;
+            return 1;
+        }
+
+        if (corners >= 2 && (!_stream_corner(c, first) || !_stream_corner(c, prev) || !_stream_corner(c, k[0]))) {
+            return 0;
+        }
+
+        if (corners == 0) first = k[0];
+        prev = k[0];
+        corners++;
+    }
+    return 1;
+}
+
+static void _stream_chunk(obj_stream_chunk_t* c, const double origin[3], load_progress_t* progress)
+{
+    c->position_count = 0;
+    c->corner_count   = 0;
+    c->rel_count      = 0;
+    c->failed         = 0;
+    c->cancelled      = 0;
+    for (int i = 0; i < 3; i++) {
+        c->min[i] = INFINITY;
+        c->max[i] = -INFINITY;
+    }
+
+    const char* p        = c->begin;
+    const char* reported = c->begin;
+    while (p < c->end) {
+        if (p - reported >= OBJ_PROGRESS_STEP) {
+            progress_add(progress, p - reported);
+            reported = p;
+            if (progress_cancelled(progress)) {
+                c->cancelled = 1;
+                return;
+            }
+        }
+
+        const char* eol = memchr(p, '\n', c->end - p);
+        if (!eol) eol = c->end;
+
+        size_t len = eol - p;
+        if (len >= 2 && p[0] == 'v' && p[1] == ' ') {
+            double      v[3];
+            const char* q = p + 2;
+            if ((q = scan_double(q, eol, &v[0])) && (q = scan_double(q, eol, &v[1])) && (q = scan_double(q, eol, &v[2])))
+            {
+                if (!_chunk_reserve((void**)&c->positions, &c->position_capacity, c->position_count + 3, sizeof(float))) {
+                    c->failed = 1;
+                    return;
+                }
+                for (int i = 0; i < 3; i++) {
+                    c->positions[c->position_count++] = (float)(v[i] - origin[i]);
+                    if (v[i] < c->min[i]) c->min[i] = v[i];
+                    if (v[i] > c->max[i]) c->max[i] = v[i];
+                }
+            }
+        } else if (p[0] == 'f' && (len == 1 || scan_is_blank(p[1]))) {
+            if (!_stream_face(c, p + 1, eol)) {
+                c->failed = 1;
+                return;
+            }
+        }
+
+        p = eol + 1;
+    }
+
+    progress_add(progress, c->end - reported);
+}
 
-    fclose(file);
-}
\ No newline at end of file
+static void _stream_task(void* userdata, int index)
+{
+    (void)index;
+    obj_stream_job_t* job = userdata;
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        _stream_chunk(&job->chunks[i], job->origin, job->progress);
+    }
+}
+
+// Resolves the chunk against the vertices streamed before it and writes what it parsed
+static bool _stream_append(obj_stream_chunk_t* c, FILE* positions, FILE* triangles, obj_stream_t* out)
+{
+    size_t base     = out->vertex_count;
+    size_t vertices = base + c->position_count / 3;
+    if (vertices > UINT_MAX) {
+        log_error("Streaming supports at most %u vertices", UINT_MAX);
+        return false;
+    }
+
+    for (int i = 0; i < c->rel_count; i++) c->corners[c->rel_corners[i]] += (long long)base;
+
+    if (!_chunk_reserve((void**)&c->indices, &c->indice_capacity, c->corner_count, sizeof(unsigned int))) return false;
+
+    // Only vertices defined so far can be referenced, a stream can't look ahead
+    int count = 0;
+    for (int t = 0; t + 3 <= c->corner_count; t += 3) {
+        const long long* k = &c->corners[t];
+        if (k[0] < 0 || k[1] < 0 || k[2] < 0 || (size_t)k[0] >= vertices || (size_t)k[1] >= vertices
+            || (size_t)k[2] >= vertices)
+        {
+            continue;
+        }
+        for (int i = 0; i < 3; i++) c->indices[count++] = (unsigned int)k[i];
+    }
+
+    if (fwrite(c->positions, sizeof(float), c->position_count, positions) != (size_t)c->position_count
+        || fwrite(c->indices, sizeof(unsigned int), count, triangles) != (size_t)count)
+    {
+        log_error("Failed to write the streamed geometry");
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (c->min[i] < out->min[i]) out->min[i] = c->min[i];
+        if (c->max[i] > out->max[i]) out->max[i] = c->max[i];
+    }
+    out->vertex_count    = vertices;
+    out->triangle_count += count / 3;
+    return true;
+}
+
+// Positions are stored relative to the first vertex, so floats keep their precision far from zero
+static void _stream_origin(const char* data, size_t size, double origin[3])
+{
+    const char* p   = data;
+    const char* end = data + size;
+
+    origin[0] = origin[1] = origin[2] = 0.0;
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+
+        double      v[3];
+        const char* q = p + 2;
+        if (eol - p >= 2 && p[0] == 'v' && p[1] == ' ' && (q = scan_double(q, eol, &v[0]))
+            && (q = scan_double(q, eol, &v[1])) && scan_double(q, eol, &v[2]))
+        {
+            memcpy(origin, v, sizeof(v));
+            return;
+        }
+        p = eol + 1;
+    }
+}
+
+bool obj_stream(const char* fp, FILE* positions, FILE* triangles, obj_stream_t* out, load_progress_t* progress)
+{
+    double start = timer_now();
+    bool   ok    = false;
+
+    file_map_t map;
+    if (!file_map(fp, &map)) {
+        log_error("Failed to open .obj file to stream %s", fp);
+        return false;
+    }
+
+    if (progress) atomic_store(&progress->bytes_total, map.size);
+
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < 3; i++) {
+        out->min[i] = INFINITY;
+        out->max[i] = -INFINITY;
+    }
+    _stream_origin(map.data, map.size, out->origin);
+
+    // Windows of a few chunks per thread are parsed in parallel and written in order, so the
+    // memory in use stays the same however large the file is
+    int                 threads     = thread_count();
+    int                 chunk_count = threads * OBJ_CHUNKS_PER_THREAD;
+    obj_stream_chunk_t* chunks      = calloc(chunk_count, sizeof(obj_stream_chunk_t));
+    if (!chunks) goto cleanup;
+
+    const char* cursor = map.data;
+    const char* end    = map.data + map.size;
+    while (cursor < end) {
+        int count = 0;
+        while (cursor < end && count < chunk_count) {
+            const char* cut = (size_t)(end - cursor) > OBJ_CHUNK_SIZE ? cursor + OBJ_CHUNK_SIZE : end;
+            if (cut < end) {
+                const char* nl = memchr(cut, '\n', end - cut);
+                cut            = nl ? nl + 1 : end;
+            }
+            chunks[count].begin = cursor;
+            chunks[count].end   = cut;
+            cursor              = cut;
+            count++;
+        }
+
+        obj_stream_job_t job = { .chunks = chunks, .chunk_count = count, .origin = out->origin, .progress = progress };
+        thread_parallel(threads < count ? threads : count, _stream_task, &job);
+
+        for (int i = 0; i < count; i++) {
+            if (chunks[i].cancelled) goto cleanup;
+            if (chunks[i].failed) {
+                log_error("Out of memory while streaming %s", fp);
+                goto cleanup;
+            }
+            if (!_stream_append(&chunks[i], positions, triangles, out)) goto cleanup;
+        }
+    }
+
+    log_info("Streamed %s [verts: %zu, tris: %zu] in %.1fms", fp, out->vertex_count, out->triangle_count,
+             (timer_now() - start) * 1000.0);
+    ok = out->triangle_count > 0;
+
+cleanup:
+    if (chunks) {
+        for (int i = 0; i < chunk_count; i++) {
+            free(chunks[i].positions);
+            free(chunks[i].corners);
+            free(chunks[i].rel_corners);
+            free(chunks[i].indices);
+        }
+    }
+    free(chunks);
+    file_unmap(&map);
+    return ok;
+}
@@ -0,0 +1,318 @@
+#include "parsers/stl.h"
+
+#include "core/weld.h"
+#include "engine/arena.h"
+#include "engine/file.h"
+#include "engine/thread.h"
+#include "engine/timer.h"
+#include "parsers/scan.h"
+
+#include "log.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STL_CHUNK_SIZE (4 << 20)
+#define STL_CHUNKS_PER_THREAD 4
+#define STL_PROGRESS_STEP (1 << 20)
+// STL repeats every shared vertex bit for bit, so an exact weld is enough
+#define STL_WELD_EPSILON 0.0
+
+typedef struct {
+    const char* begin;
+    const char* end;
+    int         vertex_count;  // "vertex" lines, counted in the first pass
+    int         vertex_offset; // first position of the chunk in the merged array
+    long        line_count;
+    long        first_invalid; // chunk relative line of the first bad vertex, -1 if none
+    int         invalid_count;
+    int         cancelled;
+} stl_chunk_t;
+
+typedef struct {
+    stl_chunk_t*     chunks;
+    int              chunk_count;
+    atomic_int       next_chunk;
+    double*          positions;
+    load_progress_t* progress;
+} stl_job_t;
+
+static inline uint32_t _read_u32(const char* p)
+{
+    // STL is little endian, like every platform fov runs on
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline int _is_keyword(const char* p, const char* end, const char* keyword, size_t len)
+{
+    return (size_t)(end - p) > len && memcmp(p, keyword, len) == 0 && scan_is_blank(p[len]);
+}
+
+static bool _head_contains(const char* head, size_t head_size, const char* word)
+{
+    size_t len = strlen(word);
+    for (size_t i = 0; i + len <= head_size; i++) {
+        if (memcmp(head + i, word, len) == 0) return true;
+    }
+    return false;
+}
+
+stl_kind_t stl_detect(const char* head, size_t head_size, size_t file_size)
+{
+    if (head_size >= STL_HEADER_SIZE && file_size >= STL_HEADER_SIZE) {
+        uint64_t count = _read_u32(head + 80);
+        if (STL_HEADER_SIZE + count * STL_RECORD_SIZE == file_size) return STL_BINARY;
+    }
+
+    // Plenty of binary exporters write "solid" into the header too, so ask for a facet or the end
+    const char* end = head + head_size;
+    const char* p   = head;
+    while (p < end && (scan_is_blank(*p) || *p == '\n')) p++;
+
+    if (end - p >= 5 && memcmp(p, "solid", 5) == 0
+        && (_head_contains(p, end - p, "facet") || _head_contains(p, end - p, "endsolid")))
+    {
+        return STL_ASCII;
+    }
+
+    return STL_NONE;
+}
+
+static int _split_chunks(const char* data, size_t size, int chunk_count, stl_chunk_t* chunks)
+{
+    size_t target = size / chunk_count;
+    int    count  = 0;
+
+    const char* begin = data;
+    const char* end   = data + size;
+
+    while (begin < end && count < chunk_count) {
+        const char* cut = begin + target;
+        if (count == chunk_count - 1 || cut >= end) {
+            cut = end;
+        } else {
+            const char* nl = memchr(cut, '\n', end - cut);
+            cut            = nl ? nl + 1 : end;
+        }
+
+        chunks[count++] = (stl_chunk_t) { .begin = begin, .end = cut, .first_invalid = -1 };
+        begin           = cut;
+    }
+
+    return count;
+}
+
+// Pass 1 only counts "vertex" lines so pass 2 can write every chunk straight into the merged array.
+// Pass 2 scans the coordinates, a bad line keeps its slot as zeros so the triangles stay aligned.
+static void _scan_chunk(stl_chunk_t* c, double* positions, load_progress_t* progress)
+{
+    const char* p        = c->begin;
+    const char* reported = c->begin;
+    int         vertex   = 0;
+    long        line     = 0;
+
+    while (p < c->end) {
+        if (positions && p - reported >= STL_PROGRESS_STEP) {
+            progress_add(progress, p - reported);
+            reported = p;
+            if (progress_cancelled(progress)) {
+                c->cancelled = 1;
+                return;
+            }
+        }
+
+        const char* eol = memchr(p, '\n', c->end - p);
+        if (!eol) eol = c->end;
+
+        p = scan_skip_blank(p, eol);
+        if (_is_keyword(p, eol, "vertex", 6)) {
+            if (positions) {
+                double*     out = &positions[(size_t)(c->vertex_offset + vertex) * 3];
+                const char* q   = p + 6;
+                if (!((q = scan_double(q, eol, &out[0])) && (q = scan_double(q, eol, &out[1]))
+                      && (q = scan_double(q, eol, &out[2]))))
+                {
+                    out[0] = out[1] = out[2] = 0.0;
+                    if (c->first_invalid < 0) c->first_invalid = line;
+                    c->invalid_count++;
+                }
+            }
+            vertex++;
+        }
+
+        line++;
+        p = eol + 1;
+    }
+
+    if (positions) progress_add(progress, c->end - reported);
+    c->vertex_count = vertex;
+    c->line_count   = line;
+}
+
+static void _count_task(void* userdata, int index)
+{
+    (void)index;
+    stl_job_t* job = userdata;
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        _scan_chunk(&job->chunks[i], NULL, job->progress);
+    }
+}
+
+static void _parse_task(void* userdata, int index)
+{
+    (void)index;
+    stl_job_t* job = userdata;
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next_chunk, 1)) < job->chunk_count) {
+        _scan_chunk(&job->chunks[i], job->positions, job->progress);
+    }
+}
+
+static bool _parse_ascii(model_t* m, const file_map_t* map, const char* fp, load_progress_t* progress)
+{
+    bool ok = false;
+
+    int threads     = thread_count();
+    int chunk_count = (int)(map->size / STL_CHUNK_SIZE) + 1;
+    if (chunk_count > threads * STL_CHUNKS_PER_THREAD) chunk_count = threads * STL_CHUNKS_PER_THREAD;
+    if (threads > chunk_count) threads = chunk_count;
+
+    arena_t*     arena = arena_scratch();
+    arena_mark_t mark  = arena_mark(arena);
+    stl_job_t    job   = {
+        .chunks   = arena_calloc(arena, chunk_count, sizeof(stl_chunk_t)),
+        .progress = progress,
+    };
+
+    if (!job.chunks) {
+        log_error("Failed to allocate parser state for %s", fp);
+        goto cleanup;
+    }
+
+    job.chunk_count = _split_chunks(map->data, map->size, chunk_count, job.chunks);
+
+    atomic_store(&job.next_chunk, 0);
+    thread_parallel(threads, _count_task, &job);
+
+    long long vertex_count = 0;
+    for (int i = 0; i < job.chunk_count; i++) {
+        job.chunks[i].vertex_offset  = (int)vertex_count;
+        vertex_count                += job.chunks[i].vertex_count;
+        if (vertex_count > INT_MAX / 3) {
+            log_error("%s has too many vertices", fp);
+            goto cleanup;
+        }
+    }
+
+    job.positions = arena_alloc(arena, (size_t)vertex_count * 3 * sizeof(double));
+    if (!job.positions) {
+        log_error("Failed to allocate %lld positions for %s", vertex_count, fp);
+        goto cleanup;
+    }
+
+    atomic_store(&job.next_chunk, 0);
+    thread_parallel(threads, _parse_task, &job);
+
+    long line_base = 1;
+    for (int i = 0; i < job.chunk_count; i++) {
+        const stl_chunk_t* c = &job.chunks[i];
+        if (c->cancelled) {
+            log_info("Cancelled parsing %s", fp);
+            goto cleanup;
+        }
+        if (c->invalid_count > 0) {
+            log_warn("%s:%ld: invalid vertex (%d in this part of the file)", fp, line_base + c->first_invalid,
+                     c->invalid_count);
+        }
+        line_base += c->line_count;
+    }
+
+    if (vertex_count % 3 != 0) log_warn("%s ends with an incomplete facet, ignored", fp);
+
+    weld_input_t in = {
+        .positions      = job.positions,
+        .position_count = (int)vertex_count,
+        .corner_count   = (int)(vertex_count / 3 * 3),
+    };
+    ok = weld_model(m, &in, STL_WELD_EPSILON);
+
+cleanup:
+    arena_release(arena, mark);
+    return ok;
+}
+
+static bool _parse_binary(model_t* m, const file_map_t* map, const char* fp, load_progress_t* progress)
+{
+    uint64_t count = _read_u32(map->data + 80);
+    uint64_t fits  = (map->size - STL_HEADER_SIZE) / STL_RECORD_SIZE;
+
+    if (count > fits) {
+        log_warn("%s declares %llu triangles but holds %llu, reading what is there", fp, (unsigned long long)count,
+                 (unsigned long long)fits);
+        count = fits;
+    }
+
+    if (count * 3 > INT_MAX) {
+        log_error("%s has too many triangles (%llu)", fp, (unsigned long long)count);
+        return false;
+    }
+
+    // The weld reads the vertices straight out of the mapped records, nothing is copied before it
+    weld_input_t in = {
+        .records          = map->data + STL_HEADER_SIZE + 3 * sizeof(float),
+        .record_stride    = STL_RECORD_SIZE,
+        .record_positions = 3,
+        .position_count   = (int)count * 3,
+        .corner_count     = (int)count * 3,
+    };
+
+    progress_add(progress, STL_HEADER_SIZE);
+    if (progress_cancelled(progress)) return false;
+
+    bool ok = weld_model(m, &in, STL_WELD_EPSILON);
+    progress_add(progress, map->size - STL_HEADER_SIZE);
+    return ok;
+}
+
+bool parse_stl(model_t* m, const char* fp, load_progress_t* progress)
+{
+    double start = timer_now();
+
+    file_map_t map;
+    if (!file_map(fp, &map)) {
+        log_fatal("Failed to open .stl file to parse %s", fp);
+        return false;
+    }
+
+    if (progress) atomic_store(&progress->bytes_total, map.size);
+
+    bool       ok   = false;
+    stl_kind_t kind = stl_detect(map.data, map.size < 512 ? map.size : 512, map.size);
+
+    // Anything else with a full header is read as binary, exporters do get the count wrong
+    if (kind == STL_NONE && map.size >= STL_HEADER_SIZE) kind = STL_BINARY;
+
+    if (kind == STL_BINARY) {
+        ok = _parse_binary(m, &map, fp, progress);
+    } else if (kind == STL_ASCII) {
+        ok = _parse_ascii(m, &map, fp, progress);
+    } else {
+        log_error("%s is not an STL file", fp);
+    }
+
+    if (ok) {
+        log_info("Parsed %s STL %s in %.1fms [verts: %d;  tris: %d]", kind == STL_BINARY ? "binary" : "ascii", fp,
+                 (timer_now() - start) * 1000.0, m->vertex_count / 3, m->indice_count / 3);
+    }
+
+    file_unmap(&map);
+    return ok;
+}